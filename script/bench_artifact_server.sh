@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# Load test of the artifact server (see artifact_server.c): downloads one binary many times at increasing concurrency levels and prints
+# the requests per second, the throughput and the p50/p95 latency of each level, after checking the ETag, a Range request and a
+# conditional request.
+# Usage: bench_artifact_server.sh <url of a binary> [requests per level] [concurrency levels]
+# e.g. bench_artifact_server.sh http://127.0.0.1:8088/latest/myproject/amd64 200 "1 8 32"
+
+url=$1
+requests=${2:-100}
+levels=${3:-"1 4 16 64"}
+
+if [ -z "$url" ] || ! command -v curl > /dev/null; then
+    echo "Usage: $0 <url of a binary> [requests per level] [concurrency levels] (needs curl)" >&2
+    exit 1
+fi
+
+work_dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$work_dir"' EXIT
+
+headers=$(curl -s -D - -o "$work_dir/binary" "$url" | tr -d '\r')
+status=$(echo "$headers" | awk 'NR == 1 { print $2 }')
+if [ "$status" != "200" ]; then
+    echo "GET $url answered $status" >&2
+    exit 1
+fi
+etag=$(echo "$headers" | awk -F': ' 'tolower($1) == "etag" { print $2 }')
+size=$(stat -c %s "$work_dir/binary")
+sha=$(sha256sum "$work_dir/binary" | cut -d' ' -f1)
+echo "Binary: $size bytes, sha256 $sha, ETag $etag"
+if [ "$etag" != "\"$sha\"" ]; then
+    echo "WARNING: the ETag is not the sha256 of the binary (a legacy plain file in its tier?)"
+fi
+
+range_status=$(curl -s -o "$work_dir/range" -w '%{http_code}' -r 0-1023 "$url")
+if [ "$range_status" = "206" ] && cmp -s "$work_dir/range" <(head -c 1024 "$work_dir/binary"); then
+    echo "Range: 206, first KB matches"
+else
+    echo "WARNING: Range request answered $range_status or did not match the binary"
+fi
+conditional_status=$(curl -s -o /dev/null -w '%{http_code}' -H "If-None-Match: $etag" "$url")
+echo "If-None-Match: $conditional_status"
+
+# Downloads $url $requests times, $1 at a time, and prints the statistics of the level
+measure() {
+    local concurrency=$1
+    local begin end
+    begin=$(date +%s%N)
+    seq "$requests" | xargs -P "$concurrency" -I{} curl -s -o /dev/null -w '%{http_code} %{time_total} %{size_download}\n' "$url" > "$work_dir/results"
+    end=$(date +%s%N)
+    sort -k2 -n "$work_dir/results" | awk -v c="$concurrency" -v ns="$((end - begin))" '
+        { time[NR] = $2; bytes += $3; if ($1 != "200") failed++ }
+        END {
+            s = ns / 1000000000
+            p50 = time[int(NR * 0.50) > 0 ? int(NR * 0.50) : 1] * 1000
+            p95 = time[int(NR * 0.95) > 0 ? int(NR * 0.95) : 1] * 1000
+            printf "concurrency %4d: %5d requests, %8.1f req/s, %8.1f MB/s, p50 %7.1f ms, p95 %7.1f ms, %d failed\n", c, NR, NR / s, bytes / s / 1048576, p50, p95, failed
+        }'
+}
+
+for concurrency in $levels; do
+    measure "$concurrency"
+done
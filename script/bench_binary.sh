@@ -0,0 +1,89 @@
+#!/bin/bash
+
+SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
+. "$SCRIPT_DIR/logging.sh"
+. "$SCRIPT_DIR/session.sh"
+
+# Benchmarks the binary copied to the target dir of the chroot by publish_binary.sh, before its publication (see artifact_bench.c):
+# the startup time of "--version" and "--help" (median of <runs> runs, with their output discarded) and, if the project defines one,
+# the wall time of a microbenchmark command run from the repository root with V2CI_BINARY set to the binary.
+# Everything runs in the chroot of the architecture: under qemu, or natively for amd64.
+# The results are left in <chroot build dir>/logs/bench-results as "<metric> <value>" lines (milliseconds, -1 when unavailable), and are
+# compared by the daemon with those of the previous build. Exit codes: 0 measured, 1 not run.
+debian_arch=$1
+thread_chroot_dir=$2
+thread_chroot_build_dir=$3
+thread_chroot_target_dir=$4
+repo_name=$5
+thread_log_file=$6
+thread_chroot_log_file=$7
+project_name=$8
+bench_command=$9
+runs=${10}
+
+if [ -z "$project_name" ] || [ -z "$repo_name" ]; then
+	exit 1
+fi
+if ! [ "$runs" -ge 1 ] 2>/dev/null; then
+	runs=1
+fi
+
+exec >> "$thread_log_file" 2>&1
+
+echo bench > "$thread_chroot_dir$thread_chroot_build_dir/logs/phase"
+if [ ! -x "$thread_chroot_dir$thread_chroot_target_dir/$repo_name-$debian_arch" ]; then
+	formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From bench_binary.sh for $debian_arch arch] No binary to benchmark at $thread_chroot_dir$thread_chroot_target_dir/$repo_name-$debian_arch"
+	exit 1
+fi
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From bench_binary.sh for $debian_arch arch] Benchmarking $repo_name-$debian_arch ($runs runs)"
+
+# The values are passed as assignments in front of a quoted script, as in run_tests.sh
+{
+	printf '%s=%q\n' debian_arch "$debian_arch" project_name "$project_name" binary "$thread_chroot_target_dir/$repo_name-$debian_arch" \
+		bench_command "$bench_command" runs "$runs" log_file "$thread_chroot_log_file" results "$thread_chroot_build_dir/logs/bench-results" \
+		repo_root "$thread_chroot_build_dir/$repo_name"
+	cat <<'EOF'
+exec >> "$log_file" 2>&1
+. /opt/v2ci/logging.sh
+rm -f "$results"
+
+# Median of the wall times of <runs> runs of the binary with the given option, in ms (-1 if it did not start or hung)
+startup_ms() {
+    local i start
+    for i in $(seq "$runs"); do
+        start=$(date +%s%N)
+        timeout 30 "$binary" "$1" < /dev/null > /dev/null 2>&1
+        [ $? -ge 124 ] && { echo -1; return; }
+        echo $(( $(date +%s%N) - start ))
+    done | sort -n | awk '$1 < 0 { hung = 1 } { t[NR] = $1 } END { if (NR == 0 || hung) print -1; else printf "%.2f", t[int((NR + 1) / 2)] / 1000000 }'
+}
+
+{
+    echo "version_ms $(startup_ms --version)"
+    echo "help_ms $(startup_ms --help)"
+    if [ -n "$bench_command" ]; then
+        start=$(date +%s%N)
+        # Its output, as the logs below, goes to the log (stderr) instead of the results
+        (cd "$repo_root" && V2CI_BINARY="$binary" bash -c "$bench_command") 1>&2
+        status=$?
+        if [ "$status" -eq 0 ]; then
+            echo "bench_ms $(awk -v ns="$(( $(date +%s%N) - start ))" 'BEGIN { printf "%.2f", ns / 1000000 }')"
+        else
+            formatted_log "WARNING" "bench_binary.sh" "$LINENO" "$project_name" "$debian_arch" "[From bench_binary.sh] The microbenchmark command exited with $status" 1>&2
+            echo "bench_ms -1"
+        fi
+    fi
+} > "$results.partial" && mv -f "$results.partial" "$results"
+EOF
+} | chroot_exec "$thread_chroot_dir"
+status=$?
+
+exec >> "$thread_log_file" 2>&1
+if [ "$status" -eq "$CHROOT_SESSION_LOST" ]; then
+	exit "$CHROOT_SESSION_LOST"
+elif [ "$status" -ne 0 ]; then
+	formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From bench_binary.sh for $debian_arch arch] Unable to benchmark $repo_name-$debian_arch (status $status)"
+	exit 1
+fi
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From bench_binary.sh for $debian_arch arch] Benchmarks of $repo_name-$debian_arch done"
+exit 0
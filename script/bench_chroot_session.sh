@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Compares the per-step overhead of a fresh <chroot_dir>/_enter (new namespace + new fakeroot daemon for every step)
+# with the one of a persistent session (see session_server.sh and session.sh).
+# Usage: bench_chroot_session.sh <chroot_dir> [iterations]
+# If no session is alive for the chroot, a temporary one is started for the benchmark and stopped at the end.
+
+SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
+. "$SCRIPT_DIR/session.sh"
+
+chroot_dir=$1
+iterations=${2:-20}
+
+if [ -z "$chroot_dir" ] || [ ! -x "$chroot_dir/_enter" ]; then
+    echo "Usage: $0 <chroot_dir> [iterations]" >&2
+    exit 1
+fi
+
+session_dir="$chroot_dir/.v2ci/session"
+temporary_session="no"
+if ! session_is_alive "$session_dir"; then
+    echo "No persistent session alive for $chroot_dir, starting a temporary one..."
+    mkdir -p "$session_dir" "$chroot_dir/opt/v2ci" || exit 1
+    install -m 0755 "$SCRIPT_DIR/session_server.sh" "$chroot_dir/opt/v2ci/session_server.sh" || exit 1
+    rm -f "$session_dir/ready" "$session_dir/ctl"
+    mkfifo "$session_dir/ctl" || exit 1
+    setsid "$chroot_dir/_enter" bash /opt/v2ci/session_server.sh < /dev/null >> "$session_dir/server.log" 2>&1 &
+    echo $! > "$session_dir/server.pid"
+    startup_begin=$(date +%s%N)
+    while [ ! -f "$session_dir/ready" ]; do
+        if ! kill -0 "$(cat "$session_dir/server.pid")" 2>/dev/null; then
+            echo "Session server failed to start, see $session_dir/server.log" >&2
+            exit 1
+        fi
+        sleep 0.05
+    done
+    echo "Session startup: $(( ($(date +%s%N) - startup_begin) / 1000000 )) ms"
+    temporary_session="yes"
+fi
+
+# Runs the same trivial step $iterations times and prints the average wall time per step in ms
+measure() {
+    local label=$1
+    shift
+    local begin end
+    begin=$(date +%s%N)
+    for _ in $(seq "$iterations"); do
+        echo "true" | "$@" > /dev/null 2>&1
+    done
+    end=$(date +%s%N)
+    awk -v label="$label" -v n="$iterations" -v ns="$((end - begin))" 'BEGIN { printf "%-12s %4d steps, avg %8.1f ms/step\n", label, n, ns / 1000000 / n }'
+}
+
+measure "_enter" "$chroot_dir/_enter"
+measure "session" chroot_exec "$chroot_dir"
+
+if [ "$temporary_session" = "yes" ]; then
+    echo "quit" > "$session_dir/ctl"
+    rm -f "$session_dir/server.pid"
+fi
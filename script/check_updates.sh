@@ -2,6 +2,7 @@
 
 SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
 . "$SCRIPT_DIR/logging.sh"
+. "$SCRIPT_DIR/session.sh"
 
 chroot_dir=$1
 chroot_build_dir=$2
@@ -25,7 +26,7 @@ if [ ! -d "$chroot_dir$chroot_build_dir/$repo_name" ]; then
 fi
 
 # Enter the chroot to check for real updates
-$chroot_dir/_enter <<EOF
+chroot_exec "$chroot_dir" <<EOF
     if [ ! -f "$worker_chroot_log_file" ]; then
         touch "$worker_chroot_log_file"
         if [ $? -ne 0 ]; then
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
+. "$SCRIPT_DIR/logging.sh"
+. "$SCRIPT_DIR/session.sh"
+
+# Incremental repair of a damaged chroot (see chroot_health.c): finishes interrupted dpkg runs, fixes broken dependencies
+# and reinstalls the packages whose critical files were modified or removed. The caller holds <chroot_dir>/lock.
+
+chroot_dir=$1
+log_file=$2
+project_name=$3
+debian_arch=$4
+shift 4
+packages=("$@")
+
+if [ -z "$chroot_dir" ] || [ -z "$log_file" ]; then
+    exit 1
+fi
+
+exec >> "$log_file" 2>&1
+
+# The here-docs of all scripts source logging.sh, so make sure it is there before entering
+mkdir -p "$chroot_dir/opt/v2ci" && install -m 0644 "$SCRIPT_DIR/logging.sh" "$chroot_dir/opt/v2ci/logging.sh"
+if [ $? -ne 0 ]; then
+    formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From chroot_repair.sh in $chroot_dir] Unable to deploy logging.sh"
+    exit 1
+fi
+
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From chroot_repair.sh in $chroot_dir] Repairing packages: ${packages[*]}"
+chroot_exec "$chroot_dir" <<EOF
+    . /opt/v2ci/logging.sh
+    export DEBIAN_FRONTEND=noninteractive
+    dpkg --configure -a || formatted_log "WARNING" "$0" "$LINENO" "$project_name" "$debian_arch" "[From chroot_repair.sh in $chroot_dir] dpkg --configure -a failed; trying apt-get -f install"
+    apt-get update || formatted_log "WARNING" "$0" "$LINENO" "$project_name" "$debian_arch" "[From chroot_repair.sh in $chroot_dir] apt-get update failed; using the cached package lists"
+    apt-get -f install -y || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From chroot_repair.sh in $chroot_dir] apt-get -f install failed"; exit 1; }
+    if [ -n "${packages[*]}" ]; then
+        apt-get install --reinstall -y ${packages[*]} || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From chroot_repair.sh in $chroot_dir] Reinstall of ${packages[*]} failed"; exit 1; }
+    fi
+EOF
+status=$?
+
+if [ "$status" -eq "$CHROOT_SESSION_LOST" ]; then
+    exit "$CHROOT_SESSION_LOST"
+elif [ "$status" -ne 0 ]; then
+    formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From chroot_repair.sh in $chroot_dir] Repair failed"
+    exit 1
+fi
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From chroot_repair.sh in $chroot_dir] Repair completed"
+exit 0
@@ -24,12 +24,24 @@ SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
 
 exec >> "$thread_log_file" 2>&1
 
+repo_dir="$thread_chroot_dir$thread_chroot_build_dir/$repo_name"
+
+# Leftovers of a cancelled run: a partial clone is discarded, stale git locks would make every following pull fail
+if [ -d "$repo_dir.partial" ]; then
+    formatted_log "INFO" "$0" "$LINENO" "$project_name" "$thread_arch" "[From clone_or_pull_for_project.sh for $repo_name] Removing partial clone left by a cancelled run"
+    rm -rf "$repo_dir.partial"
+fi
+if [ -d "$repo_dir/.git" ]; then
+    find "$repo_dir/.git" -maxdepth 1 -name "*.lock" -type f -delete
+fi
+
 # check if the repo was already cloned
-if [ ! -d "$thread_chroot_dir$thread_chroot_build_dir/$repo_name" ]; then
-    formatted_log "INFO" "$0" "$LINENO" "$project_name" "$thread_arch" "[From clone_or_pull_for_project.sh for $repo_name] Cloning repository $git_url into $thread_chroot_dir$thread_chroot_build_dir/$repo_name"
-    git clone "$git_url" "$thread_chroot_dir$thread_chroot_build_dir/$repo_name"
+if [ ! -d "$repo_dir" ]; then
+    formatted_log "INFO" "$0" "$LINENO" "$project_name" "$thread_arch" "[From clone_or_pull_for_project.sh for $repo_name] Cloning repository $git_url into $repo_dir"
+    # Clone aside and rename, so that a cancelled clone is never mistaken for a complete repository
+    git clone "$git_url" "$repo_dir.partial" && mv "$repo_dir.partial" "$repo_dir"
     if [ $? -ne 0 ]; then
-        formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$thread_arch" "Error: [From clone_or_pull_for_project.sh for $repo_name] Failed to clone repository $git_url into $thread_chroot_dir$thread_chroot_build_dir/$repo_name"
+        formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$thread_arch" "Error: [From clone_or_pull_for_project.sh for $repo_name] Failed to clone repository $git_url into $repo_dir"
         exit 1
     fi
 else
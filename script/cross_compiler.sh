@@ -2,6 +2,7 @@
 
 SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
 . "$SCRIPT_DIR/logging.sh"
+. "$SCRIPT_DIR/session.sh"
 
 debian_arch=$1
 thread_chroot_dir=$2
@@ -14,6 +15,11 @@ project_name=$8
 thread_chroot_target_dir=$9
 project_target_dir=${10}
 mem_limit=${11}
+cross_mode=${12}
+host_chroot_dir=${13}
+tmpfs_build=${14}
+tmpfs_budget_mb=${15}
+build_jobs=${16}
 
 if [ -z "$project_name" ]
 	then
@@ -35,162 +41,263 @@ fi
 
 exec >> "$thread_log_file" 2>&1
 
+# Parallel jobs chosen by the admission control of the worker from the host pressure (see pressure.c); one per CPU of the chroot otherwise
+if ! [ "$build_jobs" -ge 1 ] 2>/dev/null; then
+	build_jobs='$(nproc)'
+fi
+
+# Native cross-compilation (cross_mode: native): compile in the amd64 chroot with crossbuild-essential-<arch>, bypassing qemu;
+# the target chroot is bind-mounted at /sysroot/<arch> (see enter_cross.sh) and only used as sysroot
+native_cross="no"
+root_prefix=""
+build_dir_name="build"
+cmake_cross_args=""
+meson_cross_args=""
+configure_cross_args=""
+cross_env=""
+if [ "$cross_mode" = "native" ] && [ "$debian_arch" != "amd64" ]; then
+	case "$debian_arch" in
+		arm64)    triplet=aarch64-linux-gnu;       cmake_processor=aarch64; meson_cpu_family=aarch64; meson_cpu=aarch64;  endian=little ;;
+		armhf)    triplet=arm-linux-gnueabihf;     cmake_processor=arm;     meson_cpu_family=arm;     meson_cpu=armv7hl;  endian=little ;;
+		armel)    triplet=arm-linux-gnueabi;       cmake_processor=arm;     meson_cpu_family=arm;     meson_cpu=armv5tel; endian=little ;;
+		i386)     triplet=i686-linux-gnu;          cmake_processor=i686;    meson_cpu_family=x86;     meson_cpu=i686;     endian=little ;;
+		riscv64)  triplet=riscv64-linux-gnu;       cmake_processor=riscv64; meson_cpu_family=riscv64; meson_cpu=riscv64;  endian=little ;;
+		ppc64el)  triplet=powerpc64le-linux-gnu;   cmake_processor=ppc64le; meson_cpu_family=ppc64;   meson_cpu=ppc64le;  endian=little ;;
+		s390x)    triplet=s390x-linux-gnu;         cmake_processor=s390x;   meson_cpu_family=s390x;   meson_cpu=s390x;    endian=big ;;
+		mips64el) triplet=mips64el-linux-gnuabi64; cmake_processor=mips64;  meson_cpu_family=mips64;  meson_cpu=mips64;   endian=little ;;
+		*)        triplet="" ;;
+	esac
+	if [ -z "$triplet" ]; then
+		formatted_log "WARNING" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] No cross toolchain mapping for $debian_arch; falling back to the emulated build"
+	elif [ -z "$host_chroot_dir" ] || [ ! -d "$host_chroot_dir/home" ]; then
+		formatted_log "WARNING" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] amd64 chroot not available at $host_chroot_dir; falling back to the emulated build"
+	else
+		native_cross="yes"
+		root_prefix="/sysroot/$debian_arch"
+		build_dir_name="build-cross"
+		cross_files_dir="/opt/v2ci/cross/$debian_arch"
+		pkg_config_libdir="$root_prefix/usr/local/lib/$triplet/pkgconfig:$root_prefix/usr/local/lib/pkgconfig:$root_prefix/usr/lib/$triplet/pkgconfig:$root_prefix/usr/lib/pkgconfig:$root_prefix/usr/share/pkgconfig"
+
+		# Generate the cmake toolchain file and the meson cross file for this arch (cheap, so always regenerated)
+		mkdir -p "$host_chroot_dir$cross_files_dir" || exit 1
+		cat > "$host_chroot_dir$cross_files_dir/toolchain.cmake" <<TOOLCHAIN
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR $cmake_processor)
+set(CMAKE_SYSROOT $root_prefix)
+set(CMAKE_C_COMPILER $triplet-gcc)
+set(CMAKE_CXX_COMPILER $triplet-g++)
+set(CMAKE_LIBRARY_ARCHITECTURE $triplet)
+set(CMAKE_FIND_ROOT_PATH $root_prefix)
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_PACKAGE ONLY)
+TOOLCHAIN
+		cat > "$host_chroot_dir$cross_files_dir/cross.ini" <<CROSSFILE
+[binaries]
+c = '$triplet-gcc'
+cpp = '$triplet-g++'
+ar = '$triplet-ar'
+strip = '$triplet-strip'
+pkg-config = 'pkg-config'
+
+[properties]
+sys_root = '$root_prefix'
+pkg_config_libdir = '$pkg_config_libdir'
+
+[host_machine]
+system = 'linux'
+cpu_family = '$meson_cpu_family'
+cpu = '$meson_cpu'
+endian = '$endian'
+CROSSFILE
+		cmake_cross_args="-DCMAKE_TOOLCHAIN_FILE=$cross_files_dir/toolchain.cmake"
+		meson_cross_args="--cross-file $cross_files_dir/cross.ini"
+		configure_cross_args="--host=$triplet"
+		cross_env="export CC='$triplet-gcc --sysroot=$root_prefix' CXX='$triplet-g++ --sysroot=$root_prefix' AR=$triplet-ar RANLIB=$triplet-ranlib STRIP=$triplet-strip PKG_CONFIG_SYSROOT_DIR=$root_prefix PKG_CONFIG_LIBDIR=$pkg_config_libdir"
+		formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Native cross-compilation with $triplet toolchain in $host_chroot_dir (sysroot: $thread_chroot_dir)"
+	fi
+fi
+
+# Enter the root where the compilation happens: the target chroot (emulated) or the amd64 chroot with the target as sysroot (native)
+enter_build_root() {
+	if [ "$native_cross" = "yes" ]; then
+		"$SCRIPT_DIR/enter_cross.sh" "$host_chroot_dir" "$thread_chroot_dir" "$debian_arch"
+	else
+		chroot_exec "$thread_chroot_dir"
+	fi
+}
+build_mode_label="emulated"
+[ "$native_cross" = "yes" ] && build_mode_label="native-$triplet"
+
 formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Starting cross-compilation for $repo_name in $debian_arch chroot at $thread_chroot_dir$thread_chroot_build_dir"
 
 formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Entering rootfs at $thread_chroot_dir$thread_chroot_build_dir; logs will be available in $thread_chroot_dir$thread_chroot_log_file"
-$thread_chroot_dir/_enter <<EOF
-    exec >> "$thread_chroot_log_file" 2>&1
+enter_build_root <<EOF
+    exec >> "$root_prefix$thread_chroot_log_file" 2>&1
     . /opt/v2ci/logging.sh
-    REPO_ROOT="$thread_chroot_build_dir/$repo_name"
+    $cross_env
+    REPO_ROOT="$root_prefix$thread_chroot_build_dir/$repo_name"
     cd "\$REPO_ROOT" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From cross_compiler.sh for $debian_arch arch] Cannot change directory to \$REPO_ROOT"; exit 1; }
 
-    # Build: main project -> build directory, no install; dependencies -> install
-    if [ "$main_repo_build_system" = "cmake" ]; then
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch for repo $repo_name] Building with CMake"
-        mkdir -p build && cd build
-        cmake .. || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: CMake configuration failed"; exit 1; }
-        if [ "$main_project" = "yes" ]; then
-            make -j\$(nproc) || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: CMake build failed"; exit 1; }
-        else
-            make -j\$(nproc) install || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: CMake install failed"; exit 1; }
-        fi
-        cd ..
+    # Report the current phase to the watchdog of the daemon, which applies the timeout of that phase (see step_executor.c)
+    set_phase() {
+        echo "\$1" > "$root_prefix$thread_chroot_build_dir/logs/phase"
+    }
 
-    elif [ "$main_repo_build_system" = "autotools" ]; then
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Building with Autotools"
-        if [ -f "configure.ac" ] || [ -f "configure.in" ]; then
-            autoreconf -fiv || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: autoreconf failed"; exit 1; }
-        fi
-        if [ ! -f "configure" ]; then
-            formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: configure script not found"; exit 1;
-        fi
-        ./configure --prefix=/usr || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: configure failed"; exit 1; }
-        if [ "$main_project" = "yes" ]; then
-            make -j\$(nproc) || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make failed"; exit 1; }
-        else
-            make -j\$(nproc) install || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make install failed"; exit 1; }
-        fi
+    # The build runs in a subshell so that it can be retried on disk
+    run_build() (
+        cd "\$1" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From cross_compiler.sh for $debian_arch arch] Cannot change directory to \$1"; exit 1; }
+        rm -rf "\$REPO_ROOT/.v2ci-candidates"
 
-    elif [ "$main_repo_build_system" = "meson" ]; then
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Building with Meson"
-        meson setup build . --default-library=both || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Meson configuration failed"; exit 1; }
-        if [ "$main_project" = "yes" ]; then
-            meson compile -C build || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Meson build failed"; exit 1; }
+        # Build: main project -> build directory, no install; dependencies -> install
+        if [ "$main_repo_build_system" = "cmake" ]; then
+            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch for repo $repo_name] Building with CMake"
+            mkdir -p $build_dir_name && cd $build_dir_name
+            set_phase configure
+            cmake .. $cmake_cross_args || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: CMake configuration failed"; exit 1; }
+            set_phase build
+            if [ "$main_project" = "yes" ]; then
+                make -j$build_jobs || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: CMake build failed"; exit 1; }
+            else
+                make -j$build_jobs install DESTDIR="$root_prefix" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: CMake install failed"; exit 1; }
+            fi
+            cd ..
+
+        elif [ "$main_repo_build_system" = "autotools" ]; then
+            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Building with Autotools"
+            set_phase configure
+            if [ -f "configure.ac" ] || [ -f "configure.in" ]; then
+                autoreconf -fiv || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: autoreconf failed"; exit 1; }
+            fi
+            # In-tree build: start from a clean tree when switching between the emulated and the native toolchain
+            if [ "\$(cat .v2ci-build-mode 2>/dev/null)" != "$build_mode_label" ]; then
+                make distclean > /dev/null 2>&1 || true
+            fi
+            echo "$build_mode_label" > .v2ci-build-mode
+            if [ ! -f "configure" ]; then
+                formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: configure script not found"; exit 1;
+            fi
+            ./configure --prefix=/usr $configure_cross_args || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: configure failed"; exit 1; }
+            set_phase build
+            if [ "$main_project" = "yes" ]; then
+                make -j$build_jobs || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make failed"; exit 1; }
+            else
+                make -j$build_jobs install DESTDIR="$root_prefix" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make install failed"; exit 1; }
+            fi
+
+        elif [ "$main_repo_build_system" = "meson" ]; then
+            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Building with Meson"
+            set_phase configure
+            meson setup $build_dir_name . --default-library=both $meson_cross_args || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Meson configuration failed"; exit 1; }
+            set_phase build
+            if [ "$main_project" = "yes" ]; then
+                meson compile -C $build_dir_name -j $build_jobs || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Meson build failed"; exit 1; }
+            else
+                meson install -C $build_dir_name ${root_prefix:+--destdir "$root_prefix"} || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Meson install failed"; exit 1; }
+            fi
+
+        elif [ "$main_repo_build_system" = "makefile" ]; then
+            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Building with Makefile"
+            set_phase build
+            if [ "\$(cat .v2ci-build-mode 2>/dev/null)" != "$build_mode_label" ]; then
+                make clean > /dev/null 2>&1 || true
+            fi
+            echo "$build_mode_label" > .v2ci-build-mode
+            if [ "$main_project" = "yes" ]; then
+                make -j$build_jobs || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make failed"; exit 1; }
+            else
+                make -j$build_jobs install DESTDIR="$root_prefix" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make install failed"; exit 1; }
+            fi
         else
-            meson install -C build || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Meson install failed"; exit 1; }
+            formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Unsupported build system: $main_repo_build_system"
+            exit 1
         fi
 
-    elif [ "$main_repo_build_system" = "makefile" ]; then
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Building with Makefile"
+        # Only for main project: the binary is selected and published by the daemon on the host (see binary_selection.c), which reads
+        # the name of the build directory; a tmpfs tree is unmounted when the step ends, so its executables (and the test lists of CTest and
+        # meson, which tell the test executables apart) are staged on disk first
         if [ "$main_project" = "yes" ]; then
-            make -j\$(nproc) || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make failed"; exit 1; }
+            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Build completed"
+            echo "$build_dir_name" > "\$REPO_ROOT/.v2ci-build-dir"
+            if [ "\$1" != "\$REPO_ROOT" ]; then
+                mkdir -p "\$REPO_ROOT/.v2ci-candidates" || exit 1
+                find $build_dir_name $([ "$build_dir_name" = builddir ] || echo builddir) target/release dist -type f \\( -executable -o -name CTestTestfile.cmake -o -name intro-tests.json \\) -not -path "*/.*" -print0 2>/dev/null | xargs -0 -r cp --parents -t "\$REPO_ROOT/.v2ci-candidates" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Failed to stage the built executables"; exit 1; }
+            fi
         else
-            make -j\$(nproc) install || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: make install failed"; exit 1; }
+            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Dependency installation completed"
         fi
-    else
-        formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Unsupported build system: $main_repo_build_system"
-        exit 1
-    fi
-
-    # Only for main project, search and copy the built binary to the target directory
-    if [ "$main_project" = "yes" ]; then
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Build completed, selecting binaries"
-
-        # 1) Priority to executables in the common build directories
-        binary_candidates=()
-        while IFS= read -r -d '' f; do
-            if file "\$f" | grep -q "ELF.*executable"; then
-                binary_candidates+=("\$f")
-            fi
-        done < <(
-            find . \( -path "./build/*" -o -path "./builddir/*" -o -path "./target/release/*" -o -path "./dist/*" \) \
-                -type f -executable -not -path "*/.*" -print0 | sort -z
-        )
+    )
 
-        if [ "\${#binary_candidates[@]}" -eq 0 ]; then
-            formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] No binaries found in known build directories"
-            exit 1
+    # Optional tmpfs build tree (tmpfs_build: yes): the sources are copied to a tmpfs mounted in this namespace and built there; only the
+    # executables staged by run_build for the selection of the binary and the size of the tree (.v2ci-tmpfs-size, used for the next prediction) are kept on disk.
+    # The tree is built on disk when the predicted size does not fit the budget or the available memory, or when the tmpfs fills up during the build.
+    tmpfs_dir=""
+    size_record="\$REPO_ROOT/.v2ci-tmpfs-size"
+    cleanup_tmpfs() {
+        if [ -n "\$tmpfs_dir" ]; then
+            umount "\$tmpfs_dir" 2>/dev/null
+            rmdir "\$tmpfs_dir" 2>/dev/null
+            tmpfs_dir=""
         fi
-
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Found \${#binary_candidates[@]} executable candidates: \${binary_candidates[*]}"
-
-		# 2) Prefer those that match the repo name
-		named_candidates=()
-		for f in "${binary_candidates[@]}"; do
-			base=$(basename "$f")
-			case "$base" in
-				${repo_name}|${repo_name}-*|${repo_name}_*|${repo_name}.*)
-					named_candidates+=("$f")
-				;;
-			esac
-		done
-		if [ "\${#named_candidates[@]}" -gt 0 ]; then
-			binary_candidates=( "\${named_candidates[@]}" )
-            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Found \${#binary_candidates[@]} named candidates: \${binary_candidates[*]}"
-		fi
-
-        # 3) Prefer statically linked binaries if multiple candidates remain
-        selected_binary=""
-        for f in "\${binary_candidates[@]}"; do
-            if file "\$f" 2>/dev/null | grep -q "statically linked"; then
-                selected_binary="\$f"
-                formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Found statically linked binary: \$selected_binary"
-                break
+    }
+    trap cleanup_tmpfs EXIT
+    # A cancelled step gets SIGTERM: exit through the EXIT trap, so that a persistent session is not left with the tmpfs mounted
+    trap 'exit 143' TERM INT
+    if [ "$tmpfs_build" = "yes" ] && [ "$tmpfs_budget_mb" -gt 0 ] 2>/dev/null; then
+        budget_kb=\$(( $tmpfs_budget_mb * 1024 ))
+        source_kb=\$(du -sk --exclude=./build --exclude=./build-cross --exclude=./builddir --exclude=./.v2ci-candidates . 2>/dev/null | cut -f1)
+        last_kb=\$(cat "\$size_record" 2>/dev/null || echo 0)
+        # A fresh tree usually grows 2-3 times while building; the size recorded at the previous build is more accurate when larger
+        predicted_kb=\$(( \${source_kb:-0} * 3 ))
+        [ "\${last_kb:-0}" -gt "\$predicted_kb" ] 2>/dev/null && predicted_kb=\$last_kb
+        mem_available_kb=\$(awk '/^MemAvailable:/ { print \$2 }' /proc/meminfo 2>/dev/null)
+        if [ "\$predicted_kb" -gt "\$budget_kb" ] || [ "\$predicted_kb" -gt "\$(( \${mem_available_kb:-0} / 2 ))" ]; then
+            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Predicted build tree of \$predicted_kb KB does not fit the tmpfs budget (\$budget_kb KB, MemAvailable \${mem_available_kb:-unknown} KB); building on disk"
+        else
+            tmpfs_dir="/tmp/v2ci-build-$repo_name-\$\$"
+            mkdir -p "\$tmpfs_dir"
+            if mount -t tmpfs -o size=\${budget_kb}k,mode=0755 tmpfs "\$tmpfs_dir" && tar -C "\$REPO_ROOT" --exclude=./build --exclude=./build-cross --exclude=./builddir --exclude=./.v2ci-candidates -cf - . | tar -C "\$tmpfs_dir" -xf -; then
+                formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Building in tmpfs \$tmpfs_dir (predicted \$predicted_kb KB, budget \$budget_kb KB)"
+            else
+                formatted_log "WARNING" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Unable to prepare the tmpfs build tree; building on disk"
+                cleanup_tmpfs
             fi
-        done
-        if [ -z "\$selected_binary" ]; then
-            selected_binary="\${binary_candidates[0]}"
         fi
+    fi
 
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Selected binary: \$selected_binary"
-        cp -f "\$selected_binary" "$thread_chroot_target_dir/$repo_name-$debian_arch" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Failed to copy final binary"; exit 1; }
-    else
-        formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Dependency installation completed"
+    if [ -n "\$tmpfs_dir" ]; then
+        run_build "\$tmpfs_dir"
+        build_status=\$?
+        tmpfs_used_kb=\$(df -Pk "\$tmpfs_dir" | awk 'NR == 2 { print \$3 }')
+        tmpfs_free_kb=\$(df -Pk "\$tmpfs_dir" | awk 'NR == 2 { print \$4 }')
+        cleanup_tmpfs
+        if [ "\$build_status" -eq 0 ]; then
+            echo "\$tmpfs_used_kb" > "\$size_record"
+        elif [ "\${tmpfs_free_kb:-0}" -lt "\$(( budget_kb / 20 ))" ]; then
+            # The tmpfs was (almost) full: remember that this tree does not fit, so that the next builds go straight to disk
+            formatted_log "WARNING" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] tmpfs full (\$tmpfs_used_kb KB used); retrying the build on disk"
+            echo "\$(( budget_kb + 1 ))" > "\$size_record"
+            run_build "\$REPO_ROOT"
+            build_status=\$?
+        fi
+        exit \$build_status
     fi
+    run_build "\$REPO_ROOT"
 EOF
+status=$?
 
-if [ $? -ne 0 ]; then
+if [ "$status" -eq "$CHROOT_SESSION_LOST" ]; then
+    exit "$CHROOT_SESSION_LOST"
+elif [ "$status" -ne 0 ]; then
     formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Build process failed in chroot"
     exit 1
 fi
 
 exec >> "$thread_log_file" 2>&1
 
-# Only for main project, move the binary to the final target directory with simple versioning
 if [ "$main_project" = "yes" ]; then
-	cd "$thread_chroot_dir$thread_chroot_build_dir/$repo_name"
-	current_tag=$(git describe --tags --abbrev=0 2>/dev/null)
-	if [ -z "$current_tag" ]; then
-		release_version="unstable"
-	else
-		release_version="$current_tag"
-	fi
-
-	formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Creating daily directory: $project_target_dir/daily"
-	mkdir -p "$project_target_dir/daily"
-
-	# Copy in the daily directory without unnecessary checks (exists and is readable)
-	if [ -f "$thread_chroot_dir$thread_chroot_target_dir/$repo_name-$debian_arch" ]; then
-		formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Moving $repo_name-$debian_arch to $project_target_dir/daily/$repo_name-$release_version-$debian_arch"
-		install -m 0755 "$thread_chroot_dir$thread_chroot_target_dir/$repo_name-$debian_arch" "$project_target_dir/daily/$repo_name-$release_version-$debian_arch" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Failed to copy final binary"; exit 1; }
-
-        # If we exceeded the mem_limit for the daily builds, remove the oldest files until we are under the limit (note: here we ignore the rotation since this will be handled by the cronjob - trade-off: it could happen that multiple builds exceed the limit due to old files that are still in the daily dir even if they were created more than 24h ago, because of low frequency of the cronjob;
-        # possible solutions: either increase cronjob frequency or implement a more complex logic here to also consider file ages. Anyway, this is a rare edge case, especially for academic projects, so we keep it simple for now)
-        total_daily_size=$(du -s "$project_target_dir/daily" | cut -f1)
-        while [ "$total_daily_size" -gt "$mem_limit" ]; do
-            oldest_file=$(ls -t "$project_target_dir/daily" | tail -n 1)
-            if [ "$oldest_file" = "$repo_name-$release_version-$debian_arch" ]; then
-                formatted_log "WARNING" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Only the just added file remains but daily memory limit exceeded; cannot remove it"
-                break
-            fi
-            oldest_file_size=$(du -s "$project_target_dir/daily/$oldest_file" | cut -f1)
-            rm -f "$project_target_dir/daily/$oldest_file"
-            total_daily_size=$((total_daily_size - oldest_file_size))
-            formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Removed oldest file $oldest_file to respect daily memory limit"
-        done
-    fi
-
-	formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Cross-compilation completed successfully"
+	formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Build of the main repository completed; the binary is selected by the daemon"
 else
 	formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From cross_compiler.sh for $debian_arch arch] Dependency installation completed successfully"
 fi
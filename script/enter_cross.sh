@@ -0,0 +1,31 @@
+#!/bin/sh
+
+# Enters the amd64 (host) chroot like its _enter does, but with the target chroot bind-mounted at /sysroot/<arch>, so that
+# native cross toolchains (crossbuild-essential-<arch>) can use the target rootfs as sysroot.
+# Usage: enter_cross.sh <host_chroot_dir> <target_chroot_dir> <debian_arch> [command...]
+
+export PATH=/usr/sbin:$PATH
+
+host_chroot_dir=$1
+target_chroot_dir=$2
+debian_arch=$3
+shift 3
+
+if [ -z "$host_chroot_dir" ] || [ -z "$target_chroot_dir" ] || [ -z "$debian_arch" ] || [ ! -d "$host_chroot_dir/home" ] || [ ! -d "$target_chroot_dir/home" ]; then
+    exit 1
+fi
+mkdir -p "$host_chroot_dir/sysroot/$debian_arch" || exit 1
+if [ $# -eq 0 ]; then
+    set -- bash
+fi
+
+FAKEROOTDONTTRYCHOWN=1 unshare -fprm sh -c '
+    host_chroot_dir=$1
+    target_chroot_dir=$2
+    debian_arch=$3
+    shift 3
+    mount --rbind "$target_chroot_dir" "$host_chroot_dir/sysroot/$debian_arch" || exit 1
+    mount -t proc proc "$host_chroot_dir/proc" || exit 1
+    cd "$host_chroot_dir" || exit 1
+    exec chroot . fakeroot -i .fakeroot.env -s .fakeroot.env "$@"
+' sh "$host_chroot_dir" "$target_chroot_dir" "$debian_arch" "$@"
@@ -2,6 +2,7 @@
 
 SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
 . "$SCRIPT_DIR/logging.sh"
+. "$SCRIPT_DIR/session.sh"
 
 chroot_dir=$1
 thread_chroot_log_file=$2
@@ -19,7 +20,7 @@ if [ -z "$chroot_dir" ] || [ -z "$thread_chroot_log_file" ]; then
     exit 1
 fi
 
-$chroot_dir/_enter <<EOF
+chroot_exec "$chroot_dir" <<EOF
     if [ ! -f "$thread_chroot_log_file" ]; then
         touch "$thread_chroot_log_file"
         if [ $? -ne 0 ]; then
@@ -39,7 +40,10 @@ $chroot_dir/_enter <<EOF
         exit 1
     fi
 EOF
-if [ $? -ne 0 ]; then
+status=$?
+if [ "$status" -eq "$CHROOT_SESSION_LOST" ]; then
+    exit "$CHROOT_SESSION_LOST"
+elif [ "$status" -ne 0 ]; then
     formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$thread_arch" "Failed to enter chroot or install packages"
     exit 1
 fi
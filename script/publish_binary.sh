@@ -0,0 +1,45 @@
+#!/bin/bash
+
+SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
+. "$SCRIPT_DIR/logging.sh"
+
+# Prepares the publication of the binary selected by the daemon after the build of the main repository (see binary_selection.c): copies
+# it to the target dir of the chroot and names its daily entry after the release of the repository (simple versioning). The daemon
+# then stores it, records it in the artifact index and keeps the daily dir within its memory limit (see artifact_store.c)
+debian_arch=$1
+thread_chroot_dir=$2
+thread_chroot_build_dir=$3
+repo_name=$4
+thread_log_file=$5
+project_name=$6
+thread_chroot_target_dir=$7
+project_target_dir=$8
+selected_binary=$9
+
+if [ -z "$project_name" ] || [ -z "$selected_binary" ]; then
+	exit 1
+fi
+
+exec >> "$thread_log_file" 2>&1
+
+echo publish > "$thread_chroot_dir$thread_chroot_build_dir/logs/phase"
+
+# Copy and rename, so that a cancelled step never leaves a truncated binary to be published
+chroot_binary="$thread_chroot_dir$thread_chroot_target_dir/$repo_name-$debian_arch"
+cp -f "$selected_binary" "$thread_chroot_dir$thread_chroot_target_dir/.$repo_name-$debian_arch.partial" && mv -f "$thread_chroot_dir$thread_chroot_target_dir/.$repo_name-$debian_arch.partial" "$chroot_binary" || { formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: Failed to copy the selected binary $selected_binary"; exit 1; }
+
+cd "$thread_chroot_dir$thread_chroot_build_dir/$repo_name"
+current_tag=$(git describe --tags --abbrev=0 2>/dev/null)
+if [ -z "$current_tag" ]; then
+	release_version="unstable"
+else
+	release_version="$current_tag"
+fi
+
+entry_name="$repo_name-$release_version-$debian_arch"
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From publish_binary.sh for $debian_arch arch] Publishing $repo_name-$debian_arch as $project_target_dir/daily/$entry_name"
+# Read back by the daemon, which publishes the binary of the chroot under this name
+echo "$entry_name $release_version" > "$thread_chroot_dir$thread_chroot_build_dir/logs/publication"
+
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From publish_binary.sh for $debian_arch arch] Cross-compilation completed successfully"
+exit 0
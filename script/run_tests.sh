@@ -0,0 +1,203 @@
+#!/bin/bash
+
+SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
+. "$SCRIPT_DIR/logging.sh"
+. "$SCRIPT_DIR/session.sh"
+
+# Runs the test suite of the main repository after its build, before the publication of its binary (see test_report.c): ctest, meson
+# test or make check according to the build system ("auto"), or a custom command run from the root of the repository.
+# The tests run where the build ran: in the chroot of the architecture under qemu, or, after a native cross build, in the amd64 chroot
+# with the target chroot as sysroot (its executables still run under qemu, with QEMU_LD_PREFIX pointing at the sysroot).
+# ctest, meson and make run <shards> tests at a time; a custom command is started <shards> times in parallel with
+# V2CI_TEST_SHARD_INDEX (0..<shards>-1) and V2CI_TEST_SHARD_COUNT set, and may write a JUnit report of its shard to $V2CI_TEST_JUNIT.
+# The results are left as JUnit in <chroot build dir>/logs/test-report.xml. Exit codes: 0 tests passed, 3 tests failed, 1 not run.
+debian_arch=$1
+thread_chroot_dir=$2
+thread_chroot_build_dir=$3
+repo_name=$4
+main_repo_build_system=$5
+thread_log_file=$6
+thread_chroot_log_file=$7
+project_name=$8
+test_command=$9
+shards=${10}
+host_chroot_dir=${11}
+
+if [ -z "$project_name" ] || [ -z "$test_command" ]; then
+	exit 1
+fi
+if ! [ "$shards" -ge 1 ] 2>/dev/null; then
+	shards=1
+fi
+
+exec >> "$thread_log_file" 2>&1
+
+repo_dir="$thread_chroot_dir$thread_chroot_build_dir/$repo_name"
+echo test > "$thread_chroot_dir$thread_chroot_build_dir/logs/phase"
+
+# Same root as the build (see cross_compiler.sh): build-cross or a native in-tree build mode means the amd64 chroot
+native_cross="no"
+root_prefix=""
+if [ "$(cat "$repo_dir/.v2ci-build-dir" 2>/dev/null)" = "build-cross" ] || grep -q '^native-' "$repo_dir/.v2ci-build-mode" 2>/dev/null; then
+	if [ -z "$host_chroot_dir" ] || [ ! -d "$host_chroot_dir/home" ]; then
+		formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From run_tests.sh for $debian_arch arch] $repo_name was cross-built natively but the amd64 chroot is not available at $host_chroot_dir"
+		exit 1
+	fi
+	native_cross="yes"
+	root_prefix="/sysroot/$debian_arch"
+fi
+enter_test_root() {
+	if [ "$native_cross" = "yes" ]; then
+		"$SCRIPT_DIR/enter_cross.sh" "$host_chroot_dir" "$thread_chroot_dir" "$debian_arch"
+	else
+		chroot_exec "$thread_chroot_dir"
+	fi
+}
+
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From run_tests.sh for $debian_arch arch] Running the tests of $repo_name ($test_command, $shards at a time)"
+
+# The values are passed as assignments in front of a quoted script, so that the script itself needs no escaping
+{
+	printf '%s=%q\n' root_prefix "$root_prefix" debian_arch "$debian_arch" project_name "$project_name" repo_name "$repo_name" \
+		build_system "$main_repo_build_system" test_command "$test_command" shards "$shards" log_file "$root_prefix$thread_chroot_log_file" \
+		logs_dir "$root_prefix$thread_chroot_build_dir/logs" repo_root "$root_prefix$thread_chroot_build_dir/$repo_name" native_cross "$native_cross"
+	cat <<'EOF'
+exec >> "$log_file" 2>&1
+. /opt/v2ci/logging.sh
+report="$logs_dir/test-report.xml"
+rm -f "$report" "$logs_dir"/test-shard-*
+cd "$repo_root" || { formatted_log "ERROR" "run_tests.sh" "$LINENO" "$project_name" "$debian_arch" "Error: Cannot change directory to $repo_root"; exit 1; }
+build_dir=$(cat .v2ci-build-dir 2>/dev/null)
+[ -n "$build_dir" ] || build_dir=build
+[ "$native_cross" = "yes" ] && export QEMU_LD_PREFIX="$root_prefix"
+
+xml_escape() {
+    sed -e 's/&/\&amp;/g' -e 's/</\&lt;/g' -e 's/>/\&gt;/g' -e 's/"/\&quot;/g'
+}
+
+# <testcase> of a test known only by its exit status: name, seconds, status, log file (its tail goes in the failure)
+testcase() {
+    local name seconds
+    name=$(printf '%s' "$1" | xml_escape)
+    seconds=$2
+    if [ "$3" = "pass" ]; then
+        printf '  <testcase classname="%s" name="%s" time="%s"/>\n' "$repo_name" "$name" "$seconds"
+    elif [ "$3" = "skip" ]; then
+        printf '  <testcase classname="%s" name="%s" time="%s"><skipped/></testcase>\n' "$repo_name" "$name" "$seconds"
+    else
+        printf '  <testcase classname="%s" name="%s" time="%s"><failure message="%s">' "$repo_name" "$name" "$seconds" "$(printf '%s' "$3" | xml_escape)"
+        [ -f "$4" ] && tail -n 50 "$4" | xml_escape
+        printf '</failure></testcase>\n'
+    fi
+}
+
+elapsed() {
+    awk -v ns="$(( $(date +%s%N) - $1 ))" 'BEGIN { printf "%.3f", ns / 1000000000 }'
+}
+
+# Wraps the test cases read from stdin into the report
+write_report() {
+    { echo '<?xml version="1.0" encoding="UTF-8"?>'; echo "<testsuite name=\"$repo_name\">"; cat; echo '</testsuite>'; } > "$report"
+}
+
+start=$(date +%s%N)
+if [ "$test_command" != "auto" ]; then
+    formatted_log "INFO" "run_tests.sh" "$LINENO" "$project_name" "$debian_arch" "[From run_tests.sh] Running '$test_command' in $shards shards"
+    pids=()
+    for shard in $(seq 0 $((shards - 1))); do
+        (
+            shard_start=$(date +%s%N)
+            V2CI_TEST_SHARD_INDEX=$shard V2CI_TEST_SHARD_COUNT=$shards V2CI_TEST_JUNIT="$logs_dir/test-shard-$shard.xml" bash -c "$test_command" > "$logs_dir/test-shard-$shard.log" 2>&1
+            echo "$? $(elapsed "$shard_start")" > "$logs_dir/test-shard-$shard.status"
+        ) &
+        pids+=($!)
+    done
+    trap 'kill "${pids[@]}" 2>/dev/null; exit 143' TERM INT
+    wait "${pids[@]}"
+    status=0
+    for shard in $(seq 0 $((shards - 1))); do
+        read -r shard_status shard_seconds 2>/dev/null < "$logs_dir/test-shard-$shard.status" || shard_status=1
+        cat "$logs_dir/test-shard-$shard.log"
+        [ "$shard_status" -ne 0 ] && status=1
+        # A shard that reported its own test cases is taken as it is; the others count as one test each
+        if [ -s "$logs_dir/test-shard-$shard.xml" ]; then
+            sed -e '/^<?xml/d' "$logs_dir/test-shard-$shard.xml"
+            if [ "$shard_status" -ne 0 ] && ! grep -q '<failure\|<error' "$logs_dir/test-shard-$shard.xml"; then
+                testcase "shard $shard" "${shard_seconds:-0}" "exited with $shard_status" "$logs_dir/test-shard-$shard.log"
+            fi
+        elif [ "$shard_status" -eq 0 ]; then
+            testcase "shard $shard" "${shard_seconds:-0}" pass
+        else
+            testcase "shard $shard" "${shard_seconds:-0}" "exited with $shard_status" "$logs_dir/test-shard-$shard.log"
+        fi
+    done > "$logs_dir/test-shard-cases"
+    write_report < "$logs_dir/test-shard-cases"
+elif [ "$build_system" = "cmake" ]; then
+    cd "$build_dir" || exit 1
+    # --output-junit needs ctest >= 3.21
+    if ctest --help 2>/dev/null | grep -q -- '--output-junit'; then
+        ctest -j "$shards" --output-on-failure --output-junit "$report"
+        status=$?
+    else
+        ctest -j "$shards" --output-on-failure > "$logs_dir/test-shard-ctest.log" 2>&1
+        status=$?
+        cat "$logs_dir/test-shard-ctest.log"
+    fi
+    [ -s "$report" ] || testcase ctest "$(elapsed "$start")" "$([ "$status" -eq 0 ] && echo pass || echo "ctest exited with $status")" "$logs_dir/test-shard-ctest.log" | write_report
+elif [ "$build_system" = "meson" ]; then
+    # Timeouts of meson tests are tuned for native runs: qemu needs more, and the time budget of the daemon bounds the whole suite
+    multiplier=10
+    [ "$debian_arch" = "amd64" ] && multiplier=1
+    meson test -C "$build_dir" --num-processes "$shards" --print-errorlogs --timeout-multiplier "$multiplier"
+    status=$?
+    if [ -s "$build_dir/meson-logs/testlog.junit.xml" ]; then
+        cp "$build_dir/meson-logs/testlog.junit.xml" "$report"
+    else
+        testcase "meson test" "$(elapsed "$start")" "$([ "$status" -eq 0 ] && echo pass || echo "meson test exited with $status")" "$build_dir/meson-logs/testlog.txt" | write_report
+    fi
+elif [ "$build_system" = "autotools" ] || [ "$build_system" = "makefile" ]; then
+    [ -d "$build_dir" ] && [ -f "$build_dir/Makefile" ] && cd "$build_dir"
+    touch "$logs_dir/test-shard-start"
+    make -j "$shards" check
+    status=$?
+    # The parallel harness of automake leaves a .trs file per test
+    find . -name '*.trs' -newer "$logs_dir/test-shard-start" > "$logs_dir/test-shard-trs"
+    if [ -s "$logs_dir/test-shard-trs" ]; then
+        while read -r trs; do
+            result=$(sed -n 's/^:test-result: *//p' "$trs" | head -n 1)
+            case "$result" in
+                PASS|XFAIL) testcase "${trs%.trs}" 0 pass ;;
+                SKIP) testcase "${trs%.trs}" 0 skip ;;
+                *) testcase "${trs%.trs}" 0 "$result" "${trs%.trs}.log" ;;
+            esac
+        done < "$logs_dir/test-shard-trs" | write_report
+    else
+        testcase "make check" "$(elapsed "$start")" "$([ "$status" -eq 0 ] && echo pass || echo "make check exited with $status")" | write_report
+    fi
+else
+    formatted_log "ERROR" "run_tests.sh" "$LINENO" "$project_name" "$debian_arch" "Error: No test runner for build system $build_system (set test.command)"
+    exit 1
+fi
+rm -f "$logs_dir"/test-shard-*
+if [ "$status" -ne 0 ]; then
+    formatted_log "ERROR" "run_tests.sh" "$LINENO" "$project_name" "$debian_arch" "[From run_tests.sh] Tests of $repo_name failed (status $status) after $(elapsed "$start") s"
+    exit 3
+fi
+formatted_log "INFO" "run_tests.sh" "$LINENO" "$project_name" "$debian_arch" "[From run_tests.sh] Tests of $repo_name passed in $(elapsed "$start") s"
+exit 0
+EOF
+} | enter_test_root
+status=$?
+
+exec >> "$thread_log_file" 2>&1
+if [ "$status" -eq 3 ]; then
+	formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "[From run_tests.sh for $debian_arch arch] Tests of $repo_name failed; the binary is not published"
+	exit 3
+elif [ "$status" -eq "$CHROOT_SESSION_LOST" ]; then
+	exit "$CHROOT_SESSION_LOST"
+elif [ "$status" -ne 0 ]; then
+	formatted_log "ERROR" "$0" "$LINENO" "$project_name" "$debian_arch" "Error: [From run_tests.sh for $debian_arch arch] Unable to run the tests of $repo_name (status $status)"
+	exit 1
+fi
+formatted_log "INFO" "$0" "$LINENO" "$project_name" "$debian_arch" "[From run_tests.sh for $debian_arch arch] Tests of $repo_name passed"
+exit 0
@@ -0,0 +1,114 @@
+#!/usr/bin/env bash
+
+# Usage:
+#   SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" >/dev/null 2>&1 && pwd)"
+#   . "$SCRIPT_DIR/session.sh"
+#   chroot_exec "$chroot_dir" <<EOF
+#       ...commands to run inside the chroot...
+#   EOF
+#
+# If the daemon keeps a persistent session for the chroot (chroot_session: persistent in config.yml), the script read from stdin
+# is executed by the session server (session_server.sh) already running inside the namespace, avoiding the startup of a new
+# namespace and of a new fakeroot daemon for every step. Otherwise it falls back to a fresh <chroot_dir>/_enter.
+
+# Exit status of chroot_exec when the session server died under a command that had started: its outcome is unknown, so the callers
+# report it as a lost session instead of a failure of the command (see SCRIPT_SESSION_LOST in scripts_runner.h)
+CHROOT_SESSION_LOST=75
+# Seconds given to the session server to accept a line on its control FIFO before it is considered unreachable
+CHROOT_SESSION_CTL_TIMEOUT=5
+
+session_is_alive() {
+  local session_dir="$1"
+  [ -p "$session_dir/ctl" ] && [ -f "$session_dir/ready" ] && [ -s "$session_dir/server.pid" ] && kill -0 "$(cat "$session_dir/server.pid")" 2>/dev/null
+}
+
+# Writes a line to the control FIFO; the open of a FIFO without readers blocks, so a dead server makes it fail after the timeout
+session_send() {
+  timeout "$CHROOT_SESSION_CTL_TIMEOUT" bash -c 'echo "$1" > "$2"' _ "$2" "$1/ctl"
+}
+
+session_log() {
+  if declare -F formatted_log > /dev/null; then
+    formatted_log "$1" "session.sh" "$2" "$project_name" "${debian_arch:-$thread_arch}" "$3" >&2
+  else
+    echo "[$1] session.sh:$2: $3" >&2
+  fi
+}
+
+chroot_exec() {
+  local chroot_dir="$1"
+  local session_dir="$chroot_dir/.v2ci/session"
+
+  if ! session_is_alive "$session_dir"; then
+    "$chroot_dir/_enter"
+    return $?
+  fi
+
+  local server_pid
+  server_pid=$(cat "$session_dir/server.pid")
+  local id="$$-$RANDOM-$(date +%s%N)"
+  local base="$session_dir/$id"
+  cat > "$base.sh" || return 1
+  if ! mkfifo "$base.out" "$base.err"; then
+    rm -f "$base.sh" "$base.out" "$base.err"
+    return 1
+  fi
+
+  # Relay the output of the remote command to our own stdout/stderr
+  cat "$base.out" &
+  local out_pid=$!
+  cat "$base.err" >&2 &
+  local err_pid=$!
+
+  # Cancellation: the server kills the process group of the remote command, or does not start it if it was not started yet
+  trap "session_send \"$session_dir\" \"cancel $id\"" TERM INT
+  local status=""
+  if ! session_send "$session_dir" "run $id"; then
+    trap - TERM INT
+    kill "$out_pid" "$err_pid" 2>/dev/null
+    wait "$out_pid" "$err_pid" 2>/dev/null
+    session_log "WARNING" "$LINENO" "The session server of $chroot_dir (PID $server_pid) did not accept the command within $CHROOT_SESSION_CTL_TIMEOUT s; running it with a fresh _enter"
+    "$chroot_dir/_enter" < "$base.sh"
+    status=$?
+    rm -f "$base.sh" "$base.out" "$base.err"
+    return "$status"
+  fi
+
+  # The relays only end when the remote command closes the FIFOs: if the server dies before (or while) running it, stop them from here
+  (
+    while kill -0 "$server_pid" 2>/dev/null && { kill -0 "$out_pid" || kill -0 "$err_pid"; } 2>/dev/null; do
+      sleep 1
+    done
+    kill "$out_pid" "$err_pid" 2>/dev/null
+  ) &
+  local guard_pid=$!
+
+  # wait returns early (> 128) when a trapped signal arrives, so loop until both relays are done
+  while kill -0 "$out_pid" 2>/dev/null || kill -0 "$err_pid" 2>/dev/null; do
+    wait "$out_pid" "$err_pid"
+  done
+  kill "$guard_pid" 2>/dev/null
+  wait "$guard_pid" 2>/dev/null
+
+  # The server stores the status right after the command exits
+  while [ ! -s "$base.status" ] && kill -0 "$server_pid" 2>/dev/null; do
+    sleep 0.01
+  done
+  [ -s "$base.status" ] && status=$(cat "$base.status")
+  trap - TERM INT
+
+  if [ -z "$status" ]; then
+    if [ ! -e "$base.pgid" ]; then
+      # The server died before starting the command: it never ran, so it can still run with a fresh _enter
+      session_log "WARNING" "$LINENO" "The session server of $chroot_dir (PID $server_pid) exited before running the command; running it with a fresh _enter"
+      "$chroot_dir/_enter" < "$base.sh"
+      status=$?
+    else
+      session_log "ERROR" "$LINENO" "Lost the session server of $chroot_dir (PID $server_pid) while it was running the command; its exit status is unknown (returning $CHROOT_SESSION_LOST)"
+      status=$CHROOT_SESSION_LOST
+    fi
+  fi
+
+  rm -f "$base.sh" "$base.out" "$base.err" "$base.pgid" "$base.status" "$base.cancel"
+  return "$status"
+}
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Persistent session server: it is started once per chroot by the daemon through <chroot_dir>/_enter, so it lives inside the
+# user/pid/mount namespace and under the fakeroot instance of that chroot for the whole daemon lifetime.
+# Clients (see session.sh) submit commands through the control FIFO:
+#   run <id>     -> execute /.v2ci/session/<id>.sh in its own session/process group, with stdout/stderr bound to the
+#                   <id>.out/<id>.err FIFOs of the client, and store the exit status in <id>.status
+#   cancel <id>  -> SIGTERM the whole process group of <id>, followed by SIGKILL after a grace period; the cancel is remembered in
+#                   <id>.cancel, so a command cancelled before it wrote its <id>.pgid exits with 143 as soon as it starts
+#   quit         -> cancel everything still running and leave the namespace
+
+session_dir="${V2CI_SESSION_DIR:-/.v2ci/session}"
+ctl="$session_dir/ctl"
+cancel_grace_period=10
+
+if [ ! -p "$ctl" ]; then
+    mkfifo "$ctl" || exit 1
+fi
+# Open the control FIFO read-write so that the loop never sees EOF when the last client closes it
+exec 3<> "$ctl"
+touch "$session_dir/ready"
+
+cancel_command() {
+    local pgid_file="$session_dir/$1.pgid"
+    # The marker comes before the read of the pgid, and the command writes its pgid before checking the marker: one of the two sees the other
+    touch "$session_dir/$1.cancel"
+    if [ -s "$pgid_file" ]; then
+        local pgid
+        pgid=$(cat "$pgid_file")
+        kill -TERM -- "-$pgid" 2>/dev/null
+        ( sleep "$cancel_grace_period"; kill -KILL -- "-$pgid" 2>/dev/null ) &
+    fi
+}
+
+while read -r verb id <&3; do
+    case "$verb" in
+        run)
+            if [ -z "$id" ] || [ ! -f "$session_dir/$id.sh" ]; then
+                continue
+            fi
+            (
+                setsid -w bash -c 'echo $$ > "$1.pgid"; [ -e "$1.cancel" ] && { : > "$1.out"; : > "$1.err"; exit 143; }; exec bash "$1.sh" < /dev/null > "$1.out" 2> "$1.err"' _ "$session_dir/$id"
+                echo $? > "$session_dir/$id.status.tmp" && mv "$session_dir/$id.status.tmp" "$session_dir/$id.status"
+            ) &
+            ;;
+        cancel)
+            [ -n "$id" ] && cancel_command "$id"
+            ;;
+        quit)
+            break
+            ;;
+    esac
+done
+
+rm -f "$session_dir/ready"
+for pgid_file in "$session_dir"/*.pgid; do
+    [ -e "$pgid_file" ] || continue
+    id=$(basename "$pgid_file" .pgid)
+    [ -e "$session_dir/$id.status" ] || cancel_command "$id"
+done
+wait
+exit 0
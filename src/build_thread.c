@@ -10,39 +10,77 @@
 #include <time.h>
 #include "utils/scripts_runner.h"
 #include "utils/utils.h"
+#include "utils/cgroup.h"
+#include "chroot/package_service.h"
+#include "chroot/chroot_health.h"
+#include "build_thread.h"
 
-static int lock_package_manager_in_chroot(const char *chroot_dir, FILE *log_fp, const char *project_name, const char *thread_arch) {
-    char lock_file_path[MAX_CONFIG_ATTR_LEN];
-    snprintf(lock_file_path, sizeof(lock_file_path), "%s/lock", chroot_dir);
-    int fd = open(lock_file_path, O_CREAT | O_RDWR, 0644);
-    if (fd == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Unable to open lock file %s: %s", lock_file_path, strerror(errno));
-        return 1;
+// Appends the duration of a successful build to <main_project_build_dir>/logs/build_times.log ("<epoch> <arch> <mode> <seconds>")
+// and compares it with the latest build of the same arch in the other cross mode, if any
+static void record_build_time(project_t *prj, const char *arch, const char *mode, double seconds, FILE *log_fp) {
+    char build_times_file[CONFIG_ATTR_LEN + 32];
+    snprintf(build_times_file, sizeof(build_times_file), "%s/logs/build_times.log", prj->main_project_build_dir);
+
+    // 1. Find the latest build of this arch in the other mode
+    double other_seconds = -1;
+    char other_mode[16] = "";
+    FILE *fp = fopen(build_times_file, "r");
+    if (fp) {
+        char line[256];
+        while (fgets(line, sizeof(line), fp)) {
+            long long epoch;
+            char line_arch[64], line_mode[16];
+            double line_seconds;
+            if (sscanf(line, "%lld %63s %15s %lf", &epoch, line_arch, line_mode, &line_seconds) == 4 && strcmp(line_arch, arch) == 0 && strcmp(line_mode, mode) != 0) {
+                other_seconds = line_seconds;
+                snprintf(other_mode, sizeof(other_mode), "%s", line_mode);
+            }
+        }
+        fclose(fp);
     }
-    if (flock(fd, LOCK_EX) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Unable to acquire lock on %s: %s", lock_file_path, strerror(errno));
+
+    // 2. Append this build (O_APPEND keeps the lines of concurrent threads whole)
+    int fd = open(build_times_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) {
+        char record[128];
+        int len = snprintf(record, sizeof(record), "%lld %s %s %.1f\n", (long long)time(NULL), arch, mode, seconds);
+        if (write(fd, record, len) != len) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to record build time in %s: %s", build_times_file, strerror(errno));
+        }
         close(fd);
-        return 1;
     }
-    return fd;
-}
 
-static int unlock_package_manager_in_chroot(int fd, FILE *log_fp, const char *project_name, const char *thread_arch) {
-    if (flock(fd, LOCK_UN) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Unable to release lock: %s", strerror(errno));
-        return 1;
+    if (other_seconds > 0) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Build took %.1f s in %s mode (latest %s build: %.1f s, %.2fx).", seconds, mode, other_mode, other_seconds, other_seconds / (seconds > 0 ? seconds : 1));
+    } else {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Build took %.1f s in %s mode.", seconds, mode);
     }
-    close(fd);
-    return 0;
 }
-    
-// This function is the entry point for each build thread.
+
+// Publishes the state of a build to the control socket; the phase start is kept while the phase does not change (status may be NULL)
+void build_status_set(build_status_t *status, int state, const char *phase) {
+    if (!status) return;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&status->lock);
+    if (status->state != state) status->started_at = now;
+    if (status->state != state || strcmp(status->phase, phase) != 0) status->phase_started_at = now;
+    status->state = state;
+    snprintf(status->phase, sizeof(status->phase), "%s", phase);
+    pthread_mutex_unlock(&status->lock);
+}
+
+// Sets the status of a failed step: the OOM killer (which may have been the actual cause of a failure of any kind) comes before the watchdog
+static void set_failure_status(thread_result_t *result, int step_result) {
+    if (result->usage.oom_kills > 0) result->status = THREAD_STATUS_OOM;
+    else if (step_result == SCRIPT_TIMED_OUT) result->status = THREAD_STATUS_TIMEOUT;
+    else if (step_result == SCRIPT_SESSION_LOST) result->status = THREAD_STATUS_SESSION_LOST;
+}
+
 // Its roles include:
 // - install all dependencies packages in the chroot
 // - clone or pull the sources of the main project and all its manual dependencies
 // - build all the manual dependencies and the main project itself
-
-void *build_thread(void *arg) {
+static void *run_build_steps(void *arg) {
     // Extract arguments
     thread_arg_t *targ = (thread_arg_t *)arg;
     project_t *prj = targ->project;
@@ -54,9 +92,12 @@ void *build_thread(void *arg) {
     if (!result) {
         return NULL;
     }
-    result->status = 1;
+    result->status = THREAD_STATUS_FAILED;
     result->error_message = NULL;
-    result->stats = "Progress: 0%";
+    memset(&result->usage, 0, sizeof(result->usage));
+    targ->context.timeouts = &prj->timeouts;
+    targ->context.usage = &result->usage;
+    targ->context.cgroup_dir[0] = '\0';
 
     // Create log file for the thread (couple project-architecture)
     int thread_log_file_result = recursive_mkdir_or_file(targ->thread_log_file, 0755, 1);
@@ -66,9 +107,16 @@ void *build_thread(void *arg) {
 
     // Initialize logging
     FILE *log_fp = fopen(targ->thread_log_file, "a");
+    if (!log_fp) {
+        result->error_message = "Unable to open the thread log file";
+        return (void *)result;
+    }
     setvbuf(log_fp, NULL, _IOLBF, 0);
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Build thread started for project %s, architecture %s.", prj->name, arch);
 
+    // All the steps of the thread run in the cgroup of the build, if enabled (otherwise without limits)
+    cgroup_prepare_build(prj, arch, targ->context.cgroup_dir, sizeof(targ->context.cgroup_dir), log_fp);
+
     // Create all necessary directories and files in the chroot:
     char expanded_chroot_build_dir[MAX_CONFIG_ATTR_LEN*2];
     snprintf(expanded_chroot_build_dir, sizeof(expanded_chroot_build_dir), "%s%s", targ->thread_chroot_dir, targ->thread_chroot_build_dir);
@@ -81,100 +129,149 @@ void *build_thread(void *arg) {
     if (chroot_build_dir_result != 0) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Unable to create chroot build directory at %s: %s", expanded_chroot_build_dir, strerror(errno));
         result->error_message = "Unable to create chroot build directory";
-        return (void *)result;
+        goto out;
     }
     int chroot_log_file_result = recursive_mkdir_or_file(expanded_chroot_log_file, 0755, 1);
     if (chroot_log_file_result != 0) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Unable to create chroot log file at %s: %s", expanded_chroot_log_file, strerror(errno));
         result->error_message = "Unable to create chroot log file";
-        return (void *)result;
+        goto out;
     }
     int chroot_target_dir_result = recursive_mkdir_or_file(expanded_chroot_target_dir, 0755, 0);
     if (chroot_target_dir_result != 0) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Unable to create chroot target directory at %s: %s", expanded_chroot_target_dir, strerror(errno));
         result->error_message = "Unable to create chroot target directory";
-        return (void *)result;
+        goto out;
     }
 
     // Install all dependency packages in the chroot
     if (*terminate_flag) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Termination signal received before starting build for architecture %s for project %s, exiting...", arch, prj->name);
         result->error_message = "Termination signal received before starting build";
-        return (void *)result;
+        goto out;
     }
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Starting installation of dependencies packages in chroot for architecture %s for project %s...", arch, prj->name);
-    // First lock this phase to avoid different forked workers accessing apt/dnf/ in the same time in same chroot
-    // Note: the different threads won't interfere as they work in different chroots, but the forked processes could do it (they operate on different projects but maybe sharing some chroots)
-    int lock_fd = lock_package_manager_in_chroot(targ->thread_chroot_dir, log_fp, prj->name, arch);
-    if (lock_fd == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to acquire package manager lock");
-        result->error_message = "Failed to acquire package manager lock";
-        return (void *)result;
+    build_status_set(targ->status, BUILD_STATE_RUNNING, "install");
+    // Merge the main dependency packages and the packages of every manual dependency into a single request for the package service of the chroot
+    // Note: the service thread of the chroot coalesces the requests of all the build threads (of every project) that share it into a single apt run
+    int install_result;
+    {   // A block of its own: the exits jump past this array to out
+        char *packages[MAX_DEPENDENCIES * (prj->manual_dep_count + 1) + 1];
+        int package_count = 0;
+        for (int i = 0; i < prj->dep_count; i++) {
+            packages[package_count++] = prj->dependency_packages[i];
+        }
+        manual_dependency_t *cur_manual = prj->manual_dependencies;
+        while (cur_manual) {
+            for (int i = 0; i < cur_manual->dep_count; i++) {
+                packages[package_count++] = cur_manual->dependencies[i];
+            }
+            cur_manual = cur_manual->next;
+        }
+        packages[package_count] = NULL;
+        install_result = package_service_install(packages, targ->thread_chroot_dir, log_fp, prj->name, arch, terminate_flag, &targ->context);
     }
-    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Acquired package manager lock for architecture %s for project %s.", arch, prj->name);
-    result->stats = "Progress: 10%";
-    // Install all main dependency packages in the chroot
-    int install_result = install_packages_list_in_chroot(prj->dependency_packages, targ->thread_chroot_dir, log_fp, targ->thread_chroot_log_file, prj->name, arch);
     if (install_result != 0) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to install main dependencies packages in chroot for architecture %s for project %s.", arch, prj->name);
-        result->error_message = "Failed to install main dependencies packages";
-        return (void *)result;
-    }
-    result->stats = "Progress: 30%";
-    // Install all secondary (manual) dependency packages in the chroot (for each manual dependency, install its dependencies)
-    manual_dependency_t *cur_manual = prj->manual_dependencies;
-    while (cur_manual) {
-        int install_result = install_packages_list_in_chroot(cur_manual->dependencies, targ->thread_chroot_dir, log_fp, targ->thread_chroot_log_file, prj->name, arch);
-        if (install_result != 0) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to install dependencies packages for manual dependency %s in chroot for architecture %s for project %s. Retrying after poll interval.", cur_manual->git_url, arch, prj->name);
-            result->error_message = "Failed to install manual dependencies packages";
-            return (void *)result;
-        }
-        cur_manual = cur_manual->next;
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to install dependencies packages in chroot for architecture %s for project %s.", arch, prj->name);
+        set_failure_status(result, install_result);
+        result->error_message = result->status == THREAD_STATUS_OOM ? "Installation of dependencies packages killed by the OOM killer" : install_result == SCRIPT_TIMED_OUT ? "Installation of dependencies packages timed out" : result->status == THREAD_STATUS_SESSION_LOST ? "Lost the chroot session during the installation of dependencies packages" : "Failed to install dependencies packages";
+        goto out;
     }
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "All dependencies installed in chroot for architecture %s for project %s.", arch, prj->name);
-    result->stats = "Progress: 50%";
-    // Release the lock on package manager
-    int unlock_result = unlock_package_manager_in_chroot(lock_fd, log_fp, prj->name, arch);
-    if (unlock_result != 0) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to release package manager lock");
-        result->error_message = "Failed to release package manager lock";
-        return (void *)result;
+
+    // In native cross mode the compilation runs in the amd64 chroot, which needs the cross toolchain for this arch (the build tools come with every install)
+    // Note: the target chroot keeps providing the libraries and headers (it is used as sysroot), so the dependency packages above stay there
+    const char *build_mode_label = "emulated";
+    if (strcmp(targ->thread_cross_mode, "native") == 0 && strcmp(arch, "amd64") != 0) {
+        char host_home_dir[MAX_CONFIG_ATTR_LEN + 8];
+        snprintf(host_home_dir, sizeof(host_home_dir), "%s/home", targ->thread_host_chroot_dir);
+        char host_chroot_log_file[MAX_CONFIG_ATTR_LEN * 2];
+        snprintf(host_chroot_log_file, sizeof(host_chroot_log_file), "%s%s", targ->thread_host_chroot_dir, targ->thread_chroot_log_file);
+        struct stat host_st;
+        if (stat(host_home_dir, &host_st) != 0 || !S_ISDIR(host_st.st_mode) || recursive_mkdir_or_file(host_chroot_log_file, 0755, 1) != 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "amd64 chroot not available at %s; building %s under emulation.", targ->thread_host_chroot_dir, arch);
+            snprintf(targ->thread_cross_mode, sizeof(targ->thread_cross_mode), "emulated");
+        } else {
+            char crossbuild_package[MIN_CONFIG_ATTR_LEN];
+            snprintf(crossbuild_package, sizeof(crossbuild_package), "crossbuild-essential-%s", arch);
+            char *host_packages[] = { crossbuild_package, NULL };
+            if (package_service_install(host_packages, targ->thread_host_chroot_dir, log_fp, prj->name, arch, terminate_flag, &targ->context) != 0) {
+                formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to install the %s toolchain in %s; building %s under emulation.", crossbuild_package, targ->thread_host_chroot_dir, arch);
+                snprintf(targ->thread_cross_mode, sizeof(targ->thread_cross_mode), "emulated");
+            } else {
+                build_mode_label = "native";
+            }
+        }
     }
-    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Released package manager lock for architecture %s for project %s.", arch, prj->name);
 
     // Clone or pull the sources of the main project and all its manual dependencies
     if (*terminate_flag) {
         formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, arch, "Termination signal received before cloning sources for architecture %s for project %s, exiting...", arch, prj->name);
         result->error_message = "Termination signal received before cloning sources";
-        return (void *)result;
+        goto out;
     }
+    build_status_set(targ->status, BUILD_STATE_RUNNING, "fetch");
     int clone_result = clone_or_pull_sources_inside_chroot(targ, log_fp);
     if (clone_result != 0) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to clone or pull sources inside chroot for architecture %s for project %s.", arch, prj->name);
-        result->error_message = "Failed to clone or pull sources inside chroot";
-        return (void *)result;
+        set_failure_status(result, clone_result);
+        result->error_message = result->status == THREAD_STATUS_OOM ? "Clone or pull of sources killed by the OOM killer" : clone_result == SCRIPT_TIMED_OUT ? "Clone or pull of sources timed out" : "Failed to clone or pull sources inside chroot";
+        goto out;
     }
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "All sources cloned or pulled inside chroot for architecture %s for project %s.", arch, prj->name);
-    result->stats = "Progress: 70%";
 
     // Start the build process in the chroot (compilation of manual dependencies and main project)
     if (*terminate_flag) {
         formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, arch, "Termination signal received before starting build for architecture %s for project %s, exiting...", arch, prj->name);
         result->error_message = "Termination signal received before starting build";
-        return (void *)result;
+        goto out;
     }
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Starting build process for architecture %s for project %s...", arch, prj->name);
+    build_status_set(targ->status, BUILD_STATE_RUNNING, "build");
+    struct timespec build_start, build_end;
+    clock_gettime(CLOCK_MONOTONIC, &build_start);
     int build_result = build_in_chroot(targ, log_fp);
+    clock_gettime(CLOCK_MONOTONIC, &build_end);
+    if (build_result == 0) {
+        double build_seconds = (build_end.tv_sec - build_start.tv_sec) + (build_end.tv_nsec - build_start.tv_nsec) / 1e9;
+        record_build_time(prj, arch, build_mode_label, build_seconds, log_fp);
+    }
     if (build_result != 0) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Build failed for architecture %s for project %s.", arch, prj->name);
-        result->error_message = "Build failed";
-        return (void *)result;
+        set_failure_status(result, build_result);
+        result->error_message = result->status == THREAD_STATUS_OOM ? "Build killed by the OOM killer (memory.max of its cgroup exceeded)" : build_result == SCRIPT_TIMED_OUT ? "Build timed out (see the watchdog message in the thread log)" : build_result == SCRIPT_TESTS_FAILED ? "Tests failed; the binary was not published" : result->status == THREAD_STATUS_SESSION_LOST ? "Lost the chroot session during the build (not a build failure)" : "Build failed";
+        goto out;
     }
 
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Build completed successfully for architecture %s for project %s.", arch, prj->name);
-    result->stats = "Progress: 100%";
-    result->status = 0;
+    result->status = THREAD_STATUS_SUCCESS;
+
+out:
+    // Every exit goes through here: the daemon is a single long-lived process, so a log left open would leak its descriptor
+    fclose(log_fp);
     return (void *)result;
 }
-    
\ No newline at end of file
+    
+
+// This function is the entry point for each build thread: it runs the steps while holding the builds lock of its chroot (shared with the
+// other builds of the arch), so that a reset of the chroot waits for them and the builds started meanwhile wait for the new rootfs
+// Note: a native build compiles in the amd64 chroot as well, so it holds its lock too, always taken first (amd64, then the target)
+void *build_thread(void *arg) {
+    thread_arg_t *targ = (thread_arg_t *)arg;
+    int native = strcmp(targ->thread_cross_mode, "native") == 0 && strcmp(targ->arch, "amd64") != 0;
+    int host_lock_fd = native ? chroot_builds_lock(targ->thread_host_chroot_dir, targ->terminate_flag) : -1;
+    int builds_lock_fd = !native || host_lock_fd >= 0 ? chroot_builds_lock(targ->thread_chroot_dir, targ->terminate_flag) : -1;
+    if (builds_lock_fd < 0) {
+        // Cancelled (or unable to lock) while waiting for a reset of the chroot: the steps never run without the lock
+        chroot_builds_unlock(host_lock_fd);
+        thread_result_t *result = calloc(1, sizeof(thread_result_t));
+        if (!result) return NULL;
+        result->status = THREAD_STATUS_CANCELLED;
+        result->error_message = "Cancelled while waiting for the builds lock of the chroot";
+        return (void *)result;
+    }
+    void *result = run_build_steps(arg);
+    chroot_builds_unlock(builds_lock_fd);
+    chroot_builds_unlock(host_lock_fd);
+    return result;
+}
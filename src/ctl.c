@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "control/control.h"
+
+static void usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s <command> [arguments]\n"
+        "  status                      projects, queue and running builds (phase and elapsed time of each <project, arch>)\n"
+        "  build <project> [<arch>]    start a cycle now, building the architecture (or all of them) even if already built\n"
+        "  cancel <project> [<arch>]   cancel the running build of the architecture (or all the running builds of the project)\n"
+        "  pause <project>             schedule no more cycles of the project (a running one ends normally)\n"
+        "  resume [<project>]          poll a paused project again, or end a drain\n"
+        "  drain                       start no new cycles; the running ones end normally\n"
+        "  rotate [<project>] [--dry-run]   rotate the binaries of the target dirs now, or print the planned moves and removals\n"
+        "  report [<count>]            slowest build phases of all the projects (p50/p95 of their recent builds), 20 by default\n"
+        "The response of the daemon is printed as a JSON document; the exit code is 0 if it reports \"ok\":true.\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 4 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        usage(argv[0]);
+        return argc < 2 ? 2 : 0;
+    }
+
+    // The request is the command line itself: "<command> [<project> [<arch>]]"
+    char request[CONTROL_REQUEST_LEN];
+    size_t len = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strchr(argv[i], ' ') || strchr(argv[i], '\n') || len + strlen(argv[i]) + 2 > sizeof(request)) {
+            fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+            return 2;
+        }
+        len += snprintf(request + len, sizeof(request) - len, "%s%s", i > 1 ? " " : "", argv[i]);
+    }
+
+    json_buf_t response = { 0 };
+    if (control_request(CONTROL_SOCKET_PATH, request, &response) != 0) {
+        const char *reason = (errno == ENOENT || errno == ECONNREFUSED) ? "the v2ci daemon is not running" : strerror(errno);
+        printf("{\"ok\":false,\"error\":\"unable to reach %s: %s\"}\n", CONTROL_SOCKET_PATH, reason);
+        json_free(&response);
+        return 1;
+    }
+    if (response.len == 0) {
+        printf("{\"ok\":false,\"error\":\"empty response from the daemon\"}\n");
+        return 1;
+    }
+    fwrite(response.data, 1, response.len, stdout);
+    int ok = strncmp(response.data, "{\"ok\":true", strlen("{\"ok\":true")) == 0;
+    json_free(&response);
+    return ok ? 0 : 1;
+}
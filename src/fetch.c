@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "store/artifact_codec.h"
+#include "store/artifact_store.h"
+#include "store/artifact_index.h"
+#include "control/control.h"
+#include "utils/sha256.h"
+#include "types/types.h"
+
+static const char *tiers[] = { "daily", "weekly", "monthly", "yearly" };
+
+static void usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s <target_dir>/<tier>/<entry> [<output>|-]   retrieve a published binary (default output: ./<entry>)\n"
+        "       %s --stats <target_dir>                       logical and stored size, ratio and decode time of each tier\n"
+        "       %s --pack <target_dir> <tier> <codec> [<project>]   encode the binaries of a tier (codec: none, delta, zstd, delta+zstd)\n"
+        "       %s --latest <target_dir> <project> <arch> [<commit>]   path of the newest binary of the architecture (built from the commit)\n"
+        "       %s --find <target_dir> [<key>=<value>...]   artifacts of the index as JSON lines (keys: id, project, arch, commit, tag, tier;\n"
+        "                                                  tier=removed or tier=any for the removed ones)\n"
+        "       %s --reindex <target_dir> [<project>]        reconcile the index with the tiers (after changing them by hand)\n"
+        "zstd support: %s\n", program, program, program, program, program, program, codec_zstd_available() ? "yes" : "no");
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static const char *object_kind(const char *object) {
+    if (strstr(object, CODEC_DELTA_BASE_TAG)) return "delta";
+    size_t len = strlen(object), suffix_len = strlen(CODEC_ZSTD_SUFFIX);
+    if (len > suffix_len && strcmp(object + len - suffix_len, CODEC_ZSTD_SUFFIX) == 0) return "zstd";
+    return "plain";
+}
+
+static long long file_size(const char *dir, const char *name) {
+    char path[MAX_CONFIG_ATTR_LEN * 3];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return stat(path, &st) == 0 ? (long long)st.st_size : 0;
+}
+
+// Reads the object of the store an entry links; returns 1 if the entry is not a link into the store
+static int entry_object(const char *entry_path, char *object, size_t size) {
+    char target[MAX_CONFIG_ATTR_LEN];
+    ssize_t n = readlink(entry_path, target, sizeof(target) - 1);
+    if (n <= 0) return 1;
+    target[n] = '\0';
+    const char *prefix = "../" STORE_DIR_NAME "/";
+    if (strncmp(target, prefix, strlen(prefix)) != 0) return 1;
+    snprintf(object, size, "%s", target + strlen(prefix));
+    return 0;
+}
+
+static int write_output(const char *output, const codec_buf_t *binary) {
+    if (strcmp(output, "-") == 0) {
+        return fwrite(binary->data, 1, binary->len, stdout) == binary->len ? 0 : 1;
+    }
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.partial", output);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (fd < 0) return 1;
+    size_t written = 0;
+    while (written < binary->len) {
+        ssize_t n = write(fd, binary->data + written, binary->len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    if (written != binary->len || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmp_path);
+        return 1;
+    }
+    close(fd);
+    if (rename(tmp_path, output) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+static int fetch(const char *entry_path, const char *output) {
+    char path_copy[MAX_CONFIG_ATTR_LEN * 2];
+    char store_dir[MAX_CONFIG_ATTR_LEN * 2 + 16];
+    char object[MAX_CONFIG_ATTR_LEN];
+    snprintf(path_copy, sizeof(path_copy), "%s", entry_path);
+    char *entry_name = basename(path_copy);
+    char default_output[MAX_CONFIG_ATTR_LEN];
+    snprintf(default_output, sizeof(default_output), "%s", entry_name);
+    snprintf(path_copy, sizeof(path_copy), "%s", entry_path);
+    snprintf(store_dir, sizeof(store_dir), "%s/../%s", dirname(path_copy), STORE_DIR_NAME);
+
+    codec_buf_t binary = { 0 };
+    const char *kind = "file";
+    long long stored = 0;
+    double start = now_ms();
+    if (entry_object(entry_path, object, sizeof(object)) == 0) {
+        kind = object_kind(object);
+        stored = file_size(store_dir, object);
+        if (store_load_object(store_dir, object, &binary) != 0) {
+            fprintf(stderr, "Unable to decode %s (%s object %s): %s\n", entry_path, kind, object,
+                errno == ENOTSUP ? "v2ci_fetch was built without zstd support" : errno == EBADMSG ? "sha256 mismatch" : strerror(errno ? errno : EIO));
+            return 1;
+        }
+    } else {
+        // An entry published before the store, or a plain file
+        FILE *fp = fopen(entry_path, "rb");
+        struct stat st;
+        if (!fp || fstat(fileno(fp), &st) != 0 || !(binary.data = malloc(st.st_size ? st.st_size : 1)) || fread(binary.data, 1, st.st_size, fp) != (size_t)st.st_size) {
+            fprintf(stderr, "Unable to read %s: %s\n", entry_path, strerror(errno ? errno : EIO));
+            if (fp) fclose(fp);
+            codec_buf_free(&binary);
+            return 1;
+        }
+        fclose(fp);
+        binary.len = st.st_size;
+        stored = st.st_size;
+    }
+    double decode_ms = now_ms() - start;
+
+    if (!output) output = default_output;
+    if (write_output(output, &binary) != 0) {
+        fprintf(stderr, "Unable to write %s: %s\n", output, strerror(errno));
+        codec_buf_free(&binary);
+        return 1;
+    }
+    fprintf(stderr, "%s: %s, %lld KB stored, %zu KB decoded (%.1fx) in %.1f ms%s%s\n", entry_name, kind, stored / 1024, binary.len / 1024,
+        stored ? (double)binary.len / stored : 0.0, decode_ms, strcmp(output, "-") == 0 ? "" : " -> ", strcmp(output, "-") == 0 ? "" : output);
+    codec_buf_free(&binary);
+    return 0;
+}
+
+// Adds name to the set (a small array: a tier holds few distinct objects); returns 1 if it was already there
+static int add_unique(char (*set)[MAX_CONFIG_ATTR_LEN], int *count, int capacity, const char *name) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp(set[i], name) == 0) return 1;
+    }
+    if (*count < capacity) snprintf(set[(*count)++], MAX_CONFIG_ATTR_LEN, "%s", name);
+    return 0;
+}
+
+#define STATS_MAX_OBJECTS 4096
+
+static int stats(const char *target_dir) {
+    char store_dir[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(store_dir, sizeof(store_dir), "%s/%s", target_dir, STORE_DIR_NAME);
+    char (*objects)[MAX_CONFIG_ATTR_LEN] = malloc(STATS_MAX_OBJECTS * sizeof(*objects));
+    if (!objects) return 1;
+    printf("%-8s %8s %12s %12s %7s %10s %10s\n", "tier", "entries", "logical KB", "stored KB", "ratio", "decode ms", "max ms");
+    for (size_t t = 0; t < sizeof(tiers) / sizeof(tiers[0]); t++) {
+        char tier_dir[MAX_CONFIG_ATTR_LEN * 2];
+        snprintf(tier_dir, sizeof(tier_dir), "%s/%s", target_dir, tiers[t]);
+        DIR *dp = opendir(tier_dir);
+        if (!dp) continue;
+        int entries = 0, object_count = 0, decoded = 0;
+        long long logical = 0, stored = 0;
+        double decode_total = 0, decode_max = 0;
+        struct dirent *de;
+        while ((de = readdir(dp)) != NULL) {
+            if (de->d_name[0] == '.') continue;
+            char entry_path[MAX_CONFIG_ATTR_LEN * 3];
+            char object[MAX_CONFIG_ATTR_LEN];
+            snprintf(entry_path, sizeof(entry_path), "%s/%s", tier_dir, de->d_name);
+            entries++;
+            if (entry_object(entry_path, object, sizeof(object)) != 0) {
+                long long size = file_size(tier_dir, de->d_name);
+                logical += size;
+                stored += size;
+                continue;
+            }
+            long long size = store_object_logical_size(store_dir, object);
+            // An object linked twice in the tier is stored (and decoded) once
+            if (add_unique(objects, &object_count, STATS_MAX_OBJECTS, object)) {
+                logical += size > 0 ? size : 0;
+                continue;
+            }
+            stored += file_size(store_dir, object);
+            const char *base = strstr(object, CODEC_DELTA_BASE_TAG);
+            if (base) {
+                char base_sha[SHA256_HEX_LEN];
+                snprintf(base_sha, sizeof(base_sha), "%.64s", base + strlen(CODEC_DELTA_BASE_TAG));
+                char base_zstd[SHA256_HEX_LEN + 8];
+                snprintf(base_zstd, sizeof(base_zstd), "%s%s", base_sha, CODEC_ZSTD_SUFFIX);
+                const char *base_object = file_size(store_dir, base_sha) > 0 ? base_sha : base_zstd;
+                if (!add_unique(objects, &object_count, STATS_MAX_OBJECTS, base_object)) stored += file_size(store_dir, base_object);
+            }
+            if (strcmp(object_kind(object), "plain") != 0) {
+                codec_buf_t binary = { 0 };
+                double start = now_ms();
+                if (store_load_object(store_dir, object, &binary) == 0) {
+                    double ms = now_ms() - start;
+                    decode_total += ms;
+                    if (ms > decode_max) decode_max = ms;
+                    decoded++;
+                    if (size < 0) size = binary.len;
+                    codec_buf_free(&binary);
+                } else {
+                    fprintf(stderr, "%s/%s: unable to decode %s\n", tiers[t], de->d_name, object);
+                }
+            }
+            logical += size > 0 ? size : 0;
+        }
+        closedir(dp);
+        printf("%-8s %8d %12lld %12lld %6.1fx %10.1f %10.1f\n", tiers[t], entries, logical / 1024, stored / 1024, stored ? (double)logical / stored : 0.0,
+            decoded ? decode_total / decoded : 0.0, decode_max);
+    }
+    free(objects);
+    return 0;
+}
+
+static int latest(const char *target_dir, const char *project, const char *arch, const char *commit) {
+    artifact_index_t index;
+    if (artifact_index_open(target_dir, 0, &index) != 0) {
+        fprintf(stderr, "Unable to load the artifact index of %s: %s\n", target_dir, strerror(errno));
+        artifact_index_close(&index, NULL, NULL);
+        return 1;
+    }
+    const artifact_record_t *r = artifact_index_latest(&index, project, arch, commit);
+    if (r) {
+        printf("%s/%s/%s\n", target_dir, artifact_index_tier_name(r->tier), r->name);
+        fprintf(stderr, "artifact %lld: %s %s, %s, sha256 %.12s, %lld KB, built in %ld s\n", r->id, r->project, r->arch, r->tag, r->sha256, r->size / 1024, r->duration_s);
+    } else {
+        fprintf(stderr, "No published binary of %s for %s%s%s.\n", project, arch, commit ? " built from " : "", commit ? commit : "");
+    }
+    artifact_index_close(&index, NULL, NULL);
+    return r ? 0 : 1;
+}
+
+static int find(const char *target_dir, int argc, char *argv[]) {
+    const char *keys[] = { "id", "project", "arch", "commit", "tag", "tier" };
+    const char *values[6] = { NULL };
+    for (int i = 0; i < argc; i++) {
+        size_t k = 0;
+        while (k < 6 && !(strncmp(argv[i], keys[k], strlen(keys[k])) == 0 && argv[i][strlen(keys[k])] == '=')) k++;
+        if (k == 6) {
+            fprintf(stderr, "Unknown filter %s\n", argv[i]);
+            return 2;
+        }
+        values[k] = argv[i] + strlen(keys[k]) + 1;
+    }
+    int tier = values[5] ? artifact_index_tier(values[5]) : -2;
+    if (values[5] && tier == -2 && strcmp(values[5], "any") != 0) {
+        fprintf(stderr, "Unknown tier %s\n", values[5]);
+        return 2;
+    }
+    artifact_index_t index;
+    if (artifact_index_open(target_dir, 0, &index) != 0) {
+        fprintf(stderr, "Unable to load the artifact index of %s: %s\n", target_dir, strerror(errno));
+        artifact_index_close(&index, NULL, NULL);
+        return 1;
+    }
+    json_buf_t buf = { 0 };
+    for (int i = 0; i < index.count; i++) {
+        const artifact_record_t *r = &index.records[i];
+        if (values[0] && r->id != atoll(values[0])) continue;
+        if (values[1] && strcmp(r->project, values[1]) != 0) continue;
+        if (values[2] && strcmp(r->arch, values[2]) != 0) continue;
+        if (values[3] && !artifact_index_has_source(r, values[3])) continue;
+        if (values[4] && strcmp(r->tag, values[4]) != 0) continue;
+        // Without a tier, only the binaries that can be fetched
+        if (values[5] ? (tier != -2 && r->tier != tier) : r->tier == ARTIFACT_TIER_REMOVED) continue;
+        char path[MAX_CONFIG_ATTR_LEN * 2];
+        snprintf(path, sizeof(path), "%s/%s/%s", target_dir, artifact_index_tier_name(r->tier), r->name);
+        artifact_index_record_json(&buf, r, "path", path);
+        json_printf(&buf, "\n");
+    }
+    if (buf.data) fwrite(buf.data, 1, buf.len, stdout);
+    json_free(&buf);
+    artifact_index_close(&index, NULL, NULL);
+    return 0;
+}
+
+static int reindex(const char *target_dir, const char *project_name) {
+    char store_dir[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(store_dir, sizeof(store_dir), "%s/%s", target_dir, STORE_DIR_NAME);
+    int lock_fd = store_lock(store_dir, stderr, project_name);
+    if (lock_fd < 0) return 1;
+    artifact_index_t index;
+    int result = artifact_index_open(target_dir, 1, &index);
+    if (result == 0 && !index.imported) result = artifact_index_rescan(&index, stderr, project_name);
+    if (result == 0) fprintf(stderr, "Artifact index of %s: %d artifacts recorded.\n", target_dir, index.count);
+    result |= artifact_index_close(&index, stderr, project_name);
+    store_unlock(lock_fd);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        usage(argv[0]);
+        return argc < 2 ? 2 : 0;
+    }
+    if (strcmp(argv[1], "--stats") == 0) {
+        if (argc != 3) {
+            usage(argv[0]);
+            return 2;
+        }
+        return stats(argv[2]);
+    }
+    if (strcmp(argv[1], "--pack") == 0) {
+        if (argc < 5 || argc > 6) {
+            usage(argv[0]);
+            return 2;
+        }
+        // The rotation of the daemon calls store_pack_tier in-process; this encodes a tier now (e.g. after changing the codec of a project)
+        return store_pack_tier(argv[2], argv[3], argv[4], stdout, argc == 6 ? argv[5] : NULL);
+    }
+    if (strcmp(argv[1], "--latest") == 0) {
+        if (argc < 5 || argc > 6) {
+            usage(argv[0]);
+            return 2;
+        }
+        return latest(argv[2], argv[3], argv[4], argc == 6 ? argv[5] : NULL);
+    }
+    if (strcmp(argv[1], "--find") == 0) {
+        if (argc < 3) {
+            usage(argv[0]);
+            return 2;
+        }
+        return find(argv[2], argc - 3, argv + 3);
+    }
+    if (strcmp(argv[1], "--reindex") == 0) {
+        if (argc < 3 || argc > 4) {
+            usage(argv[0]);
+            return 2;
+        }
+        return reindex(argv[2], argc == 4 ? argv[3] : NULL);
+    }
+    if (argc > 3) {
+        usage(argv[0]);
+        return 2;
+    }
+    return fetch(argv[1], argc == 3 ? argv[2] : NULL);
+}
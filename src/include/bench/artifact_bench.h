@@ -0,0 +1,31 @@
+#ifndef ARTIFACT_BENCH_H
+#define ARTIFACT_BENCH_H
+
+#include <stdio.h>
+#include "types/types.h"
+#include "utils/sha256.h"
+
+#define BENCH_RESULTS_FILE "bench-results"          // Left in <chroot build dir>/logs by bench_binary.sh
+#define BENCH_HISTORY_FILE "benchmarks.log"         // In <main_project_build_dir>/logs, one line per benchmarked binary
+#define BENCH_MIN_DELTA_MS 5.0                      // A time must also grow by this much to be a regression (qemu startup jitter)
+
+#define BENCH_SIZE 0
+#define BENCH_TEXT 1
+#define BENCH_DATA 2
+#define BENCH_BSS 3
+#define BENCH_VERSION_MS 4
+#define BENCH_HELP_MS 5
+#define BENCH_COMMAND_MS 6
+#define BENCH_METRICS 7
+
+typedef struct artifact_bench {
+    char commit[72];                                // Of the main repository ("-" if unknown)
+    char sha256[SHA256_HEX_LEN];                    // Of the binary
+    double metrics[BENCH_METRICS];                  // Bytes or milliseconds, indexed by BENCH_*; -1 when unavailable
+} artifact_bench_t;
+
+int artifact_bench_measure(const char *binary, const char *results_file, const char *commit, artifact_bench_t *bench);
+
+int artifact_bench_record(const project_t *prj, const char *arch, const artifact_bench_t *bench, FILE *log_fp);
+
+#endif // ARTIFACT_BENCH_H
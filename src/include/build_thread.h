@@ -1,6 +1,10 @@
 #ifndef BUILD_THREAD_H
 #define BUILD_THREAD_H
 
+#include "types/types.h"
+
 void *build_thread(void *arg);
 
+void build_status_set(build_status_t *status, int state, const char *phase);
+
 #endif // BUILD_THREAD_H
\ No newline at end of file
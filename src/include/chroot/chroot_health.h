@@ -0,0 +1,22 @@
+#ifndef CHROOT_HEALTH_H
+#define CHROOT_HEALTH_H
+
+#include <stdio.h>
+#include <signal.h>
+
+#define CHROOT_HEALTHY 0
+#define CHROOT_DAMAGED 1    // Some packages are half-installed or have modified/missing critical files: reinstall them
+#define CHROOT_BROKEN 2     // The rootfs structure itself is missing: it must be set up again
+
+int chroot_health_check(const char *chroot_dir, FILE *log_fp, const char *project_name, const char *arch, char ***affected_packages, int *affected_count);
+
+void chroot_health_free_packages(char **affected_packages, int affected_count);
+
+int chroot_health_ensure(const char *arch, const char *chroot_dir, const char *setup_log_file, FILE *log_fp, const char *project_name);
+
+// Shared lock held by each build thread on its chroot, so that the chroot is not moved aside under it (returns the fd to unlock, or -1)
+int chroot_builds_lock(const char *chroot_dir, volatile sig_atomic_t *terminate_flag);
+
+void chroot_builds_unlock(int fd);
+
+#endif // CHROOT_HEALTH_H
@@ -0,0 +1,10 @@
+#ifndef PACKAGE_SERVICE_H
+#define PACKAGE_SERVICE_H
+
+#include <stdio.h>
+#include <signal.h>
+#include "types/types.h"
+
+int package_service_install(char *packages[], const char *chroot_dir, FILE *log_fp, const char *project_name, const char *thread_arch, volatile sig_atomic_t *terminate_flag, const step_context_t *context);
+
+#endif // PACKAGE_SERVICE_H
@@ -0,0 +1,15 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+int session_start(const char *chroot_dir, FILE *log_fp, const char *arch);
+
+int session_stop(const char *chroot_dir, FILE *log_fp, const char *arch);
+
+int session_is_alive(const char *chroot_dir);
+
+pid_t session_server_pid(const char *chroot_dir);
+
+#endif // SESSION_H
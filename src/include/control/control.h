@@ -0,0 +1,36 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stddef.h>
+
+#define CONTROL_SOCKET_PATH "/tmp/rootless_v2ci.sock"
+#define CONTROL_REQUEST_LEN 512             // One command line: "<command> [<project> [<arch>]]"
+#define CONTROL_IO_TIMEOUT_MS 2000          // Longest time a peer may take to send its request, or to read the response once it is ready
+#define CONTROL_RESPONSE_TIMEOUT_MS 60000   // Longest time v2ci_ctl waits for the response
+#define CONTROL_RESPONSE_MAX (1024 * 1024)
+
+// Growable buffer the JSON responses are written to (a failed allocation is remembered and reported by the server)
+typedef struct json_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} json_buf_t;
+
+void json_printf(json_buf_t *buf, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+void json_string(json_buf_t *buf, const char *value);
+
+void json_free(json_buf_t *buf);
+
+int control_listen(const char *path);
+
+int control_accept(int listen_fd);
+
+int control_read_request(int fd, char *request, size_t request_size, size_t *len);
+
+int control_send_response(int fd, const json_buf_t *response, size_t *sent);
+
+int control_request(const char *path, const char *request, json_buf_t *response);
+
+#endif // CONTROL_H
@@ -0,0 +1,13 @@
+#ifndef BINARY_SELECTION_H
+#define BINARY_SELECTION_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types/types.h"
+
+#define BINARY_CANDIDATES_DIR ".v2ci-candidates"    // Executables staged on disk by a tmpfs build (see cross_compiler.sh)
+#define BINARY_BUILD_DIR_FILE ".v2ci-build-dir"      // Name of the build directory used by the last build of the repository
+
+int select_binary(const project_t *prj, const char *arch, const char *repo_dir, const char *repo_name, char *selected, size_t selected_size, FILE *log_fp);
+
+#endif // BINARY_SELECTION_H
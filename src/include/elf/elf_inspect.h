@@ -0,0 +1,35 @@
+#ifndef ELF_INSPECT_H
+#define ELF_INSPECT_H
+
+#define ELF_KIND_OTHER 0            // Relocatable, core, or a shared library
+#define ELF_KIND_EXECUTABLE 1
+
+#define ELF_LINK_DYNAMIC 0          // Has a program interpreter (PT_INTERP)
+#define ELF_LINK_STATIC 1           // ET_EXEC without interpreter
+#define ELF_LINK_STATIC_PIE 2       // ET_DYN without interpreter, flagged DF_1_PIE
+
+// What the ELF headers and program headers of a file say about it
+typedef struct elf_info {
+    int elf_class;                  // 32 or 64
+    int big_endian;
+    int machine;                    // e_machine (EM_*)
+    int kind;                       // One of ELF_KIND_*
+    int linkage;                    // One of ELF_LINK_* (executables only)
+} elf_info_t;
+
+// Sizes of the allocated sections, as "size" reports them (from the PT_LOAD segments when there are no section headers)
+typedef struct elf_sizes {
+    long long text;                 // Read-only: code, constants, relocation and symbol tables loaded at run time
+    long long data;                 // Writable with contents in the file
+    long long bss;                  // Writable, zero-filled at load time
+} elf_sizes_t;
+
+int elf_inspect(const char *path, elf_info_t *info);
+
+int elf_matches_arch(const elf_info_t *info, const char *debian_arch);
+
+const char *elf_linkage_name(int linkage);
+
+int elf_section_sizes(const char *path, elf_sizes_t *sizes);
+
+#endif // ELF_INSPECT_H
@@ -1,3 +1,9 @@
 #include "types/types.h"
 
-int load_config(Config *cfg);
\ No newline at end of file
+int load_config(Config *cfg);
+
+void free_project(project_t *prj);
+
+void free_config_projects(Config *cfg);
+
+int project_config_equal(const project_t *a, const project_t *b);
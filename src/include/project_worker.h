@@ -1,8 +1,47 @@
 #ifndef WORKER_H
 #define WORKER_H
 
+#include <stdio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include "types/types.h"
+#include "utils/pressure.h"
 
-int project_worker(project_t *prj, char *main_build_dir);
+// Step of the running cycle of a project, shown by the control socket
+#define WORKER_STEP_IDLE 0
+#define WORKER_STEP_HEALTH_CHECK 1
+#define WORKER_STEP_UPDATE_CHECK 2
+#define WORKER_STEP_BUILDS 3
+#define WORKER_STEP_RECOVERY 4
 
-#endif // WORKER_H
\ No newline at end of file
+// What a project worker keeps between two cycles (the cycles themselves are scheduled by the supervisor, see supervisor.c)
+typedef struct worker_state {
+    project_t *project;
+    char main_build_dir[MIN_CONFIG_ATTR_LEN];
+    int initialized;                                    // Directories ready
+    pthread_t abandoned_threads[MAX_ARCHITECTURES];     // Build threads that exceeded their time limit (indexed by architecture)
+    thread_arg_t *abandoned_args[MAX_ARCHITECTURES];    // and their arguments, which stay allocated until they end
+    admission_stats_t admission_stats;
+    volatile sig_atomic_t terminate_flag;               // Raised at shutdown, or when the project is removed by a configuration reload
+    struct timespec terminate_received_at;              // Set together with the flag, to measure the shutdown latency
+    int arch_pending[MAX_ARCHITECTURES];                // Architectures not built at the sources of the last update check (see state_journal.c)
+    int arch_forced[MAX_ARCHITECTURES];                 // Built by the next cycle even if already built at its sources (set before the cycle starts)
+    volatile sig_atomic_t arch_cancel[MAX_ARCHITECTURES];   // Terminate flags of the build threads: the project flag cancels them all, these one build
+    build_status_t builds[MAX_ARCHITECTURES];           // Live state of the build of each architecture
+    volatile sig_atomic_t cycle_step;                   // One of WORKER_STEP_*
+} worker_state_t;
+
+int project_worker_init(worker_state_t *ws, FILE *log_fp);
+
+int project_worker_cycle(worker_state_t *ws);
+
+void project_worker_request_stop(worker_state_t *ws);
+
+int project_worker_cancel_build(worker_state_t *ws, const char *arch);
+
+int project_worker_reap_abandoned(worker_state_t *ws);
+
+int project_worker_shutdown(worker_state_t *ws);
+
+#endif // WORKER_H
@@ -0,0 +1,30 @@
+#ifndef ARTIFACT_SERVER_H
+#define ARTIFACT_SERVER_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+#define SERVER_DEFAULT_HOST "127.0.0.1"         // Address of an artifact_server given as a bare port
+#define SERVER_MAX_CONNECTIONS 256              // Further clients get 503 and are closed
+#define SERVER_REQUEST_MAX 8192                 // Request line and headers
+#define SERVER_IDLE_TIMEOUT_S 30                // A connection making no progress this long is closed
+#define SERVER_SENDFILE_CHUNK (1024 * 1024)
+#define SERVER_CHUNKS_PER_TURN 4                // Chunks sent to a connection before the loop serves the others
+#define SERVER_DECODED_CACHE 8                  // Encoded objects kept decoded (in memfds) for the next downloads
+#define SERVER_DECODE_RETRY_AFTER "1"           // Retry-After (s) of the 503 answered while an encoded binary is decoded
+
+// A project whose target dir is served, as /<name>/<tier>/<entry> and /latest/<name>/<arch>
+typedef struct artifact_server_project {
+    char name[64];
+    char target_dir[CONFIG_ATTR_LEN];
+} artifact_server_project_t;
+
+typedef struct artifact_server artifact_server_t;
+
+artifact_server_t *artifact_server_start(const char *address, FILE *log_fp);
+
+int artifact_server_set_projects(artifact_server_t *server, const artifact_server_project_t *projects, int count);
+
+void artifact_server_stop(artifact_server_t *server);
+
+#endif // ARTIFACT_SERVER_H
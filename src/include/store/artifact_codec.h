@@ -0,0 +1,38 @@
+#ifndef ARTIFACT_CODEC_H
+#define ARTIFACT_CODEC_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "store/artifact_store.h"
+
+#define CODEC_ZSTD_SUFFIX ".zst"                // <sha256>.zst: the binary as a zstd frame
+#define CODEC_DELTA_SUFFIX ".vd"                // <sha256>.from-<base sha256>.vd: the binary as a delta against a full object
+#define CODEC_DELTA_BASE_TAG ".from-"
+#define CODEC_KEYFRAME_INTERVAL 8               // Deltas against the same full object before a new one is kept
+#define CODEC_MAX_DELTA_PERCENT 50              // A delta larger than this share of the binary is not worth it: the binary becomes a full object
+#define CODEC_ZSTD_LEVEL 19
+
+typedef struct codec_buf {
+    unsigned char *data;
+    size_t len;
+} codec_buf_t;
+
+void codec_buf_free(codec_buf_t *buf);
+
+int codec_zstd_available(void);
+
+int codec_parse(const char *codec, int *use_delta, int *use_zstd);
+
+int codec_delta_encode(const unsigned char *base, size_t base_len, const unsigned char *target, size_t target_len, codec_buf_t *out);
+
+int codec_delta_apply(const unsigned char *base, size_t base_len, const unsigned char *delta, size_t delta_len, codec_buf_t *out);
+
+int store_load_object(const char *store_dir, const char *object, codec_buf_t *out);
+
+long long store_object_logical_size(const char *store_dir, const char *object);
+
+int store_delta_base_object(const char *store_dir, const char *object, char *base_object, size_t size);
+
+int store_pack_tier(const char *target_dir, const char *tier, const char *codec, FILE *log_fp, const char *project_name);
+
+#endif // ARTIFACT_CODEC_H
@@ -0,0 +1,126 @@
+#ifndef ARTIFACT_INDEX_H
+#define ARTIFACT_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include "types/types.h"
+#include "utils/sha256.h"
+
+#define ARTIFACT_INDEX_LOG ".index.log"             // In the store of the target dir, next to its lock (see artifact_index.c)
+#define ARTIFACT_INDEX_SNAPSHOT ".index.snapshot"
+#define ARTIFACT_INDEX_COMPACT_AFTER 1024           // Lines of the log after which it is folded into the snapshot
+#define ARTIFACT_INDEX_HISTORY_DAYS 400             // Removed artifacts are kept in the index this long
+#define ARTIFACT_OBJECT_LEN 160                     // Longest object name of the store (<sha256>.from-<sha256>.vd)
+#define ARTIFACT_TIER_REMOVED -1
+#define ARTIFACT_TIER_COUNT 4                       // daily, weekly, monthly, yearly (see ROTATION_TIER_* in rotation.h)
+
+// A binary published to a target dir, and where it is now
+typedef struct artifact_record {
+    long long id;
+    char project[MIN_CONFIG_ATTR_LEN];
+    char arch[MIN_CONFIG_ATTR_LEN];
+    char tag[MIN_CONFIG_ATTR_LEN];                  // Release of the main repository ("unstable" without tags)
+    char sha256[SHA256_HEX_LEN];                    // Of the binary
+    char *sources;                                  // "<repo>=<sha>,..." the binary was built from ("" if unknown)
+    long long built_at;
+    long duration_s;                                // Wall time of the build (-1 if unknown)
+    long long size;                                 // Bytes of the binary
+    int tier;                                       // One of ROTATION_TIER_*, or ARTIFACT_TIER_REMOVED
+    char name[NAME_MAX + 1];                        // Entry in the tier dir
+    struct timespec mtime;                          // Of the entry: its age for the rotation
+    char object[ARTIFACT_OBJECT_LEN];               // Object of the store the entry links ("" for a plain file)
+    long long stored;                               // Disk usage of the object (or of the plain file)
+    char base[ARTIFACT_OBJECT_LEN];                 // Keyframe of a delta ("" otherwise)
+    long long base_stored;
+    long long removed_at;
+    char removed_reason[16];                        // expire, thin, evict, replaced or vanished
+    int older;                                      // Neighbours in the age order of its tier (positions in the records, -1: none)
+    int newer;
+} artifact_record_t;
+
+// Open addressing from the hash of a key to a record (the key is checked against the record itself)
+typedef struct artifact_map {
+    uint64_t *hashes;
+    int *records;                                   // -1: free slot, -2: deleted
+    size_t capacity;                                // Power of two
+    size_t used;                                    // Records and deleted slots
+} artifact_map_t;
+
+// Running totals of a tier, kept by the events (see artifact_index.c)
+typedef struct artifact_tier {
+    int oldest;                                     // Ends of the age order of the live entries (positions in the records, -1: empty)
+    int newest;
+    int entries;
+    long long stored;                               // Disk usage, each object (and keyframe) counted once
+} artifact_tier_t;
+
+// References of the live entries to an object of the store, per tier
+typedef struct artifact_object {
+    uint64_t key;                                   // See artifact_index_object_key
+    long long bytes;
+    int refs[ARTIFACT_TIER_COUNT];
+    int used;
+} artifact_object_t;
+
+struct json_buf;
+
+typedef struct artifact_index {
+    char target_dir[MAX_CONFIG_ATTR_LEN];
+    char store_dir[MAX_CONFIG_ATTR_LEN + 16];
+    artifact_record_t *records;                     // In id order
+    int count;
+    int capacity;
+    long long next_id;
+    artifact_map_t by_id;
+    artifact_map_t by_entry;                        // <tier, name> of the live records
+    artifact_map_t latest;                          // <project, arch>: newest live record
+    artifact_map_t by_commit;                       // <project, arch, commit>: newest live record built from it
+    artifact_tier_t tiers[ARTIFACT_TIER_COUNT];
+    artifact_object_t *objects;                     // Open addressing on the object keys
+    size_t object_capacity;                         // Power of two
+    size_t object_used;
+    int writable;                                   // Changes are appended to the log (the caller holds the store lock)
+    int log_fd;
+    int log_lines;
+    int appended;
+    int damaged;                                    // Torn or corrupt lines dropped while loading
+    int imported;                                   // Built by a scan of the tiers: written as a snapshot on close
+    int stale;                                      // The tiers were found to differ from the index (see artifact_index_rescan)
+} artifact_index_t;
+
+const char *artifact_index_tier_name(int tier);
+
+int artifact_index_tier(const char *name);
+
+int artifact_index_open(const char *target_dir, int writable, artifact_index_t *index);
+
+int artifact_index_rescan(artifact_index_t *index, FILE *log_fp, const char *project_name);
+
+int artifact_index_close(artifact_index_t *index, FILE *log_fp, const char *project_name);
+
+artifact_record_t *artifact_index_get(const artifact_index_t *index, long long id);
+
+artifact_record_t *artifact_index_entry(const artifact_index_t *index, int tier, const char *name);
+
+artifact_record_t *artifact_index_latest(const artifact_index_t *index, const char *project, const char *arch, const char *commit);
+
+int artifact_index_has_source(const artifact_record_t *record, const char *commit);
+
+void artifact_index_record_json(struct json_buf *buf, const artifact_record_t *r, const char *location_key, const char *location);
+
+uint64_t artifact_index_object_key(const artifact_record_t *record, int base);
+
+int artifact_index_object_refs(const artifact_index_t *index, const artifact_record_t *record, int base);
+
+int artifact_index_publish(artifact_index_t *index, artifact_record_t *record);
+
+int artifact_index_move(artifact_index_t *index, long long id, int tier);
+
+int artifact_index_encode(artifact_index_t *index, long long id, const char *object, long long stored, const char *base, long long base_stored);
+
+int artifact_index_remove(artifact_index_t *index, long long id, const char *reason);
+
+#endif // ARTIFACT_INDEX_H
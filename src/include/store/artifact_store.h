@@ -0,0 +1,20 @@
+#ifndef ARTIFACT_STORE_H
+#define ARTIFACT_STORE_H
+
+#include <stdio.h>
+#include "types/types.h"
+#include "store/artifact_index.h"
+
+#define STORE_DIR_NAME ".store"                 // Content-addressed store of a target dir (see artifact_store.c)
+#define STORE_LOCK_FILE ".lock"
+#define STORE_BLOB_TMP_PREFIX ".blob."          // Temporary files of the publications and of the codec
+
+int store_lock(const char *store_dir, FILE *log_fp, const char *project_name);
+
+void store_unlock(int lock_fd);
+
+int store_publish(const char *target_dir, const char *binary, const char *tier, const char *name, char sha[SHA256_HEX_LEN], FILE *log_fp, const char *project_name, const char *arch);
+
+int store_publish_artifact(const char *target_dir, const char *binary, artifact_record_t *record, const binaries_limits_for_project_t *limits, FILE *log_fp);
+
+#endif // ARTIFACT_STORE_H
@@ -0,0 +1,61 @@
+#ifndef ROTATION_H
+#define ROTATION_H
+
+#include <stdio.h>
+#include <time.h>
+#include <limits.h>
+#include "types/types.h"
+#include "store/artifact_index.h"
+
+#define ROTATION_TIER_DAILY 0
+#define ROTATION_TIER_WEEKLY 1
+#define ROTATION_TIER_MONTHLY 2
+#define ROTATION_TIER_YEARLY 3
+#define ROTATION_TIER_COUNT ARTIFACT_TIER_COUNT
+
+// Minimum age (in minutes) of the entries moved out of a tier, and of the yearly entries removed
+#define ROTATION_DAY_MINUTES 1440
+#define ROTATION_WEEK_MINUTES 10080
+#define ROTATION_MONTH_MINUTES 43200
+#define ROTATION_YEAR_MINUTES 525600
+
+#define ROTATION_ACTION_MOVE 0          // Oldest entry of a tier, old enough to move to the next one
+#define ROTATION_ACTION_EXPIRE 1        // Yearly entry older than a year
+#define ROTATION_ACTION_THIN 2          // Entry closer to the newest entry of the next tier than the interval of that tier
+#define ROTATION_ACTION_EVICT 3         // Oldest entry of a tier over its memory limit
+
+typedef struct rotation_action {
+    long long id;                       // Artifact of the entry (see artifact_index.h)
+    int type;                           // One of ROTATION_ACTION_*
+    int tier;                           // Tier of the entry
+    int to_tier;                        // Destination of a move (-1 otherwise)
+    char name[NAME_MAX + 1];
+    struct timespec mtime;              // Age of the entry when planned: an entry replaced since then is left alone
+    long long kb;                       // Stored size of the entry (its blob, and the keyframe of a delta)
+} rotation_action_t;
+
+typedef struct rotation_plan {
+    rotation_action_t *actions;         // In execution order
+    int count;
+    int capacity;
+    int entries_before[ROTATION_TIER_COUNT];
+    int entries_after[ROTATION_TIER_COUNT];
+    long long kb_before[ROTATION_TIER_COUNT];
+    long long kb_after[ROTATION_TIER_COUNT];
+} rotation_plan_t;
+
+const char *rotation_tier_name(int tier);
+
+const char *rotation_action_name(int type);
+
+int rotation_plan(const char *target_dir, const binaries_limits_for_project_t *limits, time_t now, rotation_plan_t *plan);
+
+int rotation_execute(const char *target_dir, const binaries_limits_for_project_t *limits, const rotation_plan_t *plan, FILE *log_fp, const char *project_name);
+
+void rotation_plan_free(rotation_plan_t *plan);
+
+int rotation_trim_tier(artifact_index_t *index, int tier, const binaries_limits_for_project_t *limits, FILE *log_fp, const char *project_name);
+
+int rotation_rotate(const char *target_dir, const binaries_limits_for_project_t *limits, FILE *log_fp, const char *project_name);
+
+#endif // ROTATION_H
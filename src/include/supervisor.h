@@ -0,0 +1,9 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int supervisor_run(Config *cfg, char *session_archs[], int session_count, FILE *log_fp);
+
+#endif // SUPERVISOR_H
@@ -0,0 +1,37 @@
+#ifndef TEST_REPORT_H
+#define TEST_REPORT_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+#define TEST_REPORT_FILE "test-report.xml"          // JUnit left in <chroot build dir>/logs by run_tests.sh
+#define TEST_REPORT_MAX_BYTES (64L * 1024 * 1024)
+#define TEST_REPORT_SLOWEST 5                       // Slowest tests logged after each run
+#define TEST_SLOWER_FACTOR 2.0                      // A test this many times slower than in the previous run is reported...
+#define TEST_SLOWER_MIN_S 1.0                       // ...if it takes at least this long
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+#define TEST_SKIPPED 2
+
+typedef struct test_case {
+    char name[256];                                 // <classname>.<name> (just <name> if they are the same)
+    double seconds;
+    int status;                                     // One of TEST_*
+} test_case_t;
+
+typedef struct test_report {
+    test_case_t *cases;
+    int count;
+    int capacity;
+    int failed;
+    int skipped;
+} test_report_t;
+
+int test_report_load(const char *junit_file, test_report_t *report);
+
+int test_report_record(const project_t *prj, const char *arch, const char *junit_file, const test_report_t *report, int passed, double wall_seconds, FILE *log_fp);
+
+void test_report_free(test_report_t *report);
+
+#endif // TEST_REPORT_H
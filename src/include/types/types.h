@@ -1,10 +1,9 @@
 #ifndef TYPES_H
 #define TYPES_H
 
-#define TEST_ENABLED 1                                          // Set to 1 to enable testing, 0 to disable (only for sshlirp)
-
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
 
 #define DEFAULT_CONFIG_PATH "~/.config/v2ci/config.yml"         // Substitute with the actual absolute path of the config file (path/to/config.yml)
 #define SCRIPTS_DIR_PATH "/usr/lib/v2ci/scripts"                // Substitute with the actual absolute path of the scripts directory
@@ -13,7 +12,11 @@
 #define INSTALL_PACKAGES_SCRIPT_PATH SCRIPTS_DIR_PATH "/install_packages_in_chroot.sh"
 #define CLONE_OR_PULL_SCRIPT_PATH SCRIPTS_DIR_PATH "/clone_or_pull_for_project.sh"
 #define BUILD_SCRIPT_PATH SCRIPTS_DIR_PATH "/cross_compiler.sh"
-#define CRONJOB_SCRIPT_PATH SCRIPTS_DIR_PATH "/binaries_rotation_cronjob.sh"
+#define SESSION_SERVER_SCRIPT_PATH SCRIPTS_DIR_PATH "/session_server.sh"
+#define CHROOT_REPAIR_SCRIPT_PATH SCRIPTS_DIR_PATH "/chroot_repair.sh"
+#define PUBLISH_SCRIPT_PATH SCRIPTS_DIR_PATH "/publish_binary.sh"
+#define TEST_SCRIPT_PATH SCRIPTS_DIR_PATH "/run_tests.sh"
+#define BENCH_SCRIPT_PATH SCRIPTS_DIR_PATH "/bench_binary.sh"
 
 #define MAX_ARCHITECTURES 9
 #define MAX_DEPENDENCIES 16
@@ -22,8 +25,60 @@
 #define MAX_CONFIG_ATTR_LEN 512
 #define MAX_COMMAND_LEN 4096
 
+#define MAX_BUILD_PHASES 8
+
 struct project;
 
+// Resources used by all the steps of a build thread in one phase (install, fetch, configure, build, publish)
+typedef struct phase_usage {
+    char phase[16];
+    int steps;                  // Number of steps that went through this phase
+    long wall_ms;
+    long user_ms;
+    long sys_ms;
+    long max_rss_kb;            // Largest max RSS of those steps
+    long read_kb;               // Block I/O
+    long write_kb;
+    long voluntary_switches;    // Context switches of the steps, counted in the phase where each step spent most of its time
+    long involuntary_switches;
+} phase_usage_t;
+
+typedef struct build_usage {
+    phase_usage_t phases[MAX_BUILD_PHASES];
+    int phase_count;
+    long oom_kills;             // Processes killed by the OOM killer in the cgroup of the build (see cgroup.c)
+} build_usage_t;
+
+// Watchdog limits (in seconds, 0 disables the limit) of the phases a build thread goes through (see step_executor.c)
+typedef struct phase_timeouts {
+    int install;        // Installation of the dependency packages
+    int fetch;          // Update check, clone or pull of each repository
+    int configure;      // cmake / meson setup / autoreconf + configure of each repository
+    int build;          // Compilation (and installation, for dependencies) of each repository
+    int publish;        // Selection of the binary and copy to the target directory
+    int inactivity;     // Maximum time a step may run without writing anything to its logs
+} phase_timeouts_t;
+
+// What the steps of a build thread share: the limits of their watchdog, where they account their resources and the cgroup they run in
+typedef struct step_context {
+    const phase_timeouts_t *timeouts;
+    build_usage_t *usage;                               // NULL: the resources are not accounted
+    char cgroup_dir[MAX_CONFIG_ATTR_LEN];               // Empty: the steps stay in the cgroup of the daemon
+} step_context_t;
+
+#define BUILD_STATE_IDLE 0
+#define BUILD_STATE_WAITING 1           // Held back by the admission control (see pressure.c)
+#define BUILD_STATE_RUNNING 2
+
+// Live state of the build of a <project, arch>, read by the control socket (see supervisor.c) while the build thread updates it
+typedef struct build_status {
+    pthread_mutex_t lock;
+    int state;                          // One of BUILD_STATE_*
+    char phase[16];                     // install, fetch or build (the build script reports configure/build/publish in its phase file)
+    time_t started_at;
+    time_t phase_started_at;
+} build_status_t;
+
 typedef struct thread_arg {
     struct project *project;
     char arch[64];
@@ -33,14 +88,26 @@ typedef struct thread_arg {
     char thread_chroot_build_dir[MAX_CONFIG_ATTR_LEN];  // /home/<project.name>/ (absolute w.r.t chroot -> <cfg.build_dir>/<arch-chroot>/home/<project.name>/)
     char thread_chroot_log_file[MAX_CONFIG_ATTR_LEN];   // /home/<project.name>/logs/worker.log (relative to chroot)
     char thread_chroot_target_dir[MAX_CONFIG_ATTR_LEN]; // /home/<project.name>/binaries (relative to chroot)
+    char thread_cross_mode[MIN_CONFIG_ATTR_LEN];        // "emulated" (build in the target chroot under qemu) or "native" (cross toolchain in the amd64 chroot)
+    char thread_host_chroot_dir[MAX_CONFIG_ATTR_LEN];   // /<cfg.build_dir>/amd64-chroot/ (used as build root in native mode)
+    char thread_jobs[16];                               // Parallel jobs of the build (-j), set by the admission control; empty: one per CPU
 
-    volatile sig_atomic_t *terminate_flag;
+    volatile sig_atomic_t *terminate_flag;              // Raised when the project stops, or when this build alone is cancelled
+    build_status_t *status;
+    step_context_t context;                             // Limits, resource accounting (the usage of its result) and cgroup of the steps of the thread
 } thread_arg_t;
 
+#define THREAD_STATUS_SUCCESS 0
+#define THREAD_STATUS_FAILED 1
+#define THREAD_STATUS_TIMEOUT 2         // A step was killed by the build watchdog, or the thread itself did not finish in time
+#define THREAD_STATUS_OOM 3             // The build failed after the OOM killer killed processes in its cgroup (see usage.oom_kills)
+#define THREAD_STATUS_CANCELLED 4       // Cancelled from the control socket (v2ci_ctl cancel)
+#define THREAD_STATUS_SESSION_LOST 5    // The persistent session of the chroot died under a step: not a failure of the build, which is retried
+
 typedef struct thread_result {
-    int status;
+    int status;                         // One of THREAD_STATUS_*
     char *error_message;
-    char *stats;
+    build_usage_t usage;                // Per-phase resources of all the steps run by the thread
 } thread_result_t;
 
 typedef struct manual_dependency {
@@ -61,20 +128,80 @@ typedef struct binaries_limits_for_project {
     int weekly_interval;
     int monthly_interval;
     int yearly_interval;
+
+    char codec[MIN_CONFIG_ATTR_LEN];        // Storage codec of the weekly, monthly and yearly binaries: "none", "delta", "zstd" or "delta+zstd" (see artifact_codec.c)
 } binaries_limits_for_project_t;
 
+// cgroup v2 limits of the builds of a project (values are written as they are, e.g. "max" or "4G"; empty leaves the default)
+typedef struct cgroup_limits {
+    char enabled[MIN_CONFIG_ATTR_LEN];  // "yes" to run every <project, arch> build in its own cgroup under the delegated user slice
+    char cpu_weight[32];
+    char memory_high[32];
+    char memory_max[32];
+    char pids_max[32];
+} cgroup_limits_t;
+
+// Pressure-aware admission of the build threads: thresholds on the "some avg10" share of /proc/pressure/{cpu,memory,io} (percent, 0 ignores a resource)
+typedef struct admission {
+    int cpu;
+    int memory;
+    int io;
+    int check_interval;                 // Seconds between two checks while a build is held back
+    int max_wait;                       // Seconds after which a held build is started anyway (with -j1), 0 to wait as long as needed
+} admission_t;
+
+// Which of the executables found in the build directories of the main repository is published (see binary_selection.c)
+typedef struct binary_selection {
+    char name[MIN_CONFIG_ATTR_LEN];     // Explicit file name or glob (a pattern with "/" is matched against the path in the build tree); empty: prefer the repository name
+    char linkage[32];                   // "prefer-static", "static" (static or static-pie only) or "any"
+} binary_selection_t;
+
+// Test suite of the main repository run after its build; a failure blocks the publication of the binary (see run_tests.sh and test_report.c)
+typedef struct test_config {
+    char enabled[MIN_CONFIG_ATTR_LEN];  // "yes" to run the tests
+    char command[MAX_CONFIG_ATTR_LEN];  // "auto" (ctest, meson test or make check, after the build system) or a shell command run from the repository root
+    int shards;                         // Tests run at a time (parallel instances of a custom command)
+    int time_budget;                    // Seconds the whole suite may take
+} test_config_t;
+
+// Benchmarks of the binary before its publication, compared with those of the previous build (see bench_binary.sh and artifact_bench.c)
+typedef struct bench_config {
+    char enabled[MIN_CONFIG_ATTR_LEN];  // "yes" to run the benchmarks
+    char command[MAX_CONFIG_ATTR_LEN];  // Microbenchmark run from the repository root with $V2CI_BINARY (empty: startup times only)
+    int runs;                           // Runs of --version and --help whose median is kept
+    int threshold;                      // Percent by which a metric may grow before it is reported as a regression
+    int time_budget;                    // Seconds the benchmarks may take
+} bench_config_t;
+
+// Alerts on the phase durations of the successful builds against their recent history (see phase_history.c)
+typedef struct duration_alerts {
+    int window;                         // Builds in the sliding window of the baseline (and of each window of v2ci_ctl report)
+    double slowdown_factor;             // A phase slower than this many times the p50 of its window is reported...
+    int min_seconds;                    // ...if it also took at least this many seconds more
+} duration_alerts_t;
+
 typedef struct project {
     char name[64];
     char main_project_build_dir[CONFIG_ATTR_LEN];       // <cfg.build_dir>/<project.name>
     char worker_log_file[MAX_CONFIG_ATTR_LEN];          // <main_project_build_dir>/logs/worker.log
-    char cronjob_log_file[MAX_CONFIG_ATTR_LEN];         // <main_project_build_dir>/logs/binaries_rotation_cronjob.log
+    char rotation_log_file[MAX_CONFIG_ATTR_LEN];        // <main_project_build_dir>/logs/binaries_rotation.log
     char target_dir[CONFIG_ATTR_LEN];                   // Absolute path got from config file
 
     char repo_url[MAX_CONFIG_ATTR_LEN];
     char main_repo_build_system[CONFIG_ATTR_LEN];
 
     char build_mode[MIN_CONFIG_ATTR_LEN];
+    char cross_mode[MIN_CONFIG_ATTR_LEN];               // "emulated" or "native" (see cross_compiler.sh)
+    char tmpfs_build[MIN_CONFIG_ATTR_LEN];              // "yes" to build in a tmpfs mounted in the chroot namespace, "no" to build on disk
+    int  tmpfs_budget_mb;                               // Size of the tmpfs; builds predicted to exceed it (or the available memory) go to disk
     int  poll_interval;
+    phase_timeouts_t timeouts;
+    cgroup_limits_t cgroup;
+    admission_t admission;
+    binary_selection_t binary;
+    test_config_t test;
+    bench_config_t bench;
+    duration_alerts_t duration_alerts;
 
     char *architectures[MAX_ARCHITECTURES];
     int arch_count;
@@ -93,6 +220,9 @@ typedef struct project {
 typedef struct {
     char build_dir[MIN_CONFIG_ATTR_LEN];
     char main_log_file[CONFIG_ATTR_LEN];
+    char chroot_session[MIN_CONFIG_ATTR_LEN];           // "oneshot" (a fresh _enter for every step) or "persistent" (one long-lived namespace per chroot)
+    int max_active_projects;                            // Projects the supervisor runs a cycle of at the same time (0: no limit)
+    char artifact_server[MIN_CONFIG_ATTR_LEN];          // "<address>:<port>" the read-only artifact server listens on, empty or "off" to disable it
     project_t *projects;
     int project_count;
 } Config;
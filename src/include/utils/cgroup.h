@@ -0,0 +1,12 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types/types.h"
+
+int cgroup_prepare_build(const project_t *prj, const char *arch, char *cgroup_dir, size_t cgroup_dir_size, FILE *log_fp);
+
+long cgroup_oom_kills(const char *cgroup_dir);
+
+#endif // CGROUP_H
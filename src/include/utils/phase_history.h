@@ -0,0 +1,38 @@
+#ifndef PHASE_HISTORY_H
+#define PHASE_HISTORY_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+#define PHASE_HISTORY_FILE "phase_history"          // In <main_project_build_dir>/logs (see phase_history.c)
+#define PHASE_HISTORY_MAX_WINDOW 50
+#define PHASE_HISTORY_MIN_SAMPLES 5                 // Builds of a phase needed before it has a baseline
+#define PHASE_REPORT_DEFAULT_LIMIT 20
+
+// Wall times of a phase of the successful builds of one architecture in one cross mode, oldest first
+typedef struct phase_series {
+    char arch[32];
+    char mode[32];
+    char phase[16];
+    long long last_at;                              // Epoch of the latest sample
+    int count;
+    long wall_ms[2 * PHASE_HISTORY_MAX_WINDOW];     // The current window and the one before it
+} phase_series_t;
+
+typedef struct phase_history {
+    phase_series_t *series;
+    int count;
+    int capacity;
+} phase_history_t;
+
+struct json_buf;
+
+int phase_history_load(const project_t *prj, phase_history_t *history);
+
+void phase_history_free(phase_history_t *history);
+
+int phase_history_record(const project_t *prj, const char *arch, const char *cross_mode, const build_usage_t *usage, FILE *log_fp);
+
+void phase_history_report_json(const project_t *const projects[], int project_count, int limit, struct json_buf *out);
+
+#endif // PHASE_HISTORY_H
@@ -0,0 +1,30 @@
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <signal.h>
+#include "types/types.h"
+
+// "some avg10" share (percent) of each resource in /proc/pressure
+typedef struct pressure_sample {
+    double cpu;
+    double memory;
+    double io;
+} pressure_sample_t;
+
+// Admission decisions of a worker since it started, logged at the end of each cycle to tune the thresholds
+typedef struct admission_stats {
+    long admitted;              // Build threads started right away
+    long delayed;               // Build threads held back until the pressure dropped
+    long forced;                // Build threads started with -j1 after waiting max_wait
+    long throttled;             // Build threads started with fewer jobs than CPUs
+    long wait_s;                // Total time spent holding back build threads
+    long unavailable;           // Build threads started without checking (no PSI support)
+} admission_stats_t;
+
+int pressure_read(pressure_sample_t *sample);
+
+int admit_build(const admission_t *admission, volatile sig_atomic_t *terminate_flag, admission_stats_t *stats, char *jobs, size_t jobs_size, FILE *log_fp, const char *project_name, const char *arch);
+
+#endif // PRESSURE_H
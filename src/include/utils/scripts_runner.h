@@ -1,11 +1,17 @@
 #include <stdio.h>
 #include "types/types.h"
 
+#define SCRIPT_TIMED_OUT 2      // Returned by the steps of a build thread when the watchdog killed the script (see step_executor.c)
+#define SCRIPT_TESTS_FAILED 3   // Returned by build_in_chroot when the test suite of the main repository failed (see run_tests.sh)
+#define SCRIPT_SESSION_LOST 4   // Returned by the steps of a build thread when the persistent session of the chroot died under their script (see session.sh)
+
 int chroot_setup(const char *debian_arch, const char *chroot_dir, const char* main_log_file, FILE *log_fp);
 
-int check_for_updates_inside_chroot(const char *chroot_dir, const char *chroot_build_dir, const char *repo_name, const char *worker_tmp_chroot_log_file, FILE *log_fp, int *need2update, const char *project_name, const char *tmp_arch);
+int check_for_updates_inside_chroot(const char *chroot_dir, const char *chroot_build_dir, const char *repo_name, const char *worker_tmp_chroot_log_file, FILE *log_fp, int *need2update, const char *project_name, const char *tmp_arch, volatile sig_atomic_t *terminate_flag, const phase_timeouts_t *timeouts);
+
+int install_packages_list_in_chroot(char *package[], const char *chroot_dir, FILE *log_fp, const char *thread_log_file, const char *project_name, const char *thread_arch, volatile sig_atomic_t *terminate_flag, step_context_t *context);
 
-int install_packages_list_in_chroot(char *package[], const char *chroot_dir, FILE *log_fp, const char *thread_log_file, const char *project_name, const char *thread_arch);
+int repair_packages_in_chroot(char *packages[], const char *chroot_dir, const char *log_file, FILE *log_fp, const char *project_name, const char *thread_arch);
 
 int clone_or_pull_sources_inside_chroot(thread_arg_t *targ, FILE *log_fp);
 
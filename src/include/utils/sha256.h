@@ -0,0 +1,27 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+#define SHA256_HEX_LEN 65       // 64 hex digits + '\0'
+
+typedef struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t bit_count;
+    uint8_t buffer[64];
+    size_t buffer_len;
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t *ctx);
+
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len);
+
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_LEN], char hex[SHA256_HEX_LEN]);
+
+int sha256_file(const char *path, char hex[SHA256_HEX_LEN]);
+
+#endif // SHA256_H
@@ -0,0 +1,37 @@
+#ifndef STATE_JOURNAL_H
+#define STATE_JOURNAL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types/types.h"
+
+#define STATE_JOURNAL_FILE "state.journal"
+#define JOURNAL_SOURCES_LEN 2048        // "<repo>=<sha>,..." of the main repository and all the manual dependencies
+#define JOURNAL_MAX_ATTEMPTS 2          // Builds of the same sources that failed this many times are not retried until new commits arrive
+
+// Outcome of the latest build of a <project, arch>
+typedef struct journal_entry {
+    long long built_at;
+    char project[MIN_CONFIG_ATTR_LEN];
+    char arch[MIN_CONFIG_ATTR_LEN];
+    int status;                             // One of THREAD_STATUS_*
+    int attempts;                           // Consecutive builds of these sources (with this outcome)
+    char sources[JOURNAL_SOURCES_LEN];      // HEAD of every repository when the build ended
+    char artifact[MAX_CONFIG_ATTR_LEN];     // Published binary, "" if none
+} journal_entry_t;
+
+int state_journal_open(const char *build_dir, FILE *log_fp);
+
+void state_journal_close(void);
+
+int state_journal_lookup(const char *project, const char *arch, journal_entry_t *entry);
+
+int state_journal_record(journal_entry_t *entry, FILE *log_fp);
+
+int state_journal_read_head(const char *repo_dir, char *sha, size_t sha_size);
+
+int state_journal_sources(const project_t *prj, const char *chroot_dir, char *sources, size_t sources_size);
+
+int state_journal_has_source(const journal_entry_t *entry, const char *repo_name, const char *sha);
+
+#endif // STATE_JOURNAL_H
@@ -0,0 +1,66 @@
+#ifndef STEP_EXECUTOR_H
+#define STEP_EXECUTOR_H
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define STEP_CANCEL_GRACE_MS 10000      // Time a cancelled step has to exit after SIGTERM before its whole group gets SIGKILL
+#define STEP_MAX_PHASES 8
+#define STEP_MAX_ACTIVITY_FILES 2
+#define STEP_PHASE_NAME_LEN 16
+
+#define STEP_TIMEOUT_NONE 0
+#define STEP_TIMEOUT_PHASE 1            // The step stayed in one phase longer than the limit of that phase
+#define STEP_TIMEOUT_INACTIVITY 2       // None of the activity files of the step changed for inactivity_ms
+
+typedef struct step_phase_limit {
+    char name[STEP_PHASE_NAME_LEN];
+    long timeout_ms;                    // 0: no limit
+} step_phase_limit_t;
+
+// Resources used by a step while it was in one phase
+typedef struct step_phase_usage {
+    char phase[STEP_PHASE_NAME_LEN];
+    long wall_ms;
+    long user_ms;
+    long sys_ms;
+    long read_kb;               // Read from / written to the storage layer (block I/O)
+    long write_kb;
+} step_phase_usage_t;
+
+// Hang detection for a step: a step that exceeds the limit of its current phase, or whose logs do not change for too long, is cancelled
+typedef struct step_watchdog {
+    step_phase_limit_t phases[STEP_MAX_PHASES];
+    int phase_count;
+    char initial_phase[STEP_PHASE_NAME_LEN];                // Phase of the step until it writes another one to phase_file
+    const char *phase_file;                                 // File where the step writes the name of its current phase (NULL: single phase)
+    const char *activity_files[STEP_MAX_ACTIVITY_FILES];    // Logs the step writes to (NULL entries are ignored)
+    long inactivity_ms;                                     // 0: no inactivity detection
+} step_watchdog_t;
+
+typedef struct step_result {
+    pid_t pid;                  // Also the process group of the step
+    int exit_code;              // Exit code of the step, -1 if it was killed by a signal or could not be started
+    int term_signal;            // Signal that killed the step, 0 if it exited
+    struct rusage usage;        // Resources used by the step and by all its (waited) descendants
+    long wall_ms;
+    int cancelled;              // The terminate flag was raised while the step was running
+    int killed;                 // The step did not exit within the grace period and was killed
+    long cancel_ms;             // Time between the cancellation and the exit of the step (shutdown latency)
+    int timed_out;              // One of STEP_TIMEOUT_*: the step was cancelled by its watchdog
+    char phase[STEP_PHASE_NAME_LEN];    // Phase the step was in when it ended
+    long phase_ms;              // Time spent in that phase
+    step_phase_usage_t phases[STEP_MAX_PHASES];     // Phases in the order the step went through them (the last one absorbs any overflow)
+    int phase_count;
+} step_result_t;
+
+int run_step(char *const argv[], const char *cgroup_dir, volatile sig_atomic_t *terminate_flag, const step_watchdog_t *watchdog, step_result_t *result);
+
+int step_watchdog_add_phase(step_watchdog_t *watchdog, const char *name, int timeout_s);
+
+long step_user_ms(const step_result_t *result);
+
+long step_sys_ms(const step_result_t *result);
+
+#endif // STEP_EXECUTOR_H
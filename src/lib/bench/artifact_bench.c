@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "bench/artifact_bench.h"
+#include "elf/elf_inspect.h"
+#include "store/artifact_index.h"
+#include "utils/utils.h"
+
+/*
+    Benchmarks of the published binaries.
+    Before its publication the binary of a build is measured: its size and the sizes of its text, data and bss (read from its ELF
+    sections on the host, see elf_inspect.c), and the times left by bench_binary.sh, which runs it in the chroot of the architecture
+    (startup time of --version and --help under qemu, or natively for amd64, and the optional microbenchmark command of the project).
+    Each binary gets a line in <main_project_build_dir>/logs/benchmarks.log:
+        <epoch> <arch> <commit> <sha256> <size> <text> <data> <bss> <version_ms> <help_ms> <bench_ms> <regressions>
+    so that the results stay available per commit of the main repository. The baseline of the comparison is the previous tiered
+    build, i.e. the newest live binary of <project, arch> in the artifact index (whatever tier the rotation moved it to), whose line is
+    found by its sha256. A metric that grew by more than the threshold of the project (and, for a time, by at least BENCH_MIN_DELTA_MS)
+    is a regression: it is reported in the worker log and listed in the last field of the line ("-" for none). The binary is published
+    anyway; a regression is a signal for the maintainers, not a failure of the build.
+*/
+
+typedef struct bench_metric {
+    const char *name;
+    const char *unit;
+    int is_time;
+} bench_metric_t;
+
+static const bench_metric_t bench_metrics[BENCH_METRICS] = {
+    { "size", "bytes", 0 },
+    { "text", "bytes", 0 },
+    { "data", "bytes", 0 },
+    { "bss", "bytes", 0 },
+    { "version_ms", "ms", 1 },
+    { "help_ms", "ms", 1 },
+    { "bench_ms", "ms", 1 },
+};
+
+// Measures the binary (on the host) and reads the times measured in the chroot from results_file; returns 0 if at least the binary
+// could be measured
+int artifact_bench_measure(const char *binary, const char *results_file, const char *commit, artifact_bench_t *bench) {
+    memset(bench, 0, sizeof(*bench));
+    for (int i = 0; i < BENCH_METRICS; i++) bench->metrics[i] = -1;
+    snprintf(bench->commit, sizeof(bench->commit), "%s", commit && commit[0] ? commit : "-");
+    struct stat st;
+    if (stat(binary, &st) != 0 || sha256_file(binary, bench->sha256) != 0) return 1;
+    bench->metrics[BENCH_SIZE] = (double)st.st_size;
+    elf_sizes_t sizes;
+    if (elf_section_sizes(binary, &sizes) == 0) {
+        bench->metrics[BENCH_TEXT] = (double)sizes.text;
+        bench->metrics[BENCH_DATA] = (double)sizes.data;
+        bench->metrics[BENCH_BSS] = (double)sizes.bss;
+    }
+    FILE *fp = results_file ? fopen(results_file, "r") : NULL;
+    if (!fp) return 0;
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+        char name[32];
+        double value;
+        if (sscanf(line, "%31s %lf", name, &value) != 2) continue;
+        for (int i = BENCH_VERSION_MS; i < BENCH_METRICS; i++) {
+            if (strcmp(name, bench_metrics[i].name) == 0) bench->metrics[i] = value;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Finds the latest line of history_file for arch and the given binary; returns 0 if there is one
+static int find_bench(const char *history_file, const char *arch, const char *sha256, artifact_bench_t *found) {
+    FILE *fp = fopen(history_file, "r");
+    if (!fp) return 1;
+    char line[512];
+    int result = 1;
+    while (fgets(line, sizeof(line), fp)) {
+        long long epoch;
+        char line_arch[64], commit[72], sha[SHA256_HEX_LEN];
+        double m[BENCH_METRICS];
+        if (sscanf(line, "%lld %63s %71s %64s %lf %lf %lf %lf %lf %lf %lf", &epoch, line_arch, commit, sha, &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &m[6]) != 11 ||
+            strcmp(line_arch, arch) != 0 || strcmp(sha, sha256) != 0) {
+            continue;
+        }
+        snprintf(found->commit, sizeof(found->commit), "%s", commit);
+        snprintf(found->sha256, sizeof(found->sha256), "%s", sha);
+        memcpy(found->metrics, m, sizeof(m));
+        result = 0;
+    }
+    fclose(fp);
+    return result;
+}
+
+// Records the benchmarks of a binary of prj for arch and compares them with those of the previous tiered build (see the comment at
+// the top); returns 0 if they were recorded
+int artifact_bench_record(const project_t *prj, const char *arch, const artifact_bench_t *bench, FILE *log_fp) {
+    char history_file[CONFIG_ATTR_LEN + 32];
+    snprintf(history_file, sizeof(history_file), "%s/logs/%s", prj->main_project_build_dir, BENCH_HISTORY_FILE);
+
+    // Baseline: the newest live binary of the index, found in the history by its sha256
+    artifact_bench_t previous;
+    int has_previous = 0;
+    char previous_name[NAME_MAX + 16] = "";
+    artifact_index_t index;
+    if (artifact_index_open(prj->target_dir, 0, &index) == 0) {
+        const artifact_record_t *r = artifact_index_latest(&index, prj->name, arch, NULL);
+        if (r) {
+            snprintf(previous_name, sizeof(previous_name), "%s/%s", artifact_index_tier_name(r->tier), r->name);
+            has_previous = find_bench(history_file, arch, r->sha256, &previous) == 0;
+        }
+    }
+    artifact_index_close(&index, NULL, NULL);
+
+    char regressions[128] = "";
+    for (int i = 0; i < BENCH_METRICS && has_previous; i++) {
+        double now = bench->metrics[i], before = previous.metrics[i];
+        if (now < 0 || before <= 0 || now <= before * (1 + prj->bench.threshold / 100.0)) continue;
+        if (bench_metrics[i].is_time && now - before < BENCH_MIN_DELTA_MS) continue;
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Benchmark regression of %s: %.*f -> %.*f %s (+%.1f%%, threshold %d%%) against the previous build %s (commit %.12s).",
+            bench_metrics[i].name, bench_metrics[i].is_time, before, bench_metrics[i].is_time, now, bench_metrics[i].unit, (now / before - 1) * 100, prj->bench.threshold, previous_name, previous.commit);
+        size_t used = strlen(regressions);
+        snprintf(regressions + used, sizeof(regressions) - used, "%s%s", used ? "," : "", bench_metrics[i].name);
+    }
+    if (has_previous && !regressions[0]) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Benchmarks within %d%% of the previous build %s: size %.0f (was %.0f) bytes, --version %.1f (was %.1f) ms, --help %.1f (was %.1f) ms.",
+            prj->bench.threshold, previous_name, bench->metrics[BENCH_SIZE], previous.metrics[BENCH_SIZE], bench->metrics[BENCH_VERSION_MS], previous.metrics[BENCH_VERSION_MS],
+            bench->metrics[BENCH_HELP_MS], previous.metrics[BENCH_HELP_MS]);
+    } else if (!has_previous) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Benchmarks: size %.0f bytes (text %.0f, data %.0f, bss %.0f), --version %.1f ms, --help %.1f ms%s (no benchmarks of a previous build to compare with).",
+            bench->metrics[BENCH_SIZE], bench->metrics[BENCH_TEXT], bench->metrics[BENCH_DATA], bench->metrics[BENCH_BSS], bench->metrics[BENCH_VERSION_MS], bench->metrics[BENCH_HELP_MS],
+            bench->metrics[BENCH_COMMAND_MS] >= 0 ? ", microbenchmark measured" : "");
+    }
+
+    // O_APPEND keeps the lines of concurrent threads whole
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%lld %s %s %s %.0f %.0f %.0f %.0f %.2f %.2f %.2f %s\n", (long long)time(NULL), arch, bench->commit, bench->sha256,
+        bench->metrics[BENCH_SIZE], bench->metrics[BENCH_TEXT], bench->metrics[BENCH_DATA], bench->metrics[BENCH_BSS], bench->metrics[BENCH_VERSION_MS],
+        bench->metrics[BENCH_HELP_MS], bench->metrics[BENCH_COMMAND_MS], regressions[0] ? regressions : "-");
+    int fd = open(history_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0 || write(fd, line, len) != len) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to record the benchmarks in %s: %s", history_file, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,623 @@
+#define _GNU_SOURCE     // nftw
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "chroot/chroot_health.h"
+#include "chroot/session.h"
+#include "utils/sha256.h"
+#include "utils/scripts_runner.h"
+#include "utils/utils.h"
+
+/*
+    Chroot health subsystem.
+    A chroot used to be considered healthy as soon as <chroot_dir>/home existed, so a half-broken rootfs was only noticed when a build failed and
+    could not be repaired (chroot_setup skips existing rootfs). Here every chroot gets a manifest (<chroot_dir>/.v2ci/manifest) with the sha256,
+    size and mtime of the files of a set of critical packages, their versions, and the sha256 of the dpkg status file it was taken from. The
+    check run before each cycle:
+    - verifies the rootfs structure (home, _enter, fakeroot state, dpkg status); if it is missing the chroot is broken;
+    - lists the packages dpkg left in an intermediate state (half-installed, unpacked, triggers pending...);
+    - verifies the critical files: stat first, hash only when size or mtime changed. If the dpkg status changed since the manifest (packages
+      were installed or upgraded), the files of the critical packages whose version changed are skipped, and once all the others are
+      verified the manifest is updated: only the files of the changed packages are hashed again.
+    Damaged packages are reinstalled (chroot_repair.sh) under the chroot lock; only a chroot that cannot be repaired is moved aside and set up again.
+    A chroot is only moved aside once the builds of its arch (of every project) drained: each build thread holds <chroot_dir>.builds.lock shared
+    while it runs, and the reset takes it exclusively. The last CHROOT_BROKEN_KEPT moved-aside rootfs are kept for inspection, the older ones
+    are deleted.
+*/
+
+#define MANIFEST_PATH ".v2ci/manifest"
+#define MANIFEST_HEADER "v2ci-manifest 2"
+#define BUILDS_LOCK_SUFFIX ".builds.lock"
+#define CHROOT_BROKEN_KEPT 2
+#define CHROOT_DRAIN_TIMEOUT_S 1800     // Longest wait for the builds of an arch to drain before its chroot is moved aside
+#define DPKG_STATUS_PATH "var/lib/dpkg/status"
+#define DPKG_INFO_DIR "var/lib/dpkg/info"
+
+// Packages whose files must be intact for the chroot to be able to enter, install packages and compile (patterns for fnmatch)
+static const char *critical_packages[] = {
+    "base-files", "bash", "coreutils", "dpkg", "apt", "libapt-pkg*", "libc6", "libc-bin", "libc6-dev", "libgcc-s1", "libstdc++6",
+    "gcc", "gcc-[0-9]*", "cpp-[0-9]*", "binutils*", "make", "fakeroot", "libfakeroot", "git", "curl"
+};
+
+typedef struct dpkg_package {
+    char name[128];
+    char arch[32];
+    char version[128];
+    int installed;          // Status "install ok installed" (or hold)
+    int half_state;         // Left by dpkg in an intermediate state
+    int multiarch_same;     // Its info files are named <name>:<arch>.*
+} dpkg_package_t;
+
+typedef struct package_names {
+    char **names;
+    int count;
+    int capacity;
+} package_names_t;
+
+typedef struct manifest_entry {
+    char hash[SHA256_HEX_LEN];
+    long long size;
+    long long mtime;
+    char package[128];
+    char *path;
+} manifest_entry_t;
+
+typedef struct manifest {
+    char status_hash[SHA256_HEX_LEN];
+    package_names_t versions;       // "<package> <version>" of the critical packages it was taken from
+    manifest_entry_t *entries;
+    int count;
+    int capacity;
+} manifest_t;
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+static int package_names_add(package_names_t *set, const char *name) {
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->names[i], name) == 0) return 0;
+    }
+    if (set->count == set->capacity) {
+        int new_capacity = set->capacity ? set->capacity * 2 : 16;
+        char **new_names = realloc(set->names, new_capacity * sizeof(char *));
+        if (!new_names) return 1;
+        set->names = new_names;
+        set->capacity = new_capacity;
+    }
+    set->names[set->count] = strdup(name);
+    if (!set->names[set->count]) return 1;
+    set->count++;
+    return 0;
+}
+
+static int package_names_contains(const package_names_t *set, const char *name) {
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->names[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+static int is_critical_package(const char *name) {
+    for (size_t i = 0; i < sizeof(critical_packages) / sizeof(critical_packages[0]); i++) {
+        if (fnmatch(critical_packages[i], name, 0) == 0) return 1;
+    }
+    return 0;
+}
+
+static void finish_stanza(dpkg_package_t *cur, const char *status, dpkg_package_t **packages, int *count, int *capacity) {
+    if (cur->name[0] == '\0') return;
+    char want[32] = "", flag[32] = "", state[32] = "";
+    sscanf(status, "%31s %31s %31s", want, flag, state);
+    cur->installed = strcmp(state, "installed") == 0 && strcmp(flag, "ok") == 0;
+    cur->half_state = strcmp(flag, "reinstreq") == 0 || !(strcmp(state, "installed") == 0 || strcmp(state, "not-installed") == 0 || strcmp(state, "config-files") == 0);
+    if (*count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 512;
+        dpkg_package_t *new_packages = realloc(*packages, new_capacity * sizeof(dpkg_package_t));
+        if (!new_packages) return;
+        *packages = new_packages;
+        *capacity = new_capacity;
+    }
+    (*packages)[(*count)++] = *cur;
+}
+
+// Parse the dpkg status file of the chroot; returns the number of packages or -1
+static int read_dpkg_status(const char *chroot_dir, dpkg_package_t **packages) {
+    char status_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(status_path, sizeof(status_path), "%s/" DPKG_STATUS_PATH, chroot_dir);
+    FILE *fp = fopen(status_path, "r");
+    if (!fp) return -1;
+
+    *packages = NULL;
+    int count = 0, capacity = 0;
+    dpkg_package_t cur;
+    memset(&cur, 0, sizeof(cur));
+    char status[128] = "";
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') {
+            finish_stanza(&cur, status, packages, &count, &capacity);
+            memset(&cur, 0, sizeof(cur));
+            status[0] = '\0';
+        } else if (strncmp(line, "Package: ", 9) == 0) {
+            snprintf(cur.name, sizeof(cur.name), "%s", line + 9);
+        } else if (strncmp(line, "Status: ", 8) == 0) {
+            snprintf(status, sizeof(status), "%s", line + 8);
+        } else if (strncmp(line, "Architecture: ", 14) == 0) {
+            snprintf(cur.arch, sizeof(cur.arch), "%s", line + 14);
+        } else if (strncmp(line, "Version: ", 9) == 0) {
+            snprintf(cur.version, sizeof(cur.version), "%s", line + 9);
+        } else if (strncmp(line, "Multi-Arch: same", 16) == 0) {
+            cur.multiarch_same = 1;
+        }
+    }
+    finish_stanza(&cur, status, packages, &count, &capacity);
+    fclose(fp);
+    return count;
+}
+
+static void free_manifest(manifest_t *manifest) {
+    chroot_health_free_packages(manifest->versions.names, manifest->versions.count);
+    for (int i = 0; i < manifest->count; i++) {
+        free(manifest->entries[i].path);
+    }
+    free(manifest->entries);
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+// Load the manifest of the chroot; returns 0 if loaded, 1 if it must be taken from scratch (missing, unreadable, old format)
+static int load_manifest(const char *chroot_dir, manifest_t *manifest) {
+    memset(manifest, 0, sizeof(*manifest));
+    char manifest_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/" MANIFEST_PATH, chroot_dir);
+    FILE *fp = fopen(manifest_path, "r");
+    if (!fp) return 1;
+    char line[PATH_MAX + 256];
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, MANIFEST_HEADER, strlen(MANIFEST_HEADER)) != 0 ||
+        !fgets(line, sizeof(line), fp) || sscanf(line, "status %64s", manifest->status_hash) != 1) {
+        fclose(fp);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "version ", 8) == 0) {
+            if (package_names_add(&manifest->versions, line + 8) != 0) break;
+            continue;
+        }
+        manifest_entry_t entry;
+        int path_offset = 0;
+        if (sscanf(line, "%64s %lld %lld %127s %n", entry.hash, &entry.size, &entry.mtime, entry.package, &path_offset) != 4 || path_offset == 0) continue;
+        if (manifest->count == manifest->capacity) {
+            int new_capacity = manifest->capacity ? manifest->capacity * 2 : 1024;
+            manifest_entry_t *new_entries = realloc(manifest->entries, new_capacity * sizeof(manifest_entry_t));
+            if (!new_entries) break;
+            manifest->entries = new_entries;
+            manifest->capacity = new_capacity;
+        }
+        entry.path = strdup(line + path_offset);
+        if (!entry.path) break;
+        manifest->entries[manifest->count++] = entry;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Version of a package in the manifest, or NULL if it was not critical (or not installed) when the manifest was taken
+static const char *manifest_version(const manifest_t *manifest, const char *package) {
+    size_t len = strlen(package);
+    for (int i = 0; i < manifest->versions.count; i++) {
+        if (strncmp(manifest->versions.names[i], package, len) == 0 && manifest->versions.names[i][len] == ' ') return manifest->versions.names[i] + len + 1;
+    }
+    return NULL;
+}
+
+// List the critical packages installed, upgraded or removed since the manifest was taken
+static void list_changed_packages(const manifest_t *manifest, const dpkg_package_t *packages, int package_count, package_names_t *changed) {
+    for (int i = 0; i < package_count; i++) {
+        if (!packages[i].installed || !is_critical_package(packages[i].name)) continue;
+        const char *version = manifest_version(manifest, packages[i].name);
+        if (!version || strcmp(version, packages[i].version) != 0) package_names_add(changed, packages[i].name);
+    }
+    for (int i = 0; i < manifest->versions.count; i++) {
+        char name[128];
+        if (sscanf(manifest->versions.names[i], "%127s", name) != 1) continue;
+        int still_installed = 0;
+        for (int k = 0; k < package_count && !still_installed; k++) {
+            still_installed = packages[k].installed && strcmp(packages[k].name, name) == 0;
+        }
+        if (!still_installed) package_names_add(changed, name);
+    }
+}
+
+// Verify the critical files against the manifest, except those of the skipped packages; the entries of the files whose content is intact
+// but whose size or mtime changed are updated in memory
+static void verify_manifest(const char *chroot_dir, manifest_t *manifest, const package_names_t *skipped, package_names_t *affected, int *file_count, int *rehashed_count) {
+    for (int i = 0; i < manifest->count; i++) {
+        manifest_entry_t *entry = &manifest->entries[i];
+        if (package_names_contains(skipped, entry->package)) continue;
+        char full_path[MAX_CONFIG_ATTR_LEN + PATH_MAX];
+        snprintf(full_path, sizeof(full_path), "%s%s", chroot_dir, entry->path);
+        (*file_count)++;
+
+        struct stat st;
+        if (lstat(full_path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            package_names_add(affected, entry->package);
+            continue;
+        }
+        if ((long long)st.st_size == entry->size && (long long)st.st_mtime == entry->mtime) {
+            continue;
+        }
+        char current_hash[SHA256_HEX_LEN];
+        (*rehashed_count)++;
+        if (sha256_file(full_path, current_hash) != 0 || strcmp(current_hash, entry->hash) != 0) {
+            package_names_add(affected, entry->package);
+        } else {
+            entry->size = (long long)st.st_size;
+            entry->mtime = (long long)st.st_mtime;
+        }
+    }
+}
+
+// Write the manifest of the critical files (atomically, concurrent workers may write it at the same time): the entries of the packages
+// that did not change are taken from the verified previous manifest, the files of the others (or of all, without one) are hashed
+static int write_manifest(const char *chroot_dir, const char *status_hash, const dpkg_package_t *packages, int package_count, const manifest_t *previous, const package_names_t *changed, int *file_count, int *hashed_count) {
+    char manifest_path[MAX_CONFIG_ATTR_LEN * 2];
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 2 + 32];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/" MANIFEST_PATH, chroot_dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", manifest_path, (int)getpid());
+    if (recursive_mkdir_or_file(manifest_path, 0755, 1) != 0) return 1;
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) return 1;
+    fprintf(out, MANIFEST_HEADER "\nstatus %s\n", status_hash);
+    for (int i = 0; i < package_count; i++) {
+        if (packages[i].installed && is_critical_package(packages[i].name)) fprintf(out, "version %s %s\n", packages[i].name, packages[i].version[0] ? packages[i].version : "-");
+    }
+
+    *file_count = 0;
+    *hashed_count = 0;
+    for (int i = 0; i < package_count; i++) {
+        if (!packages[i].installed || !is_critical_package(packages[i].name)) continue;
+        if (previous && !package_names_contains(changed, packages[i].name)) {
+            for (int k = 0; k < previous->count; k++) {
+                const manifest_entry_t *entry = &previous->entries[k];
+                if (strcmp(entry->package, packages[i].name) != 0) continue;
+                fprintf(out, "%s %lld %lld %s %s\n", entry->hash, entry->size, entry->mtime, entry->package, entry->path);
+                (*file_count)++;
+            }
+            continue;
+        }
+        char list_path[MAX_CONFIG_ATTR_LEN * 2 + 256];
+        snprintf(list_path, sizeof(list_path), "%s/" DPKG_INFO_DIR "/%s.list", chroot_dir, packages[i].name);
+        FILE *list_fp = fopen(list_path, "r");
+        if (!list_fp && packages[i].multiarch_same) {
+            snprintf(list_path, sizeof(list_path), "%s/" DPKG_INFO_DIR "/%s:%s.list", chroot_dir, packages[i].name, packages[i].arch);
+            list_fp = fopen(list_path, "r");
+        }
+        if (!list_fp) continue;
+        char path[PATH_MAX];
+        while (fgets(path, sizeof(path), list_fp)) {
+            path[strcspn(path, "\n")] = '\0';
+            char full_path[MAX_CONFIG_ATTR_LEN + PATH_MAX];
+            snprintf(full_path, sizeof(full_path), "%s%s", chroot_dir, path);
+            struct stat st;
+            char hash[SHA256_HEX_LEN];
+            // Only regular files are hashed (directories and symlinks are shared or resolved through other packages)
+            if (lstat(full_path, &st) != 0 || !S_ISREG(st.st_mode) || sha256_file(full_path, hash) != 0) continue;
+            fprintf(out, "%s %lld %lld %s %s\n", hash, (long long)st.st_size, (long long)st.st_mtime, packages[i].name, path);
+            (*file_count)++;
+            (*hashed_count)++;
+        }
+        fclose(list_fp);
+    }
+
+    if (fclose(out) != 0 || rename(tmp_path, manifest_path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+void chroot_health_free_packages(char **affected_packages, int affected_count) {
+    for (int i = 0; i < affected_count; i++) {
+        free(affected_packages[i]);
+    }
+    free(affected_packages);
+}
+
+int chroot_health_check(const char *chroot_dir, FILE *log_fp, const char *project_name, const char *arch, char ***affected_packages, int *affected_count) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *affected_packages = NULL;
+    *affected_count = 0;
+
+    // 1. Structure of the rootfs: without these the chroot cannot even be entered to repair it
+    const char *required_paths[] = { "home", "_enter", ".fakeroot.env", DPKG_STATUS_PATH };
+    for (size_t i = 0; i < sizeof(required_paths) / sizeof(required_paths[0]); i++) {
+        char path[MAX_CONFIG_ATTR_LEN * 2];
+        snprintf(path, sizeof(path), "%s/%s", chroot_dir, required_paths[i]);
+        if (access(path, F_OK) != 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "[Health] %s is broken: %s is missing (checked in %ld ms).", chroot_dir, required_paths[i], elapsed_ms(&start));
+            return CHROOT_BROKEN;
+        }
+    }
+
+    // 2. Packages left in an intermediate state by an interrupted dpkg/apt run
+    dpkg_package_t *packages = NULL;
+    int package_count = read_dpkg_status(chroot_dir, &packages);
+    if (package_count <= 0) {
+        free(packages);
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "[Health] %s is broken: unreadable or empty dpkg status (checked in %ld ms).", chroot_dir, elapsed_ms(&start));
+        return CHROOT_BROKEN;
+    }
+    package_names_t affected = { NULL, 0, 0 };
+    for (int i = 0; i < package_count; i++) {
+        if (packages[i].half_state) package_names_add(&affected, packages[i].name);
+    }
+
+    // 3. Critical files against the manifest (updated for the packages that legitimately changed, once the others are verified)
+    char status_path[MAX_CONFIG_ATTR_LEN * 2];
+    char status_hash[SHA256_HEX_LEN] = "";
+    snprintf(status_path, sizeof(status_path), "%s/" DPKG_STATUS_PATH, chroot_dir);
+    sha256_file(status_path, status_hash);
+    int file_count = 0, rehashed_count = 0;
+    manifest_t manifest;
+    int has_manifest = load_manifest(chroot_dir, &manifest) == 0;
+    package_names_t changed = { NULL, 0, 0 };
+    if (has_manifest && strcmp(manifest.status_hash, status_hash) != 0) {
+        list_changed_packages(&manifest, packages, package_count, &changed);
+    }
+    if (has_manifest) {
+        verify_manifest(chroot_dir, &manifest, &changed, &affected, &file_count, &rehashed_count);
+    }
+    if (!has_manifest || strcmp(manifest.status_hash, status_hash) != 0) {
+        // A damaged chroot keeps its manifest: the repair is verified against it
+        if (affected.count == 0) {
+            int hashed_count = 0;
+            if (write_manifest(chroot_dir, status_hash, packages, package_count, has_manifest ? &manifest : NULL, &changed, &file_count, &hashed_count) != 0) {
+                formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "[Health] Unable to write the manifest of %s: %s", chroot_dir, strerror(errno));
+            } else if (has_manifest) {
+                formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "[Health] dpkg status of %s changed: manifest updated for %d changed critical packages (%d files hashed).", chroot_dir, changed.count, hashed_count);
+            } else {
+                formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "[Health] Manifest of %s taken (%d critical files).", chroot_dir, file_count);
+            }
+            rehashed_count += hashed_count;
+        }
+    }
+    chroot_health_free_packages(changed.names, changed.count);
+    free_manifest(&manifest);
+    free(packages);
+
+    long check_ms = elapsed_ms(&start);
+    if (affected.count > 0) {
+        char package_list[CONFIG_ATTR_LEN] = "";
+        for (int i = 0; i < affected.count; i++) {
+            if (strlen(package_list) + strlen(affected.names[i]) + 2 >= sizeof(package_list)) break;
+            if (i > 0) strcat(package_list, " ");
+            strcat(package_list, affected.names[i]);
+        }
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "[Health] %s is damaged: %d packages affected (%s); %d critical files, %d hashed, checked in %ld ms.", chroot_dir, affected.count, package_list, file_count, rehashed_count, check_ms);
+        *affected_packages = affected.names;
+        *affected_count = affected.count;
+        return CHROOT_DAMAGED;
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "[Health] %s is healthy: %d critical files, %d hashed, checked in %ld ms.", chroot_dir, file_count, rehashed_count, check_ms);
+    free(affected.names);
+    return CHROOT_HEALTHY;
+}
+
+static int repair_under_chroot_lock(const char *chroot_dir, char **affected_packages, int affected_count, const char *setup_log_file, FILE *log_fp, const char *project_name, const char *arch) {
+    // The same lock as the package service: no apt run can start in the chroot while it is being repaired
+    char lock_file_path[MAX_CONFIG_ATTR_LEN];
+    snprintf(lock_file_path, sizeof(lock_file_path), "%s/lock", chroot_dir);
+    int lock_fd = open(lock_file_path, O_CREAT | O_RDWR, 0644);
+    if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Unable to lock %s for repair: %s", lock_file_path, strerror(errno));
+        if (lock_fd != -1) close(lock_fd);
+        return 1;
+    }
+    char *packages[affected_count + 1];
+    for (int i = 0; i < affected_count; i++) {
+        packages[i] = affected_packages[i];
+    }
+    packages[affected_count] = NULL;
+    int result = repair_packages_in_chroot(packages, chroot_dir, setup_log_file, log_fp, project_name, arch);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return result;
+}
+
+int chroot_builds_lock(const char *chroot_dir, volatile sig_atomic_t *terminate_flag) {
+    char lock_path[MAX_CONFIG_ATTR_LEN + 16];
+    snprintf(lock_path, sizeof(lock_path), "%s" BUILDS_LOCK_SUFFIX, chroot_dir);
+    int fd = open(lock_path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1) return -1;
+    // Polled, so that a build waiting for a reset of its chroot can still be cancelled
+    while (flock(fd, LOCK_SH | LOCK_NB) == -1) {
+        if ((errno != EWOULDBLOCK && errno != EINTR) || (terminate_flag && *terminate_flag)) {
+            close(fd);
+            return -1;
+        }
+        sleep(1);
+    }
+    return fd;
+}
+
+void chroot_builds_unlock(int fd) {
+    if (fd < 0) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Wait (at most CHROOT_DRAIN_TIMEOUT_S) for the builds of the chroot to end, and keep new ones out; returns the lock fd or -1
+static int drain_builds(const char *chroot_dir, FILE *log_fp, const char *project_name, const char *arch) {
+    char lock_path[MAX_CONFIG_ATTR_LEN + 16];
+    snprintf(lock_path, sizeof(lock_path), "%s" BUILDS_LOCK_SUFFIX, chroot_dir);
+    int fd = open(lock_path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Unable to open %s: %s", lock_path, strerror(errno));
+        return -1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int logged = 0;
+    while (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno != EWOULDBLOCK && errno != EINTR) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Unable to lock %s: %s", lock_path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (elapsed_ms(&start) >= CHROOT_DRAIN_TIMEOUT_S * 1000L) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Builds still running in %s after %d s; not moving it aside.", chroot_dir, CHROOT_DRAIN_TIMEOUT_S);
+            close(fd);
+            return -1;
+        }
+        if (!logged) {
+            formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "[Health] Waiting for the builds running in %s to end before moving it aside...", chroot_dir);
+            logged = 1;
+        }
+        sleep(1);
+    }
+    return fd;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    return (type == FTW_DP ? rmdir(path) : unlink(path)) == 0 ? 0 : -1;
+}
+
+static int make_writable(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type == FTW_D) chmod(path, (st->st_mode & 07777) | S_IRWXU);
+    return 0;
+}
+
+// Delete the moved-aside copies of the chroot but the newest CHROOT_BROKEN_KEPT ones (named <chroot_dir>.broken-<epoch>)
+static void prune_broken_chroots(const char *chroot_dir, FILE *log_fp, const char *project_name, const char *arch) {
+    char parent[MAX_CONFIG_ATTR_LEN];
+    snprintf(parent, sizeof(parent), "%s", chroot_dir);
+    char *slash = strrchr(parent, '/');
+    const char *base = slash ? slash + 1 : parent;
+    char prefix[MAX_CONFIG_ATTR_LEN + 16];
+    snprintf(prefix, sizeof(prefix), "%s.broken-", base);
+    if (slash) *slash = '\0';
+    DIR *dir = opendir(slash ? (parent[0] ? parent : "/") : ".");
+    if (!dir) return;
+    long long stamps[64];
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && count < (int)(sizeof(stamps) / sizeof(stamps[0]))) {
+        char *end;
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0) continue;
+        long long stamp = strtoll(entry->d_name + strlen(prefix), &end, 10);
+        if (*end == '\0' && end != entry->d_name + strlen(prefix)) stamps[count++] = stamp;
+    }
+    closedir(dir);
+    // Newest first
+    for (int i = 1; i < count; i++) {
+        for (int k = i; k > 0 && stamps[k] > stamps[k - 1]; k--) {
+            long long tmp = stamps[k];
+            stamps[k] = stamps[k - 1];
+            stamps[k - 1] = tmp;
+        }
+    }
+    for (int i = CHROOT_BROKEN_KEPT; i < count; i++) {
+        char broken_dir[MAX_CONFIG_ATTR_LEN + 32];
+        snprintf(broken_dir, sizeof(broken_dir), "%s.broken-%lld", chroot_dir, stamps[i]);
+        nftw(broken_dir, make_writable, 16, FTW_PHYS);
+        if (nftw(broken_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "[Health] Unable to delete the old broken chroot %s: %s", broken_dir, strerror(errno));
+        } else {
+            formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "[Health] Deleted the old broken chroot %s (keeping the last %d).", broken_dir, CHROOT_BROKEN_KEPT);
+        }
+    }
+}
+
+// Move the rootfs aside (kept for inspection) and set it up again, unless another worker already did it while this one waited for the lock
+static int reset_chroot(const char *arch, const char *chroot_dir, const char *setup_log_file, FILE *log_fp, const char *project_name) {
+    char **affected_packages = NULL;
+    int affected_count = 0;
+    if (chroot_health_check(chroot_dir, log_fp, project_name, arch, &affected_packages, &affected_count) == CHROOT_HEALTHY) {
+        return 0;
+    }
+    chroot_health_free_packages(affected_packages, affected_count);
+    // The builds of the other projects in the same chroot end first, and the new ones wait for the new rootfs
+    int builds_fd = drain_builds(chroot_dir, log_fp, project_name, arch);
+    if (builds_fd == -1) {
+        return 1;
+    }
+    session_stop(chroot_dir, log_fp, arch);
+    if (access(chroot_dir, F_OK) == 0) {
+        char broken_dir[MAX_CONFIG_ATTR_LEN + 32];
+        snprintf(broken_dir, sizeof(broken_dir), "%s.broken-%lld", chroot_dir, (long long)time(NULL));
+        if (rename(chroot_dir, broken_dir) != 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Unable to move %s to %s: %s", chroot_dir, broken_dir, strerror(errno));
+            chroot_builds_unlock(builds_fd);
+            return 1;
+        }
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "[Health] Moved unrepairable %s to %s; setting it up again.", chroot_dir, broken_dir);
+        prune_broken_chroots(chroot_dir, log_fp, project_name, arch);
+    }
+    int result = chroot_setup(arch, chroot_dir, setup_log_file, log_fp);
+    chroot_builds_unlock(builds_fd);
+    if (result != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Failed to set up %s again.", chroot_dir);
+        return 1;
+    }
+    return 0;
+}
+
+int chroot_health_ensure(const char *arch, const char *chroot_dir, const char *setup_log_file, FILE *log_fp, const char *project_name) {
+    char **affected_packages = NULL;
+    int affected_count = 0;
+    int health = chroot_health_check(chroot_dir, log_fp, project_name, arch, &affected_packages, &affected_count);
+    if (health == CHROOT_HEALTHY) {
+        return 0;
+    }
+
+    // 1. Targeted repair: reinstall the affected packages
+    if (health == CHROOT_DAMAGED) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "[Health] Repairing %s (%d packages)...", chroot_dir, affected_count);
+        int repair_result = repair_under_chroot_lock(chroot_dir, affected_packages, affected_count, setup_log_file, log_fp, project_name, arch);
+        chroot_health_free_packages(affected_packages, affected_count);
+        if (repair_result == 0) {
+            health = chroot_health_check(chroot_dir, log_fp, project_name, arch, &affected_packages, &affected_count);
+            chroot_health_free_packages(affected_packages, affected_count);
+        }
+        if (repair_result == 0 && health == CHROOT_HEALTHY) {
+            formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "[Health] %s repaired in %ld ms.", chroot_dir, elapsed_ms(&start));
+            return 0;
+        }
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Repair of %s failed after %ld ms.", chroot_dir, elapsed_ms(&start));
+    }
+
+    // 2. Last resort: set the chroot up again
+    // The lock lives next to the chroot (not inside it) and serializes the workers sharing it: the ones that waited find it set up again
+    char setup_lock_path[MAX_CONFIG_ATTR_LEN + 16];
+    snprintf(setup_lock_path, sizeof(setup_lock_path), "%s.setup.lock", chroot_dir);
+    int setup_lock_fd = open(setup_lock_path, O_CREAT | O_RDWR, 0644);
+    if (setup_lock_fd == -1 || flock(setup_lock_fd, LOCK_EX) == -1) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "[Health] Unable to lock %s: %s", setup_lock_path, strerror(errno));
+        if (setup_lock_fd != -1) close(setup_lock_fd);
+        return 1;
+    }
+    int result = reset_chroot(arch, chroot_dir, setup_log_file, log_fp, project_name);
+    flock(setup_lock_fd, LOCK_UN);
+    close(setup_lock_fd);
+    return result;
+}
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include "chroot/package_service.h"
+#include "utils/scripts_runner.h"
+#include "utils/utils.h"
+
+/*
+    Per-chroot package manager service.
+    Every build thread (of every project, all of them run in the daemon) that needs APT packages in a chroot submits an install request to
+    the service of that chroot instead of running its own apt pass. The service of a chroot is created by its first request and lives as
+    long as the daemon: a queue of pending requests under a mutex, and one service thread that waits on a condvar for requests, takes all
+    the pending ones, merges their packages into a single apt run and completes them together, waking all their waiters.
+    - A request whose packages are all part of the batch being installed right now is not queued: it joins that run (piggyback) and is
+      served by its outcome.
+    - A waiter that is terminated withdraws its request: a pending one leaves the queue, a running one is left to the service thread to
+      free. A run whose requests were all withdrawn is cancelled.
+    - The run uses the most generous install and inactivity limits of its requests; it runs in the cgroup of the daemon and is not
+      accounted to any build (it serves several of them).
+    - The service thread still takes the <chroot_dir>/lock flock around each run: apt may also be run on the chroot by the health repair
+      (see chroot_health.c) or by hand.
+    The runs are logged in <chroot_dir>/.v2ci/pkgsvc/service.log (the output of apt included) and each served request in stats.log, with
+    its queue time and apt time.
+*/
+
+#define PKG_SERVICE_DIR ".v2ci/pkgsvc"
+#define PKG_SERVICE_LOG "service.log"
+#define PKG_SERVICE_TERMINATE_CHECK_MS 200  // How often a waiter checks its terminate flag
+
+#define PKG_REQUEST_PENDING 0
+#define PKG_REQUEST_RUNNING 1
+#define PKG_REQUEST_DONE 2
+
+typedef struct package_set {
+    char **items;
+    int count;
+    int capacity;
+} package_set_t;
+
+typedef struct package_request {
+    unsigned long id;
+    char project_name[64];
+    package_set_t packages;
+    phase_timeouts_t timeouts;              // Of the requesting build (copied: a reload may free its project meanwhile)
+    long long enqueued_ms;
+    int state;                              // One of PKG_REQUEST_*
+    int withdrawn;                          // Its waiter is gone: the service thread frees it once its run ends
+    int status;
+    unsigned long run;
+    long long queue_ms;
+    long long apt_ms;
+    int batch_requests;
+    int batch_packages;
+    struct package_request *next;
+} package_request_t;
+
+typedef struct package_service {
+    char chroot_dir[MAX_CONFIG_ATTR_LEN];
+    char spool_dir[MAX_CONFIG_ATTR_LEN];
+    FILE *log_fp;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;                  // Signalled to the service thread when a request is queued
+    pthread_cond_t served;                  // Broadcast to the waiters when a run ends
+    package_request_t *pending;
+    package_request_t *running;             // The requests of the current run
+    package_set_t batch;                    // The packages of the current run (empty between runs)
+    int run_active;
+    unsigned long runs;
+    unsigned long requests;
+    volatile sig_atomic_t cancel;           // All the requests of the current run were withdrawn
+    struct package_service *next;
+} package_service_t;
+
+static pthread_mutex_t services_lock = PTHREAD_MUTEX_INITIALIZER;
+static package_service_t *services;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
+static int package_set_contains(const package_set_t *set, const char *pkg) {
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->items[i], pkg) == 0) return 1;
+    }
+    return 0;
+}
+
+static int package_set_add(package_set_t *set, const char *pkg) {
+    if (!pkg || !pkg[0] || package_set_contains(set, pkg)) return 0;
+    // Always keep room for the NULL terminator expected by install_packages_list_in_chroot()
+    if (set->count + 1 >= set->capacity) {
+        int new_capacity = set->capacity ? set->capacity * 2 : 32;
+        char **new_items = realloc(set->items, new_capacity * sizeof(char *));
+        if (!new_items) return 1;
+        set->items = new_items;
+        set->capacity = new_capacity;
+    }
+    set->items[set->count] = strdup(pkg);
+    if (!set->items[set->count]) return 1;
+    set->count++;
+    set->items[set->count] = NULL;
+    return 0;
+}
+
+static int package_set_covers(const package_set_t *set, const package_set_t *subset) {
+    for (int i = 0; i < subset->count; i++) {
+        if (!package_set_contains(set, subset->items[i])) return 0;
+    }
+    return 1;
+}
+
+static void package_set_free(package_set_t *set) {
+    for (int i = 0; i < set->count; i++) free(set->items[i]);
+    free(set->items);
+    set->items = NULL;
+    set->count = 0;
+    set->capacity = 0;
+}
+
+static void free_request(package_request_t *req) {
+    package_set_free(&req->packages);
+    free(req);
+}
+
+// The larger of two limits, where 0 (no limit) is the largest
+static int looser_limit(int a, int b) {
+    return a == 0 || b == 0 ? 0 : a > b ? a : b;
+}
+
+static int lock_chroot(const char *chroot_dir, FILE *log_fp) {
+    char lock_file_path[MAX_CONFIG_ATTR_LEN + 8];
+    snprintf(lock_file_path, sizeof(lock_file_path), "%s/lock", chroot_dir);
+    int fd = open(lock_file_path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to open the lock file %s: %s", lock_file_path, strerror(errno));
+        return -1;
+    }
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to lock %s: %s", lock_file_path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Runs apt once for all the pending requests of the service (lock held on entry and on return, released during the run)
+static void run_batch(package_service_t *svc) {
+    package_request_t *drained = svc->pending;
+    svc->pending = NULL;
+    svc->running = drained;
+    svc->run_active = 1;
+    svc->cancel = 0;
+    unsigned long run = ++svc->runs;
+    int request_count = 0;
+    int merge_failed = 0;
+    phase_timeouts_t timeouts = drained->timeouts;
+    for (package_request_t *req = drained; req; req = req->next) {
+        req->state = PKG_REQUEST_RUNNING;
+        request_count++;
+        for (int i = 0; i < req->packages.count; i++) {
+            if (package_set_add(&svc->batch, req->packages.items[i]) != 0) merge_failed = 1;
+        }
+        timeouts.install = looser_limit(timeouts.install, req->timeouts.install);
+        timeouts.inactivity = looser_limit(timeouts.inactivity, req->timeouts.inactivity);
+    }
+    pthread_mutex_unlock(&svc->lock);
+
+    long long start_ms = now_ms();
+    int status = 1;
+    if (merge_failed) {
+        formatted_log(svc->log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Memory allocation failed while merging the package requests of run %lu.", run);
+    } else {
+        formatted_log(svc->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Package service run %lu: installing %d package(s) for %d coalesced request(s) in %s", run, svc->batch.count, request_count, svc->chroot_dir);
+        int lock_fd = lock_chroot(svc->chroot_dir, svc->log_fp);
+        if (lock_fd >= 0) {
+            if (svc->cancel) {
+                formatted_log(svc->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Package service run %lu cancelled: all its requests were withdrawn.", run);
+            } else {
+                step_context_t context = { .timeouts = &timeouts, .usage = NULL, .cgroup_dir = "" };
+                char *empty_list[] = { NULL };
+                status = install_packages_list_in_chroot(svc->batch.count ? svc->batch.items : empty_list, svc->chroot_dir, svc->log_fp, "/" PKG_SERVICE_DIR "/" PKG_SERVICE_LOG, "N/A", "N/A", &svc->cancel, &context);
+            }
+            flock(lock_fd, LOCK_UN);
+            close(lock_fd);
+        }
+    }
+    long long end_ms = now_ms();
+    formatted_log(svc->log_fp, status == 0 ? "INFO" : "ERROR", __FILE__, __LINE__, NULL, NULL, "Package service run %lu ended with status %d after %lld ms.", run, status, end_ms - start_ms);
+
+    // Complete all the requests of the run together (those that joined it meanwhile included)
+    char stats_path[MAX_CONFIG_ATTR_LEN + 16];
+    snprintf(stats_path, sizeof(stats_path), "%s/stats.log", svc->spool_dir);
+    FILE *stats_fp = fopen(stats_path, "a");
+    pthread_mutex_lock(&svc->lock);
+    request_count = 0;
+    for (package_request_t *req = svc->running; req; req = req->next) request_count++;
+    package_request_t *req = svc->running;
+    while (req) {
+        package_request_t *next = req->next;
+        long long queue_ms = start_ms - req->enqueued_ms;
+        req->queue_ms = queue_ms < 0 ? 0 : queue_ms;
+        req->apt_ms = end_ms - (req->enqueued_ms > start_ms ? req->enqueued_ms : start_ms);
+        if (stats_fp) {
+            fprintf(stats_fp, "%lld %lu %lu %s queue_ms=%lld apt_ms=%lld batch_requests=%d batch_packages=%d status=%d%s\n",
+                end_ms, run, req->id, req->project_name[0] ? req->project_name : "N/A", req->queue_ms, req->apt_ms, request_count, svc->batch.count, status, req->withdrawn ? " withdrawn" : "");
+        }
+        if (req->withdrawn) {
+            free_request(req);
+        } else {
+            req->state = PKG_REQUEST_DONE;
+            req->status = status;
+            req->run = run;
+            req->batch_requests = request_count;
+            req->batch_packages = svc->batch.count;
+        }
+        req = next;
+    }
+    if (stats_fp) fclose(stats_fp);
+    svc->running = NULL;
+    svc->run_active = 0;
+    package_set_free(&svc->batch);
+    pthread_cond_broadcast(&svc->served);
+}
+
+static void *package_service_thread(void *arg) {
+    package_service_t *svc = (package_service_t *)arg;
+    pthread_mutex_lock(&svc->lock);
+    for (;;) {
+        while (!svc->pending) pthread_cond_wait(&svc->queued, &svc->lock);
+        run_batch(svc);
+    }
+    return NULL;
+}
+
+// Returns the service of chroot_dir, starting it on the first request; NULL if it cannot be started
+static package_service_t *get_service(const char *chroot_dir, FILE *log_fp, const char *project_name, const char *thread_arch) {
+    pthread_mutex_lock(&services_lock);
+    package_service_t *svc = services;
+    while (svc && strcmp(svc->chroot_dir, chroot_dir) != 0) svc = svc->next;
+    if (svc) {
+        pthread_mutex_unlock(&services_lock);
+        return svc;
+    }
+
+    svc = calloc(1, sizeof(package_service_t));
+    if (!svc) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Unable to allocate the package service of %s", chroot_dir);
+        pthread_mutex_unlock(&services_lock);
+        return NULL;
+    }
+    snprintf(svc->chroot_dir, sizeof(svc->chroot_dir), "%s", chroot_dir);
+    snprintf(svc->spool_dir, sizeof(svc->spool_dir), "%s/" PKG_SERVICE_DIR, chroot_dir);
+    char log_path[MAX_CONFIG_ATTR_LEN + 16];
+    snprintf(log_path, sizeof(log_path), "%s/" PKG_SERVICE_LOG, svc->spool_dir);
+    if (recursive_mkdir_or_file(svc->spool_dir, 0755, 0) != 0 || !(svc->log_fp = fopen(log_path, "a"))) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Unable to create the package service log %s: %s", log_path, strerror(errno));
+        free(svc);
+        pthread_mutex_unlock(&services_lock);
+        return NULL;
+    }
+    setvbuf(svc->log_fp, NULL, _IOLBF, 0);
+    pthread_mutex_init(&svc->lock, NULL);
+    pthread_cond_init(&svc->queued, NULL);
+    pthread_condattr_t served_attr;
+    pthread_condattr_init(&served_attr);
+    pthread_condattr_setclock(&served_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&svc->served, &served_attr);
+    pthread_condattr_destroy(&served_attr);
+
+    // The service thread lives as long as the daemon
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, package_service_thread, svc);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Unable to start the package service of %s: %s", chroot_dir, strerror(err));
+        fclose(svc->log_fp);
+        pthread_cond_destroy(&svc->served);
+        pthread_cond_destroy(&svc->queued);
+        pthread_mutex_destroy(&svc->lock);
+        free(svc);
+        pthread_mutex_unlock(&services_lock);
+        return NULL;
+    }
+    svc->next = services;
+    services = svc;
+    pthread_mutex_unlock(&services_lock);
+    return svc;
+}
+
+// Takes a withdrawn request out of the service (lock held): frees it, unless its run is still going (the service thread frees it then)
+static void withdraw_request(package_service_t *svc, package_request_t *req) {
+    if (req->state == PKG_REQUEST_PENDING) {
+        package_request_t **link = &svc->pending;
+        while (*link && *link != req) link = &(*link)->next;
+        if (*link) *link = req->next;
+        free_request(req);
+        return;
+    }
+    if (req->state == PKG_REQUEST_DONE) {
+        free_request(req);
+        return;
+    }
+    req->withdrawn = 1;
+    int waited = 0;
+    for (package_request_t *cur = svc->running; cur; cur = cur->next) {
+        if (!cur->withdrawn) waited = 1;
+    }
+    if (!waited) svc->cancel = 1;
+}
+
+int package_service_install(char *packages[], const char *chroot_dir, FILE *log_fp, const char *project_name, const char *thread_arch, volatile sig_atomic_t *terminate_flag, const step_context_t *context) {
+    package_service_t *svc = get_service(chroot_dir, log_fp, project_name, thread_arch);
+    if (!svc) return 1;
+
+    // 1. Build the (deduplicated) requested set
+    package_request_t *req = calloc(1, sizeof(package_request_t));
+    if (!req) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Memory allocation failed while building the package request");
+        return 1;
+    }
+    for (int i = 0; packages && packages[i] != NULL; i++) {
+        if (package_set_add(&req->packages, packages[i]) != 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Memory allocation failed while building the package request");
+            free_request(req);
+            return 1;
+        }
+    }
+    snprintf(req->project_name, sizeof(req->project_name), "%s", project_name ? project_name : "");
+    if (context && context->timeouts) req->timeouts = *context->timeouts;
+    req->enqueued_ms = now_ms();
+
+    // 2. Join the run in progress if it already installs all the packages, otherwise queue the request for the next run
+    pthread_mutex_lock(&svc->lock);
+    req->id = ++svc->requests;
+    if (svc->run_active && !svc->cancel && package_set_covers(&svc->batch, &req->packages)) {
+        req->state = PKG_REQUEST_RUNNING;
+        req->next = svc->running;
+        svc->running = req;
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, thread_arch, "All %d requested package(s) are already being installed by run %lu in %s; waiting for it to complete.", req->packages.count, svc->runs, chroot_dir);
+    } else {
+        req->state = PKG_REQUEST_PENDING;
+        package_request_t **tail = &svc->pending;
+        while (*tail) tail = &(*tail)->next;
+        *tail = req;
+        pthread_cond_signal(&svc->queued);
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, thread_arch, "Enqueued package request %lu (%d package(s)) for chroot %s.", req->id, req->packages.count, chroot_dir);
+    }
+
+    // 3. Wait for the run that serves the request, checking the terminate flag (raised without signalling the condvar) now and then
+    while (req->state != PKG_REQUEST_DONE) {
+        if (terminate_flag && *terminate_flag) {
+            unsigned long id = req->id;
+            withdraw_request(svc, req);
+            pthread_mutex_unlock(&svc->lock);
+            formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, project_name, thread_arch, "Termination signal received while waiting for the package service of %s; request %lu withdrawn.", chroot_dir, id);
+            return 1;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += PKG_SERVICE_TERMINATE_CHECK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&svc->served, &svc->lock, &deadline);
+    }
+    pthread_mutex_unlock(&svc->lock);
+
+    int status = req->status;
+    formatted_log(log_fp, status == 0 ? "INFO" : "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Package request %lu served by run %lu with %d request(s) and %d package(s) (status %d, queue time %lld ms, apt time %lld ms; apt output in %s/" PKG_SERVICE_LOG ").",
+        req->id, req->run, req->batch_requests, req->batch_packages, status, req->queue_ms, req->apt_ms, svc->spool_dir);
+    free_request(req);
+    // A batch killed by its watchdog is reported as a timeout to all the requests it served (and one whose session died, as such)
+    if (status == SCRIPT_TIMED_OUT || status == SCRIPT_SESSION_LOST) return status;
+    return status == 0 ? 0 : 1;
+}
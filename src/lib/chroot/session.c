@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "chroot/session.h"
+#include "utils/utils.h"
+
+/*
+    Persistent namespace sessions.
+    Instead of paying for a new "unshare -fpr --mount-proc -R" and a new fakeroot daemon (that reloads .fakeroot.env) at every step,
+    the daemon can keep one long-lived namespace per chroot: <chroot_dir>/_enter is started once with session_server.sh, which then
+    executes the commands submitted by the scripts through the control FIFO <chroot_dir>/.v2ci/session/ctl (see session.sh).
+    Scripts detect a live session on their own (ready file + live server pid) and fall back to a fresh _enter otherwise, so a session
+    that dies only costs the per-step overhead again.
+*/
+
+#define SESSION_DIR ".v2ci/session"
+#define SESSION_SERVER_CHROOT_PATH "/opt/v2ci/session_server.sh"
+#define SESSION_READY_TIMEOUT_S 120     // The first startup of the namespace under qemu can be slow
+#define SESSION_STOP_TIMEOUT_S 15
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static pid_t read_server_pid(const char *session_dir) {
+    char pid_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(pid_path, sizeof(pid_path), "%s/server.pid", session_dir);
+    FILE *fp = fopen(pid_path, "r");
+    if (!fp) return -1;
+    pid_t pid = -1;
+    if (fscanf(fp, "%d", &pid) != 1) pid = -1;
+    fclose(fp);
+    return pid;
+}
+
+static int copy_file(const char *src, const char *dst, mode_t mode) {
+    FILE *in = fopen(src, "rb");
+    if (!in) return 1;
+    FILE *out = fopen(dst, "wb");
+    if (!out) {
+        fclose(in);
+        return 1;
+    }
+    char buffer[8192];
+    size_t n;
+    int result = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            result = 1;
+            break;
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0) result = 1;
+    if (result == 0) chmod(dst, mode);
+    return result;
+}
+
+// Returns the pid of the session server of the chroot (a child of the daemon if it started it), or -1 if there is none
+pid_t session_server_pid(const char *chroot_dir) {
+    char session_dir[MAX_CONFIG_ATTR_LEN];
+    snprintf(session_dir, sizeof(session_dir), "%s/" SESSION_DIR, chroot_dir);
+    return read_server_pid(session_dir);
+}
+
+int session_is_alive(const char *chroot_dir) {
+    char session_dir[MAX_CONFIG_ATTR_LEN];
+    char ready_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(session_dir, sizeof(session_dir), "%s/" SESSION_DIR, chroot_dir);
+    snprintf(ready_path, sizeof(ready_path), "%s/ready", session_dir);
+    pid_t pid = read_server_pid(session_dir);
+    return pid > 0 && access(ready_path, F_OK) == 0 && kill(pid, 0) == 0;
+}
+
+int session_start(const char *chroot_dir, FILE *log_fp, const char *arch) {
+    if (session_is_alive(chroot_dir)) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, arch, "Persistent session for %s already running.", chroot_dir);
+        return 0;
+    }
+
+    // 1. Prepare the session directory (removing leftovers of a previous session) and the control FIFO
+    char session_dir[MAX_CONFIG_ATTR_LEN];
+    snprintf(session_dir, sizeof(session_dir), "%s/" SESSION_DIR, chroot_dir);
+    if (recursive_mkdir_or_file(session_dir, 0755, 0) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, arch, "Unable to create session directory %s: %s", session_dir, strerror(errno));
+        return 1;
+    }
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    const char *stale_files[] = { "ready", "server.pid", "ctl" };
+    for (size_t i = 0; i < sizeof(stale_files) / sizeof(stale_files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", session_dir, stale_files[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/ctl", session_dir);
+    if (mkfifo(path, 0600) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, arch, "Unable to create session control FIFO %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    // 2. Deploy the session server inside the chroot (always refreshed, so that existing chroots get the current version)
+    char *server_script_expanded_path = expand_tilde(SESSION_SERVER_SCRIPT_PATH);
+    char server_chroot_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(server_chroot_path, sizeof(server_chroot_path), "%s" SESSION_SERVER_CHROOT_PATH, chroot_dir);
+    if (!server_script_expanded_path || recursive_mkdir_or_file(server_chroot_path, 0755, 1) != 0 || copy_file(server_script_expanded_path, server_chroot_path, 0755) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, arch, "Unable to deploy session server %s into %s", server_script_expanded_path ? server_script_expanded_path : SESSION_SERVER_SCRIPT_PATH, server_chroot_path);
+        free(server_script_expanded_path);
+        return 1;
+    }
+    free(server_script_expanded_path);
+
+    // 3. Start the namespace once: the server gets its own session/process group so it outlives the process that started it
+    char enter_path[MAX_CONFIG_ATTR_LEN];
+    char server_log_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(enter_path, sizeof(enter_path), "%s/_enter", chroot_dir);
+    snprintf(server_log_path, sizeof(server_log_path), "%s/server.log", session_dir);
+    pid_t pid = fork();
+    if (pid < 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, arch, "Unable to fork the session server for %s: %s", chroot_dir, strerror(errno));
+        return 1;
+    }
+    if (pid == 0) {
+        // The supervisor blocks the signals it reads through its signalfd: the server must get them with the default behaviour
+        sigset_t empty_mask;
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+        setsid();
+        int null_fd = open("/dev/null", O_RDONLY);
+        int log_fd = open(server_log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (null_fd >= 0) dup2(null_fd, STDIN_FILENO);
+        if (log_fd >= 0) {
+            dup2(log_fd, STDOUT_FILENO);
+            dup2(log_fd, STDERR_FILENO);
+        }
+        execl(enter_path, enter_path, "bash", SESSION_SERVER_CHROOT_PATH, (char *)NULL);
+        _exit(127);
+    }
+    snprintf(path, sizeof(path), "%s/server.pid", session_dir);
+    FILE *pid_fp = fopen(path, "w");
+    if (!pid_fp) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, arch, "Unable to write session pid file %s", path);
+        kill(-pid, SIGKILL);
+        return 1;
+    }
+    fprintf(pid_fp, "%d\n", pid);
+    fclose(pid_fp);
+
+    // 4. Wait for the server to announce that it is ready to accept commands
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    snprintf(path, sizeof(path), "%s/ready", session_dir);
+    while (access(path, F_OK) != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (waitpid(pid, NULL, WNOHANG) == pid || now.tv_sec - start.tv_sec > SESSION_READY_TIMEOUT_S) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, arch, "Persistent session for %s did not become ready; see %s. Steps will use a fresh _enter.", chroot_dir, server_log_path);
+            kill(-pid, SIGKILL);
+            return 1;
+        }
+        sleep_ms(100);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long startup_ms = (now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L;
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, arch, "Persistent session for %s started with PID %d in %ld ms.", chroot_dir, pid, startup_ms);
+    return 0;
+}
+
+int session_stop(const char *chroot_dir, FILE *log_fp, const char *arch) {
+    char session_dir[MAX_CONFIG_ATTR_LEN];
+    snprintf(session_dir, sizeof(session_dir), "%s/" SESSION_DIR, chroot_dir);
+    pid_t pid = read_server_pid(session_dir);
+    if (pid <= 0 || kill(pid, 0) != 0) {
+        return 0;
+    }
+
+    // 1. Ask the server to quit (it cancels the commands still running and lets fakeroot save its state)
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/ctl", session_dir);
+    int ctl_fd = open(path, O_WRONLY | O_NONBLOCK);
+    if (ctl_fd >= 0) {
+        const char *quit = "quit\n";
+        if (write(ctl_fd, quit, strlen(quit)) < 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, arch, "Unable to send quit to the session of %s: %s", chroot_dir, strerror(errno));
+        }
+        close(ctl_fd);
+    }
+    for (int i = 0; i < SESSION_STOP_TIMEOUT_S * 10 && kill(pid, 0) == 0; i++) {
+        sleep_ms(100);
+    }
+
+    // 2. Tear the namespace down if the server did not leave on its own
+    if (kill(pid, 0) == 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, arch, "Persistent session for %s did not quit in %d s; killing it.", chroot_dir, SESSION_STOP_TIMEOUT_S);
+        kill(-pid, SIGKILL);
+    }
+    snprintf(path, sizeof(path), "%s/ready", session_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/server.pid", session_dir);
+    unlink(path);
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, arch, "Persistent session for %s stopped.", chroot_dir);
+    return 0;
+}
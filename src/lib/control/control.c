@@ -0,0 +1,213 @@
+#define _GNU_SOURCE     // accept4, struct ucred
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "control/control.h"
+
+/*
+    Control socket.
+    The supervisor listens on a Unix stream socket (CONTROL_SOCKET_PATH, mode 0600) in its epoll loop; v2ci_ctl connects, writes a single
+    command line and reads a single JSON document until the server closes the connection. One request per connection keeps the server
+    simple. The accepted sockets are non-blocking and driven by the epoll loop of the supervisor: control_read_request and
+    control_send_response take what the socket has or takes and return, so that a slow peer never holds the loop; the supervisor closes a
+    connection that does not finish its request, or read its response, within CONTROL_IO_TIMEOUT_MS. Only peers with the uid of the
+    daemon are served (SO_PEERCRED).
+*/
+
+static int json_reserve(json_buf_t *buf, size_t extra) {
+    if (buf->failed) return 1;
+    if (buf->len + extra + 1 <= buf->cap) return 0;
+    size_t new_cap = buf->cap ? buf->cap : 1024;
+    while (new_cap < buf->len + extra + 1) new_cap *= 2;
+    char *data = realloc(buf->data, new_cap);
+    if (!data) {
+        buf->failed = 1;
+        return 1;
+    }
+    buf->data = data;
+    buf->cap = new_cap;
+    return 0;
+}
+
+void json_printf(json_buf_t *buf, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (needed < 0 || json_reserve(buf, (size_t)needed) != 0) return;
+    va_start(args, format);
+    vsnprintf(buf->data + buf->len, buf->cap - buf->len, format, args);
+    va_end(args);
+    buf->len += (size_t)needed;
+}
+
+// Appends value as a JSON string (null if value is NULL)
+void json_string(json_buf_t *buf, const char *value) {
+    if (!value) {
+        json_printf(buf, "null");
+        return;
+    }
+    json_printf(buf, "\"");
+    for (const unsigned char *c = (const unsigned char *)value; *c; c++) {
+        if (*c == '"' || *c == '\\') json_printf(buf, "\\%c", *c);
+        else if (*c == '\n') json_printf(buf, "\\n");
+        else if (*c == '\t') json_printf(buf, "\\t");
+        else if (*c < 0x20) json_printf(buf, "\\u%04x", *c);
+        else json_printf(buf, "%c", *c);
+    }
+    json_printf(buf, "\"");
+}
+
+void json_free(json_buf_t *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+static void set_io_timeout(int fd, int option, int timeout_ms) {
+    struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+}
+
+static int fill_address(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return 1;
+    }
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+    return 0;
+}
+
+// Creates the (non-blocking) listening socket at path, replacing a stale one left by a crashed supervisor; returns its fd, -1 on error
+// (EADDRINUSE if another daemon is serving path)
+int control_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) != 0) return -1;
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0) {
+        int alive = connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(probe);
+        if (alive) {
+            errno = EADDRINUSE;
+            return -1;
+        }
+    }
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    // The socket file gets its mode at bind time
+    mode_t old_umask = umask(0077);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_umask);
+    if (bound != 0 || listen(fd, 16) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+// Accepts a connection (non-blocking); returns its fd, -1 if there was no connection or the peer is not the owner of the daemon (EACCES)
+int control_accept(int listen_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return -1;
+    struct ucred peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) != 0 || peer.uid != getuid()) {
+        close(fd);
+        errno = EACCES;
+        return -1;
+    }
+    return fd;
+}
+
+// Reads what the peer sent of its request line (len bytes so far); returns 1 once the line is complete (without the newline; also at the
+// end of the stream or of the buffer), 0 if more is to come, -1 on error
+int control_read_request(int fd, char *request, size_t request_size, size_t *len) {
+    while (*len < request_size - 1) {
+        ssize_t n = read(fd, request + *len, request_size - 1 - *len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        if (n == 0) break;
+        *len += (size_t)n;
+        if (memchr(request + *len - n, '\n', (size_t)n)) break;
+    }
+    request[*len] = '\0';
+    request[strcspn(request, "\r\n")] = '\0';
+    return 1;
+}
+
+// Sends what the socket takes of the response, one JSON document and a newline (sent bytes so far); returns 1 once it is all sent, 0 if
+// more is to come, -1 on error
+int control_send_response(int fd, const json_buf_t *response, size_t *sent) {
+    const char *data = response->failed ? "{\"ok\":false,\"error\":\"out of memory\"}" : response->data;
+    size_t len = response->failed ? strlen(data) : response->len;
+    while (*sent <= len) {
+        ssize_t n = *sent < len ? send(fd, data + *sent, len - *sent, MSG_NOSIGNAL) : send(fd, "\n", 1, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        if (n == 0) return -1;
+        *sent += (size_t)n;
+    }
+    return 1;
+}
+
+// Client side: sends request to the daemon listening on path and reads its whole response; returns 0 on success, 1 with errno set otherwise
+int control_request(const char *path, const char *request, json_buf_t *response) {
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) != 0) return 1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return 1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return 1;
+    }
+    // The response of rotate --dry-run or report may take a while: a helper thread of the supervisor reads the disk for it
+    set_io_timeout(fd, SO_SNDTIMEO, CONTROL_IO_TIMEOUT_MS);
+    set_io_timeout(fd, SO_RCVTIMEO, CONTROL_RESPONSE_TIMEOUT_MS);
+    size_t len = strlen(request);
+    if (send(fd, request, len, MSG_NOSIGNAL) != (ssize_t)len || send(fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    char chunk[4096];
+    while (1) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return 1;
+        }
+        if (n == 0) break;
+        if (response->len + (size_t)n > CONTROL_RESPONSE_MAX) {
+            close(fd);
+            errno = EMSGSIZE;
+            return 1;
+        }
+        json_printf(response, "%.*s", (int)n, chunk);
+    }
+    close(fd);
+    if (response->failed) {
+        errno = ENOMEM;
+        return 1;
+    }
+    return 0;
+}
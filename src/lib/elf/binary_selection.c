@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "elf/binary_selection.h"
+#include "elf/elf_inspect.h"
+#include "utils/utils.h"
+
+/*
+    Selection of the binary to publish.
+    After the build of the main repository the daemon walks, on the host, the build directories of its checkout in the chroot (the one
+    used by the build, build or build-cross, then builddir, target/release and dist, each once; hidden entries are skipped) and
+    inspects every regular file with an execute bit (see elf_inspect.c). A tmpfs build is gone once its step ends, so the build script
+    stages the executables of those directories in <repo>/.v2ci-candidates, which is walked instead.
+    The candidates are the ELF executables of the target machine (host tools built along, e.g. by a native cross build, are skipped),
+    except the test executables listed by the build system (the add_test commands of the CTestTestfile.cmake files of CMake, the
+    meson-info/intro-tests.json of meson), unless nothing else is left.
+    The binary rules of the project then narrow them down, in this order:
+    - name: only the executables whose file name (or path in the build tree, for a pattern with "/") matches the glob; without a name,
+      the executables named after the repository (<repo>, <repo>-*, <repo>_*, <repo>.*) are preferred if there is any, and among them
+      those that do not look like tests (a "test" in the suffix, or a test/tests directory) unless they are all like that;
+    - linkage: "static" keeps only the static and static-pie executables, "prefer-static" takes a static one, then a static-pie one,
+      before any dynamic one, "any" does not look at the linkage;
+    - the one named exactly <repo> (without a name rule), then the first in path order among those left.
+*/
+
+#define SELECTION_MAX_DEPTH 32
+
+typedef struct candidate {
+    char path[MAX_CONFIG_ATTR_LEN * 2];     // Absolute path on the host
+    char rel_path[MAX_CONFIG_ATTR_LEN];     // Path in the build tree (e.g. build/src/sshlirp)
+    int linkage;
+} candidate_t;
+
+typedef struct candidate_list {
+    candidate_t *items;
+    int count;
+    int capacity;
+    int foreign;                            // ELF executables of another machine
+    char **tests;                           // File names of the test executables listed by the build system
+    int test_count;
+    int test_capacity;
+} candidate_list_t;
+
+static void free_candidates(candidate_list_t *list) {
+    for (int i = 0; i < list->test_count; i++) free(list->tests[i]);
+    free(list->tests);
+    free(list->items);
+}
+
+static int add_candidate(candidate_list_t *list, const char *path, const char *rel_path, int linkage) {
+    if (list->count == list->capacity) {
+        int new_capacity = list->capacity ? list->capacity * 2 : 32;
+        candidate_t *items = realloc(list->items, new_capacity * sizeof(candidate_t));
+        if (!items) return 1;
+        list->items = items;
+        list->capacity = new_capacity;
+    }
+    candidate_t *c = &list->items[list->count++];
+    snprintf(c->path, sizeof(c->path), "%s", path);
+    snprintf(c->rel_path, sizeof(c->rel_path), "%s", rel_path);
+    c->linkage = linkage;
+    return 0;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void add_test(candidate_list_t *list, const char *command, size_t len) {
+    char name[NAME_MAX + 1];
+    snprintf(name, sizeof(name), "%.*s", (int)len, command);
+    const char *file_name = base_name(name);
+    if (!file_name[0]) return;
+    for (int i = 0; i < list->test_count; i++) {
+        if (strcmp(list->tests[i], file_name) == 0) return;
+    }
+    if (list->test_count == list->test_capacity) {
+        int new_capacity = list->test_capacity ? list->test_capacity * 2 : 16;
+        char **tests = realloc(list->tests, new_capacity * sizeof(char *));
+        if (!tests) return;
+        list->tests = tests;
+        list->test_capacity = new_capacity;
+    }
+    list->tests[list->test_count] = strdup(file_name);
+    if (list->tests[list->test_count]) list->test_count++;
+}
+
+// Collects the test executables of a CTestTestfile.cmake (the first quoted argument after the name of each add_test) or of a meson
+// intro-tests.json (the first element of each "cmd")
+static void read_test_list(const char *path, int is_meson, candidate_list_t *list) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+    char line[MAX_COMMAND_LEN];
+    while (fgets(line, sizeof(line), fp)) {
+        const char *p = line;
+        while ((p = strstr(p, is_meson ? "\"cmd\": [\"" : "add_test(")) != NULL) {
+            const char *start = is_meson ? p + 9 : strchr(p, '"');
+            if (!start) break;
+            if (!is_meson) start++;
+            const char *end = strchr(start, '"');
+            if (!end) break;
+            add_test(list, start, (size_t)(end - start));
+            p = end;
+        }
+    }
+    fclose(fp);
+}
+
+static void walk(const char *dir, const char *rel_dir, const char *arch, int depth, candidate_list_t *list) {
+    if (depth > SELECTION_MAX_DEPTH) return;
+    DIR *dp = opendir(dir);
+    if (!dp) return;
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char path[MAX_CONFIG_ATTR_LEN * 2];
+        char rel_path[MAX_CONFIG_ATTR_LEN];
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path)) continue;
+        if (snprintf(rel_path, sizeof(rel_path), "%s/%s", rel_dir, entry->d_name) >= (int)sizeof(rel_path)) continue;
+        struct stat st;
+        if (lstat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            walk(path, rel_path, arch, depth + 1, list);
+        } else if (S_ISREG(st.st_mode) && (strcmp(entry->d_name, "CTestTestfile.cmake") == 0 || strcmp(entry->d_name, "intro-tests.json") == 0)) {
+            read_test_list(path, entry->d_name[0] == 'i', list);
+        } else if (S_ISREG(st.st_mode) && (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {
+            elf_info_t info;
+            if (elf_inspect(path, &info) != 0 || info.kind != ELF_KIND_EXECUTABLE) continue;
+            if (!elf_matches_arch(&info, arch)) {
+                list->foreign++;
+                continue;
+            }
+            add_candidate(list, path, rel_path, info.linkage);
+        }
+    }
+    closedir(dp);
+}
+
+static int compare_candidates(const void *a, const void *b) {
+    return strcmp(((const candidate_t *)a)->rel_path, ((const candidate_t *)b)->rel_path);
+}
+
+// prefer-static order: static, then static-pie, then dynamic
+static int linkage_rank(int linkage) {
+    return linkage == ELF_LINK_STATIC ? 2 : linkage == ELF_LINK_STATIC_PIE ? 1 : 0;
+}
+
+static int is_listed_test(const candidate_list_t *list, const char *name) {
+    for (int i = 0; i < list->test_count; i++) {
+        if (strcmp(list->tests[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+// How well a candidate is named after the repository: 0 not at all, 1 <repo>-*, <repo>_* or <repo>.* looking like a test (e.g.
+// <repo>_test, or in a tests directory), 2 any other <repo>-*, <repo>_* or <repo>.*, 3 exactly <repo>
+static int repo_name_rank(const candidate_t *c, const char *repo_name) {
+    const char *name = base_name(c->rel_path);
+    size_t len = strlen(repo_name);
+    if (strncmp(name, repo_name, len) != 0) return 0;
+    if (name[len] == '\0') return 3;
+    if (name[len] != '-' && name[len] != '_' && name[len] != '.') return 0;
+    char suffix[NAME_MAX + 1];
+    snprintf(suffix, sizeof(suffix), "%s", name + len);
+    for (char *p = suffix; *p; p++) *p = (char)tolower((unsigned char)*p);
+    int test_like = strstr(suffix, "test") != NULL || strstr(c->rel_path, "/test/") != NULL || strstr(c->rel_path, "/tests/") != NULL;
+    return test_like ? 1 : 2;
+}
+
+// Without a name rule, the executable named exactly after the repository wins the ties
+static int exact_name(const candidate_t *c, const project_t *prj, const char *repo_name) {
+    return !prj->binary.name[0] && strcmp(base_name(c->rel_path), repo_name) == 0;
+}
+
+// Keeps only the candidates for which keep is set; returns the number left
+static int keep_marked(candidate_list_t *list, const int *keep) {
+    int kept = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (keep[i]) list->items[kept++] = list->items[i];
+    }
+    list->count = kept;
+    return kept;
+}
+
+// Selects the binary to publish among the executables built in repo_dir (see above); returns 0 with its host path in selected, 1 if none fits
+int select_binary(const project_t *prj, const char *arch, const char *repo_dir, const char *repo_name, char *selected, size_t selected_size, FILE *log_fp) {
+    char base[MAX_CONFIG_ATTR_LEN * 2 + 32];
+    char path[MAX_CONFIG_ATTR_LEN * 2 + 32];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", repo_dir, BINARY_CANDIDATES_DIR);
+    int staged = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+    snprintf(base, sizeof(base), "%s", staged ? path : repo_dir);
+
+    char build_dir_name[64] = "build";
+    snprintf(path, sizeof(path), "%s/%s", repo_dir, BINARY_BUILD_DIR_FILE);
+    FILE *fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%63s", build_dir_name) != 1) snprintf(build_dir_name, sizeof(build_dir_name), "build");
+        fclose(fp);
+    }
+
+    candidate_list_t list = { 0 };
+    const char *roots[] = { build_dir_name, "builddir", "target/release", "dist" };
+    for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+        // The build directory may itself be one of the others (e.g. builddir): each tree is walked once
+        int seen = 0;
+        for (size_t k = 0; k < i && !seen; k++) seen = strcmp(roots[k], roots[i]) == 0;
+        if (seen || snprintf(path, sizeof(path), "%s/%s", base, roots[i]) >= (int)sizeof(path)) continue;
+        walk(path, roots[i], arch, 0, &list);
+    }
+    if (list.count == 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "No %s executable found in the build directories of %s%s (%d executables of other machines skipped).",
+            arch, base, staged ? " (staged by the tmpfs build)" : "", list.foreign);
+        free_candidates(&list);
+        return 1;
+    }
+    qsort(list.items, list.count, sizeof(candidate_t), compare_candidates);
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Found %d %s executables in %s (%d of other machines skipped).", list.count, arch, base, list.foreign);
+
+    int keep[list.count];
+    // 0. The test executables listed by the build system are not candidates (unless there is nothing else)
+    int tests = 0;
+    for (int i = 0; i < list.count; i++) {
+        keep[i] = !is_listed_test(&list, base_name(list.items[i].rel_path));
+        tests += !keep[i];
+    }
+    if (tests > 0 && tests < list.count) {
+        keep_marked(&list, keep);
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Skipped %d test executables listed by the build system.", tests);
+    }
+    // 1. Name: an explicit name or glob must match, the repository name is only a preference
+    if (prj->binary.name[0]) {
+        int path_pattern = strchr(prj->binary.name, '/') != NULL;
+        for (int i = 0; i < list.count; i++) {
+            keep[i] = fnmatch(prj->binary.name, path_pattern ? list.items[i].rel_path : base_name(list.items[i].rel_path), path_pattern ? FNM_PATHNAME : 0) == 0;
+        }
+        if (keep_marked(&list, keep) == 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "No executable matches the binary name '%s' of the project.", prj->binary.name);
+            free_candidates(&list);
+            return 1;
+        }
+    } else {
+        int best_rank = 0;
+        for (int i = 0; i < list.count; i++) {
+            int rank = repo_name_rank(&list.items[i], repo_name);
+            if (rank > best_rank) best_rank = rank;
+        }
+        // Any name that does not look like a test is kept (the exact one only wins on a tie of linkage below)
+        if (best_rank > 0) {
+            for (int i = 0; i < list.count; i++) {
+                int rank = repo_name_rank(&list.items[i], repo_name);
+                keep[i] = best_rank >= 2 ? rank >= 2 : rank == 1;
+            }
+            keep_marked(&list, keep);
+        }
+    }
+
+    // 2. Linkage
+    int chosen = 0;
+    if (strcmp(prj->binary.linkage, "any") != 0) {
+        if (strcmp(prj->binary.linkage, "static") != 0 && strcmp(prj->binary.linkage, "prefer-static") != 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unknown binary linkage '%s'; using prefer-static.", prj->binary.linkage);
+        }
+        int best = -1;
+        for (int i = 0; i < list.count; i++) {
+            int rank = linkage_rank(list.items[i].linkage), best_rank = best < 0 ? -1 : linkage_rank(list.items[best].linkage);
+            if (rank > best_rank || (rank == best_rank && exact_name(&list.items[i], prj, repo_name) && !exact_name(&list.items[best], prj, repo_name))) best = i;
+        }
+        if (strcmp(prj->binary.linkage, "static") == 0 && list.items[best].linkage == ELF_LINK_DYNAMIC) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Only dynamically linked candidates are left (e.g. %s), and the project requires a static binary.", list.items[best].rel_path);
+            free_candidates(&list);
+            return 1;
+        }
+        chosen = best;
+    } else {
+        for (int i = 0; i < list.count; i++) {
+            if (exact_name(&list.items[i], prj, repo_name)) {
+                chosen = i;
+                break;
+            }
+        }
+    }
+
+    const candidate_t *c = &list.items[chosen];
+    snprintf(selected, selected_size, "%s", c->path);
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Selected binary: %s (%s; %d candidates left by the rules).", c->rel_path, elf_linkage_name(c->linkage), list.count);
+    free_candidates(&list);
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <elf.h>
+#include "elf/elf_inspect.h"
+
+/*
+    ELF inspection.
+    Classifies a file from its ELF header and program headers only (read with plain stdio on the host, whatever the architecture of
+    the file), which is what "file" did for the binary selection when it was run on every candidate under qemu:
+    - kind: an executable is ET_EXEC, or ET_DYN with a program interpreter (PIE) or with DF_1_PIE in its dynamic section (static-pie);
+      any other ET_DYN is a shared library;
+    - linkage: dynamic with a PT_INTERP segment, static for an ET_EXEC without it, static-pie for an ET_DYN without it;
+    - machine, class and byte order, checked against the Debian architecture the build was for.
+    The sizes of the text, data and bss of a binary (for its benchmarks, see artifact_bench.c) are added up from its allocated sections
+    as "size" does, or from its loadable segments for a binary stripped of its section headers.
+    Both classes and both byte orders are handled by decoding the fields by hand instead of casting to the host structures.
+*/
+
+#define ELF_MAX_PHDRS 256           // Far more than any linker emits; a larger count means a corrupt header
+#define ELF_MAX_DYNAMIC_ENTRIES 4096
+#define ELF_MAX_SHDRS 65280         // SHN_LORESERVE
+
+typedef struct arch_machine {
+    const char *debian_arch;
+    int machine;
+    int elf_class;
+    int big_endian;
+} arch_machine_t;
+
+static const arch_machine_t arch_machines[] = {
+    { "amd64", EM_X86_64, 64, 0 },
+    { "arm64", EM_AARCH64, 64, 0 },
+    { "armhf", EM_ARM, 32, 0 },
+    { "armel", EM_ARM, 32, 0 },
+    { "i386", EM_386, 32, 0 },
+    { "riscv64", EM_RISCV, 64, 0 },
+    { "ppc64el", EM_PPC64, 64, 0 },
+    { "s390x", EM_S390, 64, 1 },
+    { "mips64el", EM_MIPS, 64, 0 },
+    { "mipsel", EM_MIPS, 32, 0 },
+};
+
+static uint64_t read_field(const unsigned char *p, int size, int big_endian) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= (uint64_t)p[big_endian ? size - 1 - i : i] << (8 * i);
+    }
+    return value;
+}
+
+// Reads size bytes at offset; returns 0 if they were all read
+static int read_at(FILE *fp, uint64_t offset, void *buf, size_t size) {
+    if (fseeko(fp, (off_t)offset, SEEK_SET) != 0) return 1;
+    return fread(buf, 1, size, fp) == size ? 0 : 1;
+}
+
+// Returns 1 if the dynamic segment at offset has DT_FLAGS_1 with DF_1_PIE
+static int has_pie_flag(FILE *fp, const elf_info_t *info, uint64_t offset, uint64_t size) {
+    int entry_size = info->elf_class == 64 ? 16 : 8;
+    int word = entry_size / 2;
+    unsigned char entry[16];
+    uint64_t count = size / entry_size;
+    for (uint64_t i = 0; i < count && i < ELF_MAX_DYNAMIC_ENTRIES; i++) {
+        if (read_at(fp, offset + i * entry_size, entry, entry_size) != 0) return 0;
+        uint64_t tag = read_field(entry, word, info->big_endian);
+        uint64_t value = read_field(entry + word, word, info->big_endian);
+        if (tag == DT_NULL) return 0;
+        if (tag == DT_FLAGS_1) return (value & DF_1_PIE) != 0;
+    }
+    return 0;
+}
+
+// Inspects the file at path; returns 0 if it is a well-formed ELF file (info filled), 1 otherwise
+int elf_inspect(const char *path, elf_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 1;
+    unsigned char ehdr[64];
+    if (fread(ehdr, 1, EI_NIDENT, fp) != EI_NIDENT || memcmp(ehdr, ELFMAG, SELFMAG) != 0 ||
+        (ehdr[EI_CLASS] != ELFCLASS32 && ehdr[EI_CLASS] != ELFCLASS64) || (ehdr[EI_DATA] != ELFDATA2LSB && ehdr[EI_DATA] != ELFDATA2MSB)) {
+        fclose(fp);
+        return 1;
+    }
+    info->elf_class = ehdr[EI_CLASS] == ELFCLASS64 ? 64 : 32;
+    info->big_endian = ehdr[EI_DATA] == ELFDATA2MSB;
+    int is64 = info->elf_class == 64;
+    size_t ehdr_size = is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    if (read_at(fp, 0, ehdr, ehdr_size) != 0) {
+        fclose(fp);
+        return 1;
+    }
+    int be = info->big_endian;
+    int type = (int)read_field(ehdr + 16, 2, be);
+    info->machine = (int)read_field(ehdr + 18, 2, be);
+    uint64_t phoff = is64 ? read_field(ehdr + 32, 8, be) : read_field(ehdr + 28, 4, be);
+    int phentsize = (int)read_field(ehdr + (is64 ? 54 : 42), 2, be);
+    int phnum = (int)read_field(ehdr + (is64 ? 56 : 44), 2, be);
+    size_t phdr_size = is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    if (type != ET_EXEC && type != ET_DYN) {
+        fclose(fp);
+        return 0;
+    }
+    if (phnum > ELF_MAX_PHDRS || (phnum > 0 && (size_t)phentsize < phdr_size)) {
+        fclose(fp);
+        return 1;
+    }
+
+    int has_interp = 0;
+    uint64_t dynamic_offset = 0, dynamic_size = 0;
+    unsigned char phdr[sizeof(Elf64_Phdr)];
+    for (int i = 0; i < phnum; i++) {
+        if (read_at(fp, phoff + (uint64_t)i * phentsize, phdr, phdr_size) != 0) {
+            fclose(fp);
+            return 1;
+        }
+        uint32_t p_type = (uint32_t)read_field(phdr, 4, be);
+        if (p_type == PT_INTERP) {
+            has_interp = 1;
+        } else if (p_type == PT_DYNAMIC) {
+            dynamic_offset = is64 ? read_field(phdr + 8, 8, be) : read_field(phdr + 4, 4, be);
+            dynamic_size = is64 ? read_field(phdr + 32, 8, be) : read_field(phdr + 16, 4, be);
+        }
+    }
+
+    if (has_interp) {
+        info->kind = ELF_KIND_EXECUTABLE;
+        info->linkage = ELF_LINK_DYNAMIC;
+    } else if (type == ET_EXEC) {
+        info->kind = ELF_KIND_EXECUTABLE;
+        info->linkage = ELF_LINK_STATIC;
+    } else if (dynamic_size > 0 && has_pie_flag(fp, info, dynamic_offset, dynamic_size)) {
+        info->kind = ELF_KIND_EXECUTABLE;
+        info->linkage = ELF_LINK_STATIC_PIE;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Returns 1 if the machine, class and byte order of the file are those of the Debian architecture (0 for unknown architectures)
+int elf_matches_arch(const elf_info_t *info, const char *debian_arch) {
+    for (size_t i = 0; i < sizeof(arch_machines) / sizeof(arch_machines[0]); i++) {
+        const arch_machine_t *arch = &arch_machines[i];
+        if (strcmp(arch->debian_arch, debian_arch) == 0) {
+            return info->machine == arch->machine && info->elf_class == arch->elf_class && info->big_endian == arch->big_endian;
+        }
+    }
+    return 0;
+}
+
+const char *elf_linkage_name(int linkage) {
+    switch (linkage) {
+        case ELF_LINK_STATIC: return "static";
+        case ELF_LINK_STATIC_PIE: return "static-pie";
+        default: return "dynamic";
+    }
+}
+
+// Adds up the text, data and bss of the ELF file at path; returns 0 on success
+int elf_section_sizes(const char *path, elf_sizes_t *sizes) {
+    memset(sizes, 0, sizeof(*sizes));
+    elf_info_t info;
+    if (elf_inspect(path, &info) != 0) return 1;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 1;
+    int is64 = info.elf_class == 64;
+    int be = info.big_endian;
+    unsigned char ehdr[sizeof(Elf64_Ehdr)];
+    if (read_at(fp, 0, ehdr, is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr)) != 0) {
+        fclose(fp);
+        return 1;
+    }
+    uint64_t shoff = is64 ? read_field(ehdr + 40, 8, be) : read_field(ehdr + 32, 4, be);
+    int shentsize = (int)read_field(ehdr + (is64 ? 58 : 46), 2, be);
+    int shnum = (int)read_field(ehdr + (is64 ? 60 : 48), 2, be);
+    size_t shdr_size = is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+    int err = 0;
+    if (shoff > 0 && shnum > 0 && shnum < ELF_MAX_SHDRS && (size_t)shentsize >= shdr_size) {
+        unsigned char shdr[sizeof(Elf64_Shdr)];
+        for (int i = 0; i < shnum && !err; i++) {
+            if (read_at(fp, shoff + (uint64_t)i * shentsize, shdr, shdr_size) != 0) {
+                err = 1;
+                break;
+            }
+            uint32_t type = (uint32_t)read_field(shdr + 4, 4, be);
+            uint64_t flags = is64 ? read_field(shdr + 8, 8, be) : read_field(shdr + 8, 4, be);
+            long long size = (long long)(is64 ? read_field(shdr + 32, 8, be) : read_field(shdr + 20, 4, be));
+            if (!(flags & SHF_ALLOC)) continue;
+            if (!(flags & SHF_WRITE)) sizes->text += size;
+            else if (type == SHT_NOBITS) sizes->bss += size;
+            else sizes->data += size;
+        }
+    } else {
+        uint64_t phoff = is64 ? read_field(ehdr + 32, 8, be) : read_field(ehdr + 28, 4, be);
+        int phentsize = (int)read_field(ehdr + (is64 ? 54 : 42), 2, be);
+        int phnum = (int)read_field(ehdr + (is64 ? 56 : 44), 2, be);
+        size_t phdr_size = is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+        unsigned char phdr[sizeof(Elf64_Phdr)];
+        if (phnum > ELF_MAX_PHDRS || (phnum > 0 && (size_t)phentsize < phdr_size)) err = 1;
+        for (int i = 0; i < phnum && !err; i++) {
+            if (read_at(fp, phoff + (uint64_t)i * phentsize, phdr, phdr_size) != 0) {
+                err = 1;
+                break;
+            }
+            if ((uint32_t)read_field(phdr, 4, be) != PT_LOAD) continue;
+            uint32_t flags = (uint32_t)(is64 ? read_field(phdr + 4, 4, be) : read_field(phdr + 24, 4, be));
+            long long filesz = (long long)(is64 ? read_field(phdr + 32, 8, be) : read_field(phdr + 16, 4, be));
+            long long memsz = (long long)(is64 ? read_field(phdr + 40, 8, be) : read_field(phdr + 20, 4, be));
+            if (!(flags & PF_W)) {
+                sizes->text += filesz;
+            } else {
+                sizes->data += filesz;
+                if (memsz > filesz) sizes->bss += memsz - filesz;
+            }
+        }
+    }
+    fclose(fp);
+    return err;
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include "utils/utils.h"
 #include "init/load_config.h"
 #include <yaml.h>
@@ -22,7 +23,43 @@
 */
 
 #define DEFAULT_BUILD_MODE "full"
+#define DEFAULT_CHROOT_SESSION "oneshot"
+#define DEFAULT_MAX_ACTIVE_PROJECTS 8
+#define DEFAULT_ARTIFACT_SERVER "off"
+#define DEFAULT_CROSS_MODE "emulated"
+#define DEFAULT_TMPFS_BUILD "no"
+#define DEFAULT_TMPFS_BUDGET_MB 2048
 #define DEFAULT_POLL_INTERVAL 180
+#define DEFAULT_INSTALL_TIMEOUT 3600        // 1 hour (apt under qemu)
+#define DEFAULT_FETCH_TIMEOUT 900           // 15 minutes
+#define DEFAULT_CONFIGURE_TIMEOUT 3600      // 1 hour
+#define DEFAULT_BUILD_TIMEOUT 14400         // 4 hours
+#define DEFAULT_PUBLISH_TIMEOUT 600         // 10 minutes
+#define DEFAULT_INACTIVITY_TIMEOUT 1800     // 30 minutes without any output
+#define DEFAULT_CGROUP_ENABLED "no"
+#define DEFAULT_CGROUP_CPU_WEIGHT "100"
+#define DEFAULT_CGROUP_MEMORY_HIGH "max"
+#define DEFAULT_CGROUP_MEMORY_MAX "max"
+#define DEFAULT_CGROUP_PIDS_MAX "max"
+#define DEFAULT_ADMISSION_CPU 90            // Percent of time some task waited for a CPU in the last 10 s
+#define DEFAULT_ADMISSION_MEMORY 20         // Percent of time some task stalled on memory (reclaim, swap-in)
+#define DEFAULT_ADMISSION_IO 50             // Percent of time some task waited for I/O
+#define DEFAULT_ADMISSION_CHECK_INTERVAL 10
+#define DEFAULT_ADMISSION_MAX_WAIT 3600     // 1 hour
+#define DEFAULT_BINARY_NAME ""              // Prefer the executables named after the repository
+#define DEFAULT_BINARY_LINKAGE "prefer-static"
+#define DEFAULT_TEST_ENABLED "no"
+#define DEFAULT_TEST_COMMAND "auto"         // ctest, meson test or make check, after the build system of the main repository
+#define DEFAULT_TEST_SHARDS 4
+#define DEFAULT_TEST_TIME_BUDGET 3600       // 1 hour
+#define DEFAULT_BENCH_ENABLED "no"
+#define DEFAULT_BENCH_COMMAND ""            // Startup times only
+#define DEFAULT_BENCH_RUNS 5
+#define DEFAULT_BENCH_THRESHOLD 10          // Percent
+#define DEFAULT_BENCH_TIME_BUDGET 600       // 10 minutes
+#define DEFAULT_DURATION_WINDOW 20          // Builds
+#define DEFAULT_DURATION_SLOWDOWN 1.5
+#define DEFAULT_DURATION_MIN_SECONDS 60
 #define DEFAULT_DAILY_MEM_LIMIT 10000       // 10 MB
 #define DEFAULT_WEEKLY_MEM_LIMIT 50000      // 50 MB
 #define DEFAULT_MONTHLY_MEM_LIMIT 200000    // 200 MB
@@ -30,6 +67,7 @@
 #define DEFAULT_WEEKLY_INTERVAL 1440
 #define DEFAULT_MONTHLY_INTERVAL 10080
 #define DEFAULT_YEARLY_INTERVAL 43200
+#define DEFAULT_BINARIES_CODEC "none"
 
 static void set_default_binaries_limits(binaries_limits_for_project_t *limits) {
     if (!limits) return;
@@ -40,6 +78,32 @@ static void set_default_binaries_limits(binaries_limits_for_project_t *limits) {
     limits->weekly_interval = DEFAULT_WEEKLY_INTERVAL;
     limits->monthly_interval = DEFAULT_MONTHLY_INTERVAL;
     limits->yearly_interval = DEFAULT_YEARLY_INTERVAL;
+    snprintf(limits->codec, sizeof(limits->codec), "%s", DEFAULT_BINARIES_CODEC);
+}
+
+static void set_default_phase_timeouts(phase_timeouts_t *timeouts) {
+    timeouts->install = DEFAULT_INSTALL_TIMEOUT;
+    timeouts->fetch = DEFAULT_FETCH_TIMEOUT;
+    timeouts->configure = DEFAULT_CONFIGURE_TIMEOUT;
+    timeouts->build = DEFAULT_BUILD_TIMEOUT;
+    timeouts->publish = DEFAULT_PUBLISH_TIMEOUT;
+    timeouts->inactivity = DEFAULT_INACTIVITY_TIMEOUT;
+}
+
+static void set_default_cgroup_limits(cgroup_limits_t *limits) {
+    snprintf(limits->enabled, sizeof(limits->enabled), "%s", DEFAULT_CGROUP_ENABLED);
+    snprintf(limits->cpu_weight, sizeof(limits->cpu_weight), "%s", DEFAULT_CGROUP_CPU_WEIGHT);
+    snprintf(limits->memory_high, sizeof(limits->memory_high), "%s", DEFAULT_CGROUP_MEMORY_HIGH);
+    snprintf(limits->memory_max, sizeof(limits->memory_max), "%s", DEFAULT_CGROUP_MEMORY_MAX);
+    snprintf(limits->pids_max, sizeof(limits->pids_max), "%s", DEFAULT_CGROUP_PIDS_MAX);
+}
+
+static void set_default_admission(admission_t *admission) {
+    admission->cpu = DEFAULT_ADMISSION_CPU;
+    admission->memory = DEFAULT_ADMISSION_MEMORY;
+    admission->io = DEFAULT_ADMISSION_IO;
+    admission->check_interval = DEFAULT_ADMISSION_CHECK_INTERVAL;
+    admission->max_wait = DEFAULT_ADMISSION_MAX_WAIT;
 }
 
 static int ensure_default_binaries_limits(project_t *prj) {
@@ -81,7 +145,7 @@ static int ensure_default_architectures(project_t *prj) {
 
 static int load_project(project_t *prj, yaml_parser_t *parser) {
 
-    typedef enum { SEC_NONE, SEC_BINARIES_CFG, SEC_BIN_INTERVAL, SEC_BIN_MEM, SEC_SOURCE, SEC_MAIN_REPO, SEC_DEP_REPO_ITEM, SEC_BUILD_CFG } Section;
+    typedef enum { SEC_NONE, SEC_BINARIES_CFG, SEC_BIN_INTERVAL, SEC_BIN_MEM, SEC_SOURCE, SEC_MAIN_REPO, SEC_DEP_REPO_ITEM, SEC_BUILD_CFG, SEC_BUILD_TIMEOUTS, SEC_BUILD_CGROUP, SEC_BUILD_ADMISSION, SEC_BUILD_BINARY, SEC_BUILD_TEST, SEC_BUILD_BENCH, SEC_BUILD_DURATIONS } Section;
     typedef enum { SEQ_NONE, SEQ_DEPS, SEQ_DEP_REPOS, SEQ_ARCH } ActiveSeq;
 
     Section section = SEC_NONE;
@@ -97,7 +161,27 @@ static int load_project(project_t *prj, yaml_parser_t *parser) {
     if (ensure_default_architectures(prj) != 0) return 1;
     if (ensure_default_binaries_limits(prj) != 0) return 1;
     snprintf(prj->build_mode, sizeof(prj->build_mode), "%s", DEFAULT_BUILD_MODE);
+    snprintf(prj->cross_mode, sizeof(prj->cross_mode), "%s", DEFAULT_CROSS_MODE);
+    snprintf(prj->tmpfs_build, sizeof(prj->tmpfs_build), "%s", DEFAULT_TMPFS_BUILD);
+    prj->tmpfs_budget_mb = DEFAULT_TMPFS_BUDGET_MB;
     prj->poll_interval = DEFAULT_POLL_INTERVAL;
+    set_default_phase_timeouts(&prj->timeouts);
+    set_default_cgroup_limits(&prj->cgroup);
+    set_default_admission(&prj->admission);
+    snprintf(prj->binary.name, sizeof(prj->binary.name), "%s", DEFAULT_BINARY_NAME);
+    snprintf(prj->binary.linkage, sizeof(prj->binary.linkage), "%s", DEFAULT_BINARY_LINKAGE);
+    snprintf(prj->test.enabled, sizeof(prj->test.enabled), "%s", DEFAULT_TEST_ENABLED);
+    snprintf(prj->test.command, sizeof(prj->test.command), "%s", DEFAULT_TEST_COMMAND);
+    prj->test.shards = DEFAULT_TEST_SHARDS;
+    prj->test.time_budget = DEFAULT_TEST_TIME_BUDGET;
+    snprintf(prj->bench.enabled, sizeof(prj->bench.enabled), "%s", DEFAULT_BENCH_ENABLED);
+    snprintf(prj->bench.command, sizeof(prj->bench.command), "%s", DEFAULT_BENCH_COMMAND);
+    prj->bench.runs = DEFAULT_BENCH_RUNS;
+    prj->bench.threshold = DEFAULT_BENCH_THRESHOLD;
+    prj->bench.time_budget = DEFAULT_BENCH_TIME_BUDGET;
+    prj->duration_alerts.window = DEFAULT_DURATION_WINDOW;
+    prj->duration_alerts.slowdown_factor = DEFAULT_DURATION_SLOWDOWN;
+    prj->duration_alerts.min_seconds = DEFAULT_DURATION_MIN_SECONDS;
 
     int add_result = 0;
 
@@ -117,15 +201,18 @@ static int load_project(project_t *prj, yaml_parser_t *parser) {
                 // General case: we are now reading the value corresponding to last_key 
                 else {
                     // First events: name and target dir
-                    if (strcmp(last_key, "name") == 0) {
+                    if (strcmp(last_key, "name") == 0 && section == SEC_NONE) {
                         snprintf(prj->name, sizeof(prj->name), "%s", val);
                         last_key[0] = '\0';
-                    } else if (strcmp(last_key, "target_dir") == 0) {
+                    } else if (strcmp(last_key, "target_dir") == 0 && section == SEC_NONE) {
                         snprintf(prj->target_dir, sizeof(prj->target_dir), "%s", val);
                         last_key[0] = '\0';
                     }
                     // General case 1: we are in a section and we're reading a key-value pair (we always need to reset the last key here)
-                    else if (section == SEC_BIN_INTERVAL) {
+                    else if (section == SEC_BINARIES_CFG) {
+                        if (strcmp(last_key, "codec") == 0) snprintf(prj->binaries_limits->codec, sizeof(prj->binaries_limits->codec), "%s", val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BIN_INTERVAL) {
                         if (strcmp(last_key, "weekly") == 0) prj->binaries_limits->weekly_interval = atoi(val);
                         else if (strcmp(last_key, "monthly") == 0) prj->binaries_limits->monthly_interval = atoi(val);
                         else if (strcmp(last_key, "yearly") == 0) prj->binaries_limits->yearly_interval = atoi(val);
@@ -150,6 +237,53 @@ static int load_project(project_t *prj, yaml_parser_t *parser) {
                     } else if (section == SEC_BUILD_CFG) {
                         if (strcmp(last_key, "build_mode") == 0) snprintf(prj->build_mode, sizeof(prj->build_mode), "%s", val);
                         else if (strcmp(last_key, "poll_interval") == 0) prj->poll_interval = atoi(val);
+                        else if (strcmp(last_key, "cross_mode") == 0) snprintf(prj->cross_mode, sizeof(prj->cross_mode), "%s", val);
+                        else if (strcmp(last_key, "tmpfs_build") == 0) snprintf(prj->tmpfs_build, sizeof(prj->tmpfs_build), "%s", val);
+                        else if (strcmp(last_key, "tmpfs_budget_mb") == 0) prj->tmpfs_budget_mb = atoi(val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BUILD_TIMEOUTS) {
+                        if (strcmp(last_key, "install") == 0) prj->timeouts.install = atoi(val);
+                        else if (strcmp(last_key, "fetch") == 0) prj->timeouts.fetch = atoi(val);
+                        else if (strcmp(last_key, "configure") == 0) prj->timeouts.configure = atoi(val);
+                        else if (strcmp(last_key, "build") == 0) prj->timeouts.build = atoi(val);
+                        else if (strcmp(last_key, "publish") == 0) prj->timeouts.publish = atoi(val);
+                        else if (strcmp(last_key, "inactivity") == 0) prj->timeouts.inactivity = atoi(val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BUILD_CGROUP) {
+                        if (strcmp(last_key, "enabled") == 0) snprintf(prj->cgroup.enabled, sizeof(prj->cgroup.enabled), "%s", val);
+                        else if (strcmp(last_key, "cpu_weight") == 0) snprintf(prj->cgroup.cpu_weight, sizeof(prj->cgroup.cpu_weight), "%s", val);
+                        else if (strcmp(last_key, "memory_high") == 0) snprintf(prj->cgroup.memory_high, sizeof(prj->cgroup.memory_high), "%s", val);
+                        else if (strcmp(last_key, "memory_max") == 0) snprintf(prj->cgroup.memory_max, sizeof(prj->cgroup.memory_max), "%s", val);
+                        else if (strcmp(last_key, "pids_max") == 0) snprintf(prj->cgroup.pids_max, sizeof(prj->cgroup.pids_max), "%s", val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BUILD_ADMISSION) {
+                        if (strcmp(last_key, "cpu") == 0) prj->admission.cpu = atoi(val);
+                        else if (strcmp(last_key, "memory") == 0) prj->admission.memory = atoi(val);
+                        else if (strcmp(last_key, "io") == 0) prj->admission.io = atoi(val);
+                        else if (strcmp(last_key, "check_interval") == 0) prj->admission.check_interval = atoi(val);
+                        else if (strcmp(last_key, "max_wait") == 0) prj->admission.max_wait = atoi(val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BUILD_BINARY) {
+                        if (strcmp(last_key, "name") == 0) snprintf(prj->binary.name, sizeof(prj->binary.name), "%s", val);
+                        else if (strcmp(last_key, "linkage") == 0) snprintf(prj->binary.linkage, sizeof(prj->binary.linkage), "%s", val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BUILD_TEST) {
+                        if (strcmp(last_key, "enabled") == 0) snprintf(prj->test.enabled, sizeof(prj->test.enabled), "%s", val);
+                        else if (strcmp(last_key, "command") == 0) snprintf(prj->test.command, sizeof(prj->test.command), "%s", val);
+                        else if (strcmp(last_key, "shards") == 0) prj->test.shards = atoi(val);
+                        else if (strcmp(last_key, "time_budget") == 0) prj->test.time_budget = atoi(val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BUILD_BENCH) {
+                        if (strcmp(last_key, "enabled") == 0) snprintf(prj->bench.enabled, sizeof(prj->bench.enabled), "%s", val);
+                        else if (strcmp(last_key, "command") == 0) snprintf(prj->bench.command, sizeof(prj->bench.command), "%s", val);
+                        else if (strcmp(last_key, "runs") == 0) prj->bench.runs = atoi(val);
+                        else if (strcmp(last_key, "threshold") == 0) prj->bench.threshold = atoi(val);
+                        else if (strcmp(last_key, "time_budget") == 0) prj->bench.time_budget = atoi(val);
+                        last_key[0] = '\0';
+                    } else if (section == SEC_BUILD_DURATIONS) {
+                        if (strcmp(last_key, "window") == 0) prj->duration_alerts.window = atoi(val);
+                        else if (strcmp(last_key, "slowdown_factor") == 0) prj->duration_alerts.slowdown_factor = atof(val);
+                        else if (strcmp(last_key, "min_seconds") == 0) prj->duration_alerts.min_seconds = atoi(val);
                         last_key[0] = '\0';
                     }
                     // General case 2: we received a scalar event due to a string-only list entry of a sequence (so we must be in a sequence). Here we mustn't reset last_key because the next scalar event will be a new value (if I reset it here, I will lose the context and read it as a key instead of a value)
@@ -210,6 +344,20 @@ static int load_project(project_t *prj, yaml_parser_t *parser) {
                     prj->manual_dep_count++;
                 } else if (strcmp(last_key, "build-config") == 0 && section == SEC_NONE) {
                     section = SEC_BUILD_CFG;
+                } else if (strcmp(last_key, "timeouts") == 0 && section == SEC_BUILD_CFG) {
+                    section = SEC_BUILD_TIMEOUTS;
+                } else if (strcmp(last_key, "cgroup") == 0 && section == SEC_BUILD_CFG) {
+                    section = SEC_BUILD_CGROUP;
+                } else if (strcmp(last_key, "admission") == 0 && section == SEC_BUILD_CFG) {
+                    section = SEC_BUILD_ADMISSION;
+                } else if (strcmp(last_key, "binary") == 0 && section == SEC_BUILD_CFG) {
+                    section = SEC_BUILD_BINARY;
+                } else if (strcmp(last_key, "test") == 0 && section == SEC_BUILD_CFG) {
+                    section = SEC_BUILD_TEST;
+                } else if (strcmp(last_key, "benchmark") == 0 && section == SEC_BUILD_CFG) {
+                    section = SEC_BUILD_BENCH;
+                } else if (strcmp(last_key, "duration_alerts") == 0 && section == SEC_BUILD_CFG) {
+                    section = SEC_BUILD_DURATIONS;
                 }
                 // Reset last_key: this operation is necessary because after a mapping start event we always expect a key next and we probably just read a key before
                 last_key[0] = '\0';
@@ -222,7 +370,15 @@ static int load_project(project_t *prj, yaml_parser_t *parser) {
                 else if (section == SEC_BIN_MEM) section = SEC_BINARIES_CFG;
                 else if (section == SEC_MAIN_REPO) section = SEC_SOURCE;
                 else if (section == SEC_DEP_REPO_ITEM) section = SEC_SOURCE;
+                else if (section == SEC_SOURCE) section = SEC_NONE;
                 else if (section == SEC_BUILD_CFG) section = SEC_NONE;
+                else if (section == SEC_BUILD_TIMEOUTS) section = SEC_BUILD_CFG;
+                else if (section == SEC_BUILD_CGROUP) section = SEC_BUILD_CFG;
+                else if (section == SEC_BUILD_ADMISSION) section = SEC_BUILD_CFG;
+                else if (section == SEC_BUILD_BINARY) section = SEC_BUILD_CFG;
+                else if (section == SEC_BUILD_TEST) section = SEC_BUILD_CFG;
+                else if (section == SEC_BUILD_BENCH) section = SEC_BUILD_CFG;
+                else if (section == SEC_BUILD_DURATIONS) section = SEC_BUILD_CFG;
                 break;
             case YAML_SEQUENCE_START_EVENT:
                 // Handle start of sequence events: increase depth and set sequence type
@@ -240,7 +396,8 @@ static int load_project(project_t *prj, yaml_parser_t *parser) {
                 // Handle end of sequence events: restore the previous sequence type and decrease depth
                 depth--;
                 if (seq == SEQ_DEP_REPOS) cur_manual = NULL;
-                seq = SEQ_NONE;
+                // The dependencies of a dependency_repos item are nested in the dependency_repos list, which goes on with the next item
+                seq = (seq == SEQ_DEPS && section == SEC_DEP_REPO_ITEM) ? SEQ_DEP_REPOS : SEQ_NONE;
                 // Reset last_key: after a sequence ends we always expect a new key next
                 // Note: if we came from the sequence end of SEQ_DEP_REPOS, the last_key was already reset in the mapping end event of the last item; if we came from SEQ_DEPS instead, we need to reset it here
                 last_key[0] = '\0';
@@ -257,6 +414,9 @@ int load_config(Config *cfg) {
     if (!cfg) return 1;
 
     memset(cfg, 0, sizeof(Config));
+    snprintf(cfg->chroot_session, sizeof(cfg->chroot_session), "%s", DEFAULT_CHROOT_SESSION);
+    cfg->max_active_projects = DEFAULT_MAX_ACTIVE_PROJECTS;
+    snprintf(cfg->artifact_server, sizeof(cfg->artifact_server), "%s", DEFAULT_ARTIFACT_SERVER);
 
     FILE *config_file = fopen_expanding_tilde(DEFAULT_CONFIG_PATH, "rb");
     if (!config_file) {
@@ -296,6 +456,12 @@ int load_config(Config *cfg) {
                         if (strcmp(top_last_key, "build_dir") == 0) {
                             snprintf(cfg->build_dir, sizeof(cfg->build_dir), "%s", val);
                             snprintf(cfg->main_log_file, sizeof(cfg->main_log_file), "%s/logs/main.log", cfg->build_dir);
+                        } else if (strcmp(top_last_key, "chroot_session") == 0) {
+                            snprintf(cfg->chroot_session, sizeof(cfg->chroot_session), "%s", val);
+                        } else if (strcmp(top_last_key, "max_active_projects") == 0) {
+                            cfg->max_active_projects = atoi(val);
+                        } else if (strcmp(top_last_key, "artifact_server") == 0) {
+                            snprintf(cfg->artifact_server, sizeof(cfg->artifact_server), "%s", val);
                         }
                         top_last_key[0] = '\0';
                     }
@@ -337,7 +503,7 @@ int load_config(Config *cfg) {
                     // Add paths required by the worker responsible for building this project
                     snprintf(prj->main_project_build_dir, sizeof(prj->main_project_build_dir), "%s/%s", cfg->build_dir, prj->name);
                     snprintf(prj->worker_log_file, sizeof(prj->worker_log_file), "%s/logs/worker.log", prj->main_project_build_dir);
-                    snprintf(prj->cronjob_log_file, sizeof(prj->cronjob_log_file), "%s/logs/binaries_rotation_cronjob.log", prj->main_project_build_dir);
+                    snprintf(prj->rotation_log_file, sizeof(prj->rotation_log_file), "%s/logs/binaries_rotation.log", prj->main_project_build_dir);
                 }
                 break;
             case YAML_SEQUENCE_END_EVENT:
@@ -362,4 +528,77 @@ int load_config(Config *cfg) {
         cfg->project_count = project_loaded;
     }
     return 0;
-}
\ No newline at end of file
+}
+// Frees a project loaded by load_config, with its manual dependencies and the strings they own
+void free_project(project_t *prj) {
+    if (!prj) return;
+    for (int i = 0; i < prj->arch_count; i++) free(prj->architectures[i]);
+    for (int i = 0; i < prj->dep_count; i++) free(prj->dependency_packages[i]);
+    manual_dependency_t *cur_manual = prj->manual_dependencies;
+    while (cur_manual) {
+        manual_dependency_t *next_manual = cur_manual->next;
+        for (int i = 0; i < cur_manual->dep_count; i++) free(cur_manual->dependencies[i]);
+        free(cur_manual);
+        cur_manual = next_manual;
+    }
+    free(prj->binaries_limits);
+    free(prj);
+}
+
+// Frees all the projects of cfg (also those of a configuration whose loading failed halfway)
+void free_config_projects(Config *cfg) {
+    project_t *current = cfg->projects;
+    while (current) {
+        project_t *next = current->next;
+        free_project(current);
+        current = next;
+    }
+    cfg->projects = NULL;
+    cfg->project_count = 0;
+}
+
+static int string_lists_equal(char *const a[], int a_count, char *const b[], int b_count) {
+    if (a_count != b_count) return 0;
+    for (int i = 0; i < a_count; i++) {
+        if (strcmp(a[i], b[i]) != 0) return 0;
+    }
+    return 1;
+}
+
+// Returns 1 if two loaded projects have the same configuration (the derived paths follow from build_dir and the name)
+int project_config_equal(const project_t *a, const project_t *b) {
+    if (strcmp(a->name, b->name) != 0 || strcmp(a->target_dir, b->target_dir) != 0 || strcmp(a->repo_url, b->repo_url) != 0 ||
+        strcmp(a->main_repo_build_system, b->main_repo_build_system) != 0 || strcmp(a->build_mode, b->build_mode) != 0 ||
+        strcmp(a->cross_mode, b->cross_mode) != 0 || strcmp(a->tmpfs_build, b->tmpfs_build) != 0 || a->tmpfs_budget_mb != b->tmpfs_budget_mb ||
+        a->poll_interval != b->poll_interval) {
+        return 0;
+    }
+    if (memcmp(&a->timeouts, &b->timeouts, sizeof(a->timeouts)) != 0 || memcmp(&a->admission, &b->admission, sizeof(a->admission)) != 0 ||
+        memcmp(a->binaries_limits, b->binaries_limits, offsetof(binaries_limits_for_project_t, codec)) != 0 || strcmp(a->binaries_limits->codec, b->binaries_limits->codec) != 0) {
+        return 0;
+    }
+    if (strcmp(a->cgroup.enabled, b->cgroup.enabled) != 0 || strcmp(a->cgroup.cpu_weight, b->cgroup.cpu_weight) != 0 ||
+        strcmp(a->cgroup.memory_high, b->cgroup.memory_high) != 0 || strcmp(a->cgroup.memory_max, b->cgroup.memory_max) != 0 ||
+        strcmp(a->cgroup.pids_max, b->cgroup.pids_max) != 0 || strcmp(a->binary.name, b->binary.name) != 0 || strcmp(a->binary.linkage, b->binary.linkage) != 0) {
+        return 0;
+    }
+    if (strcmp(a->test.enabled, b->test.enabled) != 0 || strcmp(a->test.command, b->test.command) != 0 || a->test.shards != b->test.shards ||
+        a->test.time_budget != b->test.time_budget || strcmp(a->bench.enabled, b->bench.enabled) != 0 || strcmp(a->bench.command, b->bench.command) != 0 ||
+        a->bench.runs != b->bench.runs || a->bench.threshold != b->bench.threshold || a->bench.time_budget != b->bench.time_budget ||
+        memcmp(&a->duration_alerts, &b->duration_alerts, sizeof(a->duration_alerts)) != 0) {
+        return 0;
+    }
+    if (!string_lists_equal(a->architectures, a->arch_count, b->architectures, b->arch_count) ||
+        !string_lists_equal(a->dependency_packages, a->dep_count, b->dependency_packages, b->dep_count) ||
+        a->manual_dep_count != b->manual_dep_count) {
+        return 0;
+    }
+    const manual_dependency_t *ma = a->manual_dependencies, *mb = b->manual_dependencies;
+    for (; ma && mb; ma = ma->next, mb = mb->next) {
+        if (strcmp(ma->git_url, mb->git_url) != 0 || strcmp(ma->build_system, mb->build_system) != 0 ||
+            !string_lists_equal(ma->dependencies, ma->dep_count, mb->dependencies, mb->dep_count)) {
+            return 0;
+        }
+    }
+    return !ma && !mb;
+}
@@ -0,0 +1,895 @@
+#define _GNU_SOURCE     // accept4, memfd_create, memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "server/artifact_server.h"
+#include "store/artifact_codec.h"
+#include "store/artifact_index.h"
+#include "store/artifact_store.h"
+#include "store/rotation.h"
+#include "control/control.h"
+#include "utils/utils.h"
+
+/*
+    Artifact server.
+    An optional, read-only HTTP/1.1 server of the target dirs (artifact_server in config.yml), so that test rigs download the binaries
+    instead of reading the target dirs over NFS:
+        GET /<project>/<tier>/<entry>       an entry of a tier (daily, weekly, monthly, yearly)
+        GET /latest/<project>/<arch>        the newest binary of the project for arch (Content-Location tells which entry it is)
+        GET /index.json, /<project>/        the live artifacts of every project (or of one) with their build data, as JSON
+    HEAD is answered as well. The server runs in a thread of its own, with its own epoll loop on non-blocking sockets, so that slow
+    clients cost a connection slot each and never hold the supervisor. A binary is sent with sendfile() straight from the object of the
+    store (no copy through user space), SERVER_SENDFILE_CHUNK at a time and at most SERVER_CHUNKS_PER_TURN chunks per connection before
+    the loop serves the others. An entry encoded by the codec of its tier (see artifact_codec.c) is decoded once into a memfd, kept for
+    the next downloads in a small LRU cache, and sent from there the same way. Decoding (delta, zstd and the sha256 check) takes far
+    longer than a turn of the loop, so the loop only queues the object in the cache and answers 503 with Retry-After: a decoder thread
+    fills its memfd meanwhile, and the retried download is sent from the cache.
+    The ETag of a binary is its sha256, read from the name of the object its entry links (a legacy plain file gets a weak one from its
+    inode, size and mtime), so If-None-Match costs a readlink and no hashing. A single byte range (Range: bytes=a-b, a- or -n, with
+    If-Range) is answered with 206; several ranges get the whole binary, as RFC 9110 allows. Connections are kept alive, pipelined
+    requests are answered in order, and a connection idle for SERVER_IDLE_TIMEOUT_S is closed.
+    The latest aliases and the listings are read from the artifact index of the target dir (see artifact_index.c), loaded without the
+    lock of the store and kept until its log or snapshot changes. The projects are handed over by the supervisor (at start and after
+    each reload) under a mutex, and the decoded cache is shared with the decoder thread under another; everything else belongs to the
+    server thread.
+*/
+
+#define SERVER_TAG_LISTEN UINT64_MAX
+#define SERVER_TAG_WAKE (UINT64_MAX - 1)
+#define SERVER_HEAD_MAX 1024
+
+typedef struct connection {
+    int fd;
+    char request[SERVER_REQUEST_MAX];
+    size_t request_len;
+    char head[SERVER_HEAD_MAX];             // Of the response being sent
+    size_t head_len;
+    size_t head_sent;
+    json_buf_t body;                        // In-memory body (listings, errors)
+    size_t body_sent;
+    int file_fd;                            // Binary being sent, from file_offset to file_end (exclusive)
+    off_t file_offset;
+    off_t file_end;
+    int sending;
+    int keep_alive;
+    time_t last_active;
+} connection_t;
+
+#define DECODED_FREE 0
+#define DECODED_QUEUED 1                    // Waiting for the decoder thread
+#define DECODED_DECODING 2
+#define DECODED_READY 3
+#define DECODED_FAILED 4                    // Reported (with its errno) to the next request, then freed
+
+// Decoded copy of an encoded object of a store
+typedef struct decoded_object {
+    char path[MAX_CONFIG_ATTR_LEN * 2];     // Of the object
+    char store_dir[MAX_CONFIG_ATTR_LEN];
+    char object[MAX_CONFIG_ATTR_LEN];       // Name in the store
+    int state;
+    int fd;                                 // memfd when ready, -1 otherwise
+    int error;                              // errno of a failed decode
+    unsigned long used;                     // LRU clock
+} decoded_object_t;
+
+typedef struct cached_index {
+    char target_dir[CONFIG_ATTR_LEN];
+    artifact_index_t index;
+    struct stat log_st;                     // As loaded: a change of either file makes the index load again
+    struct stat snapshot_st;
+    struct cached_index *next;
+} cached_index_t;
+
+// An entry opened for a download
+typedef struct served_entry {
+    int fd;
+    off_t size;
+    char etag[SHA256_HEX_LEN + 8];
+    char last_modified[64];
+} served_entry_t;
+
+struct artifact_server {
+    int listen_fd;
+    int wake_fd;
+    int epoll_fd;
+    FILE *log_fp;
+    char address[MIN_CONFIG_ATTR_LEN];
+    pthread_t thread;
+    volatile int stopping;
+
+    pthread_mutex_t lock;                   // Guards the projects
+    artifact_server_project_t *projects;
+    int project_count;
+
+    connection_t *connections[SERVER_MAX_CONNECTIONS];
+    int connection_count;
+
+    pthread_mutex_t decode_lock;            // Guards the decoded cache, shared with the decoder thread
+    pthread_cond_t decode_cond;             // Signaled when an object is queued (or on stop)
+    pthread_t decoder;
+    int decoder_started;
+    decoded_object_t decoded[SERVER_DECODED_CACHE];
+    unsigned long decoded_clock;
+    cached_index_t *indexes;
+    unsigned long long requests;
+    unsigned long long bytes_sent;
+};
+
+/* Listening */
+
+// Splits "<host>:<port>", "[<ipv6>]:<port>" or "<port>" (numeric hosts) and binds a listening socket on it; returns the socket, -1 on failure
+static int listen_on(const char *address) {
+    char host[MIN_CONFIG_ATTR_LEN];
+    const char *port = strrchr(address, ':');
+    if (!port) {
+        snprintf(host, sizeof(host), "%s", SERVER_DEFAULT_HOST);
+        port = address;
+    } else {
+        const char *start = address, *end = port;
+        if (*start == '[' && end > start && end[-1] == ']') {
+            start++;
+            end--;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(end - start), start);
+        port++;
+    }
+    char *rest;
+    long port_number = strtol(port, &rest, 10);
+    if (rest == port || *rest || port_number <= 0 || port_number > 65535) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Numeric addresses only: the resolver of glibc has no place in a static binary
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    struct sockaddr_in *in4 = (struct sockaddr_in *)&addr;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+    if (inet_pton(AF_INET, host, &in4->sin_addr) == 1) {
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons((uint16_t)port_number);
+        addr_len = sizeof(*in4);
+    } else if (inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons((uint16_t)port_number);
+        addr_len = sizeof(*in6);
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 || bind(fd, (struct sockaddr *)&addr, addr_len) != 0 || listen(fd, SOMAXCONN) != 0)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/* Responses */
+
+static const char *status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+// Starts the head of a response; extra holds the header lines specific to it (each ending with \r\n)
+static void set_head(connection_t *c, int status, const char *content_type, long long length, const char *extra) {
+    int len = snprintf(c->head, sizeof(c->head), "HTTP/1.1 %d %s\r\nServer: v2ci\r\n%s%s%sContent-Length: %lld\r\n%sConnection: %s\r\n\r\n", status,
+        status_text(status), status == 304 ? "" : "Content-Type: ", status == 304 ? "" : content_type, status == 304 ? "" : "\r\n", length, extra ? extra : "",
+        c->keep_alive ? "keep-alive" : "close");
+    c->head_len = len > 0 && (size_t)len < sizeof(c->head) ? (size_t)len : 0;
+    c->head_sent = 0;
+}
+
+// Answers with a JSON body (taken over from body); a HEAD request only gets its head
+static void respond_json(connection_t *c, int status, json_buf_t *body, int head_only, const char *extra) {
+    if (body->failed) {
+        json_free(body);
+        status = 500;
+        json_printf(body, "{\"error\":\"out of memory\"}\n");
+    }
+    set_head(c, status, "application/json", (long long)body->len, extra);
+    if (head_only) json_free(body);
+    c->body = *body;
+    c->body_sent = 0;
+    memset(body, 0, sizeof(*body));
+}
+
+static void respond_error(connection_t *c, int status, const char *message, int head_only, const char *extra) {
+    json_buf_t body = { 0 };
+    json_printf(&body, "{\"error\":");
+    json_string(&body, message);
+    json_printf(&body, "}\n");
+    respond_json(c, status, &body, head_only, extra);
+}
+
+/* Entries */
+
+static int has_suffix(const char *s, const char *suffix) {
+    size_t len = strlen(s), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+// memfd holding the decoded binary of store_dir/object (-1 on failure, errno set)
+static int decode_object(const char *store_dir, const char *object) {
+    codec_buf_t buf = { 0 };
+    if (store_load_object(store_dir, object, &buf) != 0) return -1;
+    int fd = memfd_create("v2ci-artifact", MFD_CLOEXEC);
+    size_t written = 0;
+    while (fd >= 0 && written < buf.len) {
+        ssize_t n = write(fd, buf.data + written, buf.len - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            int err = n < 0 ? errno : EIO;
+            close(fd);
+            fd = -1;
+            errno = err;
+            break;
+        }
+        written += (size_t)n;
+    }
+    codec_buf_free(&buf);
+    return fd;
+}
+
+// Decodes the queued objects of the cache, one at a time, out of the lock
+static void *decoder_thread(void *arg) {
+    artifact_server_t *server = (artifact_server_t *)arg;
+    pthread_mutex_lock(&server->decode_lock);
+    while (!server->stopping) {
+        decoded_object_t *d = NULL;
+        for (int i = 0; i < SERVER_DECODED_CACHE && !d; i++) {
+            if (server->decoded[i].state == DECODED_QUEUED) d = &server->decoded[i];
+        }
+        if (!d) {
+            pthread_cond_wait(&server->decode_cond, &server->decode_lock);
+            continue;
+        }
+        // A slot being decoded is never evicted, so its names stay put while unlocked
+        d->state = DECODED_DECODING;
+        pthread_mutex_unlock(&server->decode_lock);
+        int fd = decode_object(d->store_dir, d->object);
+        int err = errno;
+        if (fd < 0 && err != ENOENT) {
+            formatted_log(server->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Artifact server: unable to decode %s: %s", d->path, strerror(err));
+        }
+        pthread_mutex_lock(&server->decode_lock);
+        d->fd = fd;
+        d->error = err;
+        d->state = fd >= 0 ? DECODED_READY : DECODED_FAILED;
+    }
+    pthread_mutex_unlock(&server->decode_lock);
+    return NULL;
+}
+
+// memfd holding the decoded binary of an encoded object (a duplicate for the caller); -1 on failure (errno set), -2 while the decoder
+// thread is at it (the object is queued if it was not)
+static int decoded_fd(artifact_server_t *server, const char *store_dir, const char *object) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/%s", store_dir, object);
+    int fd = -2;
+    pthread_mutex_lock(&server->decode_lock);
+    decoded_object_t *slot = NULL;
+    for (int i = 0; i < SERVER_DECODED_CACHE; i++) {
+        decoded_object_t *d = &server->decoded[i];
+        if (d->state != DECODED_FREE && strcmp(d->path, path) == 0) {
+            d->used = ++server->decoded_clock;
+            if (d->state == DECODED_READY) {
+                fd = fcntl(d->fd, F_DUPFD_CLOEXEC, 0);
+            } else if (d->state == DECODED_FAILED) {
+                // Reported once: the next request decodes it again
+                d->state = DECODED_FREE;
+                errno = d->error;
+                fd = -1;
+            }
+            pthread_mutex_unlock(&server->decode_lock);
+            return fd;
+        }
+        if (d->state == DECODED_QUEUED || d->state == DECODED_DECODING) continue;
+        if (!slot || d->state == DECODED_FREE || (slot->state != DECODED_FREE && d->used < slot->used)) slot = d;
+    }
+    // Without a slot (all of them being decoded) nothing is queued, and the retry of the request queues it later
+    if (slot) {
+        if (slot->fd >= 0) close(slot->fd);
+        snprintf(slot->path, sizeof(slot->path), "%s", path);
+        snprintf(slot->store_dir, sizeof(slot->store_dir), "%s", store_dir);
+        snprintf(slot->object, sizeof(slot->object), "%s", object);
+        slot->fd = -1;
+        slot->state = DECODED_QUEUED;
+        slot->used = ++server->decoded_clock;
+        pthread_cond_signal(&server->decode_cond);
+    }
+    pthread_mutex_unlock(&server->decode_lock);
+    return fd;
+}
+
+// Opens <target_dir>/<tier>/<name> for a download, with its validators; returns 0 on success, 404, 500 or 503 (an encoded binary not
+// decoded yet)
+static int open_entry(artifact_server_t *server, const char *target_dir, const char *tier, const char *name, served_entry_t *entry) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    char link[MAX_CONFIG_ATTR_LEN];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s/%s", target_dir, tier, name);
+    if (lstat(path, &st) != 0 || !(S_ISLNK(st.st_mode) || S_ISREG(st.st_mode))) return 404;
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    const char *prefix = "../" STORE_DIR_NAME "/";
+    ssize_t n = S_ISLNK(st.st_mode) ? readlink(path, link, sizeof(link) - 1) : -1;
+    const char *object = NULL;
+    if (n > 0) {
+        link[n] = '\0';
+        if (strncmp(link, prefix, strlen(prefix)) == 0) object = link + strlen(prefix);
+    }
+    if (object && strspn(object, "0123456789abcdef") >= SHA256_HEX_LEN - 1) {
+        snprintf(entry->etag, sizeof(entry->etag), "\"%.*s\"", SHA256_HEX_LEN - 1, object);
+    } else {
+        object = NULL;
+    }
+    if (object && (has_suffix(object, CODEC_ZSTD_SUFFIX) || has_suffix(object, CODEC_DELTA_SUFFIX))) {
+        char store_dir[MAX_CONFIG_ATTR_LEN];
+        snprintf(store_dir, sizeof(store_dir), "%s/" STORE_DIR_NAME, target_dir);
+        entry->fd = decoded_fd(server, store_dir, object);
+        if (entry->fd == -2) return 503;
+        if (entry->fd < 0) return errno == ENOENT ? 404 : 500;
+    } else {
+        entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (entry->fd < 0) return errno == ENOENT ? 404 : 500;
+    }
+    if (fstat(entry->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(entry->fd);
+        return 404;
+    }
+    entry->size = st.st_size;
+    if (!object) {
+        snprintf(entry->etag, sizeof(entry->etag), "W/\"%lx-%llx-%lx\"", (unsigned long)st.st_ino, (unsigned long long)st.st_size, (unsigned long)st.st_mtime);
+    }
+    return 0;
+}
+
+// Value of a header of the request (up to the end of its line, copied into value), or NULL
+static const char *header_value(const char *headers, const char *name, char *value, size_t size) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(headers, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        const char *start = line + 2;
+        if (strncasecmp(start, name, name_len) != 0 || start[name_len] != ':') continue;
+        start += name_len + 1;
+        while (*start == ' ' || *start == '\t') start++;
+        const char *end = strstr(start, "\r\n");
+        snprintf(value, size, "%.*s", (int)(end ? end - start : (long)strlen(start)), start);
+        return value;
+    }
+    return NULL;
+}
+
+// Parses a single range of Range (bytes=a-b, a- or -n) against size; returns 1 for a range (in *start, *end exclusive), 0 to send the
+// whole binary, -1 if it cannot be satisfied
+static int parse_range(const char *range, off_t size, off_t *start, off_t *end) {
+    if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',')) return 0;
+    const char *spec = range + 6;
+    char *rest;
+    if (*spec == '-') {
+        long long suffix = strtoll(spec + 1, &rest, 10);
+        if (rest == spec + 1 || *rest) return 0;
+        if (suffix <= 0 || size == 0) return -1;
+        *start = suffix >= size ? 0 : size - suffix;
+        *end = size;
+        return 1;
+    }
+    long long first = strtoll(spec, &rest, 10);
+    if (rest == spec || *rest != '-' || first < 0) return 0;
+    spec = rest + 1;
+    long long last = size - 1;
+    if (*spec) {
+        last = strtoll(spec, &rest, 10);
+        if (*rest || last < first) return 0;
+    }
+    if (first >= size) return -1;
+    *start = first;
+    *end = (last >= size ? size - 1 : last) + 1;
+    return 1;
+}
+
+static void serve_entry(artifact_server_t *server, connection_t *c, const char *headers, int head_only, const char *target_dir, const char *tier, const char *name, const char *location) {
+    served_entry_t entry;
+    int status = open_entry(server, target_dir, tier, name, &entry);
+    if (status == 503) {
+        respond_error(c, 503, "the binary is being decoded, retry shortly", head_only, "Retry-After: " SERVER_DECODE_RETRY_AFTER "\r\n");
+        return;
+    }
+    if (status != 0) {
+        respond_error(c, status, status == 404 ? "no such binary" : "unable to read the binary", head_only, NULL);
+        return;
+    }
+    char extra[SERVER_HEAD_MAX / 2];
+    int len = snprintf(extra, sizeof(extra), "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\nCache-Control: no-cache\r\nContent-Disposition: attachment; filename=\"%s\"\r\n",
+        entry.etag, entry.last_modified, name);
+    if (location) len += snprintf(extra + len, sizeof(extra) - len, "Content-Location: %s\r\n", location);
+
+    char value[256];
+    if (header_value(headers, "If-None-Match", value, sizeof(value)) && (strcmp(value, "*") == 0 || strstr(value, entry.etag))) {
+        close(entry.fd);
+        json_buf_t empty = { 0 };
+        respond_json(c, 304, &empty, 1, extra);
+        return;
+    }
+    off_t start = 0, end = entry.size;
+    int ranged = 0;
+    if (header_value(headers, "Range", value, sizeof(value))) {
+        char if_range[128];
+        // A range of another version of the binary would be spliced into the old one: send it all
+        if (!header_value(headers, "If-Range", if_range, sizeof(if_range)) || strcmp(if_range, entry.etag) == 0) {
+            ranged = parse_range(value, entry.size, &start, &end);
+        }
+    }
+    if (ranged < 0) {
+        close(entry.fd);
+        snprintf(extra + len, sizeof(extra) - len, "Content-Range: bytes */%lld\r\n", (long long)entry.size);
+        respond_error(c, 416, "range not satisfiable", head_only, extra);
+        return;
+    }
+    if (ranged) {
+        snprintf(extra + len, sizeof(extra) - len, "Content-Range: bytes %lld-%lld/%lld\r\n", (long long)start, (long long)end - 1, (long long)entry.size);
+    }
+    set_head(c, ranged ? 206 : 200, "application/octet-stream", (long long)(end - start), extra);
+    if (head_only) {
+        close(entry.fd);
+        return;
+    }
+    c->file_fd = entry.fd;
+    c->file_offset = start;
+    c->file_end = end;
+}
+
+/* Routes */
+
+// Copies the target dir of a served project; returns 0 if it is served
+static int project_target_dir(artifact_server_t *server, const char *name, char *target_dir, size_t size) {
+    int found = 1;
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < server->project_count && found; i++) {
+        if (strcmp(server->projects[i].name, name) == 0) {
+            snprintf(target_dir, size, "%s", server->projects[i].target_dir);
+            found = 0;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    return found;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Artifact index of a target dir, loaded again if it changed since it was last used; NULL if it cannot be loaded
+static artifact_index_t *served_index(artifact_server_t *server, const char *target_dir) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    struct stat log_st, snapshot_st;
+    memset(&log_st, 0, sizeof(log_st));
+    memset(&snapshot_st, 0, sizeof(snapshot_st));
+    snprintf(path, sizeof(path), "%s/" STORE_DIR_NAME "/" ARTIFACT_INDEX_LOG, target_dir);
+    stat(path, &log_st);
+    snprintf(path, sizeof(path), "%s/" STORE_DIR_NAME "/" ARTIFACT_INDEX_SNAPSHOT, target_dir);
+    stat(path, &snapshot_st);
+    cached_index_t *cached = server->indexes;
+    while (cached && strcmp(cached->target_dir, target_dir) != 0) cached = cached->next;
+    if (cached && same_file(&cached->log_st, &log_st) && same_file(&cached->snapshot_st, &snapshot_st)) return &cached->index;
+    if (!cached) {
+        cached = calloc(1, sizeof(cached_index_t));
+        if (!cached) return NULL;
+        snprintf(cached->target_dir, sizeof(cached->target_dir), "%s", target_dir);
+        cached->next = server->indexes;
+        server->indexes = cached;
+    } else {
+        artifact_index_close(&cached->index, NULL, NULL);
+    }
+    cached->log_st = log_st;
+    cached->snapshot_st = snapshot_st;
+    if (artifact_index_open(target_dir, 0, &cached->index) != 0) {
+        formatted_log(server->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Artifact server: unable to load the artifact index of %s: %s", target_dir, strerror(errno));
+        // Loaded again at the next request
+        memset(&cached->log_st, 0, sizeof(cached->log_st));
+    }
+    return &cached->index;
+}
+
+// Records of a project in the index of its target dir (those imported from the tiers have no project)
+static int project_record(const artifact_record_t *r, const char *project) {
+    return r->tier != ARTIFACT_TIER_REMOVED && (strcmp(r->project, project) == 0 || r->project[0] == '\0');
+}
+
+static void project_json(artifact_server_t *server, const artifact_server_project_t *project, json_buf_t *out) {
+    json_printf(out, "{\"name\":");
+    json_string(out, project->name);
+    json_printf(out, ",\"artifacts\":[");
+    artifact_index_t *index = served_index(server, project->target_dir);
+    int first = 1;
+    for (int i = 0; index && i < index->count; i++) {
+        const artifact_record_t *r = &index->records[i];
+        if (!project_record(r, project->name)) continue;
+        char url[MAX_CONFIG_ATTR_LEN];
+        snprintf(url, sizeof(url), "/%s/%s/%s", project->name, artifact_index_tier_name(r->tier), r->name);
+        json_printf(out, first ? "" : ",");
+        artifact_index_record_json(out, r, "url", url);
+        first = 0;
+    }
+    json_printf(out, "]}");
+}
+
+// Lists the live artifacts of the named project, or of all of them (name NULL); returns 404 for a project not served
+static int list_projects(artifact_server_t *server, const char *name, json_buf_t *out) {
+    pthread_mutex_lock(&server->lock);
+    int count = server->project_count;
+    artifact_server_project_t *projects = malloc((count ? count : 1) * sizeof(artifact_server_project_t));
+    if (projects) memcpy(projects, server->projects, count * sizeof(artifact_server_project_t));
+    pthread_mutex_unlock(&server->lock);
+    if (!projects) return 500;
+    int listed = 0;
+    json_printf(out, "{\"projects\":[");
+    for (int i = 0; i < count; i++) {
+        if (name && strcmp(projects[i].name, name) != 0) continue;
+        if (listed++) json_printf(out, ",");
+        project_json(server, &projects[i], out);
+    }
+    json_printf(out, "]}\n");
+    free(projects);
+    return name && !listed ? 404 : 200;
+}
+
+// Splits the path of the request into at most max segments (the last one may not contain a '/'); returns their number, -1 if the path is not acceptable
+static int split_path(char *path, char *segments[], int max) {
+    if (path[0] != '/') return -1;
+    int count = 0;
+    char *save = NULL;
+    for (char *segment = strtok_r(path + 1, "/", &save); segment; segment = strtok_r(NULL, "/", &save)) {
+        // No hidden entries (the store, the temporary links) and no way out of the tiers
+        if (segment[0] == '.' || count == max) return -1;
+        segments[count++] = segment;
+    }
+    return count;
+}
+
+static void handle_request(artifact_server_t *server, connection_t *c, char *request) {
+    server->requests++;
+    char method[16], target[SERVER_REQUEST_MAX], version[16];
+    if (sscanf(request, "%15s %8191s %15s", method, target, version) != 3 || strncmp(version, "HTTP/1.", 7) != 0) {
+        c->keep_alive = 0;
+        respond_error(c, 400, "malformed request", 0, NULL);
+        return;
+    }
+    char connection[64];
+    int http10 = strcmp(version, "HTTP/1.0") == 0;
+    const char *conn = header_value(request, "Connection", connection, sizeof(connection));
+    c->keep_alive = conn ? strcasecmp(conn, "close") != 0 && (!http10 || strcasecmp(conn, "keep-alive") == 0) : !http10;
+    int head_only = strcmp(method, "HEAD") == 0;
+    if (!head_only && strcmp(method, "GET") != 0) {
+        respond_error(c, 405, "only GET and HEAD are served", 0, "Allow: GET, HEAD\r\n");
+        return;
+    }
+    target[strcspn(target, "?#")] = '\0';
+    char *segments[3];
+    int count = split_path(target, segments, 3);
+    char target_dir[CONFIG_ATTR_LEN];
+    json_buf_t body = { 0 };
+    if (count == 0 || (count == 1 && strcmp(segments[0], "index.json") == 0)) {
+        int status = list_projects(server, NULL, &body);
+        respond_json(c, status, &body, head_only, NULL);
+    } else if ((count == 1 || (count == 2 && strcmp(segments[1], "index.json") == 0)) && strcmp(segments[0], "latest") != 0) {
+        int status = list_projects(server, segments[0], &body);
+        if (status != 200) {
+            json_free(&body);
+            respond_error(c, status, "no such project", head_only, NULL);
+        } else {
+            respond_json(c, status, &body, head_only, NULL);
+        }
+    } else if (count == 3 && strcmp(segments[0], "latest") == 0) {
+        artifact_index_t *index = project_target_dir(server, segments[1], target_dir, sizeof(target_dir)) == 0 ? served_index(server, target_dir) : NULL;
+        const artifact_record_t *r = index ? artifact_index_latest(index, segments[1], segments[2], NULL) : NULL;
+        // Entries imported from the tiers before the index existed have no project
+        if (index && !r) r = artifact_index_latest(index, "", segments[2], NULL);
+        if (!r) {
+            respond_error(c, 404, "no binary published for this project and architecture", head_only, NULL);
+            return;
+        }
+        char location[MAX_CONFIG_ATTR_LEN];
+        char name[NAME_MAX + 1];
+        const char *tier = artifact_index_tier_name(r->tier);
+        snprintf(name, sizeof(name), "%s", r->name);
+        snprintf(location, sizeof(location), "/%s/%s/%s", segments[1], tier, name);
+        serve_entry(server, c, request, head_only, target_dir, tier, name, location);
+    } else if (count == 3 && artifact_index_tier(segments[1]) >= 0 && project_target_dir(server, segments[0], target_dir, sizeof(target_dir)) == 0) {
+        serve_entry(server, c, request, head_only, target_dir, segments[1], segments[2], NULL);
+    } else {
+        respond_error(c, 404, "not found", head_only, NULL);
+    }
+}
+
+/* Connections */
+
+static void close_connection(artifact_server_t *server, int slot) {
+    connection_t *c = server->connections[slot];
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->file_fd >= 0) close(c->file_fd);
+    json_free(&c->body);
+    free(c);
+    server->connections[slot] = NULL;
+    server->connection_count--;
+}
+
+static void watch(artifact_server_t *server, int slot, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.u64 = (uint64_t)slot };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, server->connections[slot]->fd, &ev);
+}
+
+// Sends what the socket takes of the response; returns 1 once it is all sent, 0 if the socket is full, -1 on errors
+static int send_response(artifact_server_t *server, connection_t *c) {
+    int more = c->body.len > c->body_sent || c->file_offset < c->file_end;
+    while (c->head_sent < c->head_len) {
+        ssize_t n = send(c->fd, c->head + c->head_sent, c->head_len - c->head_sent, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        c->head_sent += (size_t)n;
+    }
+    while (c->body_sent < c->body.len) {
+        ssize_t n = send(c->fd, c->body.data + c->body_sent, c->body.len - c->body_sent, MSG_NOSIGNAL);
+        if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        c->body_sent += (size_t)n;
+        server->bytes_sent += (unsigned long long)n;
+    }
+    for (int chunk = 0; c->file_offset < c->file_end; chunk++) {
+        // The others get their turn: the socket is still writable, so the loop comes back to it
+        if (chunk == SERVER_CHUNKS_PER_TURN) return 0;
+        off_t left = c->file_end - c->file_offset;
+        ssize_t n = sendfile(c->fd, c->file_fd, &c->file_offset, left < SERVER_SENDFILE_CHUNK ? (size_t)left : SERVER_SENDFILE_CHUNK);
+        if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        // Truncated under us: the length announced cannot be honoured
+        if (n == 0) return -1;
+        server->bytes_sent += (unsigned long long)n;
+    }
+    return 1;
+}
+
+// Answers the complete requests read so far, one at a time; returns -1 if the connection is to be closed
+static int process(artifact_server_t *server, int slot) {
+    connection_t *c = server->connections[slot];
+    while (1) {
+        if (c->sending) {
+            int sent = send_response(server, c);
+            if (sent < 0) return -1;
+            if (sent == 0) {
+                watch(server, slot, EPOLLOUT);
+                return 0;
+            }
+            if (c->file_fd >= 0) close(c->file_fd);
+            c->file_fd = -1;
+            c->file_offset = c->file_end = 0;
+            json_free(&c->body);
+            c->sending = 0;
+            if (!c->keep_alive) return -1;
+        }
+        char *end = c->request_len ? memmem(c->request, c->request_len, "\r\n\r\n", 4) : NULL;
+        if (!end) {
+            if (c->request_len == sizeof(c->request)) {
+                c->keep_alive = 0;
+                respond_error(c, 431, "request too large", 0, NULL);
+                c->request_len = 0;
+                c->sending = 1;
+                continue;
+            }
+            watch(server, slot, EPOLLIN);
+            return 0;
+        }
+        size_t request_len = (size_t)(end - c->request) + 4;
+        char request[SERVER_REQUEST_MAX + 1];
+        memcpy(request, c->request, request_len);
+        request[request_len] = '\0';
+        // Pipelined requests wait for this one to be answered
+        memmove(c->request, c->request + request_len, c->request_len - request_len);
+        c->request_len -= request_len;
+        handle_request(server, c, request);
+        c->sending = 1;
+    }
+}
+
+static void accept_connections(artifact_server_t *server) {
+    int fd;
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int slot = -1;
+        for (int i = 0; i < SERVER_MAX_CONNECTIONS && slot < 0; i++) {
+            if (!server->connections[i]) slot = i;
+        }
+        connection_t *c = slot >= 0 ? calloc(1, sizeof(connection_t)) : NULL;
+        if (!c) {
+            static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+            ssize_t n = send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+            (void)n;
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->fd = fd;
+        c->file_fd = -1;
+        c->last_active = time(NULL);
+        server->connections[slot] = c;
+        server->connection_count++;
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint64_t)slot };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) close_connection(server, slot);
+    }
+}
+
+static void handle_connection(artifact_server_t *server, int slot, uint32_t events) {
+    connection_t *c = server->connections[slot];
+    if (!c) return;
+    c->last_active = time(NULL);
+    if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        close_connection(server, slot);
+        return;
+    }
+    if ((events & EPOLLIN) && !c->sending) {
+        while (c->request_len < sizeof(c->request)) {
+            ssize_t n = recv(c->fd, c->request + c->request_len, sizeof(c->request) - c->request_len, 0);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                close_connection(server, slot);
+                return;
+            }
+            if (n < 0) break;
+            c->request_len += (size_t)n;
+        }
+    }
+    if (process(server, slot) != 0) close_connection(server, slot);
+}
+
+static void close_idle_connections(artifact_server_t *server, time_t now) {
+    for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+        if (server->connections[i] && now - server->connections[i]->last_active > SERVER_IDLE_TIMEOUT_S) close_connection(server, i);
+    }
+}
+
+static void *server_thread(void *arg) {
+    artifact_server_t *server = (artifact_server_t *)arg;
+    struct epoll_event events[64];
+    time_t last_sweep = time(NULL);
+    while (!server->stopping) {
+        int n = epoll_wait(server->epoll_fd, events, 64, 1000);
+        if (n < 0 && errno != EINTR) {
+            formatted_log(server->log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Artifact server: epoll_wait failed: %s; stopping.", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == SERVER_TAG_LISTEN) accept_connections(server);
+            else if (tag != SERVER_TAG_WAKE) handle_connection(server, (int)tag, events[i].events);
+        }
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            close_idle_connections(server, now);
+            last_sweep = now;
+        }
+    }
+    return NULL;
+}
+
+/* Lifecycle */
+
+static void free_server(artifact_server_t *server) {
+    for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+        if (server->connections[i]) close_connection(server, i);
+    }
+    if (server->decoder_started) {
+        pthread_mutex_lock(&server->decode_lock);
+        server->stopping = 1;
+        pthread_cond_signal(&server->decode_cond);
+        pthread_mutex_unlock(&server->decode_lock);
+        pthread_join(server->decoder, NULL);
+    }
+    for (int i = 0; i < SERVER_DECODED_CACHE; i++) {
+        if (server->decoded[i].fd >= 0) close(server->decoded[i].fd);
+    }
+    while (server->indexes) {
+        cached_index_t *next = server->indexes->next;
+        artifact_index_close(&server->indexes->index, NULL, NULL);
+        free(server->indexes);
+        server->indexes = next;
+    }
+    int fds[] = { server->listen_fd, server->wake_fd, server->epoll_fd };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+    pthread_mutex_destroy(&server->lock);
+    pthread_mutex_destroy(&server->decode_lock);
+    pthread_cond_destroy(&server->decode_cond);
+    free(server->projects);
+    free(server);
+}
+
+// Listens on address ("<host>:<port>", "[<ipv6>]:<port>" or a port of SERVER_DEFAULT_HOST) and serves the projects handed over by
+// artifact_server_set_projects in a thread of its own; returns NULL (logged) on failure
+artifact_server_t *artifact_server_start(const char *address, FILE *log_fp) {
+    artifact_server_t *server = calloc(1, sizeof(artifact_server_t));
+    if (!server) return NULL;
+    server->log_fp = log_fp;
+    server->listen_fd = server->wake_fd = server->epoll_fd = -1;
+    snprintf(server->address, sizeof(server->address), "%s", address);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_mutex_init(&server->decode_lock, NULL);
+    pthread_cond_init(&server->decode_cond, NULL);
+    for (int i = 0; i < SERVER_DECODED_CACHE; i++) server->decoded[i].fd = -1;
+
+    server->listen_fd = listen_on(address);
+    server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_ev = { .events = EPOLLIN, .data.u64 = SERVER_TAG_LISTEN };
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.u64 = SERVER_TAG_WAKE };
+    if (server->listen_fd < 0 || server->wake_fd < 0 || server->epoll_fd < 0 || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &listen_ev) != 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &wake_ev) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to start the artifact server on %s: %s", address, strerror(errno));
+        free_server(server);
+        return NULL;
+    }
+    int err = pthread_create(&server->decoder, NULL, decoder_thread, server);
+    if (err == 0) {
+        server->decoder_started = 1;
+        err = pthread_create(&server->thread, NULL, server_thread, server);
+    }
+    if (err != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to start the artifact server thread: %s", strerror(err));
+        free_server(server);
+        return NULL;
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Artifact server listening on %s.", address);
+    return server;
+}
+
+// Replaces the served projects (copied); returns 0 on success
+int artifact_server_set_projects(artifact_server_t *server, const artifact_server_project_t *projects, int count) {
+    artifact_server_project_t *copy = malloc((count ? count : 1) * sizeof(artifact_server_project_t));
+    if (!copy) return 1;
+    memcpy(copy, projects, count * sizeof(artifact_server_project_t));
+    pthread_mutex_lock(&server->lock);
+    free(server->projects);
+    server->projects = copy;
+    server->project_count = count;
+    pthread_mutex_unlock(&server->lock);
+    return 0;
+}
+
+// Stops the server (the downloads in progress are cut) and frees it
+void artifact_server_stop(artifact_server_t *server) {
+    if (!server) return;
+    server->stopping = 1;
+    uint64_t one = 1;
+    ssize_t written = write(server->wake_fd, &one, sizeof(one));
+    (void)written;
+    pthread_join(server->thread, NULL);
+    formatted_log(server->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Artifact server on %s stopped: %llu requests, %llu KB sent.", server->address, server->requests, server->bytes_sent / 1024);
+    free_server(server);
+}
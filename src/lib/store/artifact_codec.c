@@ -0,0 +1,742 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "store/artifact_codec.h"
+#include "store/artifact_index.h"
+#include "store/rotation.h"
+#include "utils/sha256.h"
+#include "utils/utils.h"
+
+/*
+    Storage codec of the older tiers (weekly, monthly, yearly) of a target dir.
+    The daily entries always link plain binaries of the store, which can be downloaded as they are. When a tier is packed (by the
+    rotation, with the codec of the project), the plain binaries its entries link are rewritten, per architecture and in age order:
+    - delta: a binary is stored as a delta against the latest full object of the tier (a keyframe), as long as the delta is at most
+      CODEC_MAX_DELTA_PERCENT% of the binary and the keyframe has fewer than CODEC_KEYFRAME_INTERVAL deltas; otherwise it becomes the
+      new keyframe. Consecutive static builds of a project share most of their bytes, so the deltas are a small fraction of a binary.
+      The delta is a list of copies from the keyframe and literal insertions (blocks of the target found in the keyframe through a
+      rolling hash, then extended in both directions), so decoding is a single pass over the keyframe;
+    - zstd (only when built with libzstd): keyframes are stored as plain zstd frames (<sha256>.zst, readable by "zstd -d") and the
+      operations of the deltas are compressed as well.
+    Deltas always refer to a full object (never to another delta), whose sha256 is in their name, so that the store cleanup keeps the
+    keyframes in use (see collect_garbage in rotation.c). Entries are relinked to the encoded object keeping their mtime, which is their
+    age for the rotation, and the new objects are recorded in the artifact index (see artifact_index.c). Every decoded object is checked
+    against the sha256 it is stored under.
+
+    Delta format: "V2CD", version (1 byte), flags (1 byte, bit 0: operations compressed with zstd), target size (8 bytes, LE), then the
+    operations (LEB128 varints): 0 <len> <bytes> (insert), 1 <offset> <len> (copy from the keyframe), 2 (end).
+*/
+
+#define DELTA_MAGIC "V2CD"
+#define DELTA_VERSION 1
+#define DELTA_FLAG_ZSTD 0x01
+#define DELTA_HEADER_LEN 14
+#define DELTA_OP_INSERT 0
+#define DELTA_OP_COPY 1
+#define DELTA_OP_END 2
+#define DELTA_BLOCK 32                  // Shortest copy; the keyframe is indexed every DELTA_BLOCK bytes
+#define DELTA_MAX_CANDIDATES 16         // Keyframe blocks compared for each hash hit
+#define DELTA_HASH_BASE 257u
+
+void codec_buf_free(codec_buf_t *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+}
+
+int codec_zstd_available(void) {
+#ifdef HAVE_ZSTD
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Parses the codec of a project ("none", "delta", "zstd", "delta+zstd"); returns 1 for an unknown codec
+int codec_parse(const char *codec, int *use_delta, int *use_zstd) {
+    *use_delta = 0;
+    *use_zstd = 0;
+    if (strcmp(codec, "none") == 0) return 0;
+    if (strcmp(codec, "delta") == 0) *use_delta = 1;
+    else if (strcmp(codec, "zstd") == 0) *use_zstd = 1;
+    else if (strcmp(codec, "delta+zstd") == 0) *use_delta = *use_zstd = 1;
+    else return 1;
+    return 0;
+}
+
+/* Growable output of the encoder */
+
+static int buf_reserve(codec_buf_t *buf, size_t *cap, size_t extra) {
+    if (buf->len + extra <= *cap) return 0;
+    size_t new_cap = *cap ? *cap : 4096;
+    while (new_cap < buf->len + extra) new_cap *= 2;
+    unsigned char *data = realloc(buf->data, new_cap);
+    if (!data) return 1;
+    buf->data = data;
+    *cap = new_cap;
+    return 0;
+}
+
+static int put_varint(codec_buf_t *buf, size_t *cap, uint64_t value) {
+    if (buf_reserve(buf, cap, 10) != 0) return 1;
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        buf->data[buf->len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return 0;
+}
+
+static int get_varint(const unsigned char *data, size_t len, size_t *pos, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos >= len) return 1;
+        unsigned char byte = data[(*pos)++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return 1;
+}
+
+static int put_insert(codec_buf_t *buf, size_t *cap, const unsigned char *data, size_t len) {
+    if (len == 0) return 0;
+    if (buf_reserve(buf, cap, 1) != 0) return 1;
+    buf->data[buf->len++] = DELTA_OP_INSERT;
+    if (put_varint(buf, cap, len) != 0 || buf_reserve(buf, cap, len) != 0) return 1;
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+static int put_copy(codec_buf_t *buf, size_t *cap, size_t offset, size_t len) {
+    if (buf_reserve(buf, cap, 1) != 0) return 1;
+    buf->data[buf->len++] = DELTA_OP_COPY;
+    return put_varint(buf, cap, offset) != 0 || put_varint(buf, cap, len) != 0;
+}
+
+static uint32_t block_hash(const unsigned char *p) {
+    uint32_t h = 0;
+    for (int k = 0; k < DELTA_BLOCK; k++) h = h * DELTA_HASH_BASE + p[k];
+    return h;
+}
+
+#ifdef HAVE_ZSTD
+static int zstd_compress_buf(const unsigned char *src, size_t len, codec_buf_t *out) {
+    size_t bound = ZSTD_compressBound(len);
+    out->data = malloc(bound ? bound : 1);
+    if (!out->data) return 1;
+    size_t written = ZSTD_compress(out->data, bound, src, len, CODEC_ZSTD_LEVEL);
+    if (ZSTD_isError(written)) {
+        codec_buf_free(out);
+        return 1;
+    }
+    out->len = written;
+    return 0;
+}
+
+static int zstd_decompress_buf(const unsigned char *src, size_t len, codec_buf_t *out) {
+    unsigned long long size = ZSTD_getFrameContentSize(src, len);
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) return 1;
+    out->data = malloc(size ? size : 1);
+    if (!out->data) return 1;
+    size_t read = ZSTD_decompress(out->data, size, src, len);
+    if (ZSTD_isError(read) || read != size) {
+        codec_buf_free(out);
+        return 1;
+    }
+    out->len = size;
+    return 0;
+}
+#endif
+
+// Encodes target as a delta against base (operations only, see above); returns 0 with the operations in out
+int codec_delta_encode(const unsigned char *base, size_t base_len, const unsigned char *target, size_t target_len, codec_buf_t *out) {
+    out->data = NULL;
+    out->len = 0;
+    size_t cap = 0;
+    size_t blocks = base_len / DELTA_BLOCK;
+    size_t buckets = 1;
+    while (buckets < blocks * 2) buckets <<= 1;
+    int32_t *head = malloc(buckets * sizeof(int32_t));
+    int32_t *next = malloc((blocks ? blocks : 1) * sizeof(int32_t));
+    if (!head || !next || blocks > INT32_MAX) {
+        free(head);
+        free(next);
+        return 1;
+    }
+    memset(head, 0xff, buckets * sizeof(int32_t));
+    // Later blocks first in the chains, so that the earliest match wins among equal ones
+    for (size_t b = blocks; b-- > 0;) {
+        uint32_t bucket = block_hash(base + b * DELTA_BLOCK) & (buckets - 1);
+        next[b] = head[bucket];
+        head[bucket] = (int32_t)b;
+    }
+
+    uint32_t top = 1;   // DELTA_HASH_BASE^(DELTA_BLOCK - 1), to roll the first byte out
+    for (int k = 1; k < DELTA_BLOCK; k++) top *= DELTA_HASH_BASE;
+    size_t i = 0, literal_start = 0;
+    uint32_t h = target_len >= DELTA_BLOCK ? block_hash(target) : 0;
+    int failed = 0;
+    while (!failed && blocks > 0 && i + DELTA_BLOCK <= target_len) {
+        size_t best_len = 0, best_offset = 0;
+        int checked = 0;
+        for (int32_t c = head[h & (buckets - 1)]; c >= 0 && checked < DELTA_MAX_CANDIDATES; c = next[c], checked++) {
+            size_t offset = (size_t)c * DELTA_BLOCK;
+            if (memcmp(base + offset, target + i, DELTA_BLOCK) != 0) continue;
+            size_t len = DELTA_BLOCK;
+            while (offset + len < base_len && i + len < target_len && base[offset + len] == target[i + len]) len++;
+            if (len > best_len) {
+                best_len = len;
+                best_offset = offset;
+            }
+        }
+        if (best_len > 0) {
+            // Extend the match backwards over the pending literal bytes
+            size_t back = 0;
+            while (back < i - literal_start && back < best_offset && base[best_offset - back - 1] == target[i - back - 1]) back++;
+            failed = put_insert(out, &cap, target + literal_start, i - back - literal_start) || put_copy(out, &cap, best_offset - back, best_len + back);
+            i += best_len;
+            literal_start = i;
+            if (i + DELTA_BLOCK <= target_len) h = block_hash(target + i);
+            continue;
+        }
+        if (i + DELTA_BLOCK < target_len) h = (h - target[i] * top) * DELTA_HASH_BASE + target[i + DELTA_BLOCK];
+        i++;
+    }
+    free(head);
+    free(next);
+    if (failed || put_insert(out, &cap, target + literal_start, target_len - literal_start) != 0 || buf_reserve(out, &cap, 1) != 0) {
+        codec_buf_free(out);
+        return 1;
+    }
+    out->data[out->len++] = DELTA_OP_END;
+    return 0;
+}
+
+// Rebuilds the target from base and the operations of a delta; returns 0 with the target in out
+static int apply_ops(const unsigned char *base, size_t base_len, const unsigned char *ops, size_t ops_len, uint64_t target_len, codec_buf_t *out) {
+    out->data = malloc(target_len ? target_len : 1);
+    out->len = 0;
+    if (!out->data) return 1;
+    size_t pos = 0;
+    while (pos < ops_len) {
+        unsigned char op = ops[pos++];
+        uint64_t offset = 0, len = 0;
+        if (op == DELTA_OP_END) {
+            if (out->len == target_len) return 0;
+            break;
+        } else if (op == DELTA_OP_INSERT) {
+            if (get_varint(ops, ops_len, &pos, &len) != 0 || len > ops_len - pos || len > target_len - out->len) break;
+            memcpy(out->data + out->len, ops + pos, len);
+            pos += len;
+        } else if (op == DELTA_OP_COPY) {
+            if (get_varint(ops, ops_len, &pos, &offset) != 0 || get_varint(ops, ops_len, &pos, &len) != 0) break;
+            if (offset > base_len || len > base_len - offset || len > target_len - out->len) break;
+            memcpy(out->data + out->len, base + offset, len);
+        } else {
+            break;
+        }
+        out->len += len;
+    }
+    codec_buf_free(out);
+    return 1;
+}
+
+// Decodes a delta file (header and operations) against its base; returns 0 with the target in out
+int codec_delta_apply(const unsigned char *base, size_t base_len, const unsigned char *delta, size_t delta_len, codec_buf_t *out) {
+    if (delta_len < DELTA_HEADER_LEN || memcmp(delta, DELTA_MAGIC, 4) != 0 || delta[4] != DELTA_VERSION) return 1;
+    uint64_t target_len = 0;
+    for (int k = 0; k < 8; k++) target_len |= (uint64_t)delta[6 + k] << (8 * k);
+    const unsigned char *ops = delta + DELTA_HEADER_LEN;
+    size_t ops_len = delta_len - DELTA_HEADER_LEN;
+    if (delta[5] & DELTA_FLAG_ZSTD) {
+#ifdef HAVE_ZSTD
+        codec_buf_t raw = { 0 };
+        if (zstd_decompress_buf(ops, ops_len, &raw) != 0) return 1;
+        int result = apply_ops(base, base_len, raw.data, raw.len, target_len, out);
+        codec_buf_free(&raw);
+        return result;
+#else
+        return 1;
+#endif
+    }
+    return apply_ops(base, base_len, ops, ops_len, target_len, out);
+}
+
+/* Objects of the store */
+
+static int read_whole_file(const char *path, codec_buf_t *out) {
+    out->data = NULL;
+    out->len = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+    out->data = malloc(st.st_size ? st.st_size : 1);
+    if (!out->data) {
+        close(fd);
+        return 1;
+    }
+    while (out->len < (size_t)st.st_size) {
+        ssize_t n = read(fd, out->data + out->len, st.st_size - out->len);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            close(fd);
+            codec_buf_free(out);
+            return 1;
+        }
+        out->len += n;
+    }
+    close(fd);
+    return 0;
+}
+
+// Writes data to <dir>/<name> through a temporary file, fsync and rename (then fsync of dir)
+static int write_object(const char *dir, const char *name, const unsigned char *data, size_t len) {
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 2];
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/" STORE_BLOB_TMP_PREFIX "XXXXXX", dir);
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) return 1;
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    if (written != len || fchmod(fd, 0644) != 0 || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmp_path);
+        return 1;
+    }
+    close(fd);
+    if (rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return 0;
+}
+
+static int has_suffix(const char *s, const char *suffix) {
+    size_t len = strlen(s), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+// Extracts the base sha256 from the name of a delta object; returns 1 if the name is not a delta
+static int delta_base(const char *object, char base[SHA256_HEX_LEN]) {
+    const char *tag = strstr(object, CODEC_DELTA_BASE_TAG);
+    if (!tag || !has_suffix(object, CODEC_DELTA_SUFFIX)) return 1;
+    tag += strlen(CODEC_DELTA_BASE_TAG);
+    if (strlen(tag) != SHA256_HEX_LEN - 1 + strlen(CODEC_DELTA_SUFFIX)) return 1;
+    memcpy(base, tag, SHA256_HEX_LEN - 1);
+    base[SHA256_HEX_LEN - 1] = '\0';
+    return 0;
+}
+
+// Name of the full object (plain or zstd) holding the binary with the given sha256; returns 1 if there is none
+static int find_full_object(const char *store_dir, const char *sha, char *object, size_t size) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", store_dir, sha);
+    if (stat(path, &st) == 0) {
+        snprintf(object, size, "%s", sha);
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s%s", store_dir, sha, CODEC_ZSTD_SUFFIX);
+    if (stat(path, &st) == 0) {
+        snprintf(object, size, "%s%s", sha, CODEC_ZSTD_SUFFIX);
+        return 0;
+    }
+    return 1;
+}
+
+static int decode_object(const char *store_dir, const char *object, codec_buf_t *out, int depth) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/%s", store_dir, object);
+    char base_sha[SHA256_HEX_LEN];
+    if (delta_base(object, base_sha) == 0) {
+        char base_object[SHA256_HEX_LEN + 8];
+        codec_buf_t base = { 0 }, delta = { 0 };
+        if (depth > 0 || find_full_object(store_dir, base_sha, base_object, sizeof(base_object)) != 0) return 1;
+        if (decode_object(store_dir, base_object, &base, depth + 1) != 0) return 1;
+        if (read_whole_file(path, &delta) != 0) {
+            codec_buf_free(&base);
+            return 1;
+        }
+        int result = codec_delta_apply(base.data, base.len, delta.data, delta.len, out);
+        codec_buf_free(&base);
+        codec_buf_free(&delta);
+        return result;
+    }
+    if (has_suffix(object, CODEC_ZSTD_SUFFIX)) {
+#ifdef HAVE_ZSTD
+        codec_buf_t frame = { 0 };
+        if (read_whole_file(path, &frame) != 0) return 1;
+        int result = zstd_decompress_buf(frame.data, frame.len, out);
+        codec_buf_free(&frame);
+        return result;
+#else
+        errno = ENOTSUP;
+        return 1;
+#endif
+    }
+    return read_whole_file(path, out);
+}
+
+// Loads the binary stored as object (plain, zstd or delta), checking it against its sha256; returns 0 with the binary in out
+int store_load_object(const char *store_dir, const char *object, codec_buf_t *out) {
+    if (decode_object(store_dir, object, out, 0) != 0) return 1;
+    uint8_t digest[SHA256_DIGEST_LEN];
+    char hex[SHA256_HEX_LEN];
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, out->data, out->len);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hex);
+    if (strncmp(object, hex, SHA256_HEX_LEN - 1) != 0) {
+        codec_buf_free(out);
+        errno = EBADMSG;
+        return 1;
+    }
+    return 0;
+}
+
+// Size of the binary stored as object, without decoding it (-1 if unknown)
+long long store_object_logical_size(const char *store_dir, const char *object) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/%s", store_dir, object);
+    char base_sha[SHA256_HEX_LEN];
+    if (delta_base(object, base_sha) == 0) {
+        unsigned char header[DELTA_HEADER_LEN];
+        FILE *fp = fopen(path, "rb");
+        if (!fp) return -1;
+        size_t n = fread(header, 1, sizeof(header), fp);
+        fclose(fp);
+        if (n != sizeof(header) || memcmp(header, DELTA_MAGIC, 4) != 0) return -1;
+        uint64_t target_len = 0;
+        for (int k = 0; k < 8; k++) target_len |= (uint64_t)header[6 + k] << (8 * k);
+        return (long long)target_len;
+    }
+    if (has_suffix(object, CODEC_ZSTD_SUFFIX)) {
+#ifdef HAVE_ZSTD
+        unsigned char header[ZSTD_FRAMEHEADERSIZE_MAX];
+        FILE *fp = fopen(path, "rb");
+        if (!fp) return -1;
+        size_t n = fread(header, 1, sizeof(header), fp);
+        fclose(fp);
+        unsigned long long size = ZSTD_getFrameContentSize(header, n);
+        return (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) ? -1 : (long long)size;
+#else
+        return -1;
+#endif
+    }
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+// Full object a delta is encoded against, as the store cleanup keeps it (the zstd frame if there is one); returns 1 if object is not a
+// delta or its base is missing
+int store_delta_base_object(const char *store_dir, const char *object, char *base_object, size_t size) {
+    char base_sha[SHA256_HEX_LEN];
+    if (delta_base(object, base_sha) != 0) return 1;
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s%s", store_dir, base_sha, CODEC_ZSTD_SUFFIX);
+    if (stat(path, &st) == 0) {
+        snprintf(base_object, size, "%s%s", base_sha, CODEC_ZSTD_SUFFIX);
+        return 0;
+    }
+    return find_full_object(store_dir, base_sha, base_object, size);
+}
+
+/* Packing of a tier */
+
+typedef struct tier_entry {
+    char name[MAX_CONFIG_ATTR_LEN];
+    char object[MAX_CONFIG_ATTR_LEN];       // Name of the object in the store the entry links
+    const char *arch;                       // Last component of the name (<repo>-<release>-<arch>)
+    struct timespec mtime;
+    int relinked;                           // Now links another object (to record in the index)
+} tier_entry_t;
+
+static int compare_entries(const void *a, const void *b) {
+    const tier_entry_t *x = a, *y = b;
+    int by_arch = strcmp(x->arch, y->arch);
+    if (by_arch != 0) return by_arch;
+    if (x->mtime.tv_sec != y->mtime.tv_sec) return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+// Points the entry to another object of the store, keeping its mtime (its age for the rotation)
+static int relink_entry(const char *tier_dir, tier_entry_t *entry, const char *object) {
+    char target[MAX_CONFIG_ATTR_LEN * 2];
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 2 + 16];
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(target, sizeof(target), "../%s/%s", STORE_DIR_NAME, object);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.partial", tier_dir, entry->name);
+    snprintf(path, sizeof(path), "%s/%s", tier_dir, entry->name);
+    unlink(tmp_path);
+    if (symlink(target, tmp_path) != 0) return 1;
+    struct timespec times[2] = { entry->mtime, entry->mtime };
+    if (utimensat(AT_FDCWD, tmp_path, times, AT_SYMLINK_NOFOLLOW) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    snprintf(entry->object, sizeof(entry->object), "%s", object);
+    entry->relinked = 1;
+    return 0;
+}
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// Stores the binary of the entry as a delta against the keyframe; returns 0 if it was worth it (entry relinked), 1 if not, -1 on errors
+static int encode_delta(const char *store_dir, const char *tier_dir, tier_entry_t *entry, const char *keyframe, int use_zstd, FILE *log_fp, const char *project_name) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    codec_buf_t base = { 0 }, target = { 0 }, ops = { 0 };
+    if (store_load_object(store_dir, keyframe, &base) != 0) return -1;
+    if (store_load_object(store_dir, entry->object, &target) != 0) {
+        codec_buf_free(&base);
+        return -1;
+    }
+    int result = codec_delta_encode(base.data, base.len, target.data, target.len, &ops) != 0 ? -1 : 0;
+    codec_buf_free(&base);
+    unsigned char flags = 0;
+#ifdef HAVE_ZSTD
+    if (result == 0 && use_zstd) {
+        codec_buf_t compressed = { 0 };
+        if (zstd_compress_buf(ops.data, ops.len, &compressed) == 0 && compressed.len < ops.len) {
+            codec_buf_free(&ops);
+            ops = compressed;
+            flags |= DELTA_FLAG_ZSTD;
+        } else {
+            codec_buf_free(&compressed);
+        }
+    }
+#else
+    (void)use_zstd;
+#endif
+    size_t delta_len = ops.len + DELTA_HEADER_LEN;
+    if (result == 0 && delta_len * 100 > target.len * CODEC_MAX_DELTA_PERCENT) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, entry->arch, "Delta of %s against its keyframe is %zu KB of %zu KB; kept as a full object.", entry->name, delta_len / 1024, target.len / 1024);
+        result = 1;
+    }
+    char object[MAX_CONFIG_ATTR_LEN];
+    if (result == 0) {
+        unsigned char *file = malloc(delta_len);
+        if (!file) {
+            result = -1;
+        } else {
+            memcpy(file, DELTA_MAGIC, 4);
+            file[4] = DELTA_VERSION;
+            file[5] = flags;
+            for (int k = 0; k < 8; k++) file[6 + k] = (unsigned char)((uint64_t)target.len >> (8 * k));
+            memcpy(file + DELTA_HEADER_LEN, ops.data, ops.len);
+            snprintf(object, sizeof(object), "%.64s%s%.64s%s", entry->object, CODEC_DELTA_BASE_TAG, keyframe, CODEC_DELTA_SUFFIX);
+            if (write_object(store_dir, object, file, delta_len) != 0 || relink_entry(tier_dir, entry, object) != 0) result = -1;
+            free(file);
+        }
+    }
+    if (result == 0) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, entry->arch, "Stored %s as a delta against %.12s: %zu KB -> %zu KB (%.1fx, %ld ms).",
+            entry->name, keyframe, target.len / 1024, delta_len / 1024, delta_len ? (double)target.len / delta_len : 0.0, elapsed_ms(&start));
+    }
+    codec_buf_free(&target);
+    codec_buf_free(&ops);
+    return result;
+}
+
+// Makes the binary of the entry a keyframe, compressed if zstd is enabled; object receives the name of the full object
+static int make_keyframe(const char *store_dir, const char *tier_dir, tier_entry_t *entry, int use_zstd, char *object, size_t size, FILE *log_fp, const char *project_name) {
+    snprintf(object, size, "%s", entry->object);
+#ifdef HAVE_ZSTD
+    if (use_zstd && !has_suffix(entry->object, CODEC_ZSTD_SUFFIX)) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        codec_buf_t plain = { 0 }, compressed = { 0 };
+        if (store_load_object(store_dir, entry->object, &plain) != 0) return 1;
+        if (zstd_compress_buf(plain.data, plain.len, &compressed) == 0) {
+            char zstd_object[MAX_CONFIG_ATTR_LEN];
+            snprintf(zstd_object, sizeof(zstd_object), "%.64s%s", entry->object, CODEC_ZSTD_SUFFIX);
+            if (write_object(store_dir, zstd_object, compressed.data, compressed.len) == 0 && relink_entry(tier_dir, entry, zstd_object) == 0) {
+                snprintf(object, size, "%s", zstd_object);
+                formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, entry->arch, "Stored keyframe %s with zstd: %zu KB -> %zu KB (%.1fx, %ld ms).",
+                    entry->name, plain.len / 1024, compressed.len / 1024, compressed.len ? (double)plain.len / compressed.len : 0.0, elapsed_ms(&start));
+            }
+        }
+        codec_buf_free(&plain);
+        codec_buf_free(&compressed);
+    }
+#else
+    (void)store_dir; (void)tier_dir; (void)use_zstd; (void)log_fp; (void)project_name;
+#endif
+    return 0;
+}
+
+static long long object_disk_usage(const char *store_dir, const char *object) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", store_dir, object);
+    return stat(path, &st) == 0 ? (long long)st.st_blocks * 512 : 0;
+}
+
+// Records the objects the relinked entries of a tier link now in the artifact index (with the store locked); returns 0 on success
+static int record_objects(const char *target_dir, int tier, const tier_entry_t *entries, int count, FILE *log_fp, const char *project_name) {
+    artifact_index_t index;
+    int errors = artifact_index_open(target_dir, 1, &index);
+    for (int i = 0; i < count && errors == 0; i++) {
+        if (!entries[i].relinked) continue;
+        const artifact_record_t *record = artifact_index_entry(&index, tier, entries[i].name);
+        if (!record) {
+            index.stale = 1;
+            continue;
+        }
+        char base[MAX_CONFIG_ATTR_LEN] = "";
+        if (store_delta_base_object(index.store_dir, entries[i].object, base, sizeof(base)) != 0) base[0] = '\0';
+        errors += artifact_index_encode(&index, record->id, entries[i].object, object_disk_usage(index.store_dir, entries[i].object), base, base[0] ? object_disk_usage(index.store_dir, base) : 0);
+    }
+    // Entries the index does not know (published behind its back) are taken in with the rest of the tiers
+    if (errors == 0 && index.stale) errors += artifact_index_rescan(&index, log_fp, project_name);
+    if (errors) formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to record the encoded objects of %s in the artifact index: %s", target_dir, strerror(errno));
+    errors += artifact_index_close(&index, log_fp, project_name);
+    return errors;
+}
+
+// Encodes the plain binaries linked by the entries of a tier with the codec (see above); returns 0 on success
+int store_pack_tier(const char *target_dir, const char *tier, const char *codec, FILE *log_fp, const char *project_name) {
+    int use_delta, use_zstd;
+    if (codec_parse(codec, &use_delta, &use_zstd) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unknown storage codec '%s'.", codec);
+        return 1;
+    }
+    if (use_zstd && !codec_zstd_available()) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, NULL, "Storage codec '%s' requested, but this build has no libzstd; zstd is skipped.", codec);
+        use_zstd = 0;
+    }
+    if (!use_delta && !use_zstd) return 0;
+
+    char store_dir[MAX_CONFIG_ATTR_LEN * 2];
+    char tier_dir[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(store_dir, sizeof(store_dir), "%s/%s", target_dir, STORE_DIR_NAME);
+    snprintf(tier_dir, sizeof(tier_dir), "%s/%s", target_dir, tier);
+    DIR *dp = opendir(tier_dir);
+    if (!dp) return errno == ENOENT ? 0 : 1;
+    int lock_fd = store_lock(store_dir, log_fp, project_name);
+    if (lock_fd < 0) {
+        closedir(dp);
+        return 1;
+    }
+
+    // Collect the entries linking objects of the store
+    tier_entry_t *entries = NULL;
+    int count = 0, capacity = 0;
+    struct dirent *de;
+    const char *prefix = "../" STORE_DIR_NAME "/";
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        char path[MAX_CONFIG_ATTR_LEN * 3];
+        char target[MAX_CONFIG_ATTR_LEN];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", tier_dir, de->d_name);
+        if (lstat(path, &st) != 0 || !S_ISLNK(st.st_mode)) continue;
+        ssize_t n = readlink(path, target, sizeof(target) - 1);
+        if (n <= 0) continue;
+        target[n] = '\0';
+        if (strncmp(target, prefix, strlen(prefix)) != 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            tier_entry_t *grown = realloc(entries, capacity * sizeof(tier_entry_t));
+            if (!grown) break;
+            entries = grown;
+        }
+        tier_entry_t *entry = &entries[count++];
+        entry->relinked = 0;
+        snprintf(entry->name, sizeof(entry->name), "%s", de->d_name);
+        snprintf(entry->object, sizeof(entry->object), "%s", target + strlen(prefix));
+        const char *dash = strrchr(entry->name, '-');
+        entry->arch = dash ? dash + 1 : entry->name;
+        entry->mtime = st.st_mtim;
+    }
+    closedir(dp);
+    qsort(entries, count, sizeof(tier_entry_t), compare_entries);
+
+    // Walk each architecture from the oldest entry, tracking the current keyframe and the deltas against it
+    int errors = 0, encoded = 0;
+    char keyframe[MAX_CONFIG_ATTR_LEN] = "";
+    int deltas = 0;
+    for (int i = 0; i < count; i++) {
+        tier_entry_t *entry = &entries[i];
+        if (i > 0 && strcmp(entry->arch, entries[i - 1].arch) != 0) {
+            keyframe[0] = '\0';
+            deltas = 0;
+        }
+        char base_sha[SHA256_HEX_LEN];
+        if (delta_base(entry->object, base_sha) == 0) {
+            // Already a delta: its base is the keyframe of the entries that follow
+            if (find_full_object(store_dir, base_sha, keyframe, sizeof(keyframe)) != 0) keyframe[0] = '\0';
+            deltas++;
+            continue;
+        }
+        if (has_suffix(entry->object, CODEC_ZSTD_SUFFIX)) {
+            snprintf(keyframe, sizeof(keyframe), "%s", entry->object);
+            deltas = 0;
+            continue;
+        }
+        if (use_delta && keyframe[0] && deltas < CODEC_KEYFRAME_INTERVAL && strncmp(keyframe, entry->object, SHA256_HEX_LEN - 1) != 0) {
+            int result = encode_delta(store_dir, tier_dir, entry, keyframe, use_zstd, log_fp, project_name);
+            if (result == 0) {
+                deltas++;
+                encoded++;
+                continue;
+            }
+            if (result < 0) {
+                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, entry->arch, "Unable to encode %s as a delta: %s", entry->name, strerror(errno));
+                errors++;
+            }
+        }
+        if (make_keyframe(store_dir, tier_dir, entry, use_zstd, keyframe, sizeof(keyframe), log_fp, project_name) != 0) {
+            errors++;
+            keyframe[0] = '\0';
+        }
+        deltas = 0;
+    }
+    int relinked = 0;
+    for (int i = 0; i < count; i++) relinked += entries[i].relinked;
+    if (relinked > 0) {
+        int dir_fd = open(tier_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+        errors += record_objects(target_dir, artifact_index_tier(tier), entries, count, log_fp, project_name);
+    }
+    free(entries);
+    store_unlock(lock_fd);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,1008 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "store/artifact_index.h"
+#include "store/artifact_store.h"
+#include "store/artifact_codec.h"
+#include "store/rotation.h"
+#include "utils/state_journal.h"
+#include "control/control.h"
+#include "utils/utils.h"
+
+/*
+    Index of the binaries published to a target dir: what was built (project, arch, tag, commits of all the repositories, build time,
+    size, sha256) and where it is now (tier, entry, object of the store and its disk usage). It lives in the store, as an append-only
+    log (.index.log) on top of a compacted snapshot (.index.snapshot), both made of checksummed lines like the state journal:
+        P <id> <tier> <name> <mtime> <project> <arch> <tag> <sha256> <size> <object> <stored> <base> <base stored> <built_at> <duration> <sources>
+        M <id> <tier>                                   (moved by the rotation; the rename keeps the mtime)
+        E <id> <object> <stored> <base> <base stored>   (re-encoded by the codec)
+        R <id> <epoch> <reason>                         (removed)
+        N <next id>                                     (first line of the snapshot)
+    An entry published or moved over another one of the same name replaces it, which the replay of the events reproduces on its own.
+    Every change of a target dir holds the lock of its store (see artifact_store.c), loads the index, appends its events with a single
+    write() each and makes them durable (fdatasync) before releasing the lock; a line torn by a crash fails its checksum and is dropped.
+    Once the log exceeds ARTIFACT_INDEX_COMPACT_AFTER lines it is folded into a new snapshot (temporary file, fsync, rename) and
+    truncated; replaying a log over the snapshot it was folded into gives the same records, so a crash in between is harmless.
+    Readers (the dry runs of the rotation, v2ci_fetch) load it without the lock.
+    Once loaded, the lookups are hash probes: by id, by <tier, entry>, and the newest live artifact of a <project, arch>, overall or
+    built from a given commit of any of its repositories. The events also keep running totals per tier: its live entries in age order
+    (a list linked through the records, where a publication or a move is appended at the newest end) and its disk usage, counting each
+    object once through the references of the entries to it. The rotation and the memory limits work on these alone (see rotation.c),
+    so that nothing lists the tiers or measures their files anymore; the tiers are scanned only to build the index of a target dir
+    that has none, and to reconcile it when the rotation finds an entry that does not match it (see artifact_index_rescan).
+*/
+
+#define INDEX_CHECKSUM_LEN 16
+#define INDEX_LINE_LEN (JOURNAL_SOURCES_LEN + NAME_MAX + 2 * ARTIFACT_OBJECT_LEN + 3 * MIN_CONFIG_ATTR_LEN + 256)
+#define INDEX_HASH_SEED 14695981039346656037ull
+#define INDEX_HASH_PRIME 1099511628211ull
+#define INDEX_SLOT_FREE -1
+#define INDEX_SLOT_DELETED -2
+
+typedef struct record_key {
+    long long id;
+    int tier;
+    const char *name;
+    const char *project;
+    const char *arch;
+    const char *commit;
+} record_key_t;
+
+typedef int (*record_match_fn)(const artifact_record_t *record, const record_key_t *key);
+
+const char *artifact_index_tier_name(int tier) {
+    return tier == ARTIFACT_TIER_REMOVED ? "removed" : rotation_tier_name(tier);
+}
+
+// Tier of the given name (ARTIFACT_TIER_REMOVED for "removed"); returns -2 for an unknown name
+int artifact_index_tier(const char *name) {
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        if (strcmp(name, rotation_tier_name(t)) == 0) return t;
+    }
+    return strcmp(name, "removed") == 0 ? ARTIFACT_TIER_REMOVED : -2;
+}
+
+/* Keys */
+
+// FNV-1a of the fields, each followed by a separator
+static uint64_t hash_field(uint64_t hash, const char *field) {
+    for (const unsigned char *p = (const unsigned char *)field; *p; p++) {
+        hash ^= *p;
+        hash *= INDEX_HASH_PRIME;
+    }
+    hash ^= 0xff;
+    return hash * INDEX_HASH_PRIME;
+}
+
+static uint64_t id_hash(long long id) {
+    char text[24];
+    snprintf(text, sizeof(text), "%lld", id);
+    return hash_field(INDEX_HASH_SEED, text);
+}
+
+static uint64_t entry_hash(int tier, const char *name) {
+    return hash_field(hash_field(INDEX_HASH_SEED, rotation_tier_name(tier)), name);
+}
+
+static uint64_t latest_hash(const char *project, const char *arch) {
+    return hash_field(hash_field(INDEX_HASH_SEED, project), arch);
+}
+
+static uint64_t commit_hash(const char *project, const char *arch, const char *commit) {
+    return hash_field(latest_hash(project, arch), commit);
+}
+
+// Identity of the object an entry links (or of the keyframe of a delta), shared by all the entries linking it: the rotation counts
+// the disk usage of a tier once per object (a plain file is its own object)
+uint64_t artifact_index_object_key(const artifact_record_t *record, int base) {
+    if (base) return hash_field(INDEX_HASH_SEED, record->base);
+    if (record->object[0]) return hash_field(INDEX_HASH_SEED, record->object);
+    char text[32];
+    snprintf(text, sizeof(text), "#%lld", record->id);
+    return hash_field(INDEX_HASH_SEED, text);
+}
+
+static int match_id(const artifact_record_t *record, const record_key_t *key) {
+    return record->id == key->id;
+}
+
+static int match_entry(const artifact_record_t *record, const record_key_t *key) {
+    return record->tier == key->tier && strcmp(record->name, key->name) == 0;
+}
+
+static int match_latest(const artifact_record_t *record, const record_key_t *key) {
+    return strcmp(record->project, key->project) == 0 && strcmp(record->arch, key->arch) == 0;
+}
+
+static int match_commit(const artifact_record_t *record, const record_key_t *key) {
+    return match_latest(record, key) && artifact_index_has_source(record, key->commit);
+}
+
+// Returns 1 if the binary was built from the given commit (or a commit starting with it) of one of its repositories
+int artifact_index_has_source(const artifact_record_t *record, const char *commit) {
+    size_t len = strlen(commit);
+    if (len == 0 || !record->sources) return 0;
+    for (const char *pair = record->sources; pair && *pair; pair = strchr(pair, ',') ? strchr(pair, ',') + 1 : NULL) {
+        const char *sha = strchr(pair, '=');
+        const char *end = strchr(pair, ',');
+        if (!sha || (end && sha > end)) continue;
+        sha++;
+        size_t sha_len = end ? (size_t)(end - sha) : strlen(sha);
+        if (len <= sha_len && strncmp(sha, commit, len) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Maps */
+
+static int map_init(artifact_map_t *map, size_t capacity) {
+    map->hashes = calloc(capacity, sizeof(uint64_t));
+    map->records = malloc(capacity * sizeof(int));
+    if (!map->hashes || !map->records) {
+        free(map->hashes);
+        free(map->records);
+        map->hashes = NULL;
+        map->records = NULL;
+        return 1;
+    }
+    for (size_t i = 0; i < capacity; i++) map->records[i] = INDEX_SLOT_FREE;
+    map->capacity = capacity;
+    map->used = 0;
+    return 0;
+}
+
+static void map_free(artifact_map_t *map) {
+    free(map->hashes);
+    free(map->records);
+    memset(map, 0, sizeof(*map));
+}
+
+// Slot of the record matching key, -1 if there is none
+static long map_find(const artifact_index_t *index, const artifact_map_t *map, uint64_t hash, record_match_fn match, const record_key_t *key) {
+    if (map->capacity == 0) return -1;
+    size_t mask = map->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        int record = map->records[i];
+        if (record == INDEX_SLOT_FREE) return -1;
+        if (record >= 0 && map->hashes[i] == hash && match(&index->records[record], key)) return (long)i;
+    }
+}
+
+// Rehashes the map into capacity slots, dropping the deleted ones
+static int map_rehash(artifact_map_t *map, size_t capacity) {
+    artifact_map_t grown;
+    if (map_init(&grown, capacity) != 0) return 1;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->records[i] < 0) continue;
+        size_t j = map->hashes[i] & (capacity - 1);
+        while (grown.records[j] != INDEX_SLOT_FREE) j = (j + 1) & (capacity - 1);
+        grown.hashes[j] = map->hashes[i];
+        grown.records[j] = map->records[i];
+        grown.used++;
+    }
+    map_free(map);
+    *map = grown;
+    return 0;
+}
+
+// Maps key to record, replacing the record it maps to if any; returns 0 on success
+static int map_put(const artifact_index_t *index, artifact_map_t *map, uint64_t hash, record_match_fn match, const record_key_t *key, int record) {
+    long slot = map_find(index, map, hash, match, key);
+    if (slot >= 0) {
+        map->records[slot] = record;
+        return 0;
+    }
+    if ((map->used + 1) * 2 > map->capacity && map_rehash(map, map->capacity * 2) != 0) return 1;
+    size_t mask = map->capacity - 1;
+    size_t i = hash & mask;
+    while (map->records[i] >= 0) i = (i + 1) & mask;
+    if (map->records[i] == INDEX_SLOT_FREE) map->used++;
+    map->hashes[i] = hash;
+    map->records[i] = record;
+    return 0;
+}
+
+// Unmaps key if it maps to record
+static void map_delete(const artifact_index_t *index, artifact_map_t *map, uint64_t hash, record_match_fn match, const record_key_t *key, int record) {
+    long slot = map_find(index, map, hash, match, key);
+    if (slot >= 0 && map->records[slot] == record) map->records[slot] = INDEX_SLOT_DELETED;
+}
+
+/* Live records */
+
+static int newer(const artifact_record_t *a, const artifact_record_t *b) {
+    return a->built_at != b->built_at ? a->built_at > b->built_at : a->id > b->id;
+}
+
+// Calls fn on each commit of the sources of the record
+static int for_each_commit(artifact_index_t *index, int record, int (*fn)(artifact_index_t *, int, const char *)) {
+    const char *sources = index->records[record].sources;
+    int result = 0;
+    while (sources && *sources) {
+        const char *end = strchr(sources, ',');
+        const char *sha = strchr(sources, '=');
+        size_t pair_len = end ? (size_t)(end - sources) : strlen(sources);
+        if (sha && sha < sources + pair_len) {
+            char commit[72];
+            snprintf(commit, sizeof(commit), "%.*s", (int)(sources + pair_len - sha - 1), sha + 1);
+            result |= fn(index, record, commit);
+        }
+        sources = end ? end + 1 : NULL;
+    }
+    return result;
+}
+
+static int link_commit(artifact_index_t *index, int record, const char *commit) {
+    const artifact_record_t *r = &index->records[record];
+    record_key_t key = { .project = r->project, .arch = r->arch, .commit = commit };
+    uint64_t hash = commit_hash(r->project, r->arch, commit);
+    long slot = map_find(index, &index->by_commit, hash, match_commit, &key);
+    if (slot >= 0 && !newer(r, &index->records[index->by_commit.records[slot]])) return 0;
+    return map_put(index, &index->by_commit, hash, match_commit, &key, record);
+}
+
+// Makes a live record reachable by its entry, and as the newest artifact of its <project, arch> and of its commits if it is
+static int link_record(artifact_index_t *index, int record) {
+    const artifact_record_t *r = &index->records[record];
+    record_key_t key = { .tier = r->tier, .name = r->name, .project = r->project, .arch = r->arch };
+    if (map_put(index, &index->by_entry, entry_hash(r->tier, r->name), match_entry, &key, record) != 0) return 1;
+    uint64_t hash = latest_hash(r->project, r->arch);
+    long slot = map_find(index, &index->latest, hash, match_latest, &key);
+    if ((slot < 0 || newer(r, &index->records[index->latest.records[slot]])) && map_put(index, &index->latest, hash, match_latest, &key, record) != 0) return 1;
+    return for_each_commit(index, record, link_commit);
+}
+
+// Newest live record of the <project, arch> of record (built from commit, if given) other than record itself; -1 if there is none
+static int newest_other(const artifact_index_t *index, int record, const char *commit) {
+    const artifact_record_t *r = &index->records[record];
+    record_key_t key = { .project = r->project, .arch = r->arch, .commit = commit };
+    int best = -1;
+    for (int i = 0; i < index->count; i++) {
+        const artifact_record_t *candidate = &index->records[i];
+        if (i == record || candidate->tier == ARTIFACT_TIER_REMOVED || !(commit ? match_commit(candidate, &key) : match_latest(candidate, &key))) continue;
+        if (best < 0 || newer(candidate, &index->records[best])) best = i;
+    }
+    return best;
+}
+
+// Hands the map slot of record over to the newest other live record matching key (or frees it); the scan only runs when the newest
+// artifact of a <project, arch> or of a commit goes away, which the rotation never does
+static void unlink_newest(artifact_index_t *index, artifact_map_t *map, uint64_t hash, record_match_fn match, const record_key_t *key, int record, const char *commit) {
+    long slot = map_find(index, map, hash, match, key);
+    if (slot < 0 || map->records[slot] != record) return;
+    int replacement = newest_other(index, record, commit);
+    map->records[slot] = replacement >= 0 ? replacement : INDEX_SLOT_DELETED;
+}
+
+static int unlink_commit(artifact_index_t *index, int record, const char *commit) {
+    const artifact_record_t *r = &index->records[record];
+    record_key_t key = { .project = r->project, .arch = r->arch, .commit = commit };
+    unlink_newest(index, &index->by_commit, commit_hash(r->project, r->arch, commit), match_commit, &key, record, commit);
+    return 0;
+}
+
+static void unlink_record(artifact_index_t *index, int record) {
+    const artifact_record_t *r = &index->records[record];
+    record_key_t key = { .tier = r->tier, .name = r->name, .project = r->project, .arch = r->arch };
+    map_delete(index, &index->by_entry, entry_hash(r->tier, r->name), match_entry, &key, record);
+    unlink_newest(index, &index->latest, latest_hash(r->project, r->arch), match_latest, &key, record, NULL);
+    for_each_commit(index, record, unlink_commit);
+}
+
+/* Running totals of the tiers */
+
+static int entry_older(const artifact_record_t *a, const artifact_record_t *b) {
+    if (a->mtime.tv_sec != b->mtime.tv_sec) return a->mtime.tv_sec < b->mtime.tv_sec;
+    if (a->mtime.tv_nsec != b->mtime.tv_nsec) return a->mtime.tv_nsec < b->mtime.tv_nsec;
+    return strcmp(a->name, b->name) < 0;
+}
+
+static artifact_object_t *object_slot(artifact_object_t *objects, size_t capacity, uint64_t key) {
+    size_t mask = capacity - 1;
+    size_t i = (size_t)key & mask;
+    while (objects[i].used && objects[i].key != key) i = (i + 1) & mask;
+    return &objects[i];
+}
+
+// Slot of an object, added if it is new (the table grows to keep half of it free); NULL if out of memory
+static artifact_object_t *object_ref(artifact_index_t *index, uint64_t key) {
+    if ((index->object_used + 1) * 2 > index->object_capacity) {
+        size_t capacity = index->object_capacity ? index->object_capacity * 2 : 64;
+        artifact_object_t *grown = calloc(capacity, sizeof(artifact_object_t));
+        if (!grown) return NULL;
+        for (size_t i = 0; i < index->object_capacity; i++) {
+            if (index->objects[i].used) *object_slot(grown, capacity, index->objects[i].key) = index->objects[i];
+        }
+        free(index->objects);
+        index->objects = grown;
+        index->object_capacity = capacity;
+    }
+    artifact_object_t *object = object_slot(index->objects, index->object_capacity, key);
+    if (!object->used) {
+        object->used = 1;
+        object->key = key;
+        index->object_used++;
+    }
+    return object;
+}
+
+static int object_total_refs(const artifact_object_t *object) {
+    int refs = 0;
+    for (int t = 0; t < ARTIFACT_TIER_COUNT; t++) refs += object->refs[t];
+    return refs;
+}
+
+// Adds (delta 1) or takes (delta -1) the references of a live record to its object and keyframe, which count in the disk usage of
+// its tier while the tier has any
+static int count_objects(artifact_index_t *index, const artifact_record_t *r, int delta) {
+    artifact_tier_t *tier = &index->tiers[r->tier];
+    for (int base = 0; base <= (r->base[0] != '\0'); base++) {
+        artifact_object_t *object = object_ref(index, artifact_index_object_key(r, base));
+        if (!object) return 1;
+        if (delta > 0 && object_total_refs(object) == 0) object->bytes = base ? r->base_stored : r->stored;
+        int *refs = &object->refs[r->tier];
+        if (delta > 0 && (*refs)++ == 0) tier->stored += object->bytes;
+        if (delta < 0 && *refs > 0 && --(*refs) == 0) tier->stored -= object->bytes;
+    }
+    return 0;
+}
+
+// Adds a live record to the totals of its tier, in age order: the walk from the newest end is short, since both the publications and
+// the entries moved from the previous tier are the newest of their tier
+static int tier_attach(artifact_index_t *index, int record) {
+    artifact_record_t *r = &index->records[record];
+    artifact_tier_t *tier = &index->tiers[r->tier];
+    if (count_objects(index, r, 1) != 0) return 1;
+    int newer = -1, older = tier->newest;
+    while (older >= 0 && entry_older(r, &index->records[older])) {
+        newer = older;
+        older = index->records[older].older;
+    }
+    r->older = older;
+    r->newer = newer;
+    if (older >= 0) index->records[older].newer = record;
+    else tier->oldest = record;
+    if (newer >= 0) index->records[newer].older = record;
+    else tier->newest = record;
+    tier->entries++;
+    return 0;
+}
+
+static void tier_detach(artifact_index_t *index, int record) {
+    artifact_record_t *r = &index->records[record];
+    artifact_tier_t *tier = &index->tiers[r->tier];
+    count_objects(index, r, -1);
+    if (r->older >= 0) index->records[r->older].newer = r->newer;
+    else tier->oldest = r->newer;
+    if (r->newer >= 0) index->records[r->newer].older = r->older;
+    else tier->newest = r->older;
+    r->older = r->newer = -1;
+    tier->entries--;
+}
+
+// Number of live entries referencing the object of record (or its keyframe, with base), in any tier
+int artifact_index_object_refs(const artifact_index_t *index, const artifact_record_t *record, int base) {
+    if (index->object_capacity == 0) return 0;
+    const artifact_object_t *object = object_slot(index->objects, index->object_capacity, artifact_index_object_key(record, base));
+    return object->used ? object_total_refs(object) : 0;
+}
+
+static int record_slot(const artifact_index_t *index, long long id) {
+    record_key_t key = { .id = id };
+    long slot = map_find(index, &index->by_id, id_hash(id), match_id, &key);
+    return slot >= 0 ? index->by_id.records[slot] : -1;
+}
+
+static void set_removed(artifact_index_t *index, int record, long long at, const char *reason) {
+    artifact_record_t *r = &index->records[record];
+    if (r->tier != ARTIFACT_TIER_REMOVED) {
+        unlink_record(index, record);
+        tier_detach(index, record);
+    }
+    r->tier = ARTIFACT_TIER_REMOVED;
+    r->removed_at = at;
+    snprintf(r->removed_reason, sizeof(r->removed_reason), "%s", reason);
+}
+
+/* Events, applied to the records (when loading and when changing the index) */
+
+// Adds a published record (or a removed one, from the snapshot)
+static int apply_publish(artifact_index_t *index, const artifact_record_t *published) {
+    int live = published->tier != ARTIFACT_TIER_REMOVED;
+    if (live && (published->tier < 0 || published->tier >= ROTATION_TIER_COUNT)) return 1;
+    char *sources = strdup(published->sources ? published->sources : "");
+    if (!sources) return 1;
+    int record = record_slot(index, published->id);
+    if (record >= 0) {
+        // Replayed over a snapshot that already has it
+        set_removed(index, record, published->mtime.tv_sec, "replaced");
+        free(index->records[record].sources);
+    } else {
+        if (index->count == index->capacity) {
+            int capacity = index->capacity ? index->capacity * 2 : 64;
+            artifact_record_t *grown = realloc(index->records, capacity * sizeof(artifact_record_t));
+            if (!grown) {
+                free(sources);
+                return 1;
+            }
+            index->records = grown;
+            index->capacity = capacity;
+        }
+        record = index->count++;
+        record_key_t key = { .id = published->id };
+        if (map_put(index, &index->by_id, id_hash(published->id), match_id, &key, record) != 0) {
+            index->count--;
+            free(sources);
+            return 1;
+        }
+    }
+    artifact_record_t *previous = live ? artifact_index_entry(index, published->tier, published->name) : NULL;
+    int replaced = previous ? (int)(previous - index->records) : -1;
+    index->records[record] = *published;
+    index->records[record].sources = sources;
+    index->records[record].older = index->records[record].newer = -1;
+    if (published->id >= index->next_id) index->next_id = published->id + 1;
+    if (!live) return 0;
+    index->records[record].removed_at = 0;
+    index->records[record].removed_reason[0] = '\0';
+    // The entry replaces the one of the same name in its tier, once it took over the maps (it is usually the newest of its
+    // <project, arch>, which then needs no scan)
+    int result = link_record(index, record);
+    if (result == 0) result = tier_attach(index, record);
+    if (replaced >= 0) set_removed(index, replaced, published->mtime.tv_sec, "replaced");
+    return result;
+}
+
+static int apply_move(artifact_index_t *index, long long id, int tier) {
+    int record = record_slot(index, id);
+    if (record < 0 || tier < 0 || tier >= ROTATION_TIER_COUNT) return 1;
+    artifact_record_t *r = &index->records[record];
+    if (r->tier == ARTIFACT_TIER_REMOVED) return 1;
+    record_key_t key = { .tier = r->tier, .name = r->name };
+    map_delete(index, &index->by_entry, entry_hash(r->tier, r->name), match_entry, &key, record);
+    tier_detach(index, record);
+    artifact_record_t *previous = artifact_index_entry(index, tier, r->name);
+    if (previous) set_removed(index, (int)(previous - index->records), r->mtime.tv_sec, "replaced");
+    r->tier = tier;
+    key.tier = tier;
+    if (map_put(index, &index->by_entry, entry_hash(tier, r->name), match_entry, &key, record) != 0) return 1;
+    return tier_attach(index, record);
+}
+
+static int apply_encode(artifact_index_t *index, long long id, const char *object, long long stored, const char *base, long long base_stored) {
+    int record = record_slot(index, id);
+    if (record < 0) return 1;
+    artifact_record_t *r = &index->records[record];
+    int live = r->tier != ARTIFACT_TIER_REMOVED;
+    if (live) count_objects(index, r, -1);
+    snprintf(r->object, sizeof(r->object), "%s", object);
+    snprintf(r->base, sizeof(r->base), "%s", base);
+    r->stored = stored;
+    r->base_stored = base_stored;
+    return live ? count_objects(index, r, 1) : 0;
+}
+
+static int apply_remove(artifact_index_t *index, long long id, long long at, const char *reason) {
+    int record = record_slot(index, id);
+    if (record < 0) return 1;
+    set_removed(index, record, at, reason);
+    return 0;
+}
+
+/* Lines */
+
+static void line_checksum(const char *text, size_t len, char checksum[INDEX_CHECKSUM_LEN + 1]) {
+    sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_LEN];
+    char hex[SHA256_HEX_LEN];
+    sha256_init(&ctx);
+    sha256_update(&ctx, text, len);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hex);
+    memcpy(checksum, hex, INDEX_CHECKSUM_LEN);
+    checksum[INDEX_CHECKSUM_LEN] = '\0';
+}
+
+// Adds the checksum and the newline to the event in line (of length len); returns the length of the line, 0 if it does not fit
+static size_t seal_line(char *line, int len, size_t line_size) {
+    if (len < 0 || (size_t)len + INDEX_CHECKSUM_LEN + 3 > line_size) return 0;
+    char checksum[INDEX_CHECKSUM_LEN + 1];
+    line_checksum(line, (size_t)len, checksum);
+    len += snprintf(line + len, line_size - len, " %s\n", checksum);
+    return (size_t)len;
+}
+
+static const char *or_dash(const char *s) {
+    return s && s[0] ? s : "-";
+}
+
+static size_t format_publish(const artifact_record_t *r, char *line, size_t line_size) {
+    int len = snprintf(line, line_size, "P %lld %d %s %lld.%09ld %s %s %s %s %lld %s %lld %s %lld %lld %ld %s", r->id, r->tier, r->name,
+        (long long)r->mtime.tv_sec, r->mtime.tv_nsec, or_dash(r->project), or_dash(r->arch), or_dash(r->tag), or_dash(r->sha256), r->size,
+        or_dash(r->object), r->stored, or_dash(r->base), r->base_stored, r->built_at, r->duration_s, or_dash(r->sources));
+    return seal_line(line, len, line_size);
+}
+
+static void copy_field(char *dst, size_t size, const char *field) {
+    snprintf(dst, size, "%s", strcmp(field, "-") == 0 ? "" : field);
+}
+
+// Parses a line of the snapshot or of the log and applies its event; returns 0 if it is whole and valid
+static int apply_line(artifact_index_t *index, char *line) {
+    char *checksum_start = strrchr(line, ' ');
+    if (!checksum_start) return 1;
+    char checksum[INDEX_CHECKSUM_LEN + 1];
+    line_checksum(line, (size_t)(checksum_start - line), checksum);
+    if (strncmp(checksum_start + 1, checksum, INDEX_CHECKSUM_LEN) != 0) return 1;
+    *checksum_start = '\0';
+
+    char *fields[18];
+    int count = 0;
+    char *save = NULL;
+    for (char *field = strtok_r(line, " ", &save); field && count < 18; field = strtok_r(NULL, " ", &save)) fields[count++] = field;
+    if (count < 2 || strlen(fields[0]) != 1) return 1;
+    long long id = atoll(fields[1]);
+    switch (fields[0][0]) {
+        case 'N':
+            if (count != 2) return 1;
+            if (id > index->next_id) index->next_id = id;
+            return 0;
+        case 'M':
+            return count == 3 ? apply_move(index, id, atoi(fields[2])) : 1;
+        case 'E':
+            if (count != 6) return 1;
+            return apply_encode(index, id, strcmp(fields[2], "-") == 0 ? "" : fields[2], atoll(fields[3]), strcmp(fields[4], "-") == 0 ? "" : fields[4], atoll(fields[5]));
+        case 'R':
+            return count == 4 ? apply_remove(index, id, atoll(fields[2]), strcmp(fields[3], "-") == 0 ? "" : fields[3]) : 1;
+        case 'P': {
+            if (count != 17) return 1;
+            artifact_record_t r;
+            memset(&r, 0, sizeof(r));
+            r.id = id;
+            r.tier = atoi(fields[2]);
+            copy_field(r.name, sizeof(r.name), fields[3]);
+            long long sec = 0;
+            long nsec = 0;
+            if (sscanf(fields[4], "%lld.%ld", &sec, &nsec) != 2) return 1;
+            r.mtime.tv_sec = (time_t)sec;
+            r.mtime.tv_nsec = nsec;
+            copy_field(r.project, sizeof(r.project), fields[5]);
+            copy_field(r.arch, sizeof(r.arch), fields[6]);
+            copy_field(r.tag, sizeof(r.tag), fields[7]);
+            copy_field(r.sha256, sizeof(r.sha256), fields[8]);
+            r.size = atoll(fields[9]);
+            copy_field(r.object, sizeof(r.object), fields[10]);
+            r.stored = atoll(fields[11]);
+            copy_field(r.base, sizeof(r.base), fields[12]);
+            r.base_stored = atoll(fields[13]);
+            r.built_at = atoll(fields[14]);
+            r.duration_s = atol(fields[15]);
+            r.sources = strcmp(fields[16], "-") == 0 ? "" : fields[16];
+            return apply_publish(index, &r);
+        }
+        default:
+            return 1;
+    }
+}
+
+// Appends an event to the log and makes it the latest change of the index; a read-only index only applies it
+static int append_line(artifact_index_t *index, const char *line, size_t len) {
+    if (!index->writable) return 0;
+    if (len == 0) {
+        errno = EOVERFLOW;
+        return 1;
+    }
+    if (index->log_fd < 0) {
+        char log_path[MAX_CONFIG_ATTR_LEN * 2];
+        snprintf(log_path, sizeof(log_path), "%s/" ARTIFACT_INDEX_LOG, index->store_dir);
+        index->log_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (index->log_fd < 0) return 1;
+    }
+    if (write(index->log_fd, line, len) != (ssize_t)len) return 1;
+    index->log_lines++;
+    index->appended++;
+    return 0;
+}
+
+static int load_file(artifact_index_t *index, const char *name, int *lines) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/%s", index->store_dir, name);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return errno == ENOENT ? -1 : 1;
+    char *line = malloc(INDEX_LINE_LEN);
+    if (!line) {
+        fclose(fp);
+        return 1;
+    }
+    while (fgets(line, INDEX_LINE_LEN, fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') continue;
+        if (lines) (*lines)++;
+        if (apply_line(index, line) != 0) index->damaged++;
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+/* Opening and closing */
+
+static void free_index(artifact_index_t *index) {
+    for (int i = 0; i < index->count; i++) free(index->records[i].sources);
+    free(index->records);
+    map_free(&index->by_id);
+    map_free(&index->by_entry);
+    map_free(&index->latest);
+    map_free(&index->by_commit);
+    free(index->objects);
+    index->objects = NULL;
+    index->object_capacity = index->object_used = 0;
+    if (index->log_fd >= 0) close(index->log_fd);
+    index->records = NULL;
+    index->count = index->capacity = 0;
+    index->log_fd = -1;
+}
+
+static int compact_index(artifact_index_t *index) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 2 + 8];
+    snprintf(path, sizeof(path), "%s/" ARTIFACT_INDEX_SNAPSHOT, index->store_dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) return 1;
+    char *line = malloc(INDEX_LINE_LEN);
+    if (!line) {
+        fclose(fp);
+        unlink(tmp_path);
+        return 1;
+    }
+    int failed = 0;
+    size_t len = seal_line(line, snprintf(line, INDEX_LINE_LEN, "N %lld", index->next_id), INDEX_LINE_LEN);
+    failed |= fwrite(line, 1, len, fp) != len;
+    long long history_limit = (long long)time(NULL) - ARTIFACT_INDEX_HISTORY_DAYS * 86400LL;
+    for (int i = 0; i < index->count && !failed; i++) {
+        artifact_record_t r = index->records[i];
+        int removed = r.tier == ARTIFACT_TIER_REMOVED;
+        if (removed && r.removed_at < history_limit) continue;
+        // A removed record is written with its removal, which sets its date and reason
+        len = format_publish(&r, line, INDEX_LINE_LEN);
+        failed |= len == 0 || fwrite(line, 1, len, fp) != len;
+        if (removed && !failed) {
+            len = seal_line(line, snprintf(line, INDEX_LINE_LEN, "R %lld %lld %s", r.id, r.removed_at, or_dash(r.removed_reason)), INDEX_LINE_LEN);
+            failed |= fwrite(line, 1, len, fp) != len;
+        }
+    }
+    free(line);
+    if (failed || fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        fclose(fp);
+        unlink(tmp_path);
+        return 1;
+    }
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    int dir_fd = open(index->store_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    // The log is folded into the snapshot: start it over
+    char log_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(log_path, sizeof(log_path), "%s/" ARTIFACT_INDEX_LOG, index->store_dir);
+    if (index->log_fd >= 0) close(index->log_fd);
+    index->log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (index->log_fd < 0 || fsync(index->log_fd) != 0) return 1;
+    index->log_lines = 0;
+    return 0;
+}
+
+// Loads the index of a target dir; one that has none yet is built from its tiers (and written on close, if writable). A writable
+// index must be opened and closed with the store locked (see store_lock). Returns 0 on success; the index is closed with
+// artifact_index_close in any case.
+int artifact_index_open(const char *target_dir, int writable, artifact_index_t *index) {
+    memset(index, 0, sizeof(*index));
+    index->log_fd = -1;
+    index->next_id = 1;
+    for (int t = 0; t < ARTIFACT_TIER_COUNT; t++) index->tiers[t].oldest = index->tiers[t].newest = -1;
+    snprintf(index->target_dir, sizeof(index->target_dir), "%s", target_dir);
+    snprintf(index->store_dir, sizeof(index->store_dir), "%s/" STORE_DIR_NAME, target_dir);
+    if (map_init(&index->by_id, 64) != 0 || map_init(&index->by_entry, 64) != 0 || map_init(&index->latest, 16) != 0 || map_init(&index->by_commit, 64) != 0) return 1;
+    int snapshot = load_file(index, ARTIFACT_INDEX_SNAPSHOT, NULL);
+    int log = load_file(index, ARTIFACT_INDEX_LOG, &index->log_lines);
+    if (snapshot > 0 || log > 0) return 1;
+    // Nothing is removed from the store on the word of an index that lost lines (see collect_garbage in rotation.c)
+    index->stale = index->damaged > 0;
+    if (snapshot < 0 && log < 0) {
+        // First use of the index on this target dir: its entries are imported without their build data
+        index->imported = 1;
+        if (artifact_index_rescan(index, NULL, NULL) != 0) return 1;
+    }
+    index->writable = writable;
+    // A torn line would be glued to the next one appended: the damaged files are rewritten first
+    if (writable && index->damaged > 0 && !index->imported && compact_index(index) != 0) return 1;
+    return 0;
+}
+
+// Makes the changes to a writable index durable (compacting it when its log has grown long) and frees it; returns 0 on success
+int artifact_index_close(artifact_index_t *index, FILE *log_fp, const char *project_name) {
+    int result = 0;
+    if (index->writable) {
+        if (index->appended > 0 && index->log_fd >= 0 && fdatasync(index->log_fd) != 0) result = 1;
+        if (result == 0 && (index->imported || index->log_lines > ARTIFACT_INDEX_COMPACT_AFTER)) {
+            if (compact_index(index) != 0) {
+                formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, NULL, "Unable to compact the artifact index of %s: %s", index->target_dir, strerror(errno));
+            } else if (index->imported) {
+                formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Artifact index of %s created with %d entries of the tiers.", index->target_dir, index->count);
+            }
+        }
+        if (result != 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to write the artifact index of %s: %s", index->target_dir, strerror(errno));
+        }
+    }
+    free_index(index);
+    return result;
+}
+
+/* Queries */
+
+artifact_record_t *artifact_index_get(const artifact_index_t *index, long long id) {
+    int record = record_slot(index, id);
+    return record >= 0 ? &index->records[record] : NULL;
+}
+
+artifact_record_t *artifact_index_entry(const artifact_index_t *index, int tier, const char *name) {
+    record_key_t key = { .tier = tier, .name = name };
+    long slot = map_find(index, &index->by_entry, entry_hash(tier, name), match_entry, &key);
+    return slot >= 0 ? &index->records[index->by_entry.records[slot]] : NULL;
+}
+
+// Newest live artifact of <project, arch>, built from the given commit of one of its repositories if commit is not NULL (a commit
+// shorter than a full sha is looked up by prefix, with a scan of the records); NULL if there is none
+artifact_record_t *artifact_index_latest(const artifact_index_t *index, const char *project, const char *arch, const char *commit) {
+    record_key_t key = { .project = project, .arch = arch, .commit = commit };
+    long slot;
+    if (!commit) {
+        slot = map_find(index, &index->latest, latest_hash(project, arch), match_latest, &key);
+        return slot >= 0 ? &index->records[index->latest.records[slot]] : NULL;
+    }
+    if (strlen(commit) >= 40) {
+        slot = map_find(index, &index->by_commit, commit_hash(project, arch, commit), match_commit, &key);
+        return slot >= 0 ? &index->records[index->by_commit.records[slot]] : NULL;
+    }
+    artifact_record_t *best = NULL;
+    for (int i = 0; i < index->count; i++) {
+        artifact_record_t *r = &index->records[i];
+        if (r->tier != ARTIFACT_TIER_REMOVED && match_commit(r, &key) && (!best || newer(r, best))) best = r;
+    }
+    return best;
+}
+
+// Appends the record to buf as a JSON object; a live record gets its location (its path, or its URL) under location_key
+void artifact_index_record_json(json_buf_t *buf, const artifact_record_t *r, const char *location_key, const char *location) {
+    json_printf(buf, "{\"id\":%lld,\"project\":", r->id);
+    json_string(buf, r->project);
+    json_printf(buf, ",\"arch\":");
+    json_string(buf, r->arch);
+    json_printf(buf, ",\"tag\":");
+    json_string(buf, r->tag);
+    json_printf(buf, ",\"sources\":");
+    json_string(buf, r->sources);
+    json_printf(buf, ",\"sha256\":\"%s\",\"built_at\":%lld,\"duration_s\":%ld,\"size\":%lld,\"stored\":%lld,\"tier\":\"%s\",\"name\":", r->sha256, r->built_at,
+        r->duration_s, r->size, r->stored + r->base_stored, artifact_index_tier_name(r->tier));
+    json_string(buf, r->name);
+    json_printf(buf, ",\"object\":");
+    json_string(buf, r->object);
+    if (r->tier == ARTIFACT_TIER_REMOVED) {
+        json_printf(buf, ",\"removed_at\":%lld,\"removed_reason\":", r->removed_at);
+        json_string(buf, r->removed_reason);
+    } else if (location_key) {
+        json_printf(buf, ",\"%s\":", location_key);
+        json_string(buf, location);
+    }
+    json_printf(buf, "}");
+}
+
+/* Changes */
+
+// Records a published entry, assigning its id; returns 0 on success
+int artifact_index_publish(artifact_index_t *index, artifact_record_t *record) {
+    record->id = index->next_id;
+    char *line = malloc(INDEX_LINE_LEN);
+    if (!line) return 1;
+    size_t len = format_publish(record, line, INDEX_LINE_LEN);
+    int result = append_line(index, line, len);
+    free(line);
+    return result == 0 ? apply_publish(index, record) : 1;
+}
+
+// Records the move of an entry to another tier (where it replaces the entry of the same name)
+int artifact_index_move(artifact_index_t *index, long long id, int tier) {
+    char line[128];
+    size_t len = seal_line(line, snprintf(line, sizeof(line), "M %lld %d", id, tier), sizeof(line));
+    return append_line(index, line, len) == 0 ? apply_move(index, id, tier) : 1;
+}
+
+// Records the object an entry links after it was encoded
+int artifact_index_encode(artifact_index_t *index, long long id, const char *object, long long stored, const char *base, long long base_stored) {
+    char line[2 * ARTIFACT_OBJECT_LEN + 128];
+    size_t len = seal_line(line, snprintf(line, sizeof(line), "E %lld %s %lld %s %lld", id, or_dash(object), stored, or_dash(base), base_stored), sizeof(line));
+    return append_line(index, line, len) == 0 ? apply_encode(index, id, object, stored, base, base_stored) : 1;
+}
+
+// Records the removal of an entry (reason: a single word)
+int artifact_index_remove(artifact_index_t *index, long long id, const char *reason) {
+    char line[128];
+    long long now = (long long)time(NULL);
+    size_t len = seal_line(line, snprintf(line, sizeof(line), "R %lld %lld %s", id, now, reason), sizeof(line));
+    return append_line(index, line, len) == 0 ? apply_remove(index, id, now, reason) : 1;
+}
+
+/* Reconciliation with the tiers */
+
+// Reads what an entry of a tier links (its object and keyframe, with their disk usage) into record; returns 1 if it is neither a link
+// nor a regular file
+static int read_entry(const artifact_index_t *index, int dir_fd, const char *name, artifact_record_t *record) {
+    struct stat st, target;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !(S_ISLNK(st.st_mode) || S_ISREG(st.st_mode))) return 1;
+    record->mtime = st.st_mtim;
+    record->object[0] = record->base[0] = '\0';
+    record->stored = record->base_stored = 0;
+    // A dangling link costs nothing; an entry published before the store is its own object
+    if (fstatat(dir_fd, name, &target, 0) != 0) return 0;
+    record->stored = (long long)target.st_blocks * 512;
+    if (S_ISREG(st.st_mode)) {
+        record->size = (long long)target.st_size;
+        return 0;
+    }
+    char link[MAX_CONFIG_ATTR_LEN];
+    const char *prefix = "../" STORE_DIR_NAME "/";
+    ssize_t n = readlinkat(dir_fd, name, link, sizeof(link) - 1);
+    if (n <= 0) return 0;
+    link[n] = '\0';
+    if (strncmp(link, prefix, strlen(prefix)) != 0) {
+        record->size = (long long)target.st_size;
+        return 0;
+    }
+    snprintf(record->object, sizeof(record->object), "%s", link + strlen(prefix));
+    char path[MAX_CONFIG_ATTR_LEN * 3];
+    if (store_delta_base_object(index->store_dir, record->object, record->base, sizeof(record->base)) == 0) {
+        snprintf(path, sizeof(path), "%s/%s", index->store_dir, record->base);
+        if (stat(path, &target) == 0) record->base_stored = (long long)target.st_blocks * 512;
+    } else {
+        record->base[0] = '\0';
+    }
+    return 0;
+}
+
+// Fills the build data of an entry found in a tier without a record, from its name (<repo>-<release>-<arch>) and its object
+static void guess_build(const artifact_index_t *index, const char *project_name, artifact_record_t *record) {
+    snprintf(record->project, sizeof(record->project), "%s", project_name ? project_name : "");
+    const char *arch = strrchr(record->name, '-');
+    snprintf(record->arch, sizeof(record->arch), "%s", arch ? arch + 1 : "");
+    if (arch) {
+        const char *tag = arch;
+        while (tag > record->name && tag[-1] != '-') tag--;
+        if (tag > record->name) snprintf(record->tag, sizeof(record->tag), "%.*s", (int)(arch - tag), tag);
+    }
+    if (record->object[0]) {
+        snprintf(record->sha256, sizeof(record->sha256), "%.64s", record->object);
+        record->size = store_object_logical_size(index->store_dir, record->object);
+    } else {
+        char path[MAX_CONFIG_ATTR_LEN * 3];
+        snprintf(path, sizeof(path), "%s/%s/%s", index->target_dir, rotation_tier_name(record->tier), record->name);
+        if (sha256_file(path, record->sha256) != 0) record->sha256[0] = '\0';
+    }
+    record->built_at = (long long)record->mtime.tv_sec;
+    record->duration_s = -1;
+    record->sources = "";
+}
+
+typedef struct found_entry {
+    char name[NAME_MAX + 1];
+    int tier;
+    artifact_record_t seen;                 // What the entry links now
+} found_entry_t;
+
+static int same_mtime(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+// Brings the index in line with the entries of the tiers: an entry found elsewhere than recorded (with its mtime) is moved, a
+// relinked one is re-encoded, an unknown one is imported (with the build data its name tells) and a missing one has vanished.
+// Returns 0 on success.
+int artifact_index_rescan(artifact_index_t *index, FILE *log_fp, const char *project_name) {
+    int *seen = calloc(index->count + 1, sizeof(int));
+    found_entry_t *unmatched = NULL;
+    int unmatched_count = 0, unmatched_capacity = 0;
+    int moved = 0, imported = 0, vanished = 0, relinked = 0, failed = seen == NULL;
+    for (int t = 0; t < ROTATION_TIER_COUNT && !failed; t++) {
+        char tier_dir[MAX_CONFIG_ATTR_LEN * 2];
+        snprintf(tier_dir, sizeof(tier_dir), "%s/%s", index->target_dir, rotation_tier_name(t));
+        DIR *dp = opendir(tier_dir);
+        if (!dp) {
+            failed = errno != ENOENT;
+            continue;
+        }
+        struct dirent *de;
+        while ((de = readdir(dp)) != NULL && !failed) {
+            // Names with blanks cannot be recorded (the publications never make them)
+            if (de->d_name[0] == '.' || strpbrk(de->d_name, " \t\n")) continue;
+            artifact_record_t current;
+            memset(&current, 0, sizeof(current));
+            if (read_entry(index, dirfd(dp), de->d_name, &current) != 0) continue;
+            artifact_record_t *r = artifact_index_entry(index, t, de->d_name);
+            if (r && same_mtime(&r->mtime, &current.mtime)) {
+                seen[r - index->records] = 1;
+                if (strcmp(r->object, current.object) != 0 || r->stored != current.stored || r->base_stored != current.base_stored) {
+                    failed |= artifact_index_encode(index, r->id, current.object, current.stored, current.base, current.base_stored);
+                    relinked++;
+                }
+                continue;
+            }
+            if (unmatched_count == unmatched_capacity) {
+                unmatched_capacity = unmatched_capacity ? unmatched_capacity * 2 : 16;
+                found_entry_t *grown = realloc(unmatched, unmatched_capacity * sizeof(found_entry_t));
+                if (!grown) {
+                    failed = 1;
+                    break;
+                }
+                unmatched = grown;
+            }
+            found_entry_t *found = &unmatched[unmatched_count++];
+            snprintf(found->name, sizeof(found->name), "%s", de->d_name);
+            found->tier = t;
+            found->seen = current;
+        }
+        closedir(dp);
+    }
+    // Entries that are not where the index has them: moved (same name and mtime in another tier), or new
+    int records_before = index->count;
+    for (int i = 0; i < unmatched_count && !failed; i++) {
+        found_entry_t *found = &unmatched[i];
+        int match = -1;
+        for (int k = 0; k < records_before; k++) {
+            artifact_record_t *r = &index->records[k];
+            if (!seen[k] && r->tier != ARTIFACT_TIER_REMOVED && strcmp(r->name, found->name) == 0 && same_mtime(&r->mtime, &found->seen.mtime)) {
+                match = k;
+                break;
+            }
+        }
+        if (match >= 0) {
+            long long id = index->records[match].id;
+            seen[match] = 1;
+            failed |= artifact_index_move(index, id, found->tier);
+            failed |= artifact_index_encode(index, id, found->seen.object, found->seen.stored, found->seen.base, found->seen.base_stored);
+            moved++;
+            continue;
+        }
+        artifact_record_t record = found->seen;
+        snprintf(record.name, sizeof(record.name), "%s", found->name);
+        record.tier = found->tier;
+        guess_build(index, project_name, &record);
+        failed |= artifact_index_publish(index, &record);
+        imported++;
+    }
+    for (int k = 0; k < records_before && !failed; k++) {
+        if (!seen[k] && index->records[k].tier != ARTIFACT_TIER_REMOVED) {
+            failed |= artifact_index_remove(index, index->records[k].id, "vanished");
+            vanished++;
+        }
+    }
+    free(seen);
+    free(unmatched);
+    if (failed) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to reconcile the artifact index of %s with its tiers: %s", index->target_dir, strerror(errno));
+        return 1;
+    }
+    index->stale = 0;
+    if (log_fp && (moved || imported || vanished || relinked)) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, NULL, "Artifact index of %s reconciled with its tiers: %d imported, %d moved, %d relinked, %d vanished.", index->target_dir, imported, moved, relinked, vanished);
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "store/artifact_store.h"
+#include "store/rotation.h"
+#include "utils/utils.h"
+
+/*
+    Content-addressed store of the published binaries of a target dir.
+    Every binary is stored once in <target_dir>/.store/<sha256>; the entries of the daily, weekly, monthly and yearly dirs are relative
+    symlinks to it (../.store/<sha256>), so that a rebuild producing the same bytes costs nothing and the rotation only renames links.
+    Links rather than hardlinks keep their own mtime, which is the age of the entry for the rotation (see rotation.c). The older tiers
+    may link encoded objects (<sha256>.zst, <sha256>.from-<base sha256>.vd), written by the rotation (see artifact_codec.c).
+    Every change of a target dir (publications of the architectures of a project, rotation, packing) is serialized by an exclusive
+    flock on <store>/.lock, under which the artifact index of the target dir is updated as well (see artifact_index.c): the index
+    always describes the tiers as of the last release of the lock.
+    A binary is written to a temporary file of the store, fsync'ed and renamed, and so is its link: a crash never leaves a partial
+    object or entry.
+*/
+
+// Creates the store if needed and locks it; returns the descriptor of the lock (for store_unlock), -1 on failure
+int store_lock(const char *store_dir, FILE *log_fp, const char *project_name) {
+    char lock_file[MAX_CONFIG_ATTR_LEN * 2 + 8];
+    snprintf(lock_file, sizeof(lock_file), "%s/" STORE_LOCK_FILE, store_dir);
+    if (recursive_mkdir_or_file(store_dir, 0755, 0) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to create the store %s: %s", store_dir, strerror(errno));
+        return -1;
+    }
+    int lock_fd = open(lock_file, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to lock the store %s: %s", store_dir, strerror(errno));
+        if (lock_fd >= 0) close(lock_fd);
+        return -1;
+    }
+    return lock_fd;
+}
+
+void store_unlock(int lock_fd) {
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+}
+
+static void sync_dir(const char *dir) {
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+// Copies binary to a new object of the store named sha (nothing to do if it is there already)
+static int store_object(const char *store_dir, const char *binary, const char *sha) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 2];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", store_dir, sha);
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) return 0;
+    snprintf(tmp_path, sizeof(tmp_path), "%s/" STORE_BLOB_TMP_PREFIX "XXXXXX", store_dir);
+    int in_fd = open(binary, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) return 1;
+    int out_fd = mkstemp(tmp_path);
+    if (out_fd < 0) {
+        close(in_fd);
+        return 1;
+    }
+    char buffer[65536];
+    ssize_t n;
+    int failed = 0;
+    while (!failed && (n = read(in_fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            failed = 1;
+            break;
+        }
+        for (ssize_t written = 0; written < n && !failed;) {
+            ssize_t w = write(out_fd, buffer + written, n - written);
+            if (w < 0 && errno != EINTR) failed = 1;
+            if (w > 0) written += w;
+        }
+    }
+    close(in_fd);
+    if (failed || fchmod(out_fd, 0755) != 0 || fsync(out_fd) != 0) {
+        close(out_fd);
+        unlink(tmp_path);
+        return 1;
+    }
+    close(out_fd);
+    if (rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    sync_dir(store_dir);
+    return 0;
+}
+
+// Adds the binary to the store (if its content is not there yet) and publishes <tier>/<name> as a link to it, with sha receiving its
+// sha256; called with the store locked, returns 0 on success
+int store_publish(const char *target_dir, const char *binary, const char *tier, const char *name, char sha[SHA256_HEX_LEN], FILE *log_fp, const char *project_name, const char *arch) {
+    char store_dir[MAX_CONFIG_ATTR_LEN * 2];
+    char tier_dir[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(store_dir, sizeof(store_dir), "%s/" STORE_DIR_NAME, target_dir);
+    snprintf(tier_dir, sizeof(tier_dir), "%s/%s", target_dir, tier);
+    if (sha256_file(binary, sha) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Unable to read %s: %s", binary, strerror(errno));
+        return 1;
+    }
+    if (recursive_mkdir_or_file(tier_dir, 0755, 0) != 0 || store_object(store_dir, binary, sha) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Unable to store %s in %s: %s", binary, store_dir, strerror(errno));
+        return 1;
+    }
+    char target[SHA256_HEX_LEN + 16];
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 3];
+    char path[MAX_CONFIG_ATTR_LEN * 3];
+    snprintf(target, sizeof(target), "../" STORE_DIR_NAME "/%s", sha);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.partial", tier_dir, name);
+    snprintf(path, sizeof(path), "%s/%s", tier_dir, name);
+    unlink(tmp_path);
+    if (symlink(target, tmp_path) != 0 || rename(tmp_path, path) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Unable to publish %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+    sync_dir(tier_dir);
+    return 0;
+}
+
+// Publishes the binary of a build as the daily entry record->name, records it in the artifact index (with the build data of record:
+// project, arch, tag, sources, built_at and duration) and keeps the daily dir within its memory limit; returns 0 on success
+int store_publish_artifact(const char *target_dir, const char *binary, artifact_record_t *record, const binaries_limits_for_project_t *limits, FILE *log_fp) {
+    char store_dir[MAX_CONFIG_ATTR_LEN * 2];
+    char entry_path[MAX_CONFIG_ATTR_LEN * 3];
+    snprintf(store_dir, sizeof(store_dir), "%s/" STORE_DIR_NAME, target_dir);
+    snprintf(entry_path, sizeof(entry_path), "%s/%s/%s", target_dir, rotation_tier_name(ROTATION_TIER_DAILY), record->name);
+    int lock_fd = store_lock(store_dir, log_fp, record->project);
+    if (lock_fd < 0) return 1;
+    if (store_publish(target_dir, binary, rotation_tier_name(ROTATION_TIER_DAILY), record->name, record->sha256, log_fp, record->project, record->arch) != 0) {
+        store_unlock(lock_fd);
+        return 1;
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, record->project, record->arch, "Published %s as %s/%s.", entry_path, STORE_DIR_NAME, record->sha256);
+
+    // The index is updated under the same lock: a rotation never sees the entry without its record
+    artifact_index_t index;
+    struct stat st;
+    char object_path[MAX_CONFIG_ATTR_LEN * 3];
+    snprintf(object_path, sizeof(object_path), "%s/%s", store_dir, record->sha256);
+    int result = artifact_index_open(target_dir, 1, &index);
+    if (result == 0 && lstat(entry_path, &st) == 0) {
+        record->tier = ROTATION_TIER_DAILY;
+        record->mtime = st.st_mtim;
+        snprintf(record->object, sizeof(record->object), "%s", record->sha256);
+        record->base[0] = '\0';
+        record->base_stored = 0;
+        if (stat(object_path, &st) == 0) {
+            record->size = (long long)st.st_size;
+            record->stored = (long long)st.st_blocks * 512;
+        }
+        result = artifact_index_publish(&index, record);
+        if (result == 0) result = rotation_trim_tier(&index, ROTATION_TIER_DAILY, limits, log_fp, record->project);
+    } else {
+        result = 1;
+    }
+    if (result != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, record->project, record->arch, "Unable to record %s in the artifact index of %s: %s", record->name, target_dir, strerror(errno));
+    } else {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, record->project, record->arch, "Recorded as artifact %lld (%lld KB, built in %ld s).", record->id, record->size / 1024, record->duration_s);
+    }
+    if (artifact_index_close(&index, log_fp, record->project) != 0) result = 1;
+    store_unlock(lock_fd);
+    return result;
+}
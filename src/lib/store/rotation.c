@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "store/rotation.h"
+#include "store/artifact_codec.h"
+#include "store/artifact_store.h"
+#include "store/artifact_index.h"
+#include "utils/utils.h"
+
+/*
+    Rotation of the binaries of a target dir (run by the supervisor every day at midnight, see supervisor.c).
+    The entries of each tier (daily, weekly, monthly, yearly) are taken from the artifact index of the target dir (see artifact_index.c)
+    into a list in the age order the index keeps (the mtime of an entry, kept by the links of the store). The rotation is then simulated
+    on the lists, which yields the plan, and only the plan touches the disk:
+    - yearly entries older than a year expire;
+    - monthly, weekly and daily entries (in this order) older than a month, a week and a day move to the next tier, oldest first, unless
+      they are closer than the interval of the next tier to its newest entry, in which case they are removed;
+    - the oldest entries of the weekly, monthly and yearly tiers are evicted while the tier exceeds its memory limit (the newest one is
+      always kept).
+    The size of a tier is kept up to date while simulating: every entry references the object of the store it links (and the keyframe,
+    for a delta) with its disk usage as recorded by the index, each tier counts the references to every object, and an object adds its
+    size to the tier when it gets its first reference and takes it back with its last one (as "du -L" counts it once). So the rotation
+    reads no directory and measures no file, whatever the number of entries. The plan is checked entry by entry when it is executed
+    (one stat each): an entry replaced since it was planned is left alone, and an entry that does not match the index makes the index
+    reconcile with the tiers before the store is cleaned up. Every move and removal is recorded in the index.
+    The daily tier is kept within its own memory limit by each publication, directly on the running totals of the index: an eviction
+    costs the unlink of the entry, and of each object no live entry references anymore (see rotation_trim_tier).
+    With a storage codec the entries moved to a tier are encoded after the moves, in the rotating process (store_pack_tier, the code
+    behind v2ci_fetch --pack, which is not run), and the evictions are planned again on the encoded sizes: the evictions of a dry run
+    are then an upper bound.
+*/
+
+#define ROTATION_BLOB_TMP_MAX_AGE_S 3600    // Temporary files of interrupted publications left in the store
+
+typedef struct object_ref {
+    uint64_t key;                           // See artifact_index_object_key
+    long long bytes;                        // Disk usage of the object (as du counts it)
+} object_ref_t;
+
+typedef struct index_entry {
+    long long id;                           // In the artifact index
+    char name[NAME_MAX + 1];
+    struct timespec mtime;
+    object_ref_t refs[2];                   // Object, and keyframe of a delta
+    int ref_count;
+    int alive;
+} index_entry_t;
+
+typedef struct object_count {
+    uint64_t key;
+    long long bytes;
+    int refs;
+    int used;
+} object_count_t;
+
+typedef struct tier_index {
+    index_entry_t *entries;                 // Oldest first
+    int count;
+    int capacity;
+    int head;                               // The entries before head are all gone
+    int alive;
+    object_count_t *objects;                // Open addressing on the object keys
+    size_t object_capacity;                 // Power of two, at least twice the references the tier can get
+    long long bytes;
+} tier_index_t;
+
+static const char *tier_names[ROTATION_TIER_COUNT] = { "daily", "weekly", "monthly", "yearly" };
+
+const char *rotation_tier_name(int tier) {
+    return tier >= 0 && tier < ROTATION_TIER_COUNT ? tier_names[tier] : "none";
+}
+
+const char *rotation_action_name(int type) {
+    switch (type) {
+        case ROTATION_ACTION_MOVE: return "move";
+        case ROTATION_ACTION_EXPIRE: return "expire";
+        case ROTATION_ACTION_THIN: return "thin";
+        default: return "evict";
+    }
+}
+
+void rotation_plan_free(rotation_plan_t *plan) {
+    free(plan->actions);
+    plan->actions = NULL;
+    plan->count = plan->capacity = 0;
+}
+
+static int compare_mtime(const struct timespec *a, const struct timespec *b) {
+    if (a->tv_sec != b->tv_sec) return a->tv_sec < b->tv_sec ? -1 : 1;
+    if (a->tv_nsec != b->tv_nsec) return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static int compare_index_entries(const void *a, const void *b) {
+    const index_entry_t *x = a, *y = b;
+    int by_mtime = compare_mtime(&x->mtime, &y->mtime);
+    return by_mtime ? by_mtime : strcmp(x->name, y->name);
+}
+
+/* Reference counts of the objects of a tier */
+
+static object_count_t *object_slot(tier_index_t *tier, const object_ref_t *ref) {
+    size_t mask = tier->object_capacity - 1;
+    size_t i = (size_t)ref->key & mask;
+    while (tier->objects[i].used && tier->objects[i].key != ref->key) {
+        i = (i + 1) & mask;
+    }
+    return &tier->objects[i];
+}
+
+static void entry_attach(tier_index_t *tier, index_entry_t *entry) {
+    for (int r = 0; r < entry->ref_count; r++) {
+        object_count_t *slot = object_slot(tier, &entry->refs[r]);
+        if (!slot->used) {
+            slot->used = 1;
+            slot->key = entry->refs[r].key;
+            slot->bytes = entry->refs[r].bytes;
+        }
+        if (slot->refs++ == 0) tier->bytes += slot->bytes;
+    }
+    entry->alive = 1;
+    tier->alive++;
+}
+
+static void entry_detach(tier_index_t *tier, index_entry_t *entry) {
+    for (int r = 0; r < entry->ref_count; r++) {
+        object_count_t *slot = object_slot(tier, &entry->refs[r]);
+        if (slot->used && --slot->refs == 0) tier->bytes -= slot->bytes;
+    }
+    entry->alive = 0;
+    tier->alive--;
+}
+
+static index_entry_t *oldest_entry(tier_index_t *tier) {
+    while (tier->head < tier->count && !tier->entries[tier->head].alive) tier->head++;
+    return tier->head < tier->count ? &tier->entries[tier->head] : NULL;
+}
+
+static index_entry_t *newest_entry(tier_index_t *tier) {
+    for (int i = tier->count - 1; i >= tier->head; i--) {
+        if (tier->entries[i].alive) return &tier->entries[i];
+    }
+    return NULL;
+}
+
+// Adds a copy of entry to the tier in mtime order (the caller made room for it)
+static void insert_entry(tier_index_t *tier, const index_entry_t *entry) {
+    int pos = tier->count;
+    while (pos > 0 && compare_index_entries(&tier->entries[pos - 1], entry) > 0) pos--;
+    memmove(&tier->entries[pos + 1], &tier->entries[pos], (tier->count - pos) * sizeof(index_entry_t));
+    tier->entries[pos] = *entry;
+    tier->count++;
+    if (pos < tier->head) tier->head = pos;
+    entry_attach(tier, &tier->entries[pos]);
+}
+
+static long long entry_bytes(const index_entry_t *entry) {
+    long long bytes = 0;
+    for (int r = 0; r < entry->ref_count; r++) bytes += entry->refs[r].bytes;
+    return bytes;
+}
+
+static void entry_of(const artifact_record_t *record, index_entry_t *entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->id = record->id;
+    snprintf(entry->name, sizeof(entry->name), "%s", record->name);
+    entry->mtime = record->mtime;
+    entry->refs[entry->ref_count++] = (object_ref_t){ artifact_index_object_key(record, 0), record->stored };
+    if (record->base[0]) entry->refs[entry->ref_count++] = (object_ref_t){ artifact_index_object_key(record, 1), record->base_stored };
+}
+
+static void free_indexes(tier_index_t tiers[ROTATION_TIER_COUNT]) {
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        free(tiers[t].entries);
+        free(tiers[t].objects);
+    }
+}
+
+// Takes the live entries of the four tiers from the artifact index (oldest first), sizing every list to hold all of them (the moves never need to grow
+// them)
+static int load_indexes(const artifact_index_t *index, tier_index_t tiers[ROTATION_TIER_COUNT]) {
+    memset(tiers, 0, ROTATION_TIER_COUNT * sizeof(tier_index_t));
+    int total = 0;
+    for (int i = 0; i < index->count; i++) {
+        if (index->records[i].tier != ARTIFACT_TIER_REMOVED) total++;
+    }
+    size_t object_capacity = 16;
+    while (object_capacity < (size_t)total * 4) object_capacity *= 2;
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        tiers[t].entries = malloc((total ? total : 1) * sizeof(index_entry_t));
+        tiers[t].objects = calloc(object_capacity, sizeof(object_count_t));
+        if (!tiers[t].entries || !tiers[t].objects) {
+            free_indexes(tiers);
+            return 1;
+        }
+        tiers[t].capacity = total;
+        tiers[t].object_capacity = object_capacity;
+    }
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        tier_index_t *tier = &tiers[t];
+        for (int i = index->tiers[t].oldest; i >= 0; i = index->records[i].newer) {
+            index_entry_t *entry = &tier->entries[tier->count++];
+            entry_of(&index->records[i], entry);
+            entry_attach(tier, entry);
+        }
+    }
+    return 0;
+}
+
+static int add_action(rotation_plan_t *plan, int type, int tier, int to_tier, const index_entry_t *entry) {
+    if (plan->count == plan->capacity) {
+        int capacity = plan->capacity ? plan->capacity * 2 : 32;
+        rotation_action_t *grown = realloc(plan->actions, capacity * sizeof(rotation_action_t));
+        if (!grown) return 1;
+        plan->actions = grown;
+        plan->capacity = capacity;
+    }
+    rotation_action_t *action = &plan->actions[plan->count++];
+    action->id = entry->id;
+    action->type = type;
+    action->tier = tier;
+    action->to_tier = to_tier;
+    snprintf(action->name, sizeof(action->name), "%s", entry->name);
+    action->mtime = entry->mtime;
+    action->kb = entry_bytes(entry) / 1024;
+    return 0;
+}
+
+static int tier_limit_kb(const binaries_limits_for_project_t *limits, int t) {
+    switch (t) {
+        case ROTATION_TIER_DAILY: return limits->daily_mem_limit;
+        case ROTATION_TIER_WEEKLY: return limits->weekly_mem_limit;
+        case ROTATION_TIER_MONTHLY: return limits->monthly_mem_limit;
+        default: return limits->yearly_mem_limit;
+    }
+}
+
+// Evicts the oldest entries of the tier while it exceeds its memory limit
+static int plan_evictions(tier_index_t tiers[ROTATION_TIER_COUNT], int t, const binaries_limits_for_project_t *limits, rotation_plan_t *plan) {
+    tier_index_t *tier = &tiers[t];
+    while (tier->bytes / 1024 > tier_limit_kb(limits, t) && tier->alive > 1) {
+        index_entry_t *oldest = oldest_entry(tier);
+        if (add_action(plan, ROTATION_ACTION_EVICT, t, -1, oldest) != 0) return 1;
+        entry_detach(tier, oldest);
+    }
+    return 0;
+}
+
+// Moves the entries of tier t old enough to the next tier (see the comment at the top)
+static int plan_moves(tier_index_t tiers[ROTATION_TIER_COUNT], int t, int min_age_min, int interval_min, time_t now, rotation_plan_t *plan) {
+    tier_index_t *current = &tiers[t];
+    tier_index_t *later = &tiers[t + 1];
+    index_entry_t *oldest;
+    while ((oldest = oldest_entry(current)) != NULL) {
+        if ((now - oldest->mtime.tv_sec) / 60 < min_age_min) break;
+        index_entry_t *recent = newest_entry(later);
+        if (recent) {
+            long long distance = oldest->mtime.tv_sec > recent->mtime.tv_sec ? oldest->mtime.tv_sec - recent->mtime.tv_sec : recent->mtime.tv_sec - oldest->mtime.tv_sec;
+            if (distance / 60 < interval_min) {
+                if (add_action(plan, ROTATION_ACTION_THIN, t, -1, oldest) != 0) return 1;
+                entry_detach(current, oldest);
+                continue;
+            }
+        }
+        if (add_action(plan, ROTATION_ACTION_MOVE, t, t + 1, oldest) != 0) return 1;
+        // The move replaces an entry of the same name in the next tier (same release of the same architecture)
+        for (int i = later->head; i < later->count; i++) {
+            if (later->entries[i].alive && strcmp(later->entries[i].name, oldest->name) == 0) {
+                entry_detach(later, &later->entries[i]);
+                break;
+            }
+        }
+        entry_detach(current, oldest);
+        insert_entry(later, oldest);
+    }
+    return 0;
+}
+
+static void record_sizes(tier_index_t tiers[ROTATION_TIER_COUNT], int *entries, long long *kb) {
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        entries[t] = tiers[t].alive;
+        kb[t] = tiers[t].bytes / 1024;
+    }
+}
+
+// Computes the rotation of the target dir recorded by the index at time now; returns 0 with the actions in plan (to free with
+// rotation_plan_free)
+static int plan_rotation(const artifact_index_t *index, const binaries_limits_for_project_t *limits, time_t now, rotation_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+    tier_index_t tiers[ROTATION_TIER_COUNT];
+    if (load_indexes(index, tiers) != 0) return 1;
+    record_sizes(tiers, plan->entries_before, plan->kb_before);
+
+    int result = 0;
+    // 1. Yearly entries older than a year
+    index_entry_t *oldest;
+    while (result == 0 && (oldest = oldest_entry(&tiers[ROTATION_TIER_YEARLY])) != NULL && (now - oldest->mtime.tv_sec) / 60 >= ROTATION_YEAR_MINUTES) {
+        result = add_action(plan, ROTATION_ACTION_EXPIRE, ROTATION_TIER_YEARLY, -1, oldest);
+        entry_detach(&tiers[ROTATION_TIER_YEARLY], oldest);
+    }
+    // 2. Monthly, weekly and daily entries to the next tier, each followed by the memory limit of that tier
+    const struct { int tier; int min_age; int interval; } steps[] = {
+        { ROTATION_TIER_MONTHLY, ROTATION_MONTH_MINUTES, limits->yearly_interval },
+        { ROTATION_TIER_WEEKLY, ROTATION_WEEK_MINUTES, limits->monthly_interval },
+        { ROTATION_TIER_DAILY, ROTATION_DAY_MINUTES, limits->weekly_interval },
+    };
+    for (size_t i = 0; result == 0 && i < sizeof(steps) / sizeof(steps[0]); i++) {
+        result = plan_moves(tiers, steps[i].tier, steps[i].min_age, steps[i].interval, now, plan);
+        if (result == 0) result = plan_evictions(tiers, steps[i].tier + 1, limits, plan);
+    }
+    record_sizes(tiers, plan->entries_after, plan->kb_after);
+    free_indexes(tiers);
+    if (result != 0) rotation_plan_free(plan);
+    return result;
+}
+
+// Computes the rotation of the target dir at time now, without changing it (nor locking it); returns 0 with the actions in plan (to
+// free with rotation_plan_free)
+int rotation_plan(const char *target_dir, const binaries_limits_for_project_t *limits, time_t now, rotation_plan_t *plan) {
+    artifact_index_t index;
+    int result = artifact_index_open(target_dir, 0, &index);
+    if (result == 0) result = plan_rotation(&index, limits, now, plan);
+    artifact_index_close(&index, NULL, NULL);
+    return result;
+}
+
+/* Execution */
+
+// Executes the actions of the plan of the given kinds (evictions or the others), recording them in the index; returns the number of
+// failed actions
+static int execute_actions(artifact_index_t *index, const rotation_plan_t *plan, int evictions, FILE *log_fp, const char *project_name) {
+    int dir_fds[ROTATION_TIER_COUNT];
+    int touched[ROTATION_TIER_COUNT] = { 0 };
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        char tier_dir[MAX_CONFIG_ATTR_LEN * 2];
+        snprintf(tier_dir, sizeof(tier_dir), "%s/%s", index->target_dir, tier_names[t]);
+        if (t > ROTATION_TIER_DAILY) mkdir(tier_dir, 0755);
+        dir_fds[t] = open(tier_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    int errors = 0;
+    for (int i = 0; i < plan->count; i++) {
+        const rotation_action_t *action = &plan->actions[i];
+        if ((action->type == ROTATION_ACTION_EVICT) != evictions) continue;
+        int from_fd = dir_fds[action->tier];
+        struct stat st;
+        const artifact_record_t *record = artifact_index_get(index, action->id);
+        if (!record || record->tier != action->tier || from_fd < 0 || fstatat(from_fd, action->name, &st, AT_SYMLINK_NOFOLLOW) != 0 || compare_mtime(&st.st_mtim, &action->mtime) != 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, NULL, "%s/%s changed since the rotation was planned; not %s.", tier_names[action->tier], action->name,
+                action->type == ROTATION_ACTION_MOVE ? "moved" : "removed");
+            // Changed behind the back of the index, if the index still has it there
+            if (record && record->tier == action->tier) index->stale = 1;
+            continue;
+        }
+        if (action->type == ROTATION_ACTION_MOVE) {
+            if (dir_fds[action->to_tier] < 0 || renameat(from_fd, action->name, dir_fds[action->to_tier], action->name) != 0) {
+                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to move %s from %s to %s: %s", action->name, tier_names[action->tier], tier_names[action->to_tier], strerror(errno));
+                errors++;
+                continue;
+            }
+            touched[action->to_tier] = 1;
+            if (artifact_index_move(index, action->id, action->to_tier) != 0) index->stale = 1;
+            formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Moved oldest %s file %s to %s.", tier_names[action->tier], action->name, tier_names[action->to_tier]);
+        } else {
+            if (unlinkat(from_fd, action->name, 0) != 0) {
+                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to remove %s/%s: %s", tier_names[action->tier], action->name, strerror(errno));
+                errors++;
+                continue;
+            }
+            if (artifact_index_remove(index, action->id, rotation_action_name(action->type)) != 0) index->stale = 1;
+            const char *reason = action->type == ROTATION_ACTION_EXPIRE ? "older than a year" :
+                action->type == ROTATION_ACTION_THIN ? "too close to the newest file of the next tier" : "to respect the memory limit";
+            formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Removed %s file %s (%s, %lld KB).", tier_names[action->tier], action->name, reason, action->kb);
+        }
+        touched[action->tier] = 1;
+    }
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        if (dir_fds[t] < 0) continue;
+        if (touched[t]) fsync(dir_fds[t]);
+        close(dir_fds[t]);
+    }
+    return errors;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Removes the objects of the store no live entry of the index references (directly, or as the keyframe of a delta), and the
+// temporary files of interrupted publications; called with the store locked. An index found stale is first reconciled with the tiers.
+static int collect_garbage(artifact_index_t *index, FILE *log_fp, const char *project_name) {
+    if (index->stale && artifact_index_rescan(index, log_fp, project_name) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, NULL, "The store %s is not cleaned up.", index->store_dir);
+        return 1;
+    }
+    const char **referenced = malloc((2 * index->count + 1) * sizeof(char *));
+    if (!referenced) return 1;
+    int count = 0;
+    for (int i = 0; i < index->count; i++) {
+        const artifact_record_t *record = &index->records[i];
+        if (record->tier == ARTIFACT_TIER_REMOVED) continue;
+        if (record->object[0]) referenced[count++] = record->object;
+        if (record->base[0]) referenced[count++] = record->base;
+    }
+    qsort(referenced, count, sizeof(char *), compare_names);
+    int removed = 0;
+    DIR *dp = opendir(index->store_dir);
+    if (dp) {
+        time_t now = time(NULL);
+        struct dirent *de;
+        while ((de = readdir(dp)) != NULL) {
+            const char *name = de->d_name;
+            struct stat st;
+            if (fstatat(dirfd(dp), name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (name[0] == '.') {
+                if (strncmp(name, STORE_BLOB_TMP_PREFIX, strlen(STORE_BLOB_TMP_PREFIX)) == 0 && now - st.st_mtime > ROTATION_BLOB_TMP_MAX_AGE_S && unlinkat(dirfd(dp), name, 0) == 0) removed++;
+                continue;
+            }
+            if (bsearch(&name, referenced, count, sizeof(char *), compare_names)) continue;
+            if (unlinkat(dirfd(dp), name, 0) == 0) removed++;
+        }
+        closedir(dp);
+    }
+    free(referenced);
+    if (removed > 0) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Removed %d unreferenced files from the store.", removed);
+    }
+    return 0;
+}
+
+// Removes the objects of the store an evicted entry referenced, once no live entry references them; returns the number removed
+static int release_objects(const artifact_index_t *index, const artifact_record_t *evicted) {
+    int removed = 0;
+    for (int base = 0; base <= (evicted->base[0] != '\0'); base++) {
+        const char *object = base ? evicted->base : evicted->object;
+        if (!object[0] || artifact_index_object_refs(index, evicted, base) > 0) continue;
+        char path[MAX_CONFIG_ATTR_LEN * 3];
+        snprintf(path, sizeof(path), "%s/%s", index->store_dir, object);
+        if (unlink(path) == 0) removed++;
+    }
+    return removed;
+}
+
+// Evicts the oldest entries of a tier while it exceeds its memory limit (the newest entry is always kept), on the running totals of
+// the index: no tier is listed and no file measured, and each eviction is recorded in the index. Called with the store locked and its
+// index open for writing (so concurrent publications of the architectures of a project evict one after the other); returns 0 on
+// success.
+int rotation_trim_tier(artifact_index_t *index, int tier, const binaries_limits_for_project_t *limits, FILE *log_fp, const char *project_name) {
+    const artifact_tier_t *totals = &index->tiers[tier];
+    if (index->stale && artifact_index_rescan(index, log_fp, project_name) != 0) return 1;
+    int errors = 0, removed = 0, rescanned = 0;
+    while (totals->stored / 1024 > tier_limit_kb(limits, tier) && totals->entries > 1) {
+        artifact_record_t evicted = index->records[totals->oldest];
+        index_entry_t entry;
+        rotation_plan_t eviction = { 0 };
+        entry_of(&evicted, &entry);
+        if (add_action(&eviction, ROTATION_ACTION_EVICT, tier, -1, &entry) != 0) return 1;
+        errors += execute_actions(index, &eviction, 1, log_fp, project_name);
+        rotation_plan_free(&eviction);
+        const artifact_record_t *record = artifact_index_get(index, evicted.id);
+        if (record && record->tier == tier) {
+            // The entry does not match the index: reconcile it with the tiers once, then give up
+            if (rescanned || !index->stale || artifact_index_rescan(index, log_fp, project_name) != 0) {
+                errors++;
+                break;
+            }
+            rescanned = 1;
+            continue;
+        }
+        removed += release_objects(index, &evicted);
+    }
+    if (totals->entries == 1 && totals->stored / 1024 > tier_limit_kb(limits, tier)) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, NULL, "Only the newest %s file remains, but it exceeds the %s memory limit (%lld KB > %d KB); cannot remove it.", tier_names[tier], tier_names[tier],
+            totals->stored / 1024, tier_limit_kb(limits, tier));
+    }
+    if (removed > 0) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Removed %d unreferenced files from the store.", removed);
+    }
+    return errors ? 1 : 0;
+}
+
+// Executes a plan of rotation_plan, encodes the tiers with the codec of the project and cleans up the store; returns 0 on success
+int rotation_execute(const char *target_dir, const binaries_limits_for_project_t *limits, const rotation_plan_t *plan, FILE *log_fp, const char *project_name) {
+    char store_dir[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(store_dir, sizeof(store_dir), "%s/%s", target_dir, STORE_DIR_NAME);
+    int use_delta = 0, use_zstd = 0;
+    int encoded = codec_parse(limits->codec, &use_delta, &use_zstd) == 0 && (use_delta || use_zstd);
+
+    // The store is locked against the publications (see artifact_store.c), which change the daily tier, the store and the index
+    artifact_index_t index;
+    int lock_fd = store_lock(store_dir, log_fp, project_name);
+    if (lock_fd < 0) return 1;
+    if (artifact_index_open(target_dir, 1, &index) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to load the artifact index of %s: %s", target_dir, strerror(errno));
+        artifact_index_close(&index, log_fp, project_name);
+        store_unlock(lock_fd);
+        return 1;
+    }
+    int errors = execute_actions(&index, plan, 0, log_fp, project_name);
+    if (!encoded) {
+        errors += execute_actions(&index, plan, 1, log_fp, project_name);
+        errors += collect_garbage(&index, log_fp, project_name);
+        errors += artifact_index_close(&index, log_fp, project_name);
+        store_unlock(lock_fd);
+        return errors ? 1 : 0;
+    }
+    errors += artifact_index_close(&index, log_fp, project_name);
+    store_unlock(lock_fd);
+
+    // Encode the tiers (which locks the store and records the new objects on its own), then evict on the encoded sizes
+    for (int t = ROTATION_TIER_WEEKLY; t < ROTATION_TIER_COUNT; t++) {
+        errors += store_pack_tier(target_dir, tier_names[t], limits->codec, log_fp, project_name);
+    }
+    if ((lock_fd = store_lock(store_dir, log_fp, project_name)) < 0) return 1;
+    tier_index_t tiers[ROTATION_TIER_COUNT];
+    rotation_plan_t evictions = { 0 };
+    if (artifact_index_open(target_dir, 1, &index) != 0 || load_indexes(&index, tiers) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to read the artifact index of %s after encoding its tiers: %s", target_dir, strerror(errno));
+        artifact_index_close(&index, log_fp, project_name);
+        store_unlock(lock_fd);
+        return 1;
+    }
+    for (int t = ROTATION_TIER_WEEKLY; t < ROTATION_TIER_COUNT; t++) {
+        if (plan_evictions(tiers, t, limits, &evictions) != 0) errors++;
+    }
+    free_indexes(tiers);
+    errors += execute_actions(&index, &evictions, 1, log_fp, project_name);
+    rotation_plan_free(&evictions);
+    errors += collect_garbage(&index, log_fp, project_name);
+    errors += artifact_index_close(&index, log_fp, project_name);
+    store_unlock(lock_fd);
+    return errors ? 1 : 0;
+}
+
+// Rotates the target dir of a project now (plan, then execution), logging to log_fp; returns 0 on success
+int rotation_rotate(const char *target_dir, const binaries_limits_for_project_t *limits, FILE *log_fp, const char *project_name) {
+    char daily_dir[MAX_CONFIG_ATTR_LEN * 2];
+    struct stat st;
+    snprintf(daily_dir, sizeof(daily_dir), "%s/%s", target_dir, tier_names[ROTATION_TIER_DAILY]);
+    // Without a daily dir nothing was built yet
+    if (stat(daily_dir, &st) != 0) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Daily directory not found in %s; nothing to rotate.", target_dir);
+        return 0;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rotation_plan_t plan;
+    if (rotation_plan(target_dir, limits, time(NULL), &plan) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Unable to plan the rotation of %s: %s", target_dir, strerror(errno));
+        return 1;
+    }
+    int counts[ROTATION_ACTION_EVICT + 1] = { 0 };
+    for (int i = 0; i < plan.count; i++) counts[plan.actions[i].type]++;
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Rotation of %s planned: %d moves, %d expired, %d thinned, %d evicted%s.", target_dir,
+        counts[ROTATION_ACTION_MOVE], counts[ROTATION_ACTION_EXPIRE], counts[ROTATION_ACTION_THIN], counts[ROTATION_ACTION_EVICT], strcmp(limits->codec, "none") != 0 ? " (before encoding)" : "");
+    int result = rotation_execute(target_dir, limits, &plan, log_fp, project_name);
+    rotation_plan_free(&plan);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    formatted_log(log_fp, result == 0 ? "INFO" : "ERROR", __FILE__, __LINE__, project_name, NULL, "Rotation of %s %s in %ld ms.", target_dir, result == 0 ? "completed" : "completed with errors", elapsed_ms);
+    return result;
+}
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "test/test_report.h"
+#include "control/control.h"
+#include "utils/utils.h"
+
+/*
+    Results of the test stage.
+    run_tests.sh leaves the results of the test suite of the main repository as JUnit (written by ctest or meson, or put together by the
+    script for make check and for custom commands). Only what the daemon needs is read from it: the name, duration and outcome of each
+    <testcase> (a <failure> or <error> fails it, a <skipped> skips it), so no XML library is needed and the variants of the runners
+    (nested <testsuites>, extra attributes and elements) do not matter.
+    After each run, in <main_project_build_dir>/logs:
+    - tests/<arch>.xml and tests/<arch>.json: the JUnit of the last run and its summary with the duration of every test;
+    - tests/<arch>.times: the duration of every test of the last passed run, against which the next run finds the tests that got
+      TEST_SLOWER_FACTOR times slower;
+    - test_times.log: one line per run ("<epoch> <arch> <passed|failed> <tests> <failed> <skipped> <seconds>"), as build_times.log for
+      the builds, whose previous line the duration of the suite is compared with.
+*/
+
+static int add_case(test_report_t *report, const test_case_t *test) {
+    if (report->count == report->capacity) {
+        int capacity = report->capacity ? report->capacity * 2 : 64;
+        test_case_t *cases = realloc(report->cases, capacity * sizeof(test_case_t));
+        if (!cases) return 1;
+        report->cases = cases;
+        report->capacity = capacity;
+    }
+    report->cases[report->count++] = *test;
+    if (test->status == TEST_FAILED) report->failed++;
+    else if (test->status == TEST_SKIPPED) report->skipped++;
+    return 0;
+}
+
+// Copies the value of an attribute of the tag [tag, end) into value, with the predefined entities decoded; returns 0 if found
+static int attribute(const char *tag, const char *end, const char *name, char *value, size_t size) {
+    size_t name_len = strlen(name);
+    for (const char *p = tag; p + name_len + 2 < end; p++) {
+        if ((p[-1] != ' ' && p[-1] != '\t' && p[-1] != '\n' && p[-1] != '\r') || strncmp(p, name, name_len) != 0 || p[name_len] != '=') continue;
+        char quote = p[name_len + 1];
+        if (quote != '"' && quote != '\'') continue;
+        const char *v = p + name_len + 2;
+        size_t len = 0;
+        while (v < end && *v != quote && len + 1 < size) {
+            static const struct { const char *entity; char c; } entities[] = { { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' } };
+            size_t skip = 1;
+            char c = *v;
+            for (size_t i = 0; c == '&' && i < sizeof(entities) / sizeof(entities[0]); i++) {
+                size_t entity_len = strlen(entities[i].entity);
+                if (v + entity_len <= end && strncmp(v, entities[i].entity, entity_len) == 0) {
+                    c = entities[i].c;
+                    skip = entity_len;
+                }
+            }
+            value[len++] = c;
+            v += skip;
+        }
+        value[len] = '\0';
+        return 0;
+    }
+    return 1;
+}
+
+// First occurrence of needle in [start, end), or NULL
+static const char *find_in(const char *start, const char *end, const char *needle) {
+    size_t len = strlen(needle);
+    for (const char *p = start; p + len <= end; p++) {
+        if (*p == *needle && strncmp(p, needle, len) == 0) return p;
+    }
+    return NULL;
+}
+
+// Reads the test cases of a JUnit file; returns 0 on success (a report without test cases is valid)
+int test_report_load(const char *junit_file, test_report_t *report) {
+    memset(report, 0, sizeof(*report));
+    FILE *fp = fopen(junit_file, "r");
+    if (!fp) return 1;
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size > TEST_REPORT_MAX_BYTES) {
+        fclose(fp);
+        errno = EFBIG;
+        return 1;
+    }
+    char *data = malloc(st.st_size + 1);
+    size_t len = data ? fread(data, 1, st.st_size, fp) : 0;
+    fclose(fp);
+    if (!data) return 1;
+    data[len] = '\0';
+
+    const char *end = data + len;
+    const char *p = data;
+    int err = 0;
+    while (!err && (p = find_in(p, end, "<testcase")) != NULL) {
+        const char *tag_end = memchr(p, '>', end - p);
+        if (!tag_end) break;
+        test_case_t test;
+        memset(&test, 0, sizeof(test));
+        char name[sizeof(test.name)], classname[sizeof(test.name)], seconds[32];
+        if (attribute(p, tag_end, "name", name, sizeof(name)) != 0) snprintf(name, sizeof(name), "test %d", report->count + 1);
+        if (attribute(p, tag_end, "classname", classname, sizeof(classname)) != 0 || strcmp(classname, name) == 0) classname[0] = '\0';
+        char full_name[sizeof(classname) + sizeof(name)];
+        snprintf(full_name, sizeof(full_name), "%s%s%s", classname, classname[0] ? "." : "", name);
+        snprintf(test.name, sizeof(test.name), "%.*s", (int)sizeof(test.name) - 1, full_name);
+        if (attribute(p, tag_end, "time", seconds, sizeof(seconds)) == 0) test.seconds = atof(seconds);
+        const char *next = tag_end + 1;
+        if (tag_end[-1] != '/') {
+            const char *close = find_in(next, end, "</testcase>");
+            const char *body_end = close ? close : end;
+            if (find_in(next, body_end, "<failure") || find_in(next, body_end, "<error")) test.status = TEST_FAILED;
+            else if (find_in(next, body_end, "<skipped")) test.status = TEST_SKIPPED;
+            next = body_end;
+        }
+        err = add_case(report, &test);
+        p = next;
+    }
+    free(data);
+    return err;
+}
+
+void test_report_free(test_report_t *report) {
+    free(report->cases);
+    memset(report, 0, sizeof(*report));
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const test_case_t *)a)->name, ((const test_case_t *)b)->name);
+}
+
+static int compare_slowest(const void *a, const void *b) {
+    double d = ((const test_case_t *)b)->seconds - ((const test_case_t *)a)->seconds;
+    return d > 0 ? 1 : d < 0 ? -1 : 0;
+}
+
+static const char *status_name(int status) {
+    return status == TEST_FAILED ? "failed" : status == TEST_SKIPPED ? "skipped" : "passed";
+}
+
+// Writes data to path through a temporary file, so that a reader never sees half of it
+static int write_atomically(const char *path, const char *data, size_t len) {
+    char tmp_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) return 1;
+    int err = fwrite(data, 1, len, fp) != len;
+    if (fclose(fp) != 0) err = 1;
+    if (err || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+static int copy_file(const char *from, const char *to) {
+    FILE *fp = fopen(from, "r");
+    if (!fp) return 1;
+    json_buf_t copy = { 0 };
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) json_printf(&copy, "%.*s", (int)n, chunk);
+    fclose(fp);
+    int err = copy.failed || write_atomically(to, copy.data ? copy.data : "", copy.len);
+    json_free(&copy);
+    return err;
+}
+
+// Reads the durations of the tests of the previous passed run, sorted by name (NULL and 0 if there is none)
+static test_case_t *load_times(const char *path, int *count) {
+    *count = 0;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return NULL;
+    test_report_t times = { 0 };
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        test_case_t test;
+        memset(&test, 0, sizeof(test));
+        char *tab = strchr(line, '\t');
+        if (!tab) continue;
+        *tab = '\0';
+        test.seconds = atof(line);
+        snprintf(test.name, sizeof(test.name), "%.*s", (int)strcspn(tab + 1, "\n"), tab + 1);
+        if (add_case(&times, &test) != 0) break;
+    }
+    fclose(fp);
+    qsort(times.cases, times.count, sizeof(test_case_t), compare_names);
+    *count = times.count;
+    return times.cases;
+}
+
+// Latest run of arch in test_times.log (its duration in *seconds); returns 0 if there is one
+static int previous_run(const char *history_file, const char *arch, double *seconds) {
+    FILE *fp = fopen(history_file, "r");
+    if (!fp) return 1;
+    char line[256];
+    int found = 1;
+    while (fgets(line, sizeof(line), fp)) {
+        long long epoch;
+        char line_arch[64], outcome[16];
+        int tests, failed, skipped;
+        double line_seconds;
+        if (sscanf(line, "%lld %63s %15s %d %d %d %lf", &epoch, line_arch, outcome, &tests, &failed, &skipped, &line_seconds) == 7 && strcmp(line_arch, arch) == 0) {
+            *seconds = line_seconds;
+            found = 0;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+// Keeps the results of a run of the test suite of prj for arch (see the comment at the top) and logs them along with the slowest tests
+// and those that got slower; returns 0 on success (the results that could not be written are logged)
+int test_report_record(const project_t *prj, const char *arch, const char *junit_file, const test_report_t *report, int passed, double wall_seconds, FILE *log_fp) {
+    char tests_dir[CONFIG_ATTR_LEN + 16];
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    char history_file[CONFIG_ATTR_LEN + 32];
+    snprintf(tests_dir, sizeof(tests_dir), "%s/logs/tests", prj->main_project_build_dir);
+    snprintf(history_file, sizeof(history_file), "%s/logs/test_times.log", prj->main_project_build_dir);
+    if (recursive_mkdir_or_file(tests_dir, 0755, 0) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to create %s: %s; the test results are not kept.", tests_dir, strerror(errno));
+        return 1;
+    }
+    int err = 0;
+    snprintf(path, sizeof(path), "%s/%s.xml", tests_dir, arch);
+    if (junit_file && copy_file(junit_file, path) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to copy the JUnit report %s to %s", junit_file, path);
+        err = 1;
+    }
+
+    double previous_seconds = -1;
+    int has_previous = previous_run(history_file, arch, &previous_seconds) == 0;
+    time_t now = time(NULL);
+    json_buf_t json = { 0 };
+    json_printf(&json, "{\"project\":");
+    json_string(&json, prj->name);
+    json_printf(&json, ",\"arch\":");
+    json_string(&json, arch);
+    json_printf(&json, ",\"at\":%lld,\"passed\":%s,\"seconds\":%.3f,\"previous_seconds\":", (long long)now, passed ? "true" : "false", wall_seconds);
+    if (has_previous) json_printf(&json, "%.3f", previous_seconds);
+    else json_printf(&json, "null");
+    json_printf(&json, ",\"tests\":%d,\"failed\":%d,\"skipped\":%d,\"cases\":[", report->count, report->failed, report->skipped);
+    for (int i = 0; i < report->count; i++) {
+        json_printf(&json, "%s{\"name\":", i ? "," : "");
+        json_string(&json, report->cases[i].name);
+        json_printf(&json, ",\"seconds\":%.3f,\"status\":\"%s\"}", report->cases[i].seconds, status_name(report->cases[i].status));
+    }
+    json_printf(&json, "]}\n");
+    snprintf(path, sizeof(path), "%s/%s.json", tests_dir, arch);
+    if (json.failed || write_atomically(path, json.data, json.len) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to write the test summary %s", path);
+        err = 1;
+    }
+    json_free(&json);
+
+    // O_APPEND keeps the lines of concurrent threads whole
+    int fd = open(history_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) {
+        char record[192];
+        int len = snprintf(record, sizeof(record), "%lld %s %s %d %d %d %.1f\n", (long long)now, arch, passed ? "passed" : "failed", report->count, report->failed, report->skipped, wall_seconds);
+        if (write(fd, record, len) != len) err = 1;
+        close(fd);
+    } else {
+        err = 1;
+    }
+
+    if (has_previous && previous_seconds > 0) {
+        formatted_log(log_fp, passed ? "INFO" : "ERROR", __FILE__, __LINE__, prj->name, arch, "Tests %s: %d tests, %d failed, %d skipped in %.1f s (previous run: %.1f s, %.2fx).", passed ? "passed" : "failed",
+            report->count, report->failed, report->skipped, wall_seconds, previous_seconds, wall_seconds / previous_seconds);
+    } else {
+        formatted_log(log_fp, passed ? "INFO" : "ERROR", __FILE__, __LINE__, prj->name, arch, "Tests %s: %d tests, %d failed, %d skipped in %.1f s.", passed ? "passed" : "failed", report->count, report->failed, report->skipped, wall_seconds);
+    }
+    for (int i = 0; i < report->count; i++) {
+        if (report->cases[i].status == TEST_FAILED) formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Test failed: %s (%.2f s)", report->cases[i].name, report->cases[i].seconds);
+    }
+    if (report->count == 0) return err;
+
+    // The durations are compared by name with those of the previous passed run, and kept for the next one if this one passed
+    test_case_t *sorted = malloc(report->count * sizeof(test_case_t));
+    if (!sorted) return 1;
+    memcpy(sorted, report->cases, report->count * sizeof(test_case_t));
+    snprintf(path, sizeof(path), "%s/%s.times", tests_dir, arch);
+    int previous_count;
+    test_case_t *previous = load_times(path, &previous_count);
+    int slower = 0;
+    for (int i = 0; i < report->count && previous; i++) {
+        const test_case_t *test = &report->cases[i];
+        const test_case_t *before = bsearch(test, previous, previous_count, sizeof(test_case_t), compare_names);
+        if (!before || test->status != TEST_PASSED || test->seconds < TEST_SLOWER_MIN_S || test->seconds < before->seconds * TEST_SLOWER_FACTOR) continue;
+        if (slower++ < TEST_REPORT_SLOWEST) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Test %s got slower: %.2f s (previous passed run: %.2f s, %.1fx).", test->name, test->seconds, before->seconds, before->seconds > 0 ? test->seconds / before->seconds : 0);
+        }
+    }
+    if (slower > TEST_REPORT_SLOWEST) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "%d more tests got %.0fx slower (see %s/%s.json).", slower - TEST_REPORT_SLOWEST, TEST_SLOWER_FACTOR, tests_dir, arch);
+    }
+    free(previous);
+    qsort(sorted, report->count, sizeof(test_case_t), compare_slowest);
+    for (int i = 0; i < report->count && i < TEST_REPORT_SLOWEST && sorted[i].seconds > 0; i++) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Slowest tests #%d: %s (%.2f s)", i + 1, sorted[i].name, sorted[i].seconds);
+    }
+    if (passed) {
+        json_buf_t times = { 0 };
+        for (int i = 0; i < report->count; i++) json_printf(&times, "%.3f\t%s\n", report->cases[i].seconds, report->cases[i].name);
+        if (times.failed || write_atomically(path, times.data ? times.data : "", times.len) != 0) err = 1;
+        json_free(&times);
+    }
+    free(sorted);
+    return err;
+}
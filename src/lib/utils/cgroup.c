@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "utils/cgroup.h"
+#include "utils/utils.h"
+
+/*
+    Rootless cgroup v2 limits per build.
+    systemd delegates the subtree of the user manager (/sys/fs/cgroup/user.slice/user-<uid>.slice/user@<uid>.service) to the unprivileged
+    user, so the daemon can create its own cgroups there without root: <user@uid.service>/v2ci/<project>-<arch>, one per build thread.
+    The v2ci cgroup holds no process and only enables the cpu, memory and pids controllers for its children (as long as the user manager
+    delegates them), each build cgroup gets the limits of its project (cpu.weight, memory.high, memory.max, pids.max) and memory.oom.group,
+    so that a build that exceeds memory.max is killed as a whole instead of the kernel picking a random victim among all the builds.
+    The steps of the thread join the cgroup before executing (see run_step), and memory.events tells which build the OOM kills belong to.
+*/
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_V2CI_DIR "v2ci"
+
+static int write_cgroup_file(const char *dir, const char *file, const char *value) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) return 1;
+    ssize_t written = write(fd, value, strlen(value));
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return written == (ssize_t)strlen(value) ? 0 : 1;
+}
+
+// Returns 0 if the controller is listed in the cgroup.controllers file of dir
+static int controller_available(const char *dir, const char *controller) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/cgroup.controllers", dir);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 1;
+    char name[64];
+    int found = 1;
+    while (fscanf(fp, "%63s", name) == 1) {
+        if (strcmp(name, controller) == 0) {
+            found = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+// Creates (if needed) and configures the cgroup of a <project, arch> build; on success cgroup_dir holds its path and 0 is returned,
+// otherwise the build runs without limits in the cgroup of the daemon (cgroup_dir is left empty)
+int cgroup_prepare_build(const project_t *prj, const char *arch, char *cgroup_dir, size_t cgroup_dir_size, FILE *log_fp) {
+    cgroup_dir[0] = '\0';
+    if (strcmp(prj->cgroup.enabled, "yes") != 0) {
+        return 1;
+    }
+
+    // 1. The delegated subtree of the user manager, on a cgroup v2 (unified) hierarchy
+    char delegated_dir[MAX_CONFIG_ATTR_LEN];
+    snprintf(delegated_dir, sizeof(delegated_dir), CGROUP_ROOT "/user.slice/user-%d.slice/user@%d.service", (int)getuid(), (int)getuid());
+    char controllers_path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(controllers_path, sizeof(controllers_path), "%s/cgroup.controllers", delegated_dir);
+    if (access(controllers_path, R_OK) != 0 || access(delegated_dir, W_OK) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "No delegated cgroup v2 subtree at %s (is systemd running a user manager on a unified hierarchy?); building without cgroup limits.", delegated_dir);
+        return 1;
+    }
+
+    // 2. The v2ci cgroup, which only distributes the controllers to the build cgroups (cgroup v2 forbids processes in inner nodes)
+    char v2ci_dir[MAX_CONFIG_ATTR_LEN + 8];
+    snprintf(v2ci_dir, sizeof(v2ci_dir), "%s/" CGROUP_V2CI_DIR, delegated_dir);
+    if (mkdir(v2ci_dir, 0755) != 0 && errno != EEXIST) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to create cgroup %s: %s; building without cgroup limits.", v2ci_dir, strerror(errno));
+        return 1;
+    }
+    const char *controllers[] = { "cpu", "memory", "pids" };
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
+        char enable[16];
+        snprintf(enable, sizeof(enable), "+%s", controllers[i]);
+        if (controller_available(v2ci_dir, controllers[i]) != 0 || write_cgroup_file(v2ci_dir, "cgroup.subtree_control", enable) != 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "The %s controller is not delegated to %s; its limits will not be applied.", controllers[i], v2ci_dir);
+        }
+    }
+
+    // 3. The build cgroup and its limits
+    char build_dir[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(build_dir, sizeof(build_dir), "%s/%s-%s", v2ci_dir, prj->name, arch);
+    if (mkdir(build_dir, 0755) != 0 && errno != EEXIST) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to create cgroup %s: %s; building without cgroup limits.", build_dir, strerror(errno));
+        return 1;
+    }
+    struct { const char *file; const char *value; } limits[] = {
+        { "cpu.weight", prj->cgroup.cpu_weight },
+        { "memory.high", prj->cgroup.memory_high },
+        { "memory.max", prj->cgroup.memory_max },
+        { "memory.oom.group", "1" },
+        { "pids.max", prj->cgroup.pids_max },
+    };
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        if (limits[i].value[0] && write_cgroup_file(build_dir, limits[i].file, limits[i].value) != 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to set %s=%s on cgroup %s: %s", limits[i].file, limits[i].value, build_dir, strerror(errno));
+        }
+    }
+    snprintf(cgroup_dir, cgroup_dir_size, "%s", build_dir);
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, arch, "Build cgroup %s ready (cpu.weight=%s, memory.high=%s, memory.max=%s, pids.max=%s).", build_dir, prj->cgroup.cpu_weight, prj->cgroup.memory_high, prj->cgroup.memory_max, prj->cgroup.pids_max);
+    return 0;
+}
+
+// Returns the number of processes killed by the OOM killer in the cgroup so far (the oom_kill counter of memory.events), -1 if unknown
+long cgroup_oom_kills(const char *cgroup_dir) {
+    if (!cgroup_dir || !cgroup_dir[0]) return -1;
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(path, sizeof(path), "%s/memory.events", cgroup_dir);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char line[128];
+    long oom_kills = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "oom_kill %ld", &oom_kills) == 1) break;
+    }
+    fclose(fp);
+    return oom_kills;
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "utils/phase_history.h"
+#include "control/control.h"
+#include "utils/utils.h"
+
+/*
+    Duration history of the build phases.
+    The wall time that every build thread accounts per phase (see account_step in scripts_runner.c, and resource_usage.log) is also kept,
+    for the successful builds only, as a sliding history per <arch, cross mode, phase> in <main_project_build_dir>/logs/phase_history:
+        <arch> <cross mode> <phase> <epoch of the latest sample> <count> <wall_ms>...   (oldest first)
+    holding the last two windows of duration_alerts.window builds: the current window and the one before it. The file is small and is
+    rewritten (through a temporary file) by the worker of the project after each build, so the supervisor may read it at any time.
+    - Alerts: once a phase has PHASE_HISTORY_MIN_SAMPLES builds, its baseline is the p50 of the last window. A build whose phase takes
+      more than slowdown_factor times the baseline, and at least min_seconds more, gets a warning in the worker log: e.g. a new
+      dependency that doubles the configure time under emulation. The cross mode is part of the key, since a change of mode changes
+      every duration on purpose.
+    - Report (v2ci_ctl report): the p50 and p95 of the last window of every phase of every project, with the p50 of the window before
+      it, sorted by p95 to list the slowest phases first.
+*/
+
+static int window_of(const project_t *prj) {
+    int window = prj->duration_alerts.window;
+    return window < 1 ? 1 : window > PHASE_HISTORY_MAX_WINDOW ? PHASE_HISTORY_MAX_WINDOW : window;
+}
+
+static int compare_ms(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank p50 and p95 of n samples (n > 0)
+static void percentiles(const long *samples, int n, long *p50, long *p95) {
+    long sorted[2 * PHASE_HISTORY_MAX_WINDOW];
+    memcpy(sorted, samples, n * sizeof(long));
+    qsort(sorted, n, sizeof(long), compare_ms);
+    *p50 = sorted[(n * 50 + 99) / 100 - 1];
+    *p95 = sorted[(n * 95 + 99) / 100 - 1];
+}
+
+static phase_series_t *find_series(phase_history_t *history, const char *arch, const char *mode, const char *phase, int create) {
+    for (int i = 0; i < history->count; i++) {
+        phase_series_t *s = &history->series[i];
+        if (strcmp(s->arch, arch) == 0 && strcmp(s->mode, mode) == 0 && strcmp(s->phase, phase) == 0) return s;
+    }
+    if (!create) return NULL;
+    if (history->count == history->capacity) {
+        int capacity = history->capacity ? history->capacity * 2 : 16;
+        phase_series_t *series = realloc(history->series, capacity * sizeof(phase_series_t));
+        if (!series) return NULL;
+        history->series = series;
+        history->capacity = capacity;
+    }
+    phase_series_t *s = &history->series[history->count++];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->arch, sizeof(s->arch), "%s", arch);
+    snprintf(s->mode, sizeof(s->mode), "%s", mode);
+    snprintf(s->phase, sizeof(s->phase), "%s", phase);
+    return s;
+}
+
+static void history_file_path(const project_t *prj, char *path, size_t size) {
+    snprintf(path, size, "%s/logs/%s", prj->main_project_build_dir, PHASE_HISTORY_FILE);
+}
+
+// Loads the history of prj (empty if it has none yet); returns 0 on success
+int phase_history_load(const project_t *prj, phase_history_t *history) {
+    memset(history, 0, sizeof(*history));
+    char path[CONFIG_ATTR_LEN + 32];
+    history_file_path(prj, path, sizeof(path));
+    FILE *fp = fopen(path, "r");
+    if (!fp) return errno == ENOENT ? 0 : 1;
+    char line[2048];
+    while (fgets(line, sizeof(line), fp)) {
+        char arch[32], mode[32], phase[16];
+        long long last_at;
+        int count, offset;
+        if (sscanf(line, "%31s %31s %15s %lld %d%n", arch, mode, phase, &last_at, &count, &offset) != 5 || count < 0) continue;
+        phase_series_t *s = find_series(history, arch, mode, phase, 1);
+        if (!s) break;
+        s->last_at = last_at;
+        const char *p = line + offset;
+        for (int i = 0; i < count && s->count < 2 * PHASE_HISTORY_MAX_WINDOW; i++) {
+            char *end;
+            long ms = strtol(p, &end, 10);
+            if (end == p) break;
+            s->wall_ms[s->count++] = ms;
+            p = end;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+void phase_history_free(phase_history_t *history) {
+    free(history->series);
+    memset(history, 0, sizeof(*history));
+}
+
+static int write_history(const project_t *prj, const phase_history_t *history) {
+    char path[CONFIG_ATTR_LEN + 32];
+    char tmp_path[CONFIG_ATTR_LEN + 48];
+    history_file_path(prj, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) return 1;
+    for (int i = 0; i < history->count; i++) {
+        const phase_series_t *s = &history->series[i];
+        fprintf(fp, "%s %s %s %lld %d", s->arch, s->mode, s->phase, s->last_at, s->count);
+        for (int k = 0; k < s->count; k++) fprintf(fp, " %ld", s->wall_ms[k]);
+        fputc('\n', fp);
+    }
+    int err = ferror(fp);
+    if (fclose(fp) != 0) err = 1;
+    if (err || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+// Adds the phases of a successful build of prj for arch to its history, warning about those much slower than their baseline (see the
+// comment at the top); returns 0 if the history was saved
+int phase_history_record(const project_t *prj, const char *arch, const char *cross_mode, const build_usage_t *usage, FILE *log_fp) {
+    phase_history_t history;
+    if (phase_history_load(prj, &history) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to read the phase duration history: %s", strerror(errno));
+        phase_history_free(&history);
+        return 1;
+    }
+    int window = window_of(prj);
+    long long now = (long long)time(NULL);
+    for (int i = 0; i < usage->phase_count; i++) {
+        const phase_usage_t *phase = &usage->phases[i];
+        phase_series_t *s = find_series(&history, arch, cross_mode, phase->phase, 1);
+        if (!s) break;
+        int baseline_count = s->count < window ? s->count : window;
+        if (baseline_count >= PHASE_HISTORY_MIN_SAMPLES) {
+            long p50, p95;
+            percentiles(s->wall_ms + s->count - baseline_count, baseline_count, &p50, &p95);
+            if (p50 > 0 && phase->wall_ms > prj->duration_alerts.slowdown_factor * p50 && phase->wall_ms - p50 >= prj->duration_alerts.min_seconds * 1000L) {
+                formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Phase %s (%s mode) took %.1f s, %.2fx its baseline (p50 %.1f s, p95 %.1f s over the last %d builds; alert above %.2fx).",
+                    phase->phase, cross_mode, phase->wall_ms / 1000.0, (double)phase->wall_ms / p50, p50 / 1000.0, p95 / 1000.0, baseline_count, prj->duration_alerts.slowdown_factor);
+            }
+        }
+        // Slide: keep the last two windows
+        if (s->count >= 2 * window) {
+            int drop = s->count - 2 * window + 1;
+            memmove(s->wall_ms, s->wall_ms + drop, (s->count - drop) * sizeof(long));
+            s->count -= drop;
+        }
+        s->wall_ms[s->count++] = phase->wall_ms;
+        s->last_at = now;
+    }
+    int err = write_history(prj, &history);
+    if (err) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, arch, "Unable to save the phase duration history in %s/logs/%s: %s", prj->main_project_build_dir, PHASE_HISTORY_FILE, strerror(errno));
+    }
+    phase_history_free(&history);
+    return err;
+}
+
+typedef struct phase_report_entry {
+    const char *project;
+    phase_series_t series;
+    int samples;                                    // In the last window
+    long p50;
+    long p95;
+    long previous_p50;                              // Of the window before it (-1 without one)
+} phase_report_entry_t;
+
+static int compare_slowest(const void *a, const void *b) {
+    const phase_report_entry_t *x = a, *y = b;
+    if (x->p95 != y->p95) return x->p95 < y->p95 ? 1 : -1;
+    return x->p50 < y->p50 ? 1 : x->p50 > y->p50 ? -1 : 0;
+}
+
+// Writes the report of the slowest phases of the projects (at most limit of them, sorted by p95) as a JSON response
+void phase_history_report_json(const project_t *const projects[], int project_count, int limit, json_buf_t *out) {
+    phase_report_entry_t *entries = NULL;
+    int count = 0, capacity = 0;
+    for (int i = 0; i < project_count; i++) {
+        const project_t *prj = projects[i];
+        phase_history_t history;
+        if (phase_history_load(prj, &history) != 0) {
+            phase_history_free(&history);
+            continue;
+        }
+        int window = window_of(prj);
+        for (int k = 0; k < history.count; k++) {
+            const phase_series_t *s = &history.series[k];
+            if (s->count == 0) continue;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                phase_report_entry_t *grown = realloc(entries, capacity * sizeof(phase_report_entry_t));
+                if (!grown) break;
+                entries = grown;
+            }
+            phase_report_entry_t *e = &entries[count++];
+            e->project = prj->name;
+            e->series = *s;
+            e->samples = s->count < window ? s->count : window;
+            percentiles(s->wall_ms + s->count - e->samples, e->samples, &e->p50, &e->p95);
+            e->previous_p50 = -1;
+            int previous = s->count - e->samples;
+            if (previous > 0) {
+                int n = previous < window ? previous : window;
+                long p95;
+                percentiles(s->wall_ms + previous - n, n, &e->previous_p50, &p95);
+            }
+        }
+        phase_history_free(&history);
+    }
+    qsort(entries, count, sizeof(phase_report_entry_t), compare_slowest);
+    json_printf(out, "{\"ok\":true,\"phases\":%d,\"slowest\":[", count);
+    for (int i = 0; i < count && i < limit; i++) {
+        const phase_report_entry_t *e = &entries[i];
+        json_printf(out, "%s{\"project\":", i ? "," : "");
+        json_string(out, e->project);
+        json_printf(out, ",\"arch\":");
+        json_string(out, e->series.arch);
+        json_printf(out, ",\"mode\":");
+        json_string(out, e->series.mode);
+        json_printf(out, ",\"phase\":");
+        json_string(out, e->series.phase);
+        json_printf(out, ",\"builds\":%d,\"last_s\":%.1f,\"p50_s\":%.1f,\"p95_s\":%.1f", e->samples, e->series.wall_ms[e->series.count - 1] / 1000.0, e->p50 / 1000.0, e->p95 / 1000.0);
+        if (e->previous_p50 > 0) json_printf(out, ",\"previous_p50_s\":%.1f,\"trend\":%.2f", e->previous_p50 / 1000.0, (double)e->p50 / e->previous_p50);
+        else json_printf(out, ",\"previous_p50_s\":null,\"trend\":null");
+        json_printf(out, ",\"last_at\":%lld}", e->series.last_at);
+    }
+    json_printf(out, "]}");
+    free(entries);
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "utils/pressure.h"
+#include "utils/utils.h"
+
+/*
+    Pressure-aware admission control.
+    Before a build thread is started, the worker reads the pressure stall information of the kernel (/proc/pressure/{cpu,memory,io}, the
+    share of the last 10 seconds in which some task was stalled on the resource) and holds the build back while any resource is above the
+    threshold of the project, checking again every check_interval seconds: queued builds start by themselves as soon as the pressure drops.
+    Consecutive build threads are started at least check_interval apart, otherwise all of them would be admitted on the same (idle) sample
+    before the first one shows up in the averages. Every project runs in the same process, so the spacing holds across projects: a gate
+    (a mutex and the time of the latest admission) makes each sample and its admission one step, and a build is sampled only once
+    check_interval (of its project) has passed since the latest build admitted by any project, e.g. after a restart or a drain.
+    The admitted build gets a -j that shrinks with the CPU pressure (and is halved when memory is already under half of its threshold),
+    passed to cross_compiler.sh; a build held for max_wait seconds starts anyway with -j1.
+*/
+
+// Reads the "some avg10" value of /proc/pressure/<resource>; returns 0 on success
+static int read_some_avg10(const char *resource, double *value) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 1;
+    char line[256];
+    int found = 1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "some avg10=%lf", value) == 1) {
+            found = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+// Returns 0 if the pressure of all the resources was read, 1 if the kernel has no PSI support (or it is disabled)
+int pressure_read(pressure_sample_t *sample) {
+    memset(sample, 0, sizeof(*sample));
+    if (read_some_avg10("cpu", &sample->cpu) != 0) return 1;
+    if (read_some_avg10("memory", &sample->memory) != 0) return 1;
+    if (read_some_avg10("io", &sample->io) != 0) return 1;
+    return 0;
+}
+
+// Returns the name of the first resource above its threshold, NULL if none
+static const char *resource_over_threshold(const admission_t *admission, const pressure_sample_t *sample) {
+    if (admission->cpu > 0 && sample->cpu > admission->cpu) return "cpu";
+    if (admission->memory > 0 && sample->memory > admission->memory) return "memory";
+    if (admission->io > 0 && sample->io > admission->io) return "io";
+    return NULL;
+}
+
+static long build_jobs(const admission_t *admission, const pressure_sample_t *sample) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    long jobs = (long)(cpus * (100.0 - sample->cpu) / 100.0 + 0.5);
+    if (admission->memory > 0 && sample->memory > admission->memory / 2.0) jobs /= 2;
+    return jobs < 1 ? 1 : jobs;
+}
+
+// Sleeps up to seconds, returning early if the terminate flag is raised; returns 1 in that case
+static int wait_or_terminate(int seconds, volatile sig_atomic_t *terminate_flag) {
+    unsigned int time_left = seconds > 0 ? (unsigned int)seconds : 0;
+    while (time_left > 0 && !*terminate_flag) {
+        time_left = sleep(time_left);
+    }
+    return *terminate_flag ? 1 : 0;
+}
+
+static pthread_mutex_t admission_gate = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec last_admission;      // Of the latest build admitted by any project (zero for none yet), under admission_gate
+
+// Seconds left before a build may be sampled, interval after the latest admission (admission_gate held)
+static long settle_left_s(int interval) {
+    if (last_admission.tv_sec == 0 && last_admission.tv_nsec == 0) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - last_admission.tv_sec) * 1000L + (now.tv_nsec - last_admission.tv_nsec) / 1000000L;
+    long left_ms = interval * 1000L - elapsed_ms;
+    return left_ms > 0 ? (left_ms + 999) / 1000 : 0;
+}
+
+static void record_admission(void) {
+    pthread_mutex_lock(&admission_gate);
+    clock_gettime(CLOCK_MONOTONIC, &last_admission);
+    pthread_mutex_unlock(&admission_gate);
+}
+
+// Waits until the host can take another build (see above) and sets jobs to the -j it should use ("" when admission is disabled or unsupported)
+// Returns 0 when the build is admitted, 1 if the terminate flag was raised meanwhile
+int admit_build(const admission_t *admission, volatile sig_atomic_t *terminate_flag, admission_stats_t *stats, char *jobs, size_t jobs_size, FILE *log_fp, const char *project_name, const char *arch) {
+    jobs[0] = '\0';
+    if (admission->cpu <= 0 && admission->memory <= 0 && admission->io <= 0) {
+        // Not gated itself, but recorded: the gated builds of the other projects let its load show up first
+        record_admission();
+        stats->admitted++;
+        return 0;
+    }
+    pressure_sample_t sample;
+    if (pressure_read(&sample) != 0) {
+        if (stats->unavailable++ == 0) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "No pressure stall information in /proc/pressure (kernel without CONFIG_PSI, or booted with psi=0); builds are started without admission control.");
+        }
+        return 0;
+    }
+
+    int interval = admission->check_interval > 0 ? admission->check_interval : 1;
+    struct timespec hold_start, now;
+    clock_gettime(CLOCK_MONOTONIC, &hold_start);
+    int held = 0;
+    int forced = 0;
+    for (;;) {
+        // The sample and the admission are one step under the gate: no two builds are admitted on the same sample
+        pthread_mutex_lock(&admission_gate);
+        long settle_s = settle_left_s(interval);
+        const char *resource = NULL;
+        if (settle_s == 0) {
+            if (pressure_read(&sample) == 0) resource = resource_over_threshold(admission, &sample);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            forced = resource && admission->max_wait > 0 && now.tv_sec - hold_start.tv_sec >= admission->max_wait;
+            if (!resource || forced) {
+                last_admission = now;
+                pthread_mutex_unlock(&admission_gate);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&admission_gate);
+        if (resource && !held) {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "Holding back the build: %s pressure above threshold (cpu %.1f%%/%d, memory %.1f%%/%d, io %.1f%%/%d); checking again every %d s.",
+                resource, sample.cpu, admission->cpu, sample.memory, admission->memory, sample.io, admission->io, admission->check_interval);
+            held = 1;
+        }
+        // Until the latest admission settles (of this project or another one), or the next check
+        if (wait_or_terminate(settle_s > 0 ? (int)settle_s : interval, terminate_flag) != 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            stats->wait_s += now.tv_sec - hold_start.tv_sec;
+            return 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long waited_s = now.tv_sec - hold_start.tv_sec;
+    stats->wait_s += waited_s;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long build_job_count = forced ? 1 : build_jobs(admission, &sample);
+    snprintf(jobs, jobs_size, "%ld", build_job_count);
+    if (forced) {
+        stats->forced++;
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, project_name, arch, "Starting the build anyway after %ld s under pressure (cpu %.1f%%, memory %.1f%%, io %.1f%%): -j1.", waited_s, sample.cpu, sample.memory, sample.io);
+    } else if (held) {
+        stats->delayed++;
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "Pressure dropped after %ld s (cpu %.1f%%, memory %.1f%%, io %.1f%%): starting the build with -j%ld.", waited_s, sample.cpu, sample.memory, sample.io, build_job_count);
+    } else {
+        stats->admitted++;
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "Build admitted (cpu %.1f%%, memory %.1f%%, io %.1f%%): -j%ld.", sample.cpu, sample.memory, sample.io, build_job_count);
+    }
+    if (build_job_count < cpus) stats->throttled++;
+    return 0;
+}
@@ -1,333 +1,566 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <execs.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include "utils/scripts_runner.h"
+#include "utils/step_executor.h"
+#include "utils/cgroup.h"
 #include "utils/utils.h"
+#include "utils/state_journal.h"
+#include "elf/binary_selection.h"
+#include "store/artifact_store.h"
+#include "test/test_report.h"
+#include "bench/artifact_bench.h"
 
-int chroot_setup(const char *debian_arch, const char *chroot_dir, const char* main_log_file, FILE *log_fp) {
-    char command[MAX_COMMAND_LEN];
-    char *chroot_setup_expanded_path = expand_tilde(CHROOT_SETUP_SCRIPT_PATH);
-    if (chmod(chroot_setup_expanded_path, 0755) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, debian_arch, "Error: Unable to set execute permissions on %s: %s", chroot_setup_expanded_path, strerror(errno));
-        free(chroot_setup_expanded_path);
-        return 1;
-    }
-    snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\"", chroot_setup_expanded_path, debian_arch, chroot_dir, main_log_file);
-    int status = system_safe(command);
-    if (status == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, debian_arch, "system_safe() call during the execution of %s failed for architecture %s", chroot_setup_expanded_path, debian_arch);
-        free(chroot_setup_expanded_path);
-        return 1;
+// Expands the path of a script and makes sure it is executable; returns NULL (after logging) on failure
+static char *prepare_script(const char *script_path, FILE *log_fp, const char *project_name, const char *arch) {
+    char *expanded_path = expand_tilde(script_path);
+    if (!expanded_path) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Error: Unable to expand path %s", script_path);
+        return NULL;
     }
-    if (WIFEXITED(status)) {
-        free(chroot_setup_expanded_path);
-        return WEXITSTATUS(status);
+    if (chmod(expanded_path, 0755) == -1) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Error: Unable to set execute permissions on %s: %s", expanded_path, strerror(errno));
+        free(expanded_path);
+        return NULL;
     }
-    formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, debian_arch, "script %s for architecture %s did not terminate normally; status: %d", chroot_setup_expanded_path, debian_arch, status);
-    free(chroot_setup_expanded_path);
+    return expanded_path;
+}
+
+#define RUN_SCRIPT_TIMED_OUT -2
+#define RUN_SCRIPT_SESSION_LOST 75      // Exit code of the scripts whose chroot_exec lost the session server (CHROOT_SESSION_LOST in session.sh)
+
+// Result of a step of a build thread whose script exited with exit_code (not 0)
+static int step_failure(int exit_code) {
+    if (exit_code == RUN_SCRIPT_TIMED_OUT) return SCRIPT_TIMED_OUT;
+    if (exit_code == RUN_SCRIPT_SESSION_LOST) return SCRIPT_SESSION_LOST;
     return 1;
 }
 
-int check_for_updates_inside_chroot(const char *chroot_dir, const char *chroot_build_dir, const char *repo_name, const char *worker_tmp_chroot_log_file, FILE *log_fp, int *need2update, const char *project_name, const char *tmp_arch) {
-    char command[MAX_COMMAND_LEN];
-    char *check_updates_expanded_path = expand_tilde(CHECK_UPDATES_SCRIPT_PATH);
-    if (chmod(check_updates_expanded_path, 0755) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, NULL, "Error: Unable to set execute permissions on %s: %s", check_updates_expanded_path, strerror(errno));
-        free(check_updates_expanded_path);
-        return 1;
-    }
-    snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"", check_updates_expanded_path, chroot_dir, chroot_build_dir, repo_name, worker_tmp_chroot_log_file, project_name, tmp_arch);
-    int status = system_safe(command);
-    if (status == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, tmp_arch, "system_safe() call during the execution of %s failed for repository %s, in the tmp chroot arch %s", check_updates_expanded_path, repo_name, tmp_arch);
-        free(check_updates_expanded_path);
-        return 1;
+// Prepares the watchdog of a step: the limits of all the phases, the phase the step starts in and the logs it writes to (chroot paths already expanded)
+static void init_watchdog(step_watchdog_t *watchdog, const phase_timeouts_t *timeouts, const char *initial_phase, const char *phase_file, const char *activity_file, const char *other_activity_file) {
+    memset(watchdog, 0, sizeof(*watchdog));
+    step_watchdog_add_phase(watchdog, "install", timeouts->install);
+    step_watchdog_add_phase(watchdog, "fetch", timeouts->fetch);
+    step_watchdog_add_phase(watchdog, "configure", timeouts->configure);
+    step_watchdog_add_phase(watchdog, "build", timeouts->build);
+    step_watchdog_add_phase(watchdog, "publish", timeouts->publish);
+    snprintf(watchdog->initial_phase, sizeof(watchdog->initial_phase), "%s", initial_phase);
+    watchdog->phase_file = phase_file;
+    watchdog->activity_files[0] = activity_file;
+    watchdog->activity_files[1] = other_activity_file;
+    watchdog->inactivity_ms = timeouts->inactivity > 0 ? timeouts->inactivity * 1000L : 0;
+}
+
+// Adds the per-phase resources of a step to the usage of its build thread
+static void account_step(build_usage_t *usage, const step_result_t *result) {
+    int dominant = 0;
+    for (int i = 0; i < result->phase_count; i++) {
+        const step_phase_usage_t *step_phase = &result->phases[i];
+        if (step_phase->wall_ms > result->phases[dominant].wall_ms) dominant = i;
+        int k = 0;
+        while (k < usage->phase_count && strcmp(usage->phases[k].phase, step_phase->phase) != 0) k++;
+        if (k == usage->phase_count) {
+            if (usage->phase_count == MAX_BUILD_PHASES) continue;
+            memset(&usage->phases[k], 0, sizeof(usage->phases[k]));
+            snprintf(usage->phases[k].phase, sizeof(usage->phases[k].phase), "%s", step_phase->phase[0] ? step_phase->phase : "other");
+            usage->phase_count++;
+        }
+        phase_usage_t *phase = &usage->phases[k];
+        phase->steps++;
+        phase->wall_ms += step_phase->wall_ms;
+        phase->user_ms += step_phase->user_ms;
+        phase->sys_ms += step_phase->sys_ms;
+        phase->read_kb += step_phase->read_kb;
+        phase->write_kb += step_phase->write_kb;
+        if (result->usage.ru_maxrss > phase->max_rss_kb) phase->max_rss_kb = result->usage.ru_maxrss;
     }
-    if (WIFEXITED(status)) {
-        int exit_code = WEXITSTATUS(status);
-        if (exit_code == 0) {
-            *need2update = 0; // No updates
-        } else if (exit_code == 2) {
-            *need2update = 1; // Updates found
-        } else {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, tmp_arch, "script %s for repository %s , in the tmp chroot arch %s, failed with code %d", check_updates_expanded_path, repo_name, tmp_arch, exit_code);
-            free(check_updates_expanded_path);
-            return 1;
+    // Context switches are only known for the whole step
+    for (int k = 0; k < usage->phase_count; k++) {
+        if (strcmp(usage->phases[k].phase, result->phases[dominant].phase) == 0) {
+            usage->phases[k].voluntary_switches += result->usage.ru_nvcsw;
+            usage->phases[k].involuntary_switches += result->usage.ru_nivcsw;
+            break;
         }
-        free(check_updates_expanded_path);
-        return 0;
     }
-    formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, tmp_arch, "script %s for repository %s , in the tmp chroot arch %s, did not terminate normally; status: %d", check_updates_expanded_path, repo_name, tmp_arch, status);
-    free(check_updates_expanded_path);
-    return 1;
 }
 
-int install_packages_list_in_chroot(char *packages[], const char *chroot_dir, FILE *log_fp, const char *thread_log_file, const char *project_name, const char *thread_arch) {
-    char command[MAX_COMMAND_LEN];
-    char *install_packages_expanded_path = expand_tilde(INSTALL_PACKAGES_SCRIPT_PATH);
-    if (chmod(install_packages_expanded_path, 0755) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Error: Unable to set execute permissions on %s: %s", install_packages_expanded_path, strerror(errno));
-        free(install_packages_expanded_path);
-        return 1;
+// Runs a script step (argv[0] is the script) in the cgroup of its context, accounts its resources in the usage of the context and logs how it ended and what it cost; returns its exit code, RUN_SCRIPT_TIMED_OUT if its watchdog
+// killed it, or -1 if it could not be run, was killed or cancelled
+// Steps that may leave a half-done state that the next cycle cannot cope with (chroot setup and repair) are run without terminate flag nor watchdog
+static int run_script(char *const argv[], volatile sig_atomic_t *terminate_flag, const step_watchdog_t *watchdog, step_context_t *context, FILE *log_fp, const char *project_name, const char *arch, const char *what) {
+    step_result_t result;
+    const char *cgroup_dir = context ? context->cgroup_dir : NULL;
+    long oom_kills_before = cgroup_oom_kills(cgroup_dir);
+    int err = run_step(argv, cgroup_dir, terminate_flag, watchdog, &result);
+    if (err != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Unable to run %s (%s): %s", argv[0], what, strerror(err));
+        return -1;
     }
-    snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\"", install_packages_expanded_path, chroot_dir, thread_log_file, project_name, thread_arch);
-    for (int i = 0; packages[i] != NULL; i++) {
-        strcat(command, " \"");
-        strcat(command, packages[i]);
-        strcat(command, "\"");
+    if (context && context->usage) {
+        account_step(context->usage, &result);
     }
-    int status = system_safe(command);
-    if (status == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "system_safe() call during the execution of %s failed for packages in chroot", install_packages_expanded_path);
-        free(install_packages_expanded_path);
-        return 1;
+    // The cgroup is only used by this build thread, so the OOM kills that happened meanwhile belong to this step
+    long oom_kills_after = cgroup_oom_kills(cgroup_dir);
+    if (oom_kills_before >= 0 && oom_kills_after > oom_kills_before) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Step %s (%s) hit memory.max of cgroup %s: %ld processes killed by the OOM killer.", argv[0], what, cgroup_dir, oom_kills_after - oom_kills_before);
+        if (context->usage) context->usage->oom_kills += oom_kills_after - oom_kills_before;
     }
-    if (WIFEXITED(status)) {
-        free(install_packages_expanded_path);
-        return WEXITSTATUS(status);
+    if (result.cancelled) {
+        formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, project_name, arch, "Step %s (%s) cancelled: its process group exited %ld ms after SIGTERM%s (ran for %ld ms).", argv[0], what, result.cancel_ms, result.killed ? " and SIGKILL" : "", result.wall_ms);
+        return -1;
     }
-    formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "script %s for packages installation did not terminate normally; status: %d", install_packages_expanded_path, status);
-    free(install_packages_expanded_path);
-    return 1;
+    if (result.timed_out == STEP_TIMEOUT_PHASE) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Step %s (%s) killed by the watchdog: phase %s exceeded its limit (%ld ms in the phase, %ld ms in total); exited %ld ms after SIGTERM%s.", argv[0], what, result.phase, result.phase_ms, result.wall_ms, result.cancel_ms, result.killed ? " and SIGKILL" : "");
+        return RUN_SCRIPT_TIMED_OUT;
+    }
+    if (result.timed_out == STEP_TIMEOUT_INACTIVITY) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "Step %s (%s) killed by the watchdog: no output for %ld s in phase %s (%ld ms in total); exited %ld ms after SIGTERM%s.", argv[0], what, watchdog->inactivity_ms / 1000, result.phase, result.wall_ms, result.cancel_ms, result.killed ? " and SIGKILL" : "");
+        return RUN_SCRIPT_TIMED_OUT;
+    }
+    if (result.term_signal != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, arch, "script %s (%s) did not terminate normally: killed by signal %d after %ld ms", argv[0], what, result.term_signal, result.wall_ms);
+        return -1;
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, arch, "Step %s (%s) exited with code %d in %ld ms (user %ld ms, sys %ld ms, max RSS %ld KB)", argv[0], what, result.exit_code, result.wall_ms, step_user_ms(&result), step_sys_ms(&result), result.usage.ru_maxrss);
+    return result.exit_code;
 }
 
-int clone_or_pull_sources_inside_chroot(thread_arg_t *targ, FILE *log_fp) {
-    // Extract repository names from URLs (manual dependencies and main project) - (useful for checking if the repos were already cloned)
-    char *repo_names[targ->project->manual_dep_count + 1];
-    manual_dependency_t *cur_manual = targ->project->manual_dependencies;
+// Extracts the repository names of the manual dependencies and of the main project (last), as used for the directories in the chroot
+static int extract_all_repo_names(project_t *prj, char *repo_names[], FILE *log_fp, const char *arch) {
+    manual_dependency_t *cur_manual = prj->manual_dependencies;
     int i = 0;
     while (cur_manual) {
         if (extract_repo_name(cur_manual->git_url, &repo_names[i]) != 0) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Failed to extract repository name from URL %s for project %s", cur_manual->git_url, targ->project->name);
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to extract repository name from URL %s for project %s", cur_manual->git_url, prj->name);
             for (int j = 0; j < i; j++) free(repo_names[j]);
             return 1;
         }
         cur_manual = cur_manual->next;
         i++;
     }
-    if (extract_repo_name(targ->project->repo_url, &repo_names[i]) != 0) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Failed to extract main repository name from URL %s for project %s", targ->project->repo_url, targ->project->name);
+    if (extract_repo_name(prj->repo_url, &repo_names[i]) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, arch, "Failed to extract main repository name from URL %s for project %s", prj->repo_url, prj->name);
         for (int j = 0; j < i; j++) free(repo_names[j]);
         return 1;
     }
+    return 0;
+}
 
-    // First clone or pull all the manual dependencies
-    char command[MAX_COMMAND_LEN];
-    cur_manual = targ->project->manual_dependencies;
-    char *clone_or_pull_expanded_path = expand_tilde(CLONE_OR_PULL_SCRIPT_PATH);
-    if (chmod(clone_or_pull_expanded_path, 0755) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Error: Unable to set execute permissions on %s: %s", clone_or_pull_expanded_path, strerror(errno));
-        for (int j = 0; j < i; j++) free(repo_names[j]);
-        free(clone_or_pull_expanded_path);
-        return 1;
+static void free_repo_names(char *repo_names[], int count) {
+    for (int k = 0; k < count; k++) {
+        free(repo_names[k]);
     }
-    i = 0;
-    while (cur_manual) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"", 
-            clone_or_pull_expanded_path, 
-            targ->thread_chroot_dir, 
-            targ->thread_chroot_build_dir, 
-            repo_names[i], 
-            cur_manual->git_url,
-            targ->thread_log_file,
-            targ->project->name,
-            targ->arch
-        );
-        int status = system_safe(command);
-        if (status == -1) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "system_safe() call during the execution of %s failed for project %s during the clone of the dependency %s", clone_or_pull_expanded_path, targ->project->name, repo_names[i]);
-            for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                if (repo_names[k]) free(repo_names[k]);
-            }
-            free(clone_or_pull_expanded_path);
-            return 1;
-        } else if (WIFEXITED(status)) {
-            int exit_code = WEXITSTATUS(status);
-            if (exit_code != 0) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the clone of the dependency %s exited with failure code %d", clone_or_pull_expanded_path, targ->project->name, repo_names[i], exit_code);
-                for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                    if (repo_names[k]) free(repo_names[k]);
-                }
-                free(clone_or_pull_expanded_path);
-                return 1;
-            }
-        } else {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the clone of the dependency %s did not terminate normally; status: %d", clone_or_pull_expanded_path, targ->project->name, repo_names[i], status);
-            for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                if (repo_names[k]) free(repo_names[k]);
-            }
-            free(clone_or_pull_expanded_path);
-            return 1;
-        }
-        cur_manual = cur_manual->next;
-        i++;
+}
+
+int chroot_setup(const char *debian_arch, const char *chroot_dir, const char* main_log_file, FILE *log_fp) {
+    char *chroot_setup_expanded_path = prepare_script(CHROOT_SETUP_SCRIPT_PATH, log_fp, NULL, debian_arch);
+    if (!chroot_setup_expanded_path) {
+        return 1;
     }
+    char *argv[] = { chroot_setup_expanded_path, (char *)debian_arch, (char *)chroot_dir, (char *)main_log_file, NULL };
+    int exit_code = run_script(argv, NULL, NULL, NULL, log_fp, NULL, debian_arch, "chroot setup");
+    free(chroot_setup_expanded_path);
+    return exit_code < 0 ? 1 : exit_code;
+}
 
-    // Now clone or pull the main project repository
-    snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"", 
-        clone_or_pull_expanded_path, 
-        targ->thread_chroot_dir,
-        targ->thread_chroot_build_dir,
-        repo_names[i], 
-        targ->project->repo_url,
-        targ->thread_log_file,
-        targ->project->name,
-        targ->arch
-    );
-    int status = system_safe(command);
-    if (status == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "system_safe() call during the execution of %s failed for project %s during the clone of the main repository", clone_or_pull_expanded_path, targ->project->name);
-        for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-            if (repo_names[k]) free(repo_names[k]);
-        }
-        free(clone_or_pull_expanded_path);
+int check_for_updates_inside_chroot(const char *chroot_dir, const char *chroot_build_dir, const char *repo_name, const char *worker_tmp_chroot_log_file, FILE *log_fp, int *need2update, const char *project_name, const char *tmp_arch, volatile sig_atomic_t *terminate_flag, const phase_timeouts_t *timeouts) {
+    char *check_updates_expanded_path = prepare_script(CHECK_UPDATES_SCRIPT_PATH, log_fp, project_name, tmp_arch);
+    if (!check_updates_expanded_path) {
         return 1;
-    } else if (WIFEXITED(status)) {
-        int exit_code = WEXITSTATUS(status);
-        if (exit_code != 0) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the clone of the main repository exited with code %d", clone_or_pull_expanded_path, targ->project->name, exit_code);
-            for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                if (repo_names[k]) free(repo_names[k]);
-            }
-            free(clone_or_pull_expanded_path);
-            return 1;
-        }
+    }
+    char *argv[] = { check_updates_expanded_path, (char *)chroot_dir, (char *)chroot_build_dir, (char *)repo_name, (char *)worker_tmp_chroot_log_file, (char *)project_name, (char *)tmp_arch, NULL };
+    char activity_file[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(activity_file, sizeof(activity_file), "%s%s", chroot_dir, worker_tmp_chroot_log_file);
+    step_watchdog_t watchdog;
+    init_watchdog(&watchdog, timeouts, "fetch", NULL, activity_file, NULL);
+    int exit_code = run_script(argv, terminate_flag, &watchdog, NULL, log_fp, project_name, tmp_arch, "update check");
+    free(check_updates_expanded_path);
+    if (exit_code == RUN_SCRIPT_TIMED_OUT) {
+        return SCRIPT_TIMED_OUT;
+    } else if (exit_code == 0) {
+        *need2update = 0; // No updates
+    } else if (exit_code == 2) {
+        *need2update = 1; // Updates found
     } else {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the clone of the main repository did not terminate normally; status: %d", clone_or_pull_expanded_path, targ->project->name, status);
-        for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-            if (repo_names[k]) free(repo_names[k]);
-        }
-        free(clone_or_pull_expanded_path);
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, tmp_arch, "Update check for repository %s, in the tmp chroot arch %s, failed with code %d", repo_name, tmp_arch, exit_code);
         return 1;
     }
-    for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-        if (repo_names[k]) free(repo_names[k]);
-    }
-    free(clone_or_pull_expanded_path);
     return 0;
 }
 
-int build_in_chroot(thread_arg_t *targ, FILE *log_fp) {
-    // Extract repository names from URLs (manual dependencies and main project) - (useful for cd for each repo)
-    char *repo_names[targ->project->manual_dep_count + 1];
-    manual_dependency_t *cur_manual = targ->project->manual_dependencies;
-    int i = 0;
-    while (cur_manual) {
-        if (extract_repo_name(cur_manual->git_url, &repo_names[i]) != 0) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Failed to extract repository name from URL %s for project %s", cur_manual->git_url, targ->project->name);
-            for (int j = 0; j < i; j++) free(repo_names[j]);
-            return 1;
-        }
-        cur_manual = cur_manual->next;
-        i++;
+int install_packages_list_in_chroot(char *packages[], const char *chroot_dir, FILE *log_fp, const char *thread_log_file, const char *project_name, const char *thread_arch, volatile sig_atomic_t *terminate_flag, step_context_t *context) {
+    char *install_packages_expanded_path = prepare_script(INSTALL_PACKAGES_SCRIPT_PATH, log_fp, project_name, thread_arch);
+    if (!install_packages_expanded_path) {
+        return 1;
     }
-    if (extract_repo_name(targ->project->repo_url, &repo_names[i]) != 0) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Failed to extract main repository name from URL %s for project %s", targ->project->repo_url, targ->project->name);
-        for (int j = 0; j < i; j++) free(repo_names[j]);
+    int package_count = 0;
+    while (packages[package_count] != NULL) package_count++;
+    char **argv = malloc((5 + package_count + 1) * sizeof(char *));
+    if (!argv) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Error: Unable to allocate the arguments for %d packages", package_count);
+        free(install_packages_expanded_path);
         return 1;
     }
+    argv[0] = install_packages_expanded_path;
+    argv[1] = (char *)chroot_dir;
+    argv[2] = (char *)thread_log_file;
+    argv[3] = (char *)project_name;
+    argv[4] = (char *)thread_arch;
+    for (int i = 0; i < package_count; i++) {
+        argv[5 + i] = packages[i];
+    }
+    argv[5 + package_count] = NULL;
+    char activity_file[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(activity_file, sizeof(activity_file), "%s%s", chroot_dir, thread_log_file);
+    step_watchdog_t watchdog;
+    init_watchdog(&watchdog, context->timeouts, "install", NULL, activity_file, NULL);
+    int exit_code = run_script(argv, terminate_flag, &watchdog, context, log_fp, project_name, thread_arch, "packages installation");
+    free(argv);
+    free(install_packages_expanded_path);
+    return exit_code == 0 ? 0 : step_failure(exit_code);
+}
 
-    // First build all the dependencies
-    char command[MAX_COMMAND_LEN];
-    cur_manual = targ->project->manual_dependencies;
-    char *build_script_expanded_path = expand_tilde(BUILD_SCRIPT_PATH);
-    if (chmod(build_script_expanded_path, 0755) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Unable to set execute permissions on %s: %s", build_script_expanded_path, strerror(errno));
-        for (int j = 0; j < i; j++) free(repo_names[j]);
-        free(build_script_expanded_path);
+int repair_packages_in_chroot(char *packages[], const char *chroot_dir, const char *log_file, FILE *log_fp, const char *project_name, const char *thread_arch) {
+    char *repair_expanded_path = prepare_script(CHROOT_REPAIR_SCRIPT_PATH, log_fp, project_name, thread_arch);
+    if (!repair_expanded_path) {
         return 1;
     }
-    i = 0;
-    while (cur_manual) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"", 
-            build_script_expanded_path, 
-            targ->arch,
-            targ->thread_chroot_dir, 
-            targ->thread_chroot_build_dir, 
+    int package_count = 0;
+    while (packages[package_count] != NULL) package_count++;
+    char **argv = malloc((5 + package_count + 1) * sizeof(char *));
+    if (!argv) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, project_name, thread_arch, "Error: Unable to allocate the arguments for %d packages", package_count);
+        free(repair_expanded_path);
+        return 1;
+    }
+    argv[0] = repair_expanded_path;
+    argv[1] = (char *)chroot_dir;
+    argv[2] = (char *)log_file;
+    argv[3] = (char *)project_name;
+    argv[4] = (char *)thread_arch;
+    for (int i = 0; i < package_count; i++) {
+        argv[5 + i] = packages[i];
+    }
+    argv[5 + package_count] = NULL;
+    int exit_code = run_script(argv, NULL, NULL, NULL, log_fp, project_name, thread_arch, "chroot repair");
+    free(argv);
+    free(repair_expanded_path);
+    return exit_code == 0 ? 0 : 1;
+}
+
+int clone_or_pull_sources_inside_chroot(thread_arg_t *targ, FILE *log_fp) {
+    // Extract repository names from URLs (manual dependencies and main project) - (useful for checking if the repos were already cloned)
+    int repo_count = targ->project->manual_dep_count + 1;
+    char *repo_names[repo_count];
+    if (extract_all_repo_names(targ->project, repo_names, log_fp, targ->arch) != 0) {
+        return 1;
+    }
+    char *clone_or_pull_expanded_path = prepare_script(CLONE_OR_PULL_SCRIPT_PATH, log_fp, targ->project->name, targ->arch);
+    if (!clone_or_pull_expanded_path) {
+        free_repo_names(repo_names, repo_count);
+        return 1;
+    }
+
+    step_watchdog_t watchdog;
+    init_watchdog(&watchdog, targ->context.timeouts, "fetch", NULL, targ->thread_log_file, NULL);
+
+    // First clone or pull all the manual dependencies, then the main project repository (last repo name)
+    manual_dependency_t *cur_manual = targ->project->manual_dependencies;
+    int result = 0;
+    for (int i = 0; i < repo_count; i++) {
+        const char *git_url = cur_manual ? cur_manual->git_url : targ->project->repo_url;
+        char *argv[] = {
+            clone_or_pull_expanded_path,
+            targ->thread_chroot_dir,
+            targ->thread_chroot_build_dir,
             repo_names[i],
-            cur_manual->build_system,
-            targ->thread_log_file, 
-            targ->thread_chroot_log_file,
-            targ->project->name
-        );
-        int status = system_safe(command);
-        if (status == -1) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "system_safe() call during the execution of %s failed for project %s during the build of the dependency %s", build_script_expanded_path, targ->project->name, repo_names[i]);
-            for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                if (repo_names[k]) free(repo_names[k]);
-            }
-            free(build_script_expanded_path);
-            return 1;
-        } else if (WIFEXITED(status)) {
-            int exit_code = WEXITSTATUS(status);
-            if (exit_code != 0) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the build of the dependency %s exited with failure code %d", build_script_expanded_path, targ->project->name, repo_names[i], exit_code);
-                for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                    if (repo_names[k]) free(repo_names[k]);
-                }
-                free(build_script_expanded_path);
-                return 1;
-            }
-        } else {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the build of the dependency %s did not terminate normally; status: %d", build_script_expanded_path, targ->project->name, repo_names[i], status);
-            for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                if (repo_names[k]) free(repo_names[k]);
-            }
-            free(build_script_expanded_path);
-            return 1;
+            (char *)git_url,
+            targ->thread_log_file,
+            targ->project->name,
+            targ->arch,
+            NULL
+        };
+        int exit_code = run_script(argv, targ->terminate_flag, &watchdog, &targ->context, log_fp, targ->project->name, targ->arch, cur_manual ? "clone of a dependency" : "clone of the main repository");
+        if (exit_code != 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Clone or pull of %s for project %s failed with code %d", repo_names[i], targ->project->name, exit_code);
+            result = exit_code == RUN_SCRIPT_TIMED_OUT ? SCRIPT_TIMED_OUT : 1;
+            break;
         }
-        cur_manual = cur_manual->next;
-        i++;
+        if (cur_manual) cur_manual = cur_manual->next;
     }
+    free_repo_names(repo_names, repo_count);
+    free(clone_or_pull_expanded_path);
+    return result;
+}
+
+// Publishes the binary copied to the target dir of the chroot by publish_binary.sh under the entry name it chose, with the build data
+// of the artifact index (see artifact_store.c), and tells the worker where it is for the state journal
+static int publish_artifact(thread_arg_t *targ, const char *repo_name, FILE *log_fp) {
+    project_t *prj = targ->project;
+    char publication_file[MAX_CONFIG_ATTR_LEN * 2 + 16];
+    char artifact_file[MAX_CONFIG_ATTR_LEN * 2 + 16];
+    char binary[MAX_CONFIG_ATTR_LEN * 3];
+    snprintf(publication_file, sizeof(publication_file), "%s%s/logs/publication", targ->thread_chroot_dir, targ->thread_chroot_build_dir);
+    snprintf(artifact_file, sizeof(artifact_file), "%s%s/logs/artifact", targ->thread_chroot_dir, targ->thread_chroot_build_dir);
+    snprintf(binary, sizeof(binary), "%s%s/%s-%s", targ->thread_chroot_dir, targ->thread_chroot_target_dir, repo_name, targ->arch);
 
-    // Now build the main project repository
-    snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%d\"", 
-        build_script_expanded_path, 
+    artifact_record_t record;
+    memset(&record, 0, sizeof(record));
+    FILE *fp = fopen(publication_file, "r");
+    int named = fp && fscanf(fp, "%255s %127s", record.name, record.tag) == 2;
+    if (fp) fclose(fp);
+    if (!named) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, targ->arch, "Unable to read the entry name of the binary from %s", publication_file);
+        return 1;
+    }
+    snprintf(record.project, sizeof(record.project), "%s", prj->name);
+    snprintf(record.arch, sizeof(record.arch), "%s", targ->arch);
+    char sources[JOURNAL_SOURCES_LEN];
+    if (state_journal_sources(prj, targ->thread_chroot_dir, sources, sizeof(sources)) != 0) sources[0] = '\0';
+    record.sources = sources;
+    record.built_at = (long long)time(NULL);
+    record.duration_s = -1;
+    if (targ->status) {
+        pthread_mutex_lock(&targ->status->lock);
+        if (targ->status->started_at > 0) record.duration_s = (long)(record.built_at - targ->status->started_at);
+        pthread_mutex_unlock(&targ->status->lock);
+    }
+    if (store_publish_artifact(prj->target_dir, binary, &record, prj->binaries_limits, log_fp) != 0) {
+        return 1;
+    }
+    fp = fopen(artifact_file, "w");
+    if (!fp) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, targ->arch, "Unable to write %s: %s", artifact_file, strerror(errno));
+        return 0;
+    }
+    fprintf(fp, "%s/daily/%s\n", prj->target_dir, record.name);
+    fclose(fp);
+    return 0;
+}
+
+// Benchmarks the binary copied to the target dir of the chroot before its publication (see bench_binary.sh and artifact_bench.c);
+// a failure is only logged, since the benchmarks never hold a binary back
+static void bench_main_binary(thread_arg_t *targ, const char *repo_name, FILE *log_fp) {
+    project_t *prj = targ->project;
+    char phase_file[MAX_CONFIG_ATTR_LEN * 2 + 16];
+    char chroot_log_file[MAX_CONFIG_ATTR_LEN * 2];
+    char results_file[MAX_CONFIG_ATTR_LEN * 2 + 32];
+    char binary[MAX_CONFIG_ATTR_LEN * 3];
+    char repo_dir[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(phase_file, sizeof(phase_file), "%s%s/logs/phase", targ->thread_chroot_dir, targ->thread_chroot_build_dir);
+    snprintf(chroot_log_file, sizeof(chroot_log_file), "%s%s", targ->thread_chroot_dir, targ->thread_chroot_log_file);
+    snprintf(results_file, sizeof(results_file), "%s%s/logs/%s", targ->thread_chroot_dir, targ->thread_chroot_build_dir, BENCH_RESULTS_FILE);
+    snprintf(binary, sizeof(binary), "%s%s/%s-%s", targ->thread_chroot_dir, targ->thread_chroot_target_dir, repo_name, targ->arch);
+    snprintf(repo_dir, sizeof(repo_dir), "%s%s/%s", targ->thread_chroot_dir, targ->thread_chroot_build_dir, repo_name);
+
+    char *bench_script_expanded_path = prepare_script(BENCH_SCRIPT_PATH, log_fp, prj->name, targ->arch);
+    if (!bench_script_expanded_path) {
+        return;
+    }
+    char runs[16];
+    snprintf(runs, sizeof(runs), "%d", prj->bench.runs);
+    char *argv[] = {
+        bench_script_expanded_path,
         targ->arch,
         targ->thread_chroot_dir,
         targ->thread_chroot_build_dir,
-        repo_names[i],
-        targ->project->main_repo_build_system,
+        targ->thread_chroot_target_dir,
+        (char *)repo_name,
         targ->thread_log_file,
         targ->thread_chroot_log_file,
+        prj->name,
+        prj->bench.command,
+        runs,
+        NULL
+    };
+    step_watchdog_t watchdog;
+    init_watchdog(&watchdog, targ->context.timeouts, "bench", phase_file, targ->thread_log_file, chroot_log_file);
+    step_watchdog_add_phase(&watchdog, "bench", prj->bench.time_budget);
+    int exit_code = run_script(argv, targ->terminate_flag, &watchdog, &targ->context, log_fp, prj->name, targ->arch, "benchmarks of the binary");
+    free(bench_script_expanded_path);
+    if (exit_code != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, targ->arch, "Benchmarks of %s-%s failed with code %d; only its sizes are recorded", repo_name, targ->arch, exit_code);
+        unlink(results_file);
+    }
+    char commit[72];
+    if (state_journal_read_head(repo_dir, commit, sizeof(commit)) != 0) commit[0] = '\0';
+    artifact_bench_t bench;
+    if (artifact_bench_measure(binary, results_file, commit, &bench) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, targ->arch, "Unable to measure %s: %s", binary, strerror(errno));
+        return;
+    }
+    artifact_bench_record(prj, targ->arch, &bench, log_fp);
+}
+
+// Selects the binary among the executables built for the main repository and publishes it (see binary_selection.c, publish_binary.sh
+// and publish_artifact)
+static int publish_main_binary(thread_arg_t *targ, const char *repo_name, step_watchdog_t *watchdog, FILE *log_fp) {
+    char repo_dir[MAX_CONFIG_ATTR_LEN * 2];
+    char selected[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(repo_dir, sizeof(repo_dir), "%s%s/%s", targ->thread_chroot_dir, targ->thread_chroot_build_dir, repo_name);
+    if (select_binary(targ->project, targ->arch, repo_dir, repo_name, selected, sizeof(selected), log_fp) != 0) {
+        return 1;
+    }
+    char *publish_script_expanded_path = prepare_script(PUBLISH_SCRIPT_PATH, log_fp, targ->project->name, targ->arch);
+    if (!publish_script_expanded_path) {
+        return 1;
+    }
+    char *argv[] = {
+        publish_script_expanded_path,
+        targ->arch,
+        targ->thread_chroot_dir,
+        targ->thread_chroot_build_dir,
+        (char *)repo_name,
+        targ->thread_log_file,
         targ->project->name,
         targ->thread_chroot_target_dir,
         targ->project->target_dir,
-        targ->project->binaries_limits->daily_mem_limit
-    );
-    int status = system_safe(command);
-    if (status == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "system_safe() call during the execution of %s failed for project %s during the build of the main repository", build_script_expanded_path, targ->project->name);
-        for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-            if (repo_names[k]) free(repo_names[k]);
-        }
-        free(build_script_expanded_path);
+        selected,
+        NULL
+    };
+    int exit_code = run_script(argv, targ->terminate_flag, watchdog, &targ->context, log_fp, targ->project->name, targ->arch, "publication of the binary");
+    free(publish_script_expanded_path);
+    if (exit_code != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Publication of %s for project %s failed with code %d", selected, targ->project->name, exit_code);
+        return step_failure(exit_code);
+    }
+    // Benchmarked before the publication, so that the newest binary of the artifact index is still the previous build
+    if (strcmp(targ->project->bench.enabled, "yes") == 0 && !*targ->terminate_flag) {
+        bench_main_binary(targ, repo_name, log_fp);
+    }
+    return publish_artifact(targ, repo_name, log_fp);
+}
+
+// Runs the test suite of the main repository where it was built (see run_tests.sh) within the time budget of the project, and keeps its
+// results (see test_report.c); returns 0 if the tests passed, SCRIPT_TESTS_FAILED if some failed, SCRIPT_TIMED_OUT or 1 if they could not be run
+static int test_main_repository(thread_arg_t *targ, const char *repo_name, const char *phase_file, const char *chroot_log_file, FILE *log_fp) {
+    project_t *prj = targ->project;
+    char *test_script_expanded_path = prepare_script(TEST_SCRIPT_PATH, log_fp, prj->name, targ->arch);
+    if (!test_script_expanded_path) {
         return 1;
-    } else if (WIFEXITED(status)) {
-        int exit_code = WEXITSTATUS(status);
-        if (exit_code != 0) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the build of the main repository exited with code %d", build_script_expanded_path, targ->project->name, exit_code);
-            for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-                if (repo_names[k]) free(repo_names[k]);
-            }
-            free(build_script_expanded_path);
-            return 1;
-        }
+    }
+    char shards[16];
+    snprintf(shards, sizeof(shards), "%d", prj->test.shards);
+    char *argv[] = {
+        test_script_expanded_path,
+        targ->arch,
+        targ->thread_chroot_dir,
+        targ->thread_chroot_build_dir,
+        (char *)repo_name,
+        prj->main_repo_build_system,
+        targ->thread_log_file,
+        targ->thread_chroot_log_file,
+        prj->name,
+        prj->test.command,
+        shards,
+        targ->thread_host_chroot_dir,
+        NULL
+    };
+    // The whole suite is bounded by the time budget, the inactivity limit still applies (see the watchdog of the build)
+    step_watchdog_t watchdog;
+    init_watchdog(&watchdog, targ->context.timeouts, "test", phase_file, targ->thread_log_file, chroot_log_file);
+    step_watchdog_add_phase(&watchdog, "test", prj->test.time_budget);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int exit_code = run_script(argv, targ->terminate_flag, &watchdog, &targ->context, log_fp, prj->name, targ->arch, "tests of the main repository");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(test_script_expanded_path);
+    if (exit_code == RUN_SCRIPT_TIMED_OUT) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, targ->arch, "Tests of %s for project %s did not finish within the time budget of %d s", repo_name, prj->name, prj->test.time_budget);
+        return SCRIPT_TIMED_OUT;
+    }
+    if (exit_code != 0 && exit_code != SCRIPT_TESTS_FAILED) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, targ->arch, "Unable to run the tests of %s for project %s (code %d)", repo_name, prj->name, exit_code);
+        return step_failure(exit_code);
+    }
+    char junit_file[MAX_CONFIG_ATTR_LEN * 2 + 32];
+    snprintf(junit_file, sizeof(junit_file), "%s%s/logs/%s", targ->thread_chroot_dir, targ->thread_chroot_build_dir, TEST_REPORT_FILE);
+    test_report_t report;
+    if (test_report_load(junit_file, &report) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, targ->arch, "Unable to read the test report %s: %s", junit_file, strerror(errno));
+        test_report_free(&report);
     } else {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "script %s for project %s during the build of the main repository did not terminate normally; status: %d", build_script_expanded_path, targ->project->name, status);
-        for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-            if (repo_names[k]) free(repo_names[k]);
-        }
-        free(build_script_expanded_path);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        test_report_record(prj, targ->arch, junit_file, &report, exit_code == 0, seconds, log_fp);
+        test_report_free(&report);
+    }
+    return exit_code == 0 ? 0 : SCRIPT_TESTS_FAILED;
+}
+
+int build_in_chroot(thread_arg_t *targ, FILE *log_fp) {
+    // Extract repository names from URLs (manual dependencies and main project) - (useful for cd for each repo)
+    int repo_count = targ->project->manual_dep_count + 1;
+    char *repo_names[repo_count];
+    if (extract_all_repo_names(targ->project, repo_names, log_fp, targ->arch) != 0) {
         return 1;
     }
-    for (int k = 0; k < (targ->project->manual_dep_count + 1); k++) {
-        if (repo_names[k]) free(repo_names[k]);
+    char *build_script_expanded_path = prepare_script(BUILD_SCRIPT_PATH, log_fp, targ->project->name, targ->arch);
+    if (!build_script_expanded_path) {
+        free_repo_names(repo_names, repo_count);
+        return 1;
     }
+    char daily_mem_limit[32];
+    char tmpfs_budget_mb[32];
+    snprintf(daily_mem_limit, sizeof(daily_mem_limit), "%d", targ->project->binaries_limits->daily_mem_limit);
+    snprintf(tmpfs_budget_mb, sizeof(tmpfs_budget_mb), "%d", targ->project->tmpfs_budget_mb);
+
+    // The build script reports its phase (configure, build) in <chroot build dir>/logs/phase, as does the publication (publish); its output goes to both logs
+    char phase_file[MAX_CONFIG_ATTR_LEN * 2 + 16];
+    char chroot_log_file[MAX_CONFIG_ATTR_LEN * 2];
+    snprintf(phase_file, sizeof(phase_file), "%s%s/logs/phase", targ->thread_chroot_dir, targ->thread_chroot_build_dir);
+    snprintf(chroot_log_file, sizeof(chroot_log_file), "%s%s", targ->thread_chroot_dir, targ->thread_chroot_log_file);
+    step_watchdog_t watchdog;
+    init_watchdog(&watchdog, targ->context.timeouts, "configure", phase_file, targ->thread_log_file, chroot_log_file);
+
+    // First build all the dependencies, then the main project repository (last repo name)
+    // Note: arguments 9-11 are left empty for dependencies (the script recognizes a dependency by them), 12-13 select the cross mode, 14-15 the tmpfs build tree, 16 the -j set by the admission control
+    manual_dependency_t *cur_manual = targ->project->manual_dependencies;
+    int run_tests = strcmp(targ->project->test.enabled, "yes") == 0;
+    int result = 0;
+    for (int i = 0; i < repo_count; i++) {
+        int main_project = (cur_manual == NULL);
+        char *argv[] = {
+            build_script_expanded_path,
+            targ->arch,
+            targ->thread_chroot_dir,
+            targ->thread_chroot_build_dir,
+            repo_names[i],
+            main_project ? targ->project->main_repo_build_system : cur_manual->build_system,
+            targ->thread_log_file,
+            targ->thread_chroot_log_file,
+            targ->project->name,
+            main_project ? targ->thread_chroot_target_dir : "",
+            main_project ? targ->project->target_dir : "",
+            main_project ? daily_mem_limit : "",
+            targ->thread_cross_mode,
+            targ->thread_host_chroot_dir,
+            // The tests need the build tree, which a tmpfs build discards: the main repository is then built on disk
+            main_project && run_tests ? "no" : targ->project->tmpfs_build,
+            tmpfs_budget_mb,
+            targ->thread_jobs,
+            NULL
+        };
+        int exit_code = run_script(argv, targ->terminate_flag, &watchdog, &targ->context, log_fp, targ->project->name, targ->arch, main_project ? "build of the main repository" : "build of a dependency");
+        if (exit_code != 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, targ->project->name, targ->arch, "Build of %s for project %s failed with code %d", repo_names[i], targ->project->name, exit_code);
+            result = step_failure(exit_code);
+            break;
+        }
+        if (cur_manual) cur_manual = cur_manual->next;
+    }
+    // Then its tests run, and only if they pass is the binary of the main repository selected on the host and published
+    if (result == 0 && run_tests) {
+        result = test_main_repository(targ, repo_names[repo_count - 1], phase_file, chroot_log_file, log_fp);
+    }
+    if (result == 0) {
+        result = publish_main_binary(targ, repo_names[repo_count - 1], &watchdog, log_fp);
+    }
+    free_repo_names(repo_names, repo_count);
     free(build_script_expanded_path);
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
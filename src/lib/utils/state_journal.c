@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "utils/state_journal.h"
+#include "utils/sha256.h"
+#include "utils/utils.h"
+
+/*
+    Persistent state journal (<build_dir>/state.journal).
+    Every build that ends (successfully or not, but not when it is cancelled by a shutdown) appends one line with the HEAD of each of its
+    repositories, its outcome and the published binary:
+        <epoch> <project> <arch> <status> <attempts> <repo>=<sha>,... <artifact or -> <checksum>
+    The artifact (a path, which may contain spaces) is the last field before the checksum, and is read up to it.
+    The line is written with a single write() on an O_APPEND descriptor and made durable with fdatasync() before the build is considered
+    recorded; the checksum (the first 16 hex digits of the sha256 of the rest of the line) lets the loader drop a line torn by a crash.
+    On open the latest line of each <project, arch> is kept and the file is compacted (written to a temporary file, fsync'd and renamed).
+    The update check compares the HEADs it pulled with the journal, so that after a restart, or after a crash between the pull and the
+    end of a build, only the architectures that were not built at those sources are built again.
+*/
+
+#define JOURNAL_CHECKSUM_LEN 16
+#define JOURNAL_LINE_LEN (JOURNAL_SOURCES_LEN + MAX_CONFIG_ATTR_LEN + 2 * MIN_CONFIG_ATTR_LEN + 128)
+#define JOURNAL_COMPACT_AFTER 1024      // Appended lines after which the journal is compacted again
+
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static journal_entry_t *journal_entries = NULL;
+static int journal_count = 0;
+static int journal_capacity = 0;
+static int journal_fd = -1;
+static int journal_appended = 0;
+static char journal_path[MAX_CONFIG_ATTR_LEN];
+static char journal_dir[MAX_CONFIG_ATTR_LEN];
+
+static void line_checksum(const char *text, size_t len, char checksum[JOURNAL_CHECKSUM_LEN + 1]) {
+    sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_LEN];
+    char hex[SHA256_HEX_LEN];
+    sha256_init(&ctx);
+    sha256_update(&ctx, text, len);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hex);
+    memcpy(checksum, hex, JOURNAL_CHECKSUM_LEN);
+    checksum[JOURNAL_CHECKSUM_LEN] = '\0';
+}
+
+// Formats the line of an entry (with its checksum and the final newline); returns its length, 0 if it does not fit
+static size_t format_entry(const journal_entry_t *entry, char *line, size_t line_size) {
+    int len = snprintf(line, line_size, "%lld %s %s %d %d %s %s", entry->built_at, entry->project, entry->arch, entry->status, entry->attempts,
+        entry->sources[0] ? entry->sources : "-", entry->artifact[0] ? entry->artifact : "-");
+    if (len < 0 || (size_t)len + JOURNAL_CHECKSUM_LEN + 3 > line_size) return 0;
+    char checksum[JOURNAL_CHECKSUM_LEN + 1];
+    line_checksum(line, (size_t)len, checksum);
+    len += snprintf(line + len, line_size - len, " %s\n", checksum);
+    return (size_t)len;
+}
+
+// Parses a journal line; returns 0 if it is whole and its checksum matches
+static int parse_entry(const char *line, journal_entry_t *entry) {
+    const char *checksum_start = strrchr(line, ' ');
+    if (!checksum_start) return 1;
+    char checksum[JOURNAL_CHECKSUM_LEN + 1];
+    line_checksum(line, (size_t)(checksum_start - line), checksum);
+    if (strncmp(checksum_start + 1, checksum, JOURNAL_CHECKSUM_LEN) != 0) return 1;
+
+    char project[MIN_CONFIG_ATTR_LEN], arch[MIN_CONFIG_ATTR_LEN], sources[JOURNAL_SOURCES_LEN];
+    int artifact_offset = 0;
+    memset(entry, 0, sizeof(*entry));
+    if (sscanf(line, "%lld %127s %127s %d %d %2047s %n", &entry->built_at, project, arch, &entry->status, &entry->attempts, sources, &artifact_offset) != 6 ||
+        artifact_offset == 0 || line + artifact_offset >= checksum_start) {
+        return 1;
+    }
+    const char *artifact = line + artifact_offset;
+    int artifact_len = (int)(checksum_start - artifact);
+    snprintf(entry->project, sizeof(entry->project), "%s", project);
+    snprintf(entry->arch, sizeof(entry->arch), "%s", arch);
+    snprintf(entry->sources, sizeof(entry->sources), "%s", strcmp(sources, "-") == 0 ? "" : sources);
+    if (artifact_len != 1 || artifact[0] != '-') snprintf(entry->artifact, sizeof(entry->artifact), "%.*s", artifact_len, artifact);
+    return 0;
+}
+
+static journal_entry_t *find_entry(const char *project, const char *arch) {
+    for (int i = 0; i < journal_count; i++) {
+        if (strcmp(journal_entries[i].project, project) == 0 && strcmp(journal_entries[i].arch, arch) == 0) {
+            return &journal_entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Keeps entry as the latest of its <project, arch>; returns 0 on success
+static int store_entry(const journal_entry_t *entry) {
+    journal_entry_t *existing = find_entry(entry->project, entry->arch);
+    if (existing) {
+        *existing = *entry;
+        return 0;
+    }
+    if (journal_count == journal_capacity) {
+        int new_capacity = journal_capacity ? journal_capacity * 2 : 16;
+        journal_entry_t *grown = realloc(journal_entries, new_capacity * sizeof(journal_entry_t));
+        if (!grown) return 1;
+        journal_entries = grown;
+        journal_capacity = new_capacity;
+    }
+    journal_entries[journal_count++] = *entry;
+    return 0;
+}
+
+static void sync_dir(const char *dir) {
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+// Rewrites the journal with the latest entry of each <project, arch> and reopens it for appending; called with the mutex held
+static int compact_journal(FILE *log_fp) {
+    char tmp_path[MAX_CONFIG_ATTR_LEN + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal_path);
+    int tmp_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd < 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to create %s: %s", tmp_path, strerror(errno));
+        return 1;
+    }
+    char line[JOURNAL_LINE_LEN];
+    for (int i = 0; i < journal_count; i++) {
+        size_t len = format_entry(&journal_entries[i], line, sizeof(line));
+        if (len == 0) continue;
+        if (write(tmp_fd, line, len) != (ssize_t)len) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to write %s: %s", tmp_path, strerror(errno));
+            close(tmp_fd);
+            unlink(tmp_path);
+            return 1;
+        }
+    }
+    if (fsync(tmp_fd) != 0 || close(tmp_fd) != 0 || rename(tmp_path, journal_path) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to replace %s: %s", journal_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+    sync_dir(journal_dir);
+    if (journal_fd >= 0) close(journal_fd);
+    journal_fd = open(journal_path, O_WRONLY | O_APPEND);
+    if (journal_fd < 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to open %s: %s", journal_path, strerror(errno));
+        return 1;
+    }
+    journal_appended = 0;
+    return 0;
+}
+
+// Loads <build_dir>/state.journal (if any) and compacts it; returns 0 if the journal can be written
+int state_journal_open(const char *build_dir, FILE *log_fp) {
+    pthread_mutex_lock(&journal_mutex);
+    snprintf(journal_dir, sizeof(journal_dir), "%s", build_dir);
+    snprintf(journal_path, sizeof(journal_path), "%s/" STATE_JOURNAL_FILE, build_dir);
+    journal_count = 0;
+    int loaded = 0;
+    int damaged = 0;
+    FILE *fp = fopen(journal_path, "r");
+    if (fp) {
+        char line[JOURNAL_LINE_LEN];
+        journal_entry_t entry;
+        while (fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[0] == '\0') continue;
+            if (parse_entry(line, &entry) != 0) {
+                damaged++;
+                continue;
+            }
+            if (store_entry(&entry) == 0) loaded++;
+        }
+        fclose(fp);
+    } else if (errno != ENOENT) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to read the state journal %s: %s; every project will be built again.", journal_path, strerror(errno));
+    }
+    int result = compact_journal(log_fp);
+    pthread_mutex_unlock(&journal_mutex);
+    formatted_log(log_fp, damaged ? "WARNING" : "INFO", __FILE__, __LINE__, NULL, NULL, "State journal %s: %d builds loaded (%d project/architecture pairs), %d damaged lines dropped.", journal_path, loaded, journal_count, damaged);
+    return result;
+}
+
+void state_journal_close(void) {
+    pthread_mutex_lock(&journal_mutex);
+    if (journal_fd >= 0) close(journal_fd);
+    journal_fd = -1;
+    free(journal_entries);
+    journal_entries = NULL;
+    journal_count = journal_capacity = 0;
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+// Copies the latest entry of <project, arch> into entry; returns 0 if there is one
+int state_journal_lookup(const char *project, const char *arch, journal_entry_t *entry) {
+    pthread_mutex_lock(&journal_mutex);
+    journal_entry_t *existing = find_entry(project, arch);
+    if (existing) *entry = *existing;
+    pthread_mutex_unlock(&journal_mutex);
+    return existing ? 0 : 1;
+}
+
+// Appends the outcome of a build (setting its built_at and attempts) and waits for it to be on disk; returns 0 once it is durable
+int state_journal_record(journal_entry_t *entry, FILE *log_fp) {
+    pthread_mutex_lock(&journal_mutex);
+    entry->built_at = (long long)time(NULL);
+    journal_entry_t *previous = find_entry(entry->project, entry->arch);
+    entry->attempts = (previous && previous->status == entry->status && strcmp(previous->sources, entry->sources) == 0) ? previous->attempts + 1 : 1;
+    int result = 1;
+    char line[JOURNAL_LINE_LEN];
+    size_t len = format_entry(entry, line, sizeof(line));
+    if (journal_fd < 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, entry->project, entry->arch, "The state journal is not open; the build will not be remembered across restarts.");
+    } else if (len == 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, entry->project, entry->arch, "Build record too long for the state journal.");
+    } else if (write(journal_fd, line, len) != (ssize_t)len || fdatasync(journal_fd) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, entry->project, entry->arch, "Unable to append to the state journal %s: %s", journal_path, strerror(errno));
+    } else {
+        result = store_entry(entry);
+        if (++journal_appended >= JOURNAL_COMPACT_AFTER) {
+            compact_journal(log_fp);
+        }
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    return result;
+}
+
+static int valid_sha(const char *sha) {
+    size_t len = strlen(sha);
+    if (len != 40 && len != 64) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit((unsigned char)sha[i])) return 0;
+    }
+    return 1;
+}
+
+// Reads the first line of a file, without the newline; returns 0 on success
+static int read_first_line(const char *path, char *line, size_t line_size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 1;
+    int result = fgets(line, (int)line_size, fp) ? 0 : 1;
+    fclose(fp);
+    line[strcspn(line, "\r\n")] = '\0';
+    return result;
+}
+
+// Resolves the HEAD commit of a git checkout from its .git directory (loose or packed ref, or detached HEAD), without running git;
+// returns 0 on success
+int state_journal_read_head(const char *repo_dir, char *sha, size_t sha_size) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    char head[MAX_CONFIG_ATTR_LEN];
+    snprintf(path, sizeof(path), "%s/.git/HEAD", repo_dir);
+    if (read_first_line(path, head, sizeof(head)) != 0) return 1;
+    if (strncmp(head, "ref: ", 5) != 0) {
+        if (!valid_sha(head)) return 1;
+        snprintf(sha, sha_size, "%s", head);
+        return 0;
+    }
+    const char *ref = head + 5;
+    char value[MAX_CONFIG_ATTR_LEN];
+    snprintf(path, sizeof(path), "%s/.git/%s", repo_dir, ref);
+    if (read_first_line(path, value, sizeof(value)) == 0 && valid_sha(value)) {
+        snprintf(sha, sha_size, "%s", value);
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/.git/packed-refs", repo_dir);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 1;
+    int result = 1;
+    char line[MAX_CONFIG_ATTR_LEN * 2];
+    while (fgets(line, sizeof(line), fp)) {
+        char packed_sha[72], packed_ref[MAX_CONFIG_ATTR_LEN];
+        if (sscanf(line, "%71s %511s", packed_sha, packed_ref) == 2 && strcmp(packed_ref, ref) == 0 && valid_sha(packed_sha)) {
+            snprintf(sha, sha_size, "%s", packed_sha);
+            result = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+// Builds the "<repo>=<sha>,..." set of the checkouts of all the repositories of the project in a chroot (manual dependencies first,
+// then the main repository); returns 0 if all of them have a readable HEAD
+int state_journal_sources(const project_t *prj, const char *chroot_dir, char *sources, size_t sources_size) {
+    sources[0] = '\0';
+    size_t used = 0;
+    int result = 0;
+    manual_dependency_t *cur_manual = prj->manual_dependencies;
+    for (int i = 0; i < prj->manual_dep_count + 1 && result == 0; i++) {
+        const char *url = cur_manual ? cur_manual->git_url : prj->repo_url;
+        char *repo_name = NULL;
+        if (extract_repo_name(url, &repo_name) != 0) return 1;
+        char repo_dir[MAX_CONFIG_ATTR_LEN * 2];
+        char sha[72];
+        snprintf(repo_dir, sizeof(repo_dir), "%s/home/%s/%s", chroot_dir, prj->name, repo_name);
+        if (state_journal_read_head(repo_dir, sha, sizeof(sha)) != 0) {
+            result = 1;
+        } else {
+            int len = snprintf(sources + used, sources_size - used, "%s%s=%s", used ? "," : "", repo_name, sha);
+            if (len < 0 || (size_t)len >= sources_size - used) result = 1;
+            else used += (size_t)len;
+        }
+        free(repo_name);
+        if (cur_manual) cur_manual = cur_manual->next;
+    }
+    return result;
+}
+
+// Returns 1 if the build of entry used the given commit of the repository
+int state_journal_has_source(const journal_entry_t *entry, const char *repo_name, const char *sha) {
+    char pair[MAX_CONFIG_ATTR_LEN];
+    int len = snprintf(pair, sizeof(pair), "%s=%s", repo_name, sha);
+    const char *match = entry->sources;
+    while ((match = strstr(match, pair)) != NULL) {
+        int starts = (match == entry->sources || match[-1] == ',');
+        int ends = (match[len] == '\0' || match[len] == ',');
+        if (starts && ends) return 1;
+        match += len;
+    }
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "utils/step_executor.h"
+
+extern char **environ;
+
+/*
+    Step executor.
+    Every script is started directly from an argv array with posix_spawn (no intermediate shell, so no quoting and no command line length limit)
+    in a new process group, whose id is the pid of the step: a whole step, with everything it started (unshare, fakeroot, qemu...), can be
+    signalled at once with kill(-pid, sig). The step is reaped with wait4, which also gives the resources it used.
+    Steps are cancellable: while a step runs, its exit is awaited on a pidfd in short slices and the terminate flag of the caller is checked
+    between them. When it is raised the whole group gets SIGTERM (which reaches everything inside the _enter namespace, since unshare and
+    fakeroot do not change process group), then SIGKILL after STEP_CANCEL_GRACE_MS. Without pidfd support the exit is polled with WNOHANG.
+    A step can also have a watchdog, checked every STEP_WATCHDOG_CHECK_MS between the same slices: the step reports its current phase (configure,
+    build...) by writing its name to the phase file, and it is cancelled in the same way when it stays in a phase longer than the limit of that
+    phase, or when none of its logs changes for the inactivity limit (a configure test or a test suite deadlocked under qemu prints nothing).
+    The resources of a step are split among its phases: at every phase change the CPU time and block I/O of the whole process group are sampled
+    from /proc (utime/stime including the waited children, and /proc/<pid>/io, which also includes them), and the last phase gets the
+    remainder of the totals returned by wait4. Max RSS and context switches are only known for the whole step (see result->usage).
+    A step can be started inside a cgroup (see cgroup.c): posix_spawn cannot place the child in a cgroup, so the child is a tiny /bin/sh that
+    moves itself into the cgroup and then execs the script, before the script can start anything that would escape the limits.
+*/
+
+#define STEP_POLL_MS 100
+#define STEP_WATCHDOG_CHECK_MS 1000
+#define STEP_CGROUP_TRAMPOLINE "{ echo 0 > \"$0/cgroup.procs\"; } 2>/dev/null; exec \"$@\""
+
+static long elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000L + (end->tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+static int pidfd_open_compat(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Waits up to STEP_POLL_MS for the step leader to exit, without reaping it (so its pid, and the group id, cannot be reused meanwhile)
+static int step_exited(pid_t pid, int pidfd) {
+    if (pidfd >= 0) {
+        struct pollfd pfd = { pidfd, POLLIN, 0 };
+        return poll(&pfd, 1, STEP_POLL_MS) > 0 && (pfd.revents & POLLIN);
+    }
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid) {
+        return 1;
+    }
+    struct timespec slice = { 0, STEP_POLL_MS * 1000000L };
+    nanosleep(&slice, NULL);
+    return 0;
+}
+
+// Sums CPU time and block I/O of the live processes of a group, each including its waited children (so everything that already ended in the group)
+static void sample_group_usage(pid_t pgid, step_phase_usage_t *sample) {
+    memset(sample, 0, sizeof(*sample));
+    DIR *proc = opendir("/proc");
+    if (!proc) return;
+    long ticks_per_s = sysconf(_SC_CLK_TCK);
+    if (ticks_per_s <= 0) ticks_per_s = 100;
+    struct dirent *entry;
+    while ((entry = readdir(proc)) != NULL) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') continue;
+        char path[sizeof(entry->d_name) + 16];
+        char line[1024];
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        int parsed = fgets(line, sizeof(line), fp) != NULL;
+        fclose(fp);
+        // The command name may contain spaces and parentheses: the fields start after the last ')'
+        char *fields = parsed ? strrchr(line, ')') : NULL;
+        int group;
+        unsigned long utime, stime;
+        long cutime, cstime;
+        if (!fields || sscanf(fields + 2, "%*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld", &group, &utime, &stime, &cutime, &cstime) != 5 || group != pgid) {
+            continue;
+        }
+        sample->user_ms += (long)((utime + cutime) * 1000 / ticks_per_s);
+        sample->sys_ms += (long)((stime + cstime) * 1000 / ticks_per_s);
+        snprintf(path, sizeof(path), "/proc/%s/io", entry->d_name);
+        fp = fopen(path, "r");
+        if (!fp) continue;
+        long long bytes;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "read_bytes: %lld", &bytes) == 1) sample->read_kb += (long)(bytes / 1024);
+            else if (sscanf(line, "write_bytes: %lld", &bytes) == 1) sample->write_kb += (long)(bytes / 1024);
+        }
+        fclose(fp);
+    }
+    closedir(proc);
+}
+
+// Closes the current phase of a step: its usage is the difference between the cumulative usage now and at the start of the phase
+static void close_phase(step_result_t *result, const struct timespec *phase_start, const struct timespec *now, const step_phase_usage_t *cumulative, step_phase_usage_t *at_phase_start) {
+    step_phase_usage_t *current = &result->phases[result->phase_count - 1];
+    current->wall_ms += elapsed_ms(phase_start, now);
+    current->user_ms += cumulative->user_ms > at_phase_start->user_ms ? cumulative->user_ms - at_phase_start->user_ms : 0;
+    current->sys_ms += cumulative->sys_ms > at_phase_start->sys_ms ? cumulative->sys_ms - at_phase_start->sys_ms : 0;
+    current->read_kb += cumulative->read_kb > at_phase_start->read_kb ? cumulative->read_kb - at_phase_start->read_kb : 0;
+    current->write_kb += cumulative->write_kb > at_phase_start->write_kb ? cumulative->write_kb - at_phase_start->write_kb : 0;
+    *at_phase_start = *cumulative;
+}
+
+// Combines size and mtime of the activity files: any write to any of them changes the signature
+static long long activity_signature(const step_watchdog_t *watchdog) {
+    long long signature = 0;
+    for (int i = 0; i < STEP_MAX_ACTIVITY_FILES; i++) {
+        struct stat st;
+        if (watchdog->activity_files[i] && stat(watchdog->activity_files[i], &st) == 0) {
+            signature = signature * 31 + (long long)st.st_size;
+            signature = signature * 31 + (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        }
+    }
+    return signature;
+}
+
+// Reads the phase currently reported by the step; returns 0 if the phase file holds a phase name
+static int read_phase(const char *phase_file, char phase[STEP_PHASE_NAME_LEN]) {
+    FILE *fp = fopen(phase_file, "r");
+    if (!fp) return 1;
+    char line[STEP_PHASE_NAME_LEN];
+    int found = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+    if (!found) return 1;
+    line[strcspn(line, " \t\n")] = '\0';
+    if (!line[0]) return 1;
+    snprintf(phase, STEP_PHASE_NAME_LEN, "%s", line);
+    return 0;
+}
+
+static long phase_limit_ms(const step_watchdog_t *watchdog, const char *phase) {
+    for (int i = 0; i < watchdog->phase_count; i++) {
+        if (strcmp(watchdog->phases[i].name, phase) == 0) return watchdog->phases[i].timeout_ms;
+    }
+    return 0;
+}
+
+// Adds the limit of a phase (timeout_s <= 0: no limit); returns 1 if the watchdog has no room left
+int step_watchdog_add_phase(step_watchdog_t *watchdog, const char *name, int timeout_s) {
+    if (watchdog->phase_count >= STEP_MAX_PHASES) return 1;
+    step_phase_limit_t *limit = &watchdog->phases[watchdog->phase_count++];
+    snprintf(limit->name, sizeof(limit->name), "%s", name);
+    limit->timeout_ms = timeout_s > 0 ? timeout_s * 1000L : 0;
+    return 0;
+}
+
+// Returns 0 if the step was started and waited for (see result for how it ended), otherwise an errno value
+// If cgroup_dir is not NULL nor empty the step runs in that cgroup (if it cannot join it, it runs anyway in the cgroup of the caller)
+// If terminate_flag is not NULL the step is cancelled as soon as the flag is raised; if watchdog is not NULL, also when it hangs
+int run_step(char *const argv[], const char *cgroup_dir, volatile sig_atomic_t *terminate_flag, const step_watchdog_t *watchdog, step_result_t *result) {
+    memset(result, 0, sizeof(*result));
+    result->pid = -1;
+    result->exit_code = -1;
+    result->phase_count = 1;
+    if (watchdog) {
+        snprintf(result->phase, sizeof(result->phase), "%s", watchdog->initial_phase);
+        snprintf(result->phases[0].phase, sizeof(result->phases[0].phase), "%s", watchdog->initial_phase);
+        // A phase file left by the previous step must not be taken for the phase of this one
+        if (watchdog->phase_file) unlink(watchdog->phase_file);
+    }
+
+    // The step starts in its own process group, with default signal dispositions and an empty mask (whatever the calling thread blocks)
+    posix_spawnattr_t attr;
+    int err = posix_spawnattr_init(&attr);
+    if (err != 0) return err;
+    sigset_t default_signals, empty_mask;
+    sigfillset(&default_signals);
+    sigemptyset(&empty_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    posix_spawnattr_setsigmask(&attr, &empty_mask);
+
+    struct timespec start, end, phase_start;
+    step_phase_usage_t at_phase_start = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    phase_start = start;
+    pid_t pid;
+    if (cgroup_dir && cgroup_dir[0]) {
+        // sh -c <trampoline> <cgroup_dir> argv...: $0 is the cgroup, "$@" the step
+        size_t argc = 0;
+        while (argv[argc]) argc++;
+        char **spawn_argv = malloc((argc + 5) * sizeof(char *));
+        if (!spawn_argv) {
+            posix_spawnattr_destroy(&attr);
+            return ENOMEM;
+        }
+        spawn_argv[0] = "/bin/sh";
+        spawn_argv[1] = "-c";
+        spawn_argv[2] = STEP_CGROUP_TRAMPOLINE;
+        spawn_argv[3] = (char *)cgroup_dir;
+        for (size_t i = 0; i <= argc; i++) spawn_argv[4 + i] = argv[i];
+        err = posix_spawn(&pid, "/bin/sh", NULL, &attr, spawn_argv, environ);
+        free(spawn_argv);
+    } else {
+        err = posix_spawn(&pid, argv[0], NULL, &attr, argv, environ);
+    }
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) return err;
+    result->pid = pid;
+
+    if (terminate_flag || watchdog) {
+        int pidfd = pidfd_open_compat(pid);
+        struct timespec cancel_start, now, last_check = start, last_activity = start;
+        long long signature = watchdog ? activity_signature(watchdog) : 0;
+        int stopping = 0;
+        while (!step_exited(pid, pidfd)) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (!stopping && watchdog && elapsed_ms(&last_check, &now) >= STEP_WATCHDOG_CHECK_MS) {
+                last_check = now;
+                char phase[STEP_PHASE_NAME_LEN];
+                if (watchdog->phase_file && read_phase(watchdog->phase_file, phase) == 0 && strcmp(phase, result->phase) != 0) {
+                    // Entering a new phase restarts both the phase limit and the inactivity limit
+                    step_phase_usage_t cumulative;
+                    sample_group_usage(pid, &cumulative);
+                    close_phase(result, &phase_start, &now, &cumulative, &at_phase_start);
+                    if (result->phase_count < STEP_MAX_PHASES) {
+                        result->phase_count++;
+                        snprintf(result->phases[result->phase_count - 1].phase, sizeof(result->phases[0].phase), "%s", phase);
+                    }
+                    snprintf(result->phase, sizeof(result->phase), "%s", phase);
+                    phase_start = now;
+                    last_activity = now;
+                }
+                long long new_signature = activity_signature(watchdog);
+                if (new_signature != signature) {
+                    signature = new_signature;
+                    last_activity = now;
+                }
+                long limit_ms = phase_limit_ms(watchdog, result->phase);
+                if (limit_ms > 0 && elapsed_ms(&phase_start, &now) >= limit_ms) {
+                    result->timed_out = STEP_TIMEOUT_PHASE;
+                } else if (watchdog->inactivity_ms > 0 && elapsed_ms(&last_activity, &now) >= watchdog->inactivity_ms) {
+                    result->timed_out = STEP_TIMEOUT_INACTIVITY;
+                }
+            }
+            if (!stopping && terminate_flag && *terminate_flag) {
+                result->cancelled = 1;
+            }
+            if (!stopping && (result->cancelled || result->timed_out)) {
+                stopping = 1;
+                cancel_start = now;
+                kill(-pid, SIGTERM);
+            } else if (stopping && !result->killed && elapsed_ms(&cancel_start, &now) >= STEP_CANCEL_GRACE_MS) {
+                result->killed = 1;
+                kill(-pid, SIGKILL);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        result->phase_ms = elapsed_ms(&phase_start, &now);
+        if (stopping) {
+            // The leader is gone but not reaped yet: sweep whatever is left of its group before the group id can be reused
+            kill(-pid, SIGKILL);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            result->cancel_ms = elapsed_ms(&cancel_start, &now);
+        }
+        if (pidfd >= 0) close(pidfd);
+    }
+
+    int status;
+    while (wait4(pid, &status, 0, &result->usage) == -1) {
+        if (errno != EINTR) {
+            return errno;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->wall_ms = elapsed_ms(&start, &end);
+    // The last phase gets what the totals of the step add to the samples taken so far
+    step_phase_usage_t totals = { 0 };
+    totals.user_ms = step_user_ms(result);
+    totals.sys_ms = step_sys_ms(result);
+    totals.read_kb = result->usage.ru_inblock / 2;     // 512-byte blocks
+    totals.write_kb = result->usage.ru_oublock / 2;
+    close_phase(result, &phase_start, &end, &totals, &at_phase_start);
+    if (WIFEXITED(status)) {
+        result->exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        result->term_signal = WTERMSIG(status);
+    }
+    return 0;
+}
+
+long step_user_ms(const step_result_t *result) {
+    return result->usage.ru_utime.tv_sec * 1000L + result->usage.ru_utime.tv_usec / 1000L;
+}
+
+long step_sys_ms(const step_result_t *result) {
+    return result->usage.ru_stime.tv_sec * 1000L + result->usage.ru_stime.tv_usec / 1000L;
+}
@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <execs.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
@@ -7,10 +7,17 @@
 #include <time.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
 #include "init/load_config.h"
-#include "project_worker.h"
+#include "supervisor.h"
 #include "utils/utils.h"
 #include "utils/scripts_runner.h"
+#include "chroot/session.h"
+
+#define GUARDIAN_BACKOFF_MIN_S 1
+#define GUARDIAN_BACKOFF_MAX_S 300
+#define GUARDIAN_STABLE_UPTIME_S 600      // A supervisor that ran this long before crashing restarts after the minimum backoff again
 
 volatile sig_atomic_t terminate_main_flag = 0;
 
@@ -80,6 +87,158 @@ static int remove_failed_archs_from_project(project_t *prj, char *failed_chroots
     return 0;
 }
 
+// Body of the supervisor process: starts the persistent sessions of the chroots used by the projects (if requested; already running ones,
+// left by a crashed supervisor, are kept) and drives all the projects until SIGTERM (see supervisor.c)
+static int run_supervisor(Config *cfg, FILE *log_fp) {
+    // One persistent namespace session per chroot (scripts fall back to a fresh _enter if a session is not alive)
+    char *session_archs[MAX_ARCHITECTURES];
+    int session_count = 0;
+    for (project_t *current = cfg->projects; current && strcmp(cfg->chroot_session, "persistent") == 0; current = current->next) {
+        for (int i = 0; i < current->arch_count + 1; i++) {
+            // The extra iteration covers the amd64 chroot used as build root by the native cross mode
+            char *arch = (i < current->arch_count) ? current->architectures[i] : "amd64";
+            if (i == current->arch_count && strcmp(current->cross_mode, "native") != 0) break;
+            int found = 0;
+            for (int k = 0; k < session_count; k++) {
+                if (strcmp(session_archs[k], arch) == 0) {
+                    found = 1;
+                    break;
+                }
+            }
+            char chroot_dir[MAX_CONFIG_ATTR_LEN + 32];
+            char home_dir[MAX_CONFIG_ATTR_LEN + 40];
+            snprintf(chroot_dir, sizeof(chroot_dir), "%s/%s-chroot", cfg->build_dir, arch);
+            snprintf(home_dir, sizeof(home_dir), "%s/home", chroot_dir);
+            // Chroots that are not set up yet are bootstrapped by the supervisor, which starts their session too
+            if (found || session_count >= MAX_ARCHITECTURES || access(home_dir, F_OK) != 0) {
+                continue;
+            }
+            if (session_start(chroot_dir, log_fp, arch) != 0) {
+                formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, arch, "Unable to start the persistent session for %s; its steps will use a fresh _enter.", chroot_dir);
+            } else {
+                session_archs[session_count++] = arch;
+            }
+        }
+    }
+    return supervisor_run(cfg, session_archs, session_count, log_fp);
+}
+
+// Sleeps up to seconds while reaping orphans, returning early on SIGTERM (the signals are blocked and read with sigtimedwait)
+static void guardian_wait(int seconds, const sigset_t *signals) {
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += seconds;
+    while (!terminate_main_flag) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) break;
+        struct timespec timeout = { deadline.tv_sec - now.tv_sec, deadline.tv_nsec - now.tv_nsec };
+        if (timeout.tv_nsec < 0) {
+            timeout.tv_sec--;
+            timeout.tv_nsec += 1000000000L;
+        }
+        int signum = sigtimedwait(signals, NULL, &timeout);
+        if (signum == SIGTERM) terminate_main_flag = 1;
+        while (waitpid(-1, NULL, WNOHANG) > 0);
+    }
+}
+
+// Runs the supervisor in a child process and restarts it, with exponential backoff, whenever it dies without being asked to stop.
+// This process is a child subreaper, so the session servers of a crashed supervisor are reaped here; SIGTERM and SIGHUP are forwarded.
+// Returns the exit code of the last supervisor
+static int guard_supervisor(Config *cfg, FILE *log_fp) {
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to become a child subreaper: %s", strerror(errno));
+    }
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    if (terminate_main_flag) {
+        return 1;
+    }
+
+    int backoff_s = GUARDIAN_BACKOFF_MIN_S;
+    int restarts = 0;
+    int exit_code = 1;
+    while (!terminate_main_flag) {
+        // A restarted supervisor gets the current configuration, with the changes reloaded by the previous one (its new chroots are
+        // bootstrapped by the supervisor)
+        if (restarts > 0) {
+            Config fresh_cfg;
+            if (load_config(&fresh_cfg) == 0 && strcmp(fresh_cfg.build_dir, cfg->build_dir) == 0) {
+                free_config_projects(cfg);
+                *cfg = fresh_cfg;
+            } else {
+                free_config_projects(&fresh_cfg);
+                formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to reload the configuration (or build_dir changed); restarting with the previous one.");
+            }
+        }
+        time_t started_at = time(NULL);
+        pid_t supervisor_pid = fork();
+        if (supervisor_pid == 0) {
+            // SIGTERM and SIGHUP stay blocked: the supervisor reads them from its signalfd
+            sigset_t child_signals;
+            sigemptyset(&child_signals);
+            sigaddset(&child_signals, SIGCHLD);
+            sigprocmask(SIG_UNBLOCK, &child_signals, NULL);
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            int result = run_supervisor(cfg, log_fp);
+            fclose(log_fp);
+            _exit(result);
+        }
+        if (supervisor_pid < 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to fork the supervisor: %s", strerror(errno));
+        } else {
+            formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Supervisor started with PID %d.", supervisor_pid);
+            int status = 0;
+            int supervisor_exited = 0;
+            int term_forwarded = 0;
+            while (!supervisor_exited) {
+                if (terminate_main_flag && !term_forwarded) {
+                    kill(supervisor_pid, SIGTERM);
+                    term_forwarded = 1;
+                }
+                int signum = sigwaitinfo(&signals, NULL);
+                if (signum == SIGTERM) {
+                    terminate_main_flag = 1;
+                } else if (signum == SIGHUP) {
+                    kill(supervisor_pid, SIGHUP);
+                }
+                // Reap the supervisor and any orphaned session server
+                pid_t pid;
+                int child_status;
+                while ((pid = waitpid(-1, &child_status, WNOHANG)) > 0) {
+                    if (pid == supervisor_pid) {
+                        status = child_status;
+                        supervisor_exited = 1;
+                    }
+                }
+            }
+            exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            if (terminate_main_flag) {
+                break;
+            }
+            long uptime_s = (long)(time(NULL) - started_at);
+            if (uptime_s >= GUARDIAN_STABLE_UPTIME_S) {
+                backoff_s = GUARDIAN_BACKOFF_MIN_S;
+            }
+            if (WIFSIGNALED(status)) {
+                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Supervisor (PID %d) crashed with signal %d (%s) after %ld s.", supervisor_pid, WTERMSIG(status), strsignal(WTERMSIG(status)), uptime_s);
+            } else {
+                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Supervisor (PID %d) exited with code %d after %ld s without being asked to stop.", supervisor_pid, WEXITSTATUS(status), uptime_s);
+            }
+        }
+        restarts++;
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Restarting the supervisor in %d s (restart %d); the builds resume from the state journal.", backoff_s, restarts);
+        guardian_wait(backoff_s, &signals);
+        backoff_s = backoff_s * 2 > GUARDIAN_BACKOFF_MAX_S ? GUARDIAN_BACKOFF_MAX_S : backoff_s * 2;
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "v2ci stopped (%d supervisor restarts).", restarts);
+    return exit_code;
+}
+
 int main() {
     printf("Starting rootless_v2ci...\n");
 
@@ -164,6 +323,25 @@ int main() {
         }
         current = current->next;
     }
+    // Projects in native cross mode compile inside the amd64 chroot (with the target chroot as sysroot), so it is needed even if no project builds for amd64
+    current = cfg.projects;
+    for (int i = 0; i < cfg.project_count; i++) {
+        if (strcmp(current->cross_mode, "native") == 0) {
+            int found = 0;
+            for (int k = 0; k < num_archs; k++) {
+                if (strcmp(archs_list[k], "amd64") == 0) {
+                    found = 1;
+                    break;
+                }
+            }
+            if (!found && num_archs < MAX_ARCHITECTURES) {
+                archs_list[num_archs] = "amd64";
+                num_archs++;
+            }
+            break;
+        }
+        current = current->next;
+    }
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Unique architectures to be built across all projects:");
     for (int i = 0; i < num_archs; i++) {
         fprintf(log_fp, "%s ", archs_list[i]);
@@ -197,45 +375,30 @@ int main() {
         return 1;
     }
 
-    // 5. Iterative project builders launch through fork (new process for each project)
-    formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Launching project build processes...");
+    // 5. Keep only the architectures whose chroot is ready, then drive all the projects from a supervisor process restarted if it crashes
+    if (terminate_main_flag) {
+        formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, NULL, NULL, "Termination signal received before launching the projects, exiting...");
+        fclose(log_fp);
+        remove(PID_FILE);
+        return 1;
+    }
     current = cfg.projects;
-    int launched_projects = 0;
     for (int i = 0; i < cfg.project_count; i++) {
-        // Before launching a new project worker, check if a termination signal was received
-        if (terminate_main_flag) {
-            formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, NULL, NULL, "Termination signal received before launching project %s, exiting...", current->name);
-            break;
-        }
-        pid_t pid = fork();
-        if (pid < 0) {
-            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Failed to fork for project %s. Exiting...", current->name);
-            break;
-        } else if (pid == 0) {
-            // Child process: launch the project worker only with architectures that succeeded in chroot setup
-            int failed_removal = remove_failed_archs_from_project(current, failed_chroots, num_failed_chroots);
-            if (failed_removal == 1) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, current->name, NULL, "Unable to remove failed architectures from project %s.", current->name);
-            }
-            int result = project_worker(current, cfg.build_dir);
-            exit(result);
-        } else {
-            // Parent process: continue to the next project
-            formatted_log(log_fp, "INFO", __FILE__, __LINE__, current->name, NULL, "Launched project %s with PID %d.", current->name, pid);
-            current = current->next;
-            launched_projects++;
+        if (remove_failed_archs_from_project(current, failed_chroots, num_failed_chroots) == 1) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, current->name, NULL, "No chroot could be set up for the architectures of project %s.", current->name);
         }
+        current = current->next;
     }
     formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Logs will be available in the various project log files. In particular:");
     current = cfg.projects;
-    for (int i = 0; i < launched_projects; i++) {
-        project_t *proj = current;
-        fprintf(log_fp, "- Project '%s' log file: %s\n", proj->name, proj->worker_log_file);
+    for (int i = 0; i < cfg.project_count; i++) {
+        fprintf(log_fp, "- Project '%s' log file: %s\n", current->name, current->worker_log_file);
         current = current->next;
     }
     fprintf(log_fp, "To terminate the entire process, run: ./v2ci_stop\n");
+    int supervisor_result = guard_supervisor(&cfg, log_fp);
 
     fclose(log_fp);
     remove(PID_FILE);
-    return 0;
+    return supervisor_result;
 }
\ No newline at end of file
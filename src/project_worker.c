@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // pthread_timedjoin_np, pthread_tryjoin_np
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -6,143 +7,69 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
-#include <execs.h>
 #include <fcntl.h>
 #include <sys/file.h>
 #include "utils/utils.h"
 #include "project_worker.h"
 #include "build_thread.h"
 #include "utils/scripts_runner.h"
-
-volatile sig_atomic_t terminate_worker_flag = 0;
-
-static void sigterm_handler(int signum) {
-    if (signum == SIGTERM) {
-        terminate_worker_flag = 1;
+#include "utils/step_executor.h"
+#include "utils/pressure.h"
+#include "utils/state_journal.h"
+#include "utils/phase_history.h"
+#include "chroot/chroot_health.h"
+#include "init/load_config.h"
+
+#define THREAD_TIME_LIMIT_MARGIN_S 300      // Grace periods of the cancelled steps and waits for the package service runs of other projects
+
+// Upper bound of a build thread: every phase at its limit for every repository (two installs in native mode: target packages and toolchain),
+// plus the time budgets of the test suite and of the benchmarks of the main repository if enabled; 0 if some phase has no limit, in which
+// case the thread is joined without deadline
+static int build_thread_time_limit(const project_t *prj) {
+    const phase_timeouts_t *t = &prj->timeouts;
+    if (t->install <= 0 || t->fetch <= 0 || t->configure <= 0 || t->build <= 0 || t->publish <= 0) {
+        return 0;
     }
-}
-
-static void sleep_and_handle_interrupts(int poll_interval, FILE *log_fp, const char *project_name) {
-    // Sleep cycle and handling of interrupt signals
-    unsigned int time_left = poll_interval;
-    while(time_left > 0) {
-        time_left = sleep(time_left);
-        if (terminate_worker_flag) {
-            formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, project_name, NULL, "Sleep interrupted by termination signal.");
-            break; 
-        }
-        if (time_left > 0) {
-            // If I had time left to sleep and I didn't receive a stop signal, then I was disturbed by someone else and so I ignore and sleep again
-            formatted_log(log_fp, "INFO", __FILE__, __LINE__, project_name, NULL, "Sleep interrupted, %u seconds remaining, continuing to wait...", time_left);
-        }
+    int run_tests = strcmp(prj->test.enabled, "yes") == 0;
+    int run_bench = strcmp(prj->bench.enabled, "yes") == 0;
+    if ((run_tests && prj->test.time_budget <= 0) || (run_bench && prj->bench.time_budget <= 0)) {
+        return 0;
     }
+    int repo_count = prj->manual_dep_count + 1;
+    return 2 * t->install + repo_count * (t->fetch + t->configure + t->build + t->publish) + (run_tests ? prj->test.time_budget : 0) + (run_bench ? prj->bench.time_budget : 0) +
+        THREAD_TIME_LIMIT_MARGIN_S;
 }
 
-static int set_binaries_rotation_cronjob(project_t *prj, FILE *log_fp) {
-    // 0. First lock the cronjob setting process globally (on /tmp) to avoid race conditions (every project worker might try to set cronjobs simultaneously, modifying the same crontab of the same user, leaving it in an inconsistent state)
-    char cronjob_lock_file[MAX_CONFIG_ATTR_LEN];
-    snprintf(cronjob_lock_file, sizeof(cronjob_lock_file), "/tmp/cronjob_lock.lock");
-    int lock_fd = open(cronjob_lock_file, O_CREAT | O_RDWR, 0644);
-    if (lock_fd == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to open cronjob lock file: %s", strerror(errno));
-        return 1;
-    }
-    if (flock(lock_fd, LOCK_EX) == -1) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to acquire lock on cronjob setting lock file: %s", strerror(errno));
-        close(lock_fd);
-        return 1;
+// Logs the per-phase resources of a build thread and appends them to <main_project_build_dir>/logs/resource_usage.log, one line per phase:
+// "<epoch> <arch> <cross mode> <phase> status=<thread status> steps=... wall_ms=... user_ms=... sys_ms=... max_rss_kb=... read_kb=... write_kb=... nvcsw=... nivcsw=... oom_kills=..."
+// (oom_kills is the number of OOM kills of the whole build, repeated on every line)
+static void record_resource_usage(project_t *prj, const thread_arg_t *targ, const thread_result_t *thread_result, FILE *log_fp) {
+    char usage_file[CONFIG_ATTR_LEN + 32];
+    snprintf(usage_file, sizeof(usage_file), "%s/logs/resource_usage.log", prj->main_project_build_dir);
+    FILE *fp = fopen(usage_file, "a");
+    if (!fp) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, targ->arch, "Unable to open resource usage history %s: %s", usage_file, strerror(errno));
     }
-
-    // 1. Prepare the cronjob entry to set. Here we set the rotation cronjob (with all the necessary parameters) script to run at the end of each day (i.e., at 00:00)
-    /* Crontab entries have the following format:
-    * * * * * command to be executed
-    - - - - -
-    | | | | |
-    | | | | +----- Day of week (0 - 7) (Sunday=0 or 7)
-    | | | +------- Month (1 - 12)
-    | | +--------- Day of month (1 - 31)
-    | +----------- Hour (0 - 23)
-    +------------- Minute (0 - 59)
-    */
-    char cronjob_entry[MAX_COMMAND_LEN];
-    char *cronjob_script_expanded_path = expand_tilde(CRONJOB_SCRIPT_PATH);
-    snprintf(cronjob_entry, sizeof(cronjob_entry), "0 0 * * * %s %s %s %s %d %d %d %d %d %d\n", cronjob_script_expanded_path,
-        prj->name,
-        prj->target_dir,
-        prj->cronjob_log_file,
-        prj->binaries_limits->weekly_mem_limit,
-        prj->binaries_limits->monthly_mem_limit,
-        prj->binaries_limits->yearly_mem_limit,
-        prj->binaries_limits->weekly_interval,
-        prj->binaries_limits->monthly_interval,
-        prj->binaries_limits->yearly_interval
-    );
-    free(cronjob_script_expanded_path);
-
-    // 2. Get existing cron jobs and copy them to a temporary file only if their entries differ from the one we want to add (to avoid duplicates)
-    char command_get_cron[MAX_COMMAND_LEN];
-    snprintf(command_get_cron, sizeof(command_get_cron), "/usr/bin/crontab -u %s -l", getenv("USER"));
-    FILE *cron_pipe = popen(command_get_cron, "r");
-    if (!cron_pipe) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to get existing crontab entries: %s", strerror(errno));
-        flock(lock_fd, LOCK_UN);
-        close(lock_fd);
-        return 1;
-    }
-    
-    char temporary_crontab_file[MAX_CONFIG_ATTR_LEN];
-    snprintf(temporary_crontab_file, sizeof(temporary_crontab_file), "%s/%s-crontab", prj->main_project_build_dir, prj->name);
-    FILE *cron_fp = fopen(temporary_crontab_file, "w");
-    if (!cron_fp) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to create temporary cron file %s: %s", temporary_crontab_file, strerror(errno));
-        pclose(cron_pipe);
-        flock(lock_fd, LOCK_UN);
-        close(lock_fd);
-        return 1;
-    }
-    char line[MAX_COMMAND_LEN];
-    while (fgets(line, sizeof(line), cron_pipe)) {
-        if (strcmp(line, cronjob_entry) == 0) {
-            // Skip this line since it is identical to the one we want to add
-            continue;
+    long long now = (long long)time(NULL);
+    for (int i = 0; i < thread_result->usage.phase_count; i++) {
+        const phase_usage_t *phase = &thread_result->usage.phases[i];
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, targ->arch, "Phase %s (%s mode, %d steps): wall %ld ms, user %ld ms, sys %ld ms, max RSS %ld KB, read %ld KB, written %ld KB, %ld/%ld context switches.",
+            phase->phase, targ->thread_cross_mode, phase->steps, phase->wall_ms, phase->user_ms, phase->sys_ms, phase->max_rss_kb, phase->read_kb, phase->write_kb, phase->voluntary_switches, phase->involuntary_switches);
+        if (fp) {
+            fprintf(fp, "%lld %s %s %s status=%d steps=%d wall_ms=%ld user_ms=%ld sys_ms=%ld max_rss_kb=%ld read_kb=%ld write_kb=%ld nvcsw=%ld nivcsw=%ld oom_kills=%ld\n",
+                now, targ->arch, targ->thread_cross_mode, phase->phase, thread_result->status, phase->steps, phase->wall_ms, phase->user_ms, phase->sys_ms, phase->max_rss_kb, phase->read_kb, phase->write_kb, phase->voluntary_switches, phase->involuntary_switches, thread_result->usage.oom_kills);
         }
-        fputs(line, cron_fp);
-    }
-    fclose(cron_fp);
-    pclose(cron_pipe);
-
-    // 3. Now append the new cron job for binaries rotation to the temporary crontab file
-    cron_fp = fopen(temporary_crontab_file, "a");
-    if (!cron_fp) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to open temporary cron file for appending the new entry: %s", strerror(errno));
-        flock(lock_fd, LOCK_UN);
-        close(lock_fd);
-        return 1;
     }
-    fputs(cronjob_entry, cron_fp);
-    fclose(cron_fp);
-
-    // 4. Set the new cron tab
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command), "/usr/bin/crontab -u %s %s", getenv("USER"), temporary_crontab_file);
-    int status = system_safe(command);
-    if (status != 0) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to set new crontab from %s, system_safe() returned status %d", temporary_crontab_file, status);
-        flock(lock_fd, LOCK_UN);
-        close(lock_fd);
-        remove(temporary_crontab_file);
-        return 1;
+    if (fp) fclose(fp);
+    // The phases of a failed build may have been cut short: only the successful ones feed the duration baselines
+    if (thread_result->status == THREAD_STATUS_SUCCESS) {
+        phase_history_record(prj, targ->arch, targ->thread_cross_mode, &thread_result->usage, log_fp);
     }
-
-    // 5. Release the lock and clean up
-    flock(lock_fd, LOCK_UN);
-    close(lock_fd);
-    remove(temporary_crontab_file);
-
-    return 0;
 }
 
-static int recovery(project_t *prj, FILE **log_fp, char *main_build_dir) {
+static int recovery(worker_state_t *ws, FILE **log_fp) {
+    project_t *prj = ws->project;
+    char *main_build_dir = ws->main_build_dir;
     // 1. Create the foundamental directories and files if they don't exist
     int main_build_dir_result = recursive_mkdir_or_file(main_build_dir, 0755, 0);
     if (main_build_dir_result != 0) {
@@ -172,22 +99,22 @@ static int recovery(project_t *prj, FILE **log_fp, char *main_build_dir) {
     setvbuf(*log_fp, NULL, _IOLBF, 0);
     formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Created fundamental directories and files for project %s.", prj->name);
 
-    // 2. For each architecture, perform the chroot setup if the chroot is missing
+    // 2. For each architecture, perform the chroot setup if the chroot is missing, or repair it if it is damaged
     for (int i = 0; i < prj->arch_count; i++) {
-        if (terminate_worker_flag) {
+        if (ws->terminate_flag) {
             formatted_log(*log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Termination signal received before starting chroot setup, exiting...");
             break;
         }
         char chroot_dir[MAX_CONFIG_ATTR_LEN];
         snprintf(chroot_dir, sizeof(chroot_dir), "%s/%s-chroot", main_build_dir, prj->architectures[i]);
-        formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Setting up chroot at %s for architecture %s if missing...", chroot_dir, prj->architectures[i]);
-        if (chroot_setup(prj->architectures[i], chroot_dir, prj->worker_log_file, *log_fp) != 0) {
+        formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Setting up or repairing chroot at %s for architecture %s if needed...", chroot_dir, prj->architectures[i]);
+        if (chroot_health_ensure(prj->architectures[i], chroot_dir, prj->worker_log_file, *log_fp, prj->name) != 0) {
             formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Failed to set up chroot for architecture %s.", prj->architectures[i]);
             return 1;
         }
     }
 
-    if (terminate_worker_flag) {
+    if (ws->terminate_flag) {
         return 2;
     } else {
         formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Recovery operations completed successfully for project %s.", prj->name);
@@ -196,7 +123,8 @@ static int recovery(project_t *prj, FILE **log_fp, char *main_build_dir) {
     return 0;
 }
 
-static int handle_recovery(FILE **log_fp, project_t *prj, char *main_build_dir) {
+static int handle_recovery(FILE **log_fp, worker_state_t *ws) {
+    project_t *prj = ws->project;
     // lock a recovery state file globally (on /tmp) to avoid multiple recoveries at the same time (each project could attempt to setup the same chroot at the same time)
     char recovery_state_file_path[MAX_CONFIG_ATTR_LEN];
     snprintf(recovery_state_file_path, sizeof(recovery_state_file_path), "/tmp/v2ci_worker_recovery_state.lock");
@@ -212,8 +140,9 @@ static int handle_recovery(FILE **log_fp, project_t *prj, char *main_build_dir)
     }
 
     // Start recovery operations
+    ws->cycle_step = WORKER_STEP_RECOVERY;
     formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Starting recovery operations...");
-    int recovery_result = recovery(prj, log_fp, main_build_dir);
+    int recovery_result = recovery(ws, log_fp);
     if (recovery_result == 1) {
         formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "[Recovery] Recovery operations failed for project %s.", prj->name);
         if (flock(fd, LOCK_UN) == -1) {
@@ -235,279 +164,521 @@ static int handle_recovery(FILE **log_fp, project_t *prj, char *main_build_dir)
     return 0;
 }
 
-int project_worker(project_t *prj, char *main_build_dir) {
-    // Create log file for the process
-    int worker_log_file_result = recursive_mkdir_or_file(prj->worker_log_file, 0755, 1);
-    if (worker_log_file_result != 0) {
-        return 1;
-    }
-
-    // Initialize logging
-    FILE *log_fp = fopen(prj->worker_log_file, "a");
-    setvbuf(log_fp, NULL, _IOLBF, 0);
-    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "v2ci process started.");
-
-    // Initialize pid file path
-    char PID_FILE[256];
-    snprintf(PID_FILE, sizeof(PID_FILE), "/tmp/%s-worker.pid", prj->name);
-
-    // Check if another instance of the process is already running
-    FILE* pid_fp_check = fopen(PID_FILE, "r");
-    if (pid_fp_check) {
-        pid_t old_pid;
-        if (fscanf(pid_fp_check, "%d", &old_pid) == 1) {
-            if (kill(old_pid, 0) == 0) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "v2ci is already running with PID %d.", old_pid);
-                fclose(pid_fp_check);
-                return 1;
-            }
-        }
-        fclose(pid_fp_check);
-    }
-
-    // Set the pid file for the worker
-    FILE *pid_fp = fopen(PID_FILE, "w");
-    if (pid_fp) {
-        fprintf(pid_fp, "%d\n", getpid());
-        fclose(pid_fp);
-    } else {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Error: Unable to create PID file for project %s at %s", prj->name, PID_FILE);
-        fclose(log_fp);
-        return 1;
-    }
-
-    // Set up signal handler for graceful termination
-    signal(SIGTERM, sigterm_handler);
-
-    // Create necessary directories and files for the worker
-    int main_worker_build_dir_result = recursive_mkdir_or_file(prj->main_project_build_dir, 0755, 0);
-    if (main_worker_build_dir_result != 0) {
+// Prepares the directories of the project; called before its first cycle, and again until it succeeds
+int project_worker_init(worker_state_t *ws, FILE *log_fp) {
+    project_t *prj = ws->project;
+    if (recursive_mkdir_or_file(prj->main_project_build_dir, 0755, 0) != 0) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to create main project build directory at %s: %s", prj->main_project_build_dir, strerror(errno));
-        fclose(log_fp);
         return 1;
     }
-    int worker_target_dir_result = recursive_mkdir_or_file(prj->target_dir, 0755, 0);
-    if (worker_target_dir_result != 0) {
+    if (recursive_mkdir_or_file(prj->target_dir, 0755, 0) != 0) {
         formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to create target directory at %s: %s", prj->target_dir, strerror(errno));
-        fclose(log_fp);
         return 1;
     }
+    // The binaries are rotated by the supervisor (see rotation.c)
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Initial directories setup completed successfully for project %s.", prj->name);
+    ws->initialized = 1;
+    return 0;
+}
 
-    // Declare chroot dir (<main_build_dir>/<architecture>-chroot) and chroot build dir (/home/<prj->name>) strings
+// Checks for updates in the repositories selected by the build mode of the project; returns 0 (with need2update set) on success,
+// the seconds before the next cycle otherwise (0 to retry at once after a successful recovery, -1 if the termination flag was raised)
+static int check_project_updates(worker_state_t *ws, FILE **log_fp, int *need2update) {
+    project_t *prj = ws->project;
     char chroot_dir[MAX_CONFIG_ATTR_LEN];
     char chroot_build_dir[MAX_CONFIG_ATTR_LEN];
     char worker_tmp_chroot_log_file[MAX_CONFIG_ATTR_LEN+20];
+    // Use the first architecture for the check, it doesn't matter which one
+    snprintf(chroot_dir, sizeof(chroot_dir), "%s/%s-chroot", ws->main_build_dir, prj->architectures[0]);
+    snprintf(chroot_build_dir, sizeof(chroot_build_dir), "/home/%s", prj->name);
+    snprintf(worker_tmp_chroot_log_file, sizeof(worker_tmp_chroot_log_file), "%s/logs/worker.log", chroot_build_dir);
+
+    // The main repository first (main and full modes), then the manual dependencies (dep mode, or full mode without updates in the main repository)
+    const char *repo_urls[MAX_DEPENDENCIES + 1];
+    int repo_count = 0;
+    if (strcmp(prj->build_mode, "main") == 0 || strcmp(prj->build_mode, "full") == 0) {
+        repo_urls[repo_count++] = prj->repo_url;
+    }
+    int check_dependencies = strcmp(prj->build_mode, "dep") == 0 || strcmp(prj->build_mode, "full") == 0;
+    int main_repo_count = repo_count;
+    for (manual_dependency_t *cur_manual = prj->manual_dependencies; check_dependencies && cur_manual && repo_count < MAX_DEPENDENCIES + 1; cur_manual = cur_manual->next) {
+        repo_urls[repo_count++] = cur_manual->git_url;
+    }
 
-    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Initial directories setup completed successfully for project %s.", prj->name);
+    // Every selected repository is pulled, so that its HEAD can be compared with the sources of the latest build of each architecture
+    char repo_names[MAX_DEPENDENCIES + 1][MIN_CONFIG_ATTR_LEN];
+    char heads[MAX_DEPENDENCIES + 1][72];
+    int pulled_updates = 0;
+    for (int k = 0; k < repo_count; k++) {
+        char *repo_name = NULL;
+        if (extract_repo_name(repo_urls[k], &repo_name) != 0) {
+            formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to extract repository name from URL %s", repo_urls[k]);
+            return prj->poll_interval;
+        }
+        snprintf(repo_names[k], sizeof(repo_names[k]), "%s", repo_name);
+        free(repo_name);
+        int repo_updated = 0;
+        int check_result = check_for_updates_inside_chroot(chroot_dir, chroot_build_dir, repo_names[k], worker_tmp_chroot_log_file, *log_fp, &repo_updated, prj->name, prj->architectures[0], &ws->terminate_flag, &prj->timeouts);
+        if (ws->terminate_flag) {
+            formatted_log(*log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during the update check of %s, exiting...", repo_urls[k]);
+            return -1;
+        }
+        if (check_result != 0) {
+            formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to check for updates in %s; trying recover operations... ", repo_urls[k]);
+            if (handle_recovery(log_fp, ws) == 1) {
+                formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Recovery operations failed; will retry update check after poll interval.");
+                return prj->poll_interval;
+            }
+            return ws->terminate_flag ? -1 : 0;
+        }
+        if (repo_updated && k >= main_repo_count) {
+            formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Update detected in manual dependency %s.", repo_urls[k]);
+        }
+        pulled_updates |= repo_updated;
+        char repo_dir[MAX_CONFIG_ATTR_LEN * 2 + MIN_CONFIG_ATTR_LEN];
+        snprintf(repo_dir, sizeof(repo_dir), "%s%s/%s", chroot_dir, chroot_build_dir, repo_names[k]);
+        if (state_journal_read_head(repo_dir, heads[k], sizeof(heads[k])) != 0) {
+            heads[k][0] = '\0';    // Not cloned yet
+        }
+    }
 
-    // Set the final binaries rotation cronjob with crontab
-    if (set_binaries_rotation_cronjob(prj, log_fp) != 0) {
-        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to set the binaries rotation cronjob for project %s.", prj->name);
-        fclose(log_fp);
-        return 1;
+    // An architecture is built if its latest build (in the state journal) is not at these sources, or failed on them fewer than JOURNAL_MAX_ATTEMPTS
+    // times; without a journal entry (first build) the pull decides. A crash between the pull and the end of a build is thus not a lost update.
+    *need2update = 0;
+    for (int i = 0; i < prj->arch_count; i++) {
+        journal_entry_t entry;
+        int pending = pulled_updates;
+        if (state_journal_lookup(prj->name, prj->architectures[i], &entry) == 0) {
+            int same_sources = 1;
+            for (int k = 0; k < repo_count && same_sources; k++) {
+                same_sources = heads[k][0] && state_journal_has_source(&entry, repo_names[k], heads[k]);
+            }
+            // A build cancelled from the control socket is not retried at the same sources either, while one whose chroot session died
+            // (which says nothing about the sources) always is
+            pending = !same_sources || entry.status == THREAD_STATUS_SESSION_LOST ||
+                (entry.status != THREAD_STATUS_SUCCESS && entry.status != THREAD_STATUS_CANCELLED && entry.attempts < JOURNAL_MAX_ATTEMPTS);
+            if (!pending && pulled_updates) {
+                formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, prj->architectures[i], "Architecture %s was already built at these sources (status %d, %d attempts, %s); skipping it.",
+                    prj->architectures[i], entry.status, entry.attempts, entry.artifact[0] ? entry.artifact : "no artifact");
+            } else if (pending && !pulled_updates) {
+                formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, prj->architectures[i], "Architecture %s is not built at the current sources (state journal); resuming its build.", prj->architectures[i]);
+            }
+        }
+        if (ws->arch_forced[i] && !pending) {
+            formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, prj->architectures[i], "Build of architecture %s requested from the control socket.", prj->architectures[i]);
+            pending = 1;
+        }
+        ws->arch_pending[i] = pending;
+        *need2update |= pending;
     }
+    return 0;
+}
 
-    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Binaries rotation cronjob set successfully for project %s.", prj->name);
+// Records the outcome of a build thread in the state journal: the HEADs of its checkouts (those of the update check if it failed before
+// cloning) and the binary published by the build thread in <chroot build dir>/logs/artifact. Builds cancelled by a shutdown are not
+// recorded, so that they are resumed after the restart.
+static void record_build_outcome(worker_state_t *ws, const thread_arg_t *targ, int status, FILE *log_fp) {
+    project_t *prj = ws->project;
+    if (ws->terminate_flag) return;
+    journal_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    snprintf(entry.project, sizeof(entry.project), "%s", prj->name);
+    snprintf(entry.arch, sizeof(entry.arch), "%s", targ->arch);
+    entry.status = status;
+    if (state_journal_sources(prj, targ->thread_chroot_dir, entry.sources, sizeof(entry.sources)) != 0) {
+        char check_chroot_dir[MAX_CONFIG_ATTR_LEN];
+        snprintf(check_chroot_dir, sizeof(check_chroot_dir), "%s/%s-chroot", ws->main_build_dir, prj->architectures[0]);
+        state_journal_sources(prj, check_chroot_dir, entry.sources, sizeof(entry.sources));
+    }
+    if (status == THREAD_STATUS_SUCCESS) {
+        char artifact_file[MAX_CONFIG_ATTR_LEN * 2 + 16];
+        snprintf(artifact_file, sizeof(artifact_file), "%s%s/logs/artifact", targ->thread_chroot_dir, targ->thread_chroot_build_dir);
+        FILE *fp = fopen(artifact_file, "r");
+        if (fp) {
+            if (fgets(entry.artifact, sizeof(entry.artifact), fp)) entry.artifact[strcspn(entry.artifact, "\n")] = '\0';
+            fclose(fp);
+        }
+    }
+    if (state_journal_record(&entry, log_fp) == 0) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, targ->arch, "Build recorded in the state journal (status %d, attempt %d): %s", status, entry.attempts, entry.artifact[0] ? entry.artifact : "no artifact");
+    }
+}
 
-    // Main loop
-    while (1) {
-        if (terminate_worker_flag) {
-            formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received before starting operations, exiting...");
-            break;
+// Starts one build thread per architecture and waits for them, recovering after failed builds; returns the seconds before the next cycle
+// (0 to restart at once after a successful recovery, -1 if the termination flag was raised)
+static int run_build_threads(worker_state_t *ws, FILE **log_fp) {
+    project_t *prj = ws->project;
+    char *main_build_dir = ws->main_build_dir;
+
+    // Reap the threads abandoned in a previous cycle that ended meanwhile; the architectures of those still running are skipped
+    for (int k = 0; k < prj->arch_count; k++) {
+        if (!ws->abandoned_args[k]) continue;
+        void *late_return_value = NULL;
+        if (pthread_tryjoin_np(ws->abandoned_threads[k], &late_return_value) == 0) {
+            formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Abandoned build thread for architecture %s finally ended.", ws->abandoned_args[k]->arch);
+            free(late_return_value);
+            free(ws->abandoned_args[k]);
+            ws->abandoned_args[k] = NULL;
+            build_status_set(&ws->builds[k], BUILD_STATE_IDLE, "");
+        } else {
+            formatted_log(*log_fp, "WARNING", __FILE__, __LINE__, prj->name, NULL, "Build thread for architecture %s abandoned in a previous cycle is still running; skipping this architecture.", prj->architectures[k]);
+        }
+    }
+
+    // Otherwise, setup threads for each architecture
+    // Note: the arguments are allocated on the heap, since a thread that exceeds its time limit is left running after this cycle ends
+    pthread_t threads[prj->arch_count];
+    thread_arg_t *args[prj->arch_count];
+    int started[prj->arch_count];
+    int args_allocated = 1;
+    for (int i = 0; i < prj->arch_count; i++) {
+        started[i] = 0;
+        args[i] = calloc(1, sizeof(thread_arg_t));
+        if (!args[i]) {
+            args_allocated = 0;
+            continue;
+        }
+        args[i]->project = prj;
+        snprintf(args[i]->arch, sizeof(args[i]->arch), "%s", prj->architectures[i]);
+
+        snprintf(args[i]->thread_log_file, sizeof(args[i]->thread_log_file), "%s/logs/%s-worker.log", prj->main_project_build_dir, prj->architectures[i]);
+        snprintf(args[i]->thread_chroot_dir, sizeof(args[i]->thread_chroot_dir), "%s/%s-chroot", main_build_dir, prj->architectures[i]);
+        snprintf(args[i]->thread_chroot_build_dir, sizeof(args[i]->thread_chroot_build_dir), "/home/%s", prj->name);
+        snprintf(args[i]->thread_chroot_log_file, sizeof(args[i]->thread_chroot_log_file), "/home/%s/logs/worker.log", prj->name);
+        snprintf(args[i]->thread_chroot_target_dir, sizeof(args[i]->thread_chroot_target_dir), "/home/%s/binaries", prj->name);
+        snprintf(args[i]->thread_cross_mode, sizeof(args[i]->thread_cross_mode), "%s", prj->cross_mode);
+        snprintf(args[i]->thread_host_chroot_dir, sizeof(args[i]->thread_host_chroot_dir), "%s/amd64-chroot", main_build_dir);
+
+        // The publication writes the entry name of the binary and then its path here (see publish_artifact and record_build_outcome)
+        char artifact_file[MAX_CONFIG_ATTR_LEN * 2 + 16];
+        snprintf(artifact_file, sizeof(artifact_file), "%s%s/logs/artifact", args[i]->thread_chroot_dir, args[i]->thread_chroot_build_dir);
+        unlink(artifact_file);
+        snprintf(artifact_file, sizeof(artifact_file), "%s%s/logs/publication", args[i]->thread_chroot_dir, args[i]->thread_chroot_build_dir);
+        unlink(artifact_file);
+
+        // Each build has its own flag, raised with the others when the project stops (the flag of an abandoned thread is left alone)
+        if (!ws->abandoned_args[i]) ws->arch_cancel[i] = ws->terminate_flag;
+        args[i]->terminate_flag = &ws->arch_cancel[i];
+        args[i]->status = &ws->builds[i];
+    }
+    if (!args_allocated) {
+        formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to allocate the build thread arguments; retrying after poll interval.");
+        for (int k = 0; k < prj->arch_count; k++) free(args[k]);
+        return prj->poll_interval;
+    }
+
+    // For each architecture, start a build thread as soon as the host can take it (see pressure.c)
+    int i = 0;
+    int admitted = 0;
+    int started_count = 0;
+    int create_failed = 0;
+    while (i < prj->arch_count) {
+        if (ws->abandoned_args[i] || !ws->arch_pending[i]) {
+            i++;
+            continue;
         }
-        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Starting build operations...");
-
-        // Depending on build mode (main or dependency), perform the update check (obviously on the first iteration the check will return the need to clone all the repos)
-        int need2update = 0;
-        // Initialize chroot paths for the update_check (use the first architecture for the check, it doesn't matter which one)
-        snprintf(chroot_dir, sizeof(chroot_dir), "%s/%s-chroot", main_build_dir, prj->architectures[0]);
-        snprintf(chroot_build_dir, sizeof(chroot_build_dir), "/home/%s", prj->name);
-        snprintf(worker_tmp_chroot_log_file, sizeof(worker_tmp_chroot_log_file), "%s/logs/worker.log", chroot_build_dir);
-        
-        if (strcmp(prj->build_mode, "main") == 0 || strcmp(prj->build_mode, "full") == 0) {
-            // Check for updates in main repo
-            char *main_repo_name = NULL;
-            int extract_result = extract_repo_name(prj->repo_url, &main_repo_name);
-            if (extract_result != 0) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to extract repository name from URL %s", prj->repo_url);
-                sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
-                if (terminate_worker_flag) {
-                    formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during wait after error, exiting...");
+        if (!admitted) {
+            build_status_set(&ws->builds[i], BUILD_STATE_WAITING, "admission");
+            if (admit_build(&prj->admission, &ws->arch_cancel[i], &ws->admission_stats, args[i]->thread_jobs, sizeof(args[i]->thread_jobs), *log_fp, prj->name, args[i]->arch) != 0) {
+                build_status_set(&ws->builds[i], BUILD_STATE_IDLE, "");
+                if (ws->terminate_flag) {
+                    formatted_log(*log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received while waiting to start the build for architecture %s.", args[i]->arch);
                     break;
                 }
+                formatted_log(*log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Build for architecture %s cancelled while waiting to start.", args[i]->arch);
+                record_build_outcome(ws, args[i], THREAD_STATUS_CANCELLED, *log_fp);
+                i++;
                 continue;
             }
-            while (check_for_updates_inside_chroot(chroot_dir, chroot_build_dir, main_repo_name, worker_tmp_chroot_log_file, log_fp, &need2update, prj->name, prj->architectures[0]) != 0) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to check for updates in main repository; trying recover operations... ");
-                while (handle_recovery(&log_fp, prj, main_build_dir) == 1) {
-                    formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Recovery operations failed; will retry update check after poll interval.");
-                    sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
-                    if (terminate_worker_flag) {
-                        formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during wait after error, exiting...");
-                        break;
-                    }
-                }
-                if (terminate_worker_flag) {
-                    break;
-                }
-            }
-            if (terminate_worker_flag) {
-                formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during main repository update check, exiting...");
-                break;
-            }
-            free(main_repo_name);
+            admitted = 1;
         }
-        if (strcmp(prj->build_mode, "dep") == 0 || (strcmp(prj->build_mode, "full") == 0 && !need2update)) {
-            // For each manual dependency, check for updates
-            manual_dependency_t *cur_manual = prj->manual_dependencies;
-            while (cur_manual) {
-                char *dependency_repo_name = NULL;
-                int extract_result = extract_repo_name(cur_manual->git_url, &dependency_repo_name);
-                if (extract_result != 0) {
-                    formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to extract repository name from URL %s", cur_manual->git_url);
-                    sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
-                    if (terminate_worker_flag) {
-                        formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during wait after error, exiting...");
-                        break;
-                    }
-                    continue;
+        build_status_set(&ws->builds[i], BUILD_STATE_RUNNING, "install");
+        if (pthread_create(&threads[i], NULL, build_thread, args[i]) != 0) {
+            build_status_set(&ws->builds[i], BUILD_STATE_IDLE, "");
+            // The architectures left are built in the next cycle, which starts after the poll interval
+            formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to create thread for architecture %s: %s. Retrying after poll interval.", prj->architectures[i], strerror(errno));
+            create_failed = 1;
+            break;
+        }
+        formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Thread created successfully for architecture %s.", args[i]->arch);
+        started[i] = 1;
+        started_count++;
+        admitted = 0;
+        i++;
+    }
+
+    if (ws->terminate_flag) {
+        formatted_log(*log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received while starting the build threads: only %d out of %d threads were created. Joining launched threads...", started_count, prj->arch_count);
+    }
+
+    // Wait only for the threads that were successfully created, and at most until their time limit: the steps have their own watchdog,
+    // so a thread still running past the limit is stuck outside of them; it is abandoned and its architecture skipped until it ends
+    int time_limit = build_thread_time_limit(prj);
+    struct timespec join_deadline;
+    clock_gettime(CLOCK_REALTIME, &join_deadline);
+    join_deadline.tv_sec += time_limit;
+    int failed_builds = 0;
+    int timed_out_builds = 0;
+    for (int j = 0; j < i; j++) {
+        if (!started[j]) {
+            free(args[j]);
+            continue;
+        }
+        void *thread_return_value = NULL;
+        int successful_join = time_limit > 0 ? pthread_timedjoin_np(threads[j], &thread_return_value, &join_deadline) : pthread_join(threads[j], &thread_return_value);
+        if (successful_join == ETIMEDOUT) {
+            formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s did not finish within %d s; abandoning it (status %d).", args[j]->arch, time_limit, THREAD_STATUS_TIMEOUT);
+            ws->abandoned_threads[j] = threads[j];
+            ws->abandoned_args[j] = args[j];
+            failed_builds++;
+            timed_out_builds++;
+            continue;
+        }
+        build_status_set(&ws->builds[j], BUILD_STATE_IDLE, "");
+        if (successful_join != 0) {
+            formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to join thread for architecture %s: %s", args[j]->arch, strerror(successful_join));
+        } else {
+            if (thread_return_value != NULL) {
+                thread_result_t *thread_result = (thread_result_t *)thread_return_value;
+                // A build cancelled on its own (v2ci_ctl cancel) ended on purpose: it is neither a failure nor retried at the same sources
+                if (ws->arch_cancel[j] && !ws->terminate_flag && thread_result->status != THREAD_STATUS_SUCCESS) {
+                    thread_result->status = THREAD_STATUS_CANCELLED;
                 }
-                while (check_for_updates_inside_chroot(chroot_dir, chroot_build_dir, dependency_repo_name, worker_tmp_chroot_log_file, log_fp, &need2update, prj->name, prj->architectures[0]) != 0) {
-                    formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to check for updates in manual dependency %s; trying recover operations... ", cur_manual->git_url);
-                    while (handle_recovery(&log_fp, prj, main_build_dir) == 1) {
-                        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Recovery operations failed; will retry update check after poll interval.");
-                        sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
-                        if (terminate_worker_flag) {
-                            formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during wait after error, exiting...");
-                            break;
-                        }
-                    }
-                    if (terminate_worker_flag) {
-                        break;
+                record_resource_usage(prj, args[j], thread_result, *log_fp);
+                record_build_outcome(ws, args[j], thread_result->status, *log_fp);
+                if (thread_result->status == THREAD_STATUS_CANCELLED) {
+                    formatted_log(*log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Build for architecture %s cancelled from the control socket.", args[j]->arch);
+                } else if (thread_result->status == THREAD_STATUS_TIMEOUT) {
+                    formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s timed out (code %d): %s", args[j]->arch, thread_result->status, (thread_result->error_message ? thread_result->error_message : "Unknown step"));
+                    failed_builds++;
+                    timed_out_builds++;
+                } else if (thread_result->status == THREAD_STATUS_SESSION_LOST) {
+                    formatted_log(*log_fp, "WARNING", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s lost the persistent session of its chroot (code %d): %s; it will be built again at the next cycle.", args[j]->arch, thread_result->status, (thread_result->error_message ? thread_result->error_message : "Unknown step"));
+                } else if (thread_result->status == THREAD_STATUS_OOM) {
+                    formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s ran out of memory (code %d, %ld OOM kills in its cgroup): %s", args[j]->arch, thread_result->status, thread_result->usage.oom_kills, (thread_result->error_message ? thread_result->error_message : "Unknown step"));
+                    failed_builds++;
+                } else if (thread_result->status != THREAD_STATUS_SUCCESS) {
+                    formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s terminated with errors (code %d): %s", args[j]->arch, thread_result->status, (thread_result->error_message ? thread_result->error_message : "Unknown error"));
+                    failed_builds++;
+                } else {
+                    // Summary of the per-phase accounting (logged in full by record_resource_usage)
+                    long wall_ms = 0, cpu_ms = 0, max_rss_kb = 0;
+                    for (int k = 0; k < thread_result->usage.phase_count; k++) {
+                        const phase_usage_t *phase = &thread_result->usage.phases[k];
+                        wall_ms += phase->wall_ms;
+                        cpu_ms += phase->user_ms + phase->sys_ms;
+                        if (phase->max_rss_kb > max_rss_kb) max_rss_kb = phase->max_rss_kb;
                     }
+                    formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s terminated successfully: wall %.1f s, CPU %.1f s, max RSS %ld KB over %d phases.",
+                        args[j]->arch, wall_ms / 1000.0, cpu_ms / 1000.0, max_rss_kb, thread_result->usage.phase_count);
                 }
-                if (terminate_worker_flag) {
-                    break;
-                }
-                if (need2update) {
-                    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Update detected in manual dependency %s.", cur_manual->git_url);
-                    break;
-                }
-                cur_manual = cur_manual->next;
-                free(dependency_repo_name);
-            }
-            if (terminate_worker_flag) {
-                formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during manual dependency update checks, exiting...");
-                break;
+            } else {
+                formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s terminated without a specific return value.", args[j]->arch);
             }
         }
+        free(thread_return_value);
+        free(args[j]);
+    }
+    for (int j = i; j < prj->arch_count; j++) {
+        free(args[j]);
+    }
+    if (timed_out_builds > 0) {
+        formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "%d build threads of project %s timed out.", timed_out_builds, prj->name);
+    }
+    formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "All launched build threads (%d out of %d) joined successfully for project %s.", started_count, prj->arch_count, prj->name);
+    formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Admission since start: %ld started right away, %ld held back until the pressure dropped, %ld forced after max_wait, %ld with reduced -j, %ld s spent waiting, %ld without PSI.",
+        ws->admission_stats.admitted, ws->admission_stats.delayed, ws->admission_stats.forced, ws->admission_stats.throttled, ws->admission_stats.wait_s, ws->admission_stats.unavailable);
+    if (ws->terminate_flag) {
+        return -1;
+    }
+    if (create_failed) {
+        return prj->poll_interval;
+    }
 
-        // If no updates were found, sleep for the poll interval and restart the loop
-        if (!need2update) {
-            formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "No updates found for project %s. Sleeping for %d seconds.", prj->name, prj->poll_interval);
-            sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
-            continue;
+    // If there were failed builds, attempt recovery and restart the cycle at once
+    if (failed_builds > 0) {
+        formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "%d builds failed for project %s. Retrying with recovery...", failed_builds, prj->name);
+        if (handle_recovery(log_fp, ws) == 1) {
+            formatted_log(*log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Recovery operations failed; will retry update check after poll interval.");
+            return prj->poll_interval;
+        }
+        if (ws->terminate_flag) {
+            formatted_log(*log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during recovery handling after failed builds, exiting...");
+            return -1;
         }
+        formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Recovery operations completed successfully for project %s. Restarting builds...", prj->name);
+        return 0;
+    }
+    formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "All builds completed successfully for project %s.", prj->name);
+    formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Your final binaries (for the successful builds) are located in %s for each architecture.", prj->target_dir);
+    formatted_log(*log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Sleeping for %d seconds before the next check.", prj->poll_interval);
+    return prj->poll_interval;
+}
 
-        // Otherwise, setup threads for each architecture
-        pthread_t threads[prj->arch_count];
-        thread_arg_t args[prj->arch_count];
-        for (int i = 0; i < prj->arch_count; i++) {
-            args[i].project = prj;
-            snprintf(args[i].arch, sizeof(args[i].arch), "%s", prj->architectures[i]);
+// Runs one build cycle of the project: chroot health checks, update checks and, if something changed, one build thread per architecture
+// (with recovery after failures). Returns the seconds before the next cycle (0 to restart at once), -1 if the termination flag was raised
+int project_worker_cycle(worker_state_t *ws) {
+    project_t *prj = ws->project;
+    char *main_build_dir = ws->main_build_dir;
 
-            snprintf(args[i].thread_log_file, sizeof(args[i].thread_log_file), "%s/logs/%s-worker.log", prj->main_project_build_dir, prj->architectures[i]);
-            snprintf(args[i].thread_chroot_dir, sizeof(args[i].thread_chroot_dir), "%s/%s-chroot", main_build_dir, prj->architectures[i]);
-            snprintf(args[i].thread_chroot_build_dir, sizeof(args[i].thread_chroot_build_dir), "/home/%s", prj->name);
-            snprintf(args[i].thread_chroot_log_file, sizeof(args[i].thread_chroot_log_file), "/home/%s/logs/worker.log", prj->name);
-            snprintf(args[i].thread_chroot_target_dir, sizeof(args[i].thread_chroot_target_dir), "/home/%s/binaries", prj->name);
+    // The log file is only open while the project is active, so that idle projects cost no file handle
+    if (recursive_mkdir_or_file(prj->worker_log_file, 0755, 1) != 0) {
+        return prj->poll_interval;
+    }
+    FILE *log_fp = fopen(prj->worker_log_file, "a");
+    if (!log_fp) {
+        return prj->poll_interval;
+    }
+    setvbuf(log_fp, NULL, _IOLBF, 0);
+    int next_cycle_s = prj->poll_interval;
 
-            args[i].terminate_flag = &terminate_worker_flag;
-        }
+    if (!ws->initialized && project_worker_init(ws, log_fp) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Initialization of project %s failed; retrying after poll interval.", prj->name);
+        goto out;
+    }
+    if (ws->terminate_flag) {
+        formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received before starting operations, exiting...");
+        next_cycle_s = -1;
+        goto out;
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Starting build operations...");
+    ws->cycle_step = WORKER_STEP_HEALTH_CHECK;
 
-        // For each architecture, start a build thread
-        int i = 0;
-        while (i < prj->arch_count) {
-            if (pthread_create(&threads[i], NULL, build_thread, &args[i]) != 0) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to create thread for architecture %s: %s. Retrying after poll interval.", prj->architectures[i], strerror(errno));
-                sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
-                if (terminate_worker_flag) {
-                    formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during wait after error, exiting...");
-                    break;
-                }
-                continue;
-            } else {
-                formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Thread created successfully for architecture %s.", args[i].arch);
-                i++;
-            }
+    // Check the chroots of the project before using them (repairing damaged ones), instead of discovering a half-broken rootfs from a failed build
+    char chroot_dir[MAX_CONFIG_ATTR_LEN];
+    int unhealthy_chroots = 0;
+    for (int i = 0; i < prj->arch_count + 1 && !ws->terminate_flag; i++) {
+        // The extra iteration covers the amd64 chroot used as build root by the native cross mode
+        const char *health_arch = (i < prj->arch_count) ? prj->architectures[i] : "amd64";
+        if (i == prj->arch_count && strcmp(prj->cross_mode, "native") != 0) break;
+        snprintf(chroot_dir, sizeof(chroot_dir), "%s/%s-chroot", main_build_dir, health_arch);
+        if (chroot_health_ensure(health_arch, chroot_dir, prj->worker_log_file, log_fp, prj->name) != 0) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, health_arch, "Chroot at %s is unhealthy and could not be repaired.", chroot_dir);
+            unhealthy_chroots++;
         }
+    }
+    if (ws->terminate_flag) {
+        formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during chroot health checks, exiting...");
+        next_cycle_s = -1;
+        goto out;
+    }
+    if (unhealthy_chroots > 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "%d chroots unhealthy; retrying after poll interval.", unhealthy_chroots);
+        goto out;
+    }
 
-        if (terminate_worker_flag) {
-            formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during thread creation retry (after failure): only %d out of %d threads were created. Joining launched threads...", i, prj->arch_count);
-        }
+    // Depending on build mode (main or dependency), perform the update check (obviously on the first iteration the check will return the need to clone all the repos)
+    int need2update = 0;
+    ws->cycle_step = WORKER_STEP_UPDATE_CHECK;
+    int check_result = check_project_updates(ws, &log_fp, &need2update);
+    if (check_result != 0) {
+        next_cycle_s = check_result;
+        goto out;
+    }
 
-        // Wait only for the threads that were successfully created
-        int failed_builds = 0;
-        for (int j = 0; j < i; j++) {
-            void *thread_return_value = NULL;
-            int successful_join = pthread_join(threads[j], &thread_return_value);
-            if (successful_join != 0) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Failed to join thread for architecture %s: %s", args[j].arch, strerror(errno));
-            } else {
-                if (thread_return_value != NULL) {
-                    thread_result_t *thread_result = (thread_result_t *)thread_return_value;
-                    if (thread_result->status != 0) {
-                        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s terminated with errors (code %d): %s", args[j].arch, thread_result->status, (thread_result->error_message ? thread_result->error_message : "Unknown error"));
-                        failed_builds++;
-                    } else {
-                        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s terminated successfully. Here the stats: %s", args[j].arch, (thread_result->stats ? thread_result->stats : "No stats available"));
-                    }
-                } else {
-                    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Thread for architecture %s terminated without a specific return value.", args[j].arch);
-                }
-            }
-            free(thread_return_value);
+    // If no updates were found, wait for the poll interval
+    if (!need2update) {
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "No updates found for project %s. Sleeping for %d seconds.", prj->name, prj->poll_interval);
+        goto out;
+    }
+
+    ws->cycle_step = WORKER_STEP_BUILDS;
+    next_cycle_s = run_build_threads(ws, &log_fp);
+
+out:
+    ws->cycle_step = WORKER_STEP_IDLE;
+    if (log_fp) fclose(log_fp);
+    return next_cycle_s;
+}
+
+// Raises the termination flag of the project, seen by its cycle, its build threads and their steps (which are cancelled at once, see step_executor.c)
+void project_worker_request_stop(worker_state_t *ws) {
+    if (!ws->terminate_flag) {
+        clock_gettime(CLOCK_MONOTONIC, &ws->terminate_received_at);
+    }
+    ws->terminate_flag = 1;
+    for (int k = 0; k < MAX_ARCHITECTURES; k++) {
+        ws->arch_cancel[k] = 1;
+    }
+}
+
+// Cancels the running (or held back) build of one architecture, or of all of them if arch is NULL, leaving the rest of the cycle alone;
+// returns the number of builds cancelled
+int project_worker_cancel_build(worker_state_t *ws, const char *arch) {
+    int cancelled = 0;
+    for (int k = 0; k < ws->project->arch_count; k++) {
+        if (arch && strcmp(ws->project->architectures[k], arch) != 0) continue;
+        pthread_mutex_lock(&ws->builds[k].lock);
+        int busy = ws->builds[k].state != BUILD_STATE_IDLE;
+        pthread_mutex_unlock(&ws->builds[k].lock);
+        if (busy && !ws->arch_cancel[k]) {
+            ws->arch_cancel[k] = 1;
+            cancelled++;
         }
-        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "All launched build threads (%d out of %d) joined successfully for project %s.", i, prj->arch_count, prj->name);
-
-        // If there were failed builds, attempt recovery and retry
-        if (failed_builds > 0) {
-            formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "%d builds failed for project %s. Retrying with recovery...", failed_builds, prj->name);
-            while (handle_recovery(&log_fp, prj, main_build_dir) == 1) {
-                formatted_log(log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Recovery operations failed; will retry update check after poll interval.");
-                sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
-                if (terminate_worker_flag) {
-                    formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during wait after error, exiting...");
-                    break;
-                }
-            }
-            if (terminate_worker_flag) {
-                formatted_log(log_fp, "INTERRUPT", __FILE__, __LINE__, prj->name, NULL, "Termination signal received during recovery handling after failed builds, exiting...");
-                break;
-            }
-            formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Recovery operations completed successfully for project %s. Restarting builds...", prj->name);
-            continue;
+    }
+    return cancelled;
+}
+
+// Reaps the abandoned build threads that ended; returns the number of those still running (which still use the project)
+int project_worker_reap_abandoned(worker_state_t *ws) {
+    int running = 0;
+    for (int k = 0; k < MAX_ARCHITECTURES; k++) {
+        if (!ws->abandoned_args[k]) continue;
+        void *late_return_value = NULL;
+        if (pthread_tryjoin_np(ws->abandoned_threads[k], &late_return_value) == 0) {
+            free(late_return_value);
+            free(ws->abandoned_args[k]);
+            ws->abandoned_args[k] = NULL;
+            build_status_set(&ws->builds[k], BUILD_STATE_IDLE, "");
         } else {
-            formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "All builds completed successfully for project %s.", prj->name);
+            running++;
         }
-        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Your final binaries (for the successful builds) are located in %s for each architecture.", prj->target_dir);
+    }
+    return running;
+}
+
+// Called once the last cycle of the project has ended (at shutdown, or when the project is removed from the configuration): waits for its
+// abandoned build threads and frees the project; returns the number of threads still running (which keep the project and the worker state)
+int project_worker_shutdown(worker_state_t *ws) {
+    project_t *prj = ws->project;
+    FILE *log_fp = fopen(prj->worker_log_file, "a");
+    if (log_fp) {
+        setvbuf(log_fp, NULL, _IOLBF, 0);
+    } else {
+        log_fp = stderr;
+    }
 
-        // Sleep for the poll interval before the next iteration
-        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Sleeping for %d seconds before the next check.", prj->poll_interval);
-        sleep_and_handle_interrupts(prj->poll_interval, log_fp, prj->name);
+    // The abandoned threads see the termination flag too: give their steps the time to be cancelled before the project is released
+    struct timespec abandoned_deadline;
+    clock_gettime(CLOCK_REALTIME, &abandoned_deadline);
+    abandoned_deadline.tv_sec += STEP_CANCEL_GRACE_MS / 1000 + 5;
+    int still_running = 0;
+    for (int k = 0; k < MAX_ARCHITECTURES; k++) {
+        if (!ws->abandoned_args[k]) continue;
+        void *late_return_value = NULL;
+        if (pthread_timedjoin_np(ws->abandoned_threads[k], &late_return_value, &abandoned_deadline) == 0) {
+            free(late_return_value);
+            free(ws->abandoned_args[k]);
+            ws->abandoned_args[k] = NULL;
+        } else {
+            formatted_log(log_fp, "WARNING", __FILE__, __LINE__, prj->name, NULL, "Abandoned build thread for architecture %s is still running.", ws->abandoned_args[k]->arch);
+            still_running++;
+        }
+    }
+    if (ws->terminate_flag) {
+        // Running steps are cancelled as soon as the flag is raised (see step_executor.c), so this is the time left to a user waiting on v2ci_stop
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long shutdown_ms = (now.tv_sec - ws->terminate_received_at.tv_sec) * 1000L + (now.tv_nsec - ws->terminate_received_at.tv_nsec) / 1000000L;
+        formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Shutdown completed %ld ms after the termination signal.", shutdown_ms);
     }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "v2ci worker for project %s exiting.", prj->name);
+    if (log_fp != stderr) fclose(log_fp);
 
-    // Cleanup
-    remove(PID_FILE);
-    // Free the project structure and its manual dependencies (allocated in load_config)
-    manual_dependency_t *cur_manual = prj->manual_dependencies;
-    while (cur_manual) {
-        manual_dependency_t *next_manual = cur_manual->next;
-        free(cur_manual);
-        cur_manual = next_manual;
+    // The project (allocated in load_config) is left to the threads still running, if any
+    if (still_running == 0) {
+        free_project(prj);
     }
-    formatted_log(log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "v2ci process for project %s exiting.", prj->name);
-    fclose(log_fp);
-    free(prj);
-    return 0;
-}
\ No newline at end of file
+    ws->project = NULL;
+    return still_running;
+}
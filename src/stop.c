@@ -4,84 +4,67 @@
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 #include "init/load_config.h"
+#include "chroot/session.h"
+
+#define STOP_WAIT_S 60      // Cancellation grace of the running steps and of the abandoned build threads, with some margin
 
 int main() {
-    // 0. Try to kil the main process if it still exists (/tmp/rootless_v2ci.pid)
+    // 0. Stop the supervisor (/tmp/rootless_v2ci.pid), which drives all the projects and cancels their running steps
     const char *MAIN_PID_FILE = "/tmp/rootless_v2ci.pid";
-    if (access(MAIN_PID_FILE, F_OK) == 0) {
-        FILE *fp = fopen(MAIN_PID_FILE, "r");
-        if (fp) {
-            pid_t main_pid;
-            if (fscanf(fp, "%d", &main_pid) == 1) {
-                if (kill(main_pid, SIGTERM) == 0) {
-                    printf("Sent termination signal to main v2ci process (PID: %d).\n", main_pid);
-                } else {
-                    fprintf(stderr, "Failed to stop main v2ci process (PID: %d). Error: %s\n", main_pid, strerror(errno));
-                }
-            }
-            fclose(fp);
-        }
+    pid_t main_pid = -1;
+    FILE *fp = fopen(MAIN_PID_FILE, "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &main_pid) != 1) main_pid = -1;
+        fclose(fp);
+    }
+    if (main_pid > 0 && kill(main_pid, SIGTERM) == 0) {
+        printf("Sent termination signal to the v2ci supervisor (PID: %d).\n", main_pid);
+    } else if (main_pid > 0) {
+        fprintf(stderr, "Failed to stop the v2ci supervisor (PID: %d). Error: %s\n", main_pid, strerror(errno));
+        main_pid = -1;
+    } else {
+        printf("No v2ci supervisor is running.\n");
     }
 
-    // 1. Load the config file variables (in order to build the projects' pid files paths)
+    // 1. Load the config file variables (in order to find the chroots of the projects)
     Config cfg;
     if(load_config(&cfg) != 0) {
         fprintf(stderr, "Failed to load configuration variables during stop process. Exiting.\n");
         return 1;
     }
 
-    // 2. Iterate over all projects and send SIGTERM to their worker processes (if running)
-    project_t *current = cfg.projects;
-    int stopped_projects = 0;
-    for (int i = 0; i < cfg.project_count; i++) {
-        if (!current) {
-            break;
+    // 2. Wait for the supervisor to exit, so that the steps running in the persistent sessions are cancelled before the sessions go away
+    if (main_pid > 0) {
+        int waited_ms = 0;
+        while (kill(main_pid, 0) == 0 && waited_ms < STOP_WAIT_S * 1000) {
+            struct timespec pause = { 0, 100000000L };
+            nanosleep(&pause, NULL);
+            waited_ms += 100;
         }
-
-        // 3. Check if the PID file exists
-        char PID_FILE[256];
-        snprintf(PID_FILE, sizeof(PID_FILE), "/tmp/%s-worker.pid", current->name);
-        if (access(PID_FILE, F_OK) == 0) {
-            // 4. Read the PID from the file
-            FILE *fp = fopen(PID_FILE, "r");
-            if (fp) {
-                pid_t pid;
-                if (fscanf(fp, "%d", &pid) == 1) {
-                    // 5. Send SIGTERM to the process
-                    if (kill(pid, SIGTERM) == 0) {
-                        stopped_projects++;
-                        printf("Sent termination signal to project %s (PID: %d).\n", current->name, pid);
-                    } else {
-                        fprintf(stderr, "Failed to stop project %s (PID: %d). Error: %s\n", current->name, pid, strerror(errno));
-                    }
-                }
-                fclose(fp);
-            }
+        if (kill(main_pid, 0) == 0) {
+            fprintf(stderr, "The v2ci supervisor (PID: %d) is still running after %d s.\n", main_pid, STOP_WAIT_S);
+        } else {
+            printf("The v2ci supervisor stopped in %.1f s.\n", waited_ms / 1000.0);
         }
-        current = current->next;
-    }
-
-    // 6. Print the summary
-    if (stopped_projects > 0) {
-        printf("Successfully stopped %d project(s).\n", stopped_projects);
-    } else {
-        printf("No projects were stopped.\n");
     }
 
-    // 7. Free allocated memory for projects (for each project, free its manual dependencies and the project itself)
-    current = cfg.projects;
+    // 3. Stop the persistent namespace sessions of all the chroots used by the projects (if any is alive)
+    project_t *current = cfg.projects;
     while (current) {
-        manual_dependency_t *cur_manual = current->manual_dependencies;
-        while (cur_manual) {
-            manual_dependency_t *next_manual = cur_manual->next;
-            free(cur_manual);
-            cur_manual = next_manual;
+        for (int i = 0; i < current->arch_count; i++) {
+            char chroot_dir[MAX_CONFIG_ATTR_LEN + 32];
+            snprintf(chroot_dir, sizeof(chroot_dir), "%s/%s-chroot", cfg.build_dir, current->architectures[i]);
+            if (session_is_alive(chroot_dir)) {
+                session_stop(chroot_dir, stdout, current->architectures[i]);
+            }
         }
-        project_t *next_project = current->next;
-        free(current);
-        current = next_project;
+        current = current->next;
     }
 
+    // 4. Free allocated memory for projects
+    free_config_projects(&cfg);
+
     return 0;
 }
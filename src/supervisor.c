@@ -0,0 +1,1569 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include "supervisor.h"
+#include "project_worker.h"
+#include "chroot/session.h"
+#include "init/load_config.h"
+#include "utils/scripts_runner.h"
+#include "utils/utils.h"
+#include "utils/state_journal.h"
+#include "utils/phase_history.h"
+#include "control/control.h"
+#include "store/rotation.h"
+#include "server/artifact_server.h"
+
+/*
+    Supervisor.
+    A single process drives all the projects from one epoll loop, instead of a forked worker per project that sleeps between its cycles:
+    - the next cycle of every idle project is a deadline in a min-heap, and one timerfd is armed on the earliest one, so idle projects
+      cost a heap entry and no thread, process, timer or file handle, whatever their number;
+    - a due project runs one cycle (update checks, builds, recovery; see project_worker_cycle) in a thread of its own, at most
+      max_active_projects at a time (the others wait in FIFO order); the thread reports its end through an eventfd and the loop
+      schedules the next cycle;
+    - SIGTERM and SIGHUP are blocked and read from a signalfd, so they are handled at once even while every project is idle: SIGTERM
+      raises the termination flag of every project (cancelling the running steps) and waits for the running cycles, SIGHUP reloads the
+      configuration (see reload_config);
+    - the persistent session servers are watched through their pidfds: a dead server is reaped (unless it was left by a crashed supervisor,
+      in which case the guardian in main.c reaps it) and restarted, unless it died within SESSION_RESTART_MIN_UPTIME_S of its start, in
+      which case the steps keep falling back to a fresh _enter.
+    - a configuration reload is diffed against the running projects by name: removed projects are stopped (their running cycle is
+      cancelled), added and changed ones get their new configuration once they are idle (a running cycle ends with the old one), and the
+      others are left alone. The chroots of architectures not seen before are bootstrapped by background threads, which report their end
+      through the same eventfd; the projects that need them wait for them (changed ones keep running with their old configuration).
+    - the control socket (see control.c) is served by the loop too, on non-blocking connections (at most SUPERVISOR_CONTROL_CONNECTIONS,
+      each closed if its peer stalls for CONTROL_IO_TIMEOUT_MS): v2ci_ctl reads the live state of the projects and of their builds
+      (handle_status) and pauses, resumes, triggers or cancels them, or drains the supervisor (no new cycle starts until resumed).
+      The requests that read the disk, rotate --dry-run (the artifact index of every project) and report (the phase duration histories
+      the workers keep, see phase_history.c), run in a helper thread on a copy of what they need, and hand their JSON back through the
+      same eventfd; the connection is answered from the loop.
+    - the binaries of the target dirs are rotated every day at local midnight by a second timerfd (on the wall clock), in a thread that
+      rotates the projects one after another (see rotation.c) and reports its end through the same eventfd; v2ci_ctl rotate starts it
+      at once, or prints the plan without executing it (--dry-run).
+    - the artifact server (see artifact_server.c), if configured, serves the target dirs over HTTP from a thread and an epoll loop of its
+      own; the loop only hands it the projects, at start and after each reload.
+    The process is restarted by its guardian (see main.c) if it crashes; what was already built is remembered in the state journal.
+    The steps themselves are still waited for by the build threads (see step_executor.c), never by the loop.
+*/
+
+#define SUPERVISOR_MAX_EVENTS 32
+#define SESSION_RESTART_MIN_UPTIME_S 60
+#define SUPERVISOR_CONTROL_CONNECTIONS 16   // Further control connections are refused until one ends
+
+// Tags of the epoll events (the sessions are SUPERVISOR_TAG_SESSION + their index)
+#define SUPERVISOR_TAG_TIMER 1
+#define SUPERVISOR_TAG_SIGNAL 2
+#define SUPERVISOR_TAG_CYCLE_DONE 3
+#define SUPERVISOR_TAG_CONTROL 4
+#define SUPERVISOR_TAG_ROTATION 5
+#define SUPERVISOR_TAG_SESSION 16
+#define SUPERVISOR_TAG_CONTROL_CONN 256     // + the index of the connection
+
+typedef struct project_slot {
+    worker_state_t worker;                  // worker.project is NULL until the first configuration of the project is applied
+    struct timespec deadline;               // Start of the next cycle (CLOCK_MONOTONIC)
+    int heap_index;                         // Position in the deadline heap, -1 if not waiting for a deadline
+    int queued;                             // In the ready queue
+    int active;                             // A cycle is running
+    int removed;                            // Removed from the configuration: released as soon as its cycle ends
+    int paused;                             // Not scheduled again once its running cycle ends (v2ci_ctl pause)
+    int triggered;                          // A cycle was requested while one was running: the next one starts at once
+    unsigned int forced_archs;              // Architectures (bits by index) to build in the next cycle whatever the state journal says
+    time_t cycle_started_at;
+    int next_cycle_s;                       // Returned by its last cycle
+    project_t *pending_project;             // New configuration, applied when the project is idle and its chroots are ready
+    struct project_slot *next_ready;        // Queue of the projects due while all the slots were busy
+    struct project_slot *next_done;         // List of the cycles that ended and were not handled yet
+    struct supervisor *supervisor;
+} project_slot_t;
+
+typedef struct session_watch {
+    char chroot_dir[MAX_CONFIG_ATTR_LEN + 32];
+    char arch[MIN_CONFIG_ATTR_LEN];
+    pid_t pid;
+    int pidfd;                              // -1 if the server is not watched (not started, or not restarted)
+    time_t started_at;
+} session_watch_t;
+
+#define ARCH_BOOTSTRAPPING 0
+#define ARCH_READY 1
+#define ARCH_FAILED 2
+
+// Chroot of an architecture used by the projects
+typedef struct chroot_state {
+    char arch[MIN_CONFIG_ATTR_LEN];
+    int state;                              // One of ARCH_*
+    int session_started;                    // Set by the bootstrap thread if it started a persistent session
+    struct chroot_state *next_done;         // List of the bootstraps that ended and were not handled yet
+    struct supervisor *supervisor;
+} chroot_state_t;
+
+// Target dir of a project to rotate (copied from its configuration, which a reload may free while the rotation runs)
+typedef struct rotation_job {
+    char project[64];
+    char target_dir[CONFIG_ATTR_LEN];
+    char log_file[MAX_CONFIG_ATTR_LEN];
+    binaries_limits_for_project_t limits;
+} rotation_job_t;
+
+#define CONTROL_CONN_FREE 0
+#define CONTROL_CONN_READING 1
+#define CONTROL_CONN_WORKING 2              // A helper thread computes the response (the socket is not watched meanwhile)
+#define CONTROL_CONN_WRITING 3
+
+// A connection of the control socket
+typedef struct control_conn {
+    int state;                              // One of CONTROL_CONN_*
+    int fd;
+    char request[CONTROL_REQUEST_LEN];
+    size_t request_len;
+    json_buf_t response;
+    size_t sent;
+    struct timespec deadline;               // Of the read of the request, then of the write of the response (CLOCK_MONOTONIC)
+} control_conn_t;
+
+// A request answered by a helper thread: rotate --dry-run, or report
+typedef struct control_job {
+    int conn;                               // Index of the connection to answer
+    int report;                             // report (otherwise rotate --dry-run)
+    int limit;                              // Of the report
+    int rotating;                           // For the dry run: a rotation was running when it was requested
+    rotation_job_t *targets;                // Of the dry run
+    project_t *projects;                    // Of the report: copies, of which only the inline fields are read (a reload may free the originals)
+    int count;
+    json_buf_t out;
+    struct control_job *next_done;
+    struct supervisor *supervisor;
+} control_job_t;
+
+typedef struct supervisor {
+    int epoll_fd;
+    int timer_fd;
+    int rotation_fd;
+    int signal_fd;
+    int cycle_done_fd;
+    int control_fd;
+    FILE *log_fp;
+    int max_active;
+    int active;
+    int stopping;
+    int draining;                           // No new cycle starts (v2ci_ctl drain) until v2ci_ctl resume
+    time_t started_at;
+    char build_dir[MIN_CONFIG_ATTR_LEN];
+    char main_log_file[CONFIG_ATTR_LEN];
+    int persistent_sessions;
+
+    project_slot_t **slots;
+    int slot_count;
+    int slot_capacity;
+    project_slot_t **heap;                  // Same capacity as slots
+    int heap_size;
+    project_slot_t *ready_head;
+    project_slot_t *ready_tail;
+
+    pthread_mutex_t done_lock;
+    project_slot_t *done_list;
+    chroot_state_t *bootstrap_done_list;
+
+    chroot_state_t *chroots[MAX_ARCHITECTURES * 2];
+    int chroot_count;
+    int bootstrapping;
+
+    session_watch_t sessions[MAX_ARCHITECTURES * 2];
+    int session_count;
+
+    int rotating;                           // A rotation thread is running
+    int rotation_finished;                  // Set by the rotation thread (under done_lock) when it ends
+    volatile sig_atomic_t rotation_cancel;  // Raised at shutdown: the projects not rotated yet are skipped
+    rotation_job_t *rotation_jobs;
+    int rotation_job_count;
+
+    control_conn_t control_conns[SUPERVISOR_CONTROL_CONNECTIONS];
+    int control_jobs;                       // Helper threads running
+    control_job_t *control_done_list;       // Under done_lock
+
+    artifact_server_t *artifact_server;     // NULL if not configured (or not started)
+    char artifact_server_address[MIN_CONFIG_ATTR_LEN];
+} supervisor_t;
+
+static int deadline_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void heap_swap(supervisor_t *sup, int i, int j) {
+    project_slot_t *tmp = sup->heap[i];
+    sup->heap[i] = sup->heap[j];
+    sup->heap[j] = tmp;
+    sup->heap[i]->heap_index = i;
+    sup->heap[j]->heap_index = j;
+}
+
+static void heap_sift_up(supervisor_t *sup, int i) {
+    while (i > 0 && deadline_before(&sup->heap[i]->deadline, &sup->heap[(i - 1) / 2]->deadline)) {
+        heap_swap(sup, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_sift_down(supervisor_t *sup, int i) {
+    while (1) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < sup->heap_size && deadline_before(&sup->heap[left]->deadline, &sup->heap[smallest]->deadline)) smallest = left;
+        if (right < sup->heap_size && deadline_before(&sup->heap[right]->deadline, &sup->heap[smallest]->deadline)) smallest = right;
+        if (smallest == i) return;
+        heap_swap(sup, i, smallest);
+        i = smallest;
+    }
+}
+
+static void heap_push(supervisor_t *sup, project_slot_t *slot) {
+    slot->heap_index = sup->heap_size;
+    sup->heap[sup->heap_size++] = slot;
+    heap_sift_up(sup, slot->heap_index);
+}
+
+static project_slot_t *heap_pop(supervisor_t *sup) {
+    project_slot_t *top = sup->heap[0];
+    sup->heap_size--;
+    if (sup->heap_size > 0) {
+        sup->heap[0] = sup->heap[sup->heap_size];
+        sup->heap[0]->heap_index = 0;
+        heap_sift_down(sup, 0);
+    }
+    top->heap_index = -1;
+    return top;
+}
+
+static void heap_remove(supervisor_t *sup, project_slot_t *slot) {
+    int i = slot->heap_index;
+    sup->heap_size--;
+    if (i != sup->heap_size) {
+        sup->heap[i] = sup->heap[sup->heap_size];
+        sup->heap[i]->heap_index = i;
+        heap_sift_down(sup, i);
+        heap_sift_up(sup, sup->heap[i]->heap_index);
+    }
+    slot->heap_index = -1;
+}
+
+// Takes an idle project out of the heap or of the ready queue
+static void unschedule(supervisor_t *sup, project_slot_t *slot) {
+    if (slot->heap_index >= 0) {
+        heap_remove(sup, slot);
+    }
+    if (slot->queued) {
+        project_slot_t **link = &sup->ready_head;
+        sup->ready_tail = NULL;
+        while (*link) {
+            if (*link == slot) {
+                *link = slot->next_ready;
+            } else {
+                sup->ready_tail = *link;
+                link = &(*link)->next_ready;
+            }
+        }
+        slot->next_ready = NULL;
+        slot->queued = 0;
+    }
+}
+
+// Arms the timer on the earliest deadline (or disarms it when no project is waiting for one)
+static void arm_timer(supervisor_t *sup) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (sup->heap_size > 0 && !sup->stopping) {
+        spec.it_value = sup->heap[0]->deadline;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(sup->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void schedule(supervisor_t *sup, project_slot_t *slot, int delay_s) {
+    clock_gettime(CLOCK_MONOTONIC, &slot->deadline);
+    slot->deadline.tv_sec += delay_s > 0 ? delay_s : 0;
+    heap_push(sup, slot);
+}
+
+static void *cycle_thread(void *arg) {
+    project_slot_t *slot = (project_slot_t *)arg;
+    supervisor_t *sup = slot->supervisor;
+    slot->next_cycle_s = project_worker_cycle(&slot->worker);
+
+    pthread_mutex_lock(&sup->done_lock);
+    slot->next_done = sup->done_list;
+    sup->done_list = slot;
+    pthread_mutex_unlock(&sup->done_lock);
+    // An eventfd write of 1 only fails if the counter overflows, which one write per cycle cannot do
+    uint64_t one = 1;
+    ssize_t written = write(sup->cycle_done_fd, &one, sizeof(one));
+    (void)written;
+    return NULL;
+}
+
+// Starts the cycles of the due projects while there are free slots
+static void start_ready_cycles(supervisor_t *sup) {
+    while (sup->ready_head && !sup->stopping && !sup->draining && (sup->max_active <= 0 || sup->active < sup->max_active)) {
+        project_slot_t *slot = sup->ready_head;
+        sup->ready_head = slot->next_ready;
+        if (!sup->ready_head) sup->ready_tail = NULL;
+        slot->next_ready = NULL;
+        slot->queued = 0;
+        for (int i = 0; i < MAX_ARCHITECTURES; i++) {
+            slot->worker.arch_forced[i] = (slot->forced_archs >> i) & 1;
+        }
+        slot->forced_archs = 0;
+        slot->triggered = 0;
+        slot->cycle_started_at = time(NULL);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        int err = pthread_create(&thread, &attr, cycle_thread, slot);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, slot->worker.project->name, NULL, "Unable to start a cycle of project %s: %s; retrying after its poll interval.", slot->worker.project->name, strerror(err));
+            schedule(sup, slot, slot->worker.project->poll_interval);
+            continue;
+        }
+        slot->active = 1;
+        sup->active++;
+    }
+}
+
+// Moves the projects whose deadline passed to the ready queue
+static void enqueue_due_projects(supervisor_t *sup) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (sup->heap_size > 0 && !deadline_before(&now, &sup->heap[0]->deadline)) {
+        project_slot_t *slot = heap_pop(sup);
+        slot->queued = 1;
+        if (sup->ready_tail) sup->ready_tail->next_ready = slot;
+        else sup->ready_head = slot;
+        sup->ready_tail = slot;
+    }
+}
+
+static chroot_state_t *find_chroot(supervisor_t *sup, const char *arch) {
+    for (int i = 0; i < sup->chroot_count; i++) {
+        if (strcmp(sup->chroots[i]->arch, arch) == 0) return sup->chroots[i];
+    }
+    return NULL;
+}
+
+static void *bootstrap_thread(void *arg) {
+    chroot_state_t *chroot = (chroot_state_t *)arg;
+    supervisor_t *sup = chroot->supervisor;
+    char chroot_dir[MAX_CONFIG_ATTR_LEN + 32];
+    snprintf(chroot_dir, sizeof(chroot_dir), "%s/%s-chroot", sup->build_dir, chroot->arch);
+    int result = chroot_setup(chroot->arch, chroot_dir, sup->main_log_file, sup->log_fp);
+    if (result == 0 && sup->persistent_sessions) {
+        chroot->session_started = session_start(chroot_dir, sup->log_fp, chroot->arch) == 0;
+    }
+
+    pthread_mutex_lock(&sup->done_lock);
+    chroot->state = result == 0 ? ARCH_READY : ARCH_FAILED;
+    chroot->next_done = sup->bootstrap_done_list;
+    sup->bootstrap_done_list = chroot;
+    pthread_mutex_unlock(&sup->done_lock);
+    uint64_t one = 1;
+    ssize_t written = write(sup->cycle_done_fd, &one, sizeof(one));
+    (void)written;
+    return NULL;
+}
+
+// Returns the state of the chroot of an architecture, bootstrapping it in the background if it was never seen (an existing chroot is
+// ready at once: its health is checked by the cycles)
+static int chroot_state(supervisor_t *sup, const char *arch) {
+    chroot_state_t *chroot = find_chroot(sup, arch);
+    if (chroot) return chroot->state;
+    if (sup->chroot_count >= (int)(sizeof(sup->chroots) / sizeof(sup->chroots[0]))) return ARCH_FAILED;
+    chroot = calloc(1, sizeof(chroot_state_t));
+    if (!chroot) return ARCH_FAILED;
+    snprintf(chroot->arch, sizeof(chroot->arch), "%s", arch);
+    chroot->supervisor = sup;
+    sup->chroots[sup->chroot_count++] = chroot;
+
+    char home_dir[MAX_CONFIG_ATTR_LEN + 32];
+    struct stat st;
+    snprintf(home_dir, sizeof(home_dir), "%s/%s-chroot/home", sup->build_dir, arch);
+    if (stat(home_dir, &st) == 0 && S_ISDIR(st.st_mode)) {
+        chroot->state = ARCH_READY;
+        return ARCH_READY;
+    }
+    chroot->state = ARCH_BOOTSTRAPPING;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, bootstrap_thread, chroot);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, NULL, arch, "Unable to start the bootstrap of the %s chroot: %s", arch, strerror(err));
+        chroot->state = ARCH_FAILED;
+        return ARCH_FAILED;
+    }
+    sup->bootstrapping++;
+    formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, arch, "Bootstrapping the chroot of the new architecture %s in the background.", arch);
+    return ARCH_BOOTSTRAPPING;
+}
+
+// Releases a project removed from the configuration (its cycle, if any, has ended)
+static void release_slot(supervisor_t *sup, project_slot_t *slot) {
+    unschedule(sup, slot);
+    int leaked = 0;
+    if (slot->worker.project) {
+        const char *name = slot->worker.project->name;
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, name, NULL, "Project %s removed from the configuration.", name);
+        // A build thread still running after the grace period keeps using the project and the termination flag of the slot
+        leaked = project_worker_shutdown(&slot->worker) > 0;
+    }
+    free_project(slot->pending_project);
+    for (int i = 0; i < sup->slot_count; i++) {
+        if (sup->slots[i] == slot) {
+            sup->slots[i] = sup->slots[--sup->slot_count];
+            break;
+        }
+    }
+    if (!leaked) free(slot);
+}
+
+// Applies the pending configuration of an idle project once the chroots it needs are ready, and starts a cycle of it
+static void apply_pending_config(supervisor_t *sup, project_slot_t *slot) {
+    project_t *prj = slot->pending_project;
+    if (!prj || slot->active || slot->removed || sup->stopping) return;
+
+    // Wait for the chroots being bootstrapped; drop the architectures whose chroot could not be set up (native builds fall back to
+    // emulation without the amd64 chroot)
+    int waiting = 0;
+    int i = 0;
+    while (i < prj->arch_count) {
+        int state = chroot_state(sup, prj->architectures[i]);
+        if (state == ARCH_FAILED) {
+            formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, prj->name, prj->architectures[i], "No chroot for architecture %s: it is not built for project %s.", prj->architectures[i], prj->name);
+            free(prj->architectures[i]);
+            for (int k = i; k < prj->arch_count - 1; k++) prj->architectures[k] = prj->architectures[k + 1];
+            prj->architectures[--prj->arch_count] = NULL;
+            continue;
+        }
+        waiting |= state == ARCH_BOOTSTRAPPING;
+        i++;
+    }
+    if (strcmp(prj->cross_mode, "native") == 0) {
+        waiting |= chroot_state(sup, "amd64") == ARCH_BOOTSTRAPPING;
+    }
+    if (prj->arch_count == 0) {
+        formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Project %s has no architecture with a working chroot; its configuration is not applied.", prj->name);
+        free_project(prj);
+        slot->pending_project = NULL;
+        if (!slot->worker.project) release_slot(sup, slot);
+        return;
+    }
+    if (waiting) return;
+    if (slot->worker.project && project_worker_reap_abandoned(&slot->worker) > 0) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, prj->name, NULL, "Build threads abandoned by project %s are still running; its new configuration is applied after they end.", prj->name);
+        return;
+    }
+
+    unschedule(sup, slot);
+    int first = slot->worker.project == NULL;
+    free_project(slot->worker.project);
+    admission_stats_t admission_stats = slot->worker.admission_stats;
+    memset(&slot->worker, 0, sizeof(slot->worker));
+    for (int k = 0; k < MAX_ARCHITECTURES; k++) {
+        pthread_mutex_init(&slot->worker.builds[k].lock, NULL);
+    }
+    slot->worker.project = prj;
+    slot->worker.admission_stats = admission_stats;
+    snprintf(slot->worker.main_build_dir, sizeof(slot->worker.main_build_dir), "%s", sup->build_dir);
+    slot->pending_project = NULL;
+    if (!first) {
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "New configuration of project %s applied; starting a cycle now.", prj->name);
+    }
+    // Every project is due at once: its first cycle prepares its directories and clones its repositories (a paused one waits for resume;
+    // the architectures forced for the old configuration are dropped, their indexes may have changed)
+    slot->forced_archs = 0;
+    if (!slot->paused) schedule(sup, slot, 0);
+}
+
+static project_slot_t *add_slot(supervisor_t *sup, project_t *prj) {
+    if (sup->slot_count == sup->slot_capacity) {
+        int new_capacity = sup->slot_capacity ? sup->slot_capacity * 2 : 16;
+        project_slot_t **slots = realloc(sup->slots, new_capacity * sizeof(project_slot_t *));
+        if (!slots) return NULL;
+        sup->slots = slots;
+        project_slot_t **heap = realloc(sup->heap, new_capacity * sizeof(project_slot_t *));
+        if (!heap) return NULL;
+        sup->heap = heap;
+        sup->slot_capacity = new_capacity;
+    }
+    project_slot_t *slot = calloc(1, sizeof(project_slot_t));
+    if (!slot) return NULL;
+    slot->heap_index = -1;
+    slot->supervisor = sup;
+    slot->pending_project = prj;
+    sup->slots[sup->slot_count++] = slot;
+    return slot;
+}
+
+static project_slot_t *find_slot(supervisor_t *sup, const char *name) {
+    for (int i = 0; i < sup->slot_count; i++) {
+        project_slot_t *slot = sup->slots[i];
+        const project_t *prj = slot->pending_project ? slot->pending_project : slot->worker.project;
+        if (!slot->removed && prj && strcmp(prj->name, name) == 0) return slot;
+    }
+    return NULL;
+}
+
+static void watch_session(supervisor_t *sup, int index);
+static void control_respond_later(supervisor_t *sup, control_job_t *job);
+
+static void handle_finished_bootstraps(supervisor_t *sup, chroot_state_t *done) {
+    int changed = 0;
+    while (done) {
+        chroot_state_t *chroot = done;
+        done = chroot->next_done;
+        chroot->next_done = NULL;
+        sup->bootstrapping--;
+        changed = 1;
+        if (chroot->state == ARCH_READY) {
+            formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, chroot->arch, "Chroot of architecture %s ready.", chroot->arch);
+            if (chroot->session_started && sup->session_count < (int)(sizeof(sup->sessions) / sizeof(sup->sessions[0]))) {
+                session_watch_t *session = &sup->sessions[sup->session_count];
+                snprintf(session->chroot_dir, sizeof(session->chroot_dir), "%s/%s-chroot", sup->build_dir, chroot->arch);
+                snprintf(session->arch, sizeof(session->arch), "%s", chroot->arch);
+                watch_session(sup, sup->session_count++);
+            }
+        } else {
+            formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, NULL, chroot->arch, "Bootstrap of the chroot of architecture %s failed.", chroot->arch);
+        }
+    }
+    if (!changed) return;
+    for (int i = sup->slot_count - 1; i >= 0; i--) {
+        apply_pending_config(sup, sup->slots[i]);
+    }
+}
+
+static void handle_finished_cycles(supervisor_t *sup) {
+    uint64_t count;
+    if (read(sup->cycle_done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to read the cycle eventfd: %s", strerror(errno));
+    }
+    pthread_mutex_lock(&sup->done_lock);
+    project_slot_t *done = sup->done_list;
+    sup->done_list = NULL;
+    chroot_state_t *bootstraps_done = sup->bootstrap_done_list;
+    sup->bootstrap_done_list = NULL;
+    int rotation_finished = sup->rotation_finished;
+    sup->rotation_finished = 0;
+    control_job_t *jobs_done = sup->control_done_list;
+    sup->control_done_list = NULL;
+    pthread_mutex_unlock(&sup->done_lock);
+
+    while (jobs_done) {
+        control_job_t *job = jobs_done;
+        jobs_done = job->next_done;
+        control_respond_later(sup, job);
+    }
+
+    if (rotation_finished) {
+        sup->rotating = 0;
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Binaries rotation of %d projects ended%s (see their binaries_rotation.log).", sup->rotation_job_count, sup->rotation_cancel ? " early, at shutdown" : "");
+    }
+
+    while (done) {
+        project_slot_t *slot = done;
+        done = slot->next_done;
+        slot->next_done = NULL;
+        slot->active = 0;
+        sup->active--;
+        if (slot->removed) {
+            if (!sup->stopping) release_slot(sup, slot);
+            continue;
+        }
+        // A cycle stopped by the termination flag is the last one of its project
+        if (slot->next_cycle_s >= 0 && !sup->stopping) {
+            if (slot->triggered) schedule(sup, slot, 0);
+            else if (!slot->paused) schedule(sup, slot, slot->next_cycle_s);
+            apply_pending_config(sup, slot);
+        }
+    }
+    handle_finished_bootstraps(sup, bootstraps_done);
+}
+
+// An artifact_server address of "off" (or none) disables the server
+static int artifact_server_enabled(const char *address) {
+    return address[0] && strcmp(address, "off") != 0;
+}
+
+// Hands the target dirs of the projects (with their configuration to come, if any) to the artifact server
+static void update_served_projects(supervisor_t *sup) {
+    if (!sup->artifact_server) return;
+    artifact_server_project_t *projects = calloc(sup->slot_count ? sup->slot_count : 1, sizeof(artifact_server_project_t));
+    if (!projects) return;
+    int count = 0;
+    for (int i = 0; i < sup->slot_count; i++) {
+        const project_t *prj = sup->slots[i]->pending_project ? sup->slots[i]->pending_project : sup->slots[i]->worker.project;
+        if (!prj || sup->slots[i]->removed) continue;
+        snprintf(projects[count].name, sizeof(projects[count].name), "%s", prj->name);
+        snprintf(projects[count].target_dir, sizeof(projects[count].target_dir), "%s", prj->target_dir);
+        count++;
+    }
+    if (artifact_server_set_projects(sup->artifact_server, projects, count) != 0) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to update the projects of the artifact server.");
+    }
+    free(projects);
+}
+
+// Re-reads config.yml and diffs it against the running projects (see the comment at the top)
+static void reload_config(supervisor_t *sup) {
+    Config cfg;
+    if (load_config(&cfg) != 0) {
+        free_config_projects(&cfg);
+        formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Configuration reload failed (see the errors above); the running configuration is kept.");
+        return;
+    }
+    if (strcmp(cfg.build_dir, sup->build_dir) != 0) {
+        free_config_projects(&cfg);
+        formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "build_dir changed (%s); this needs a restart, the running configuration is kept.", cfg.build_dir);
+        return;
+    }
+    if ((strcmp(cfg.chroot_session, "persistent") == 0) != sup->persistent_sessions) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "chroot_session changed to %s; it takes effect at the next start.", cfg.chroot_session);
+    }
+    if (strcmp(cfg.artifact_server, sup->artifact_server_address) != 0) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "artifact_server changed to %s; it takes effect at the next start.", cfg.artifact_server);
+    }
+    if (cfg.max_active_projects != sup->max_active) {
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "max_active_projects changed from %d to %d.", sup->max_active, cfg.max_active_projects);
+        sup->max_active = cfg.max_active_projects;
+    }
+    // Chroots whose bootstrap failed are tried again
+    for (int i = 0; i < sup->chroot_count; i++) {
+        if (sup->chroots[i]->state == ARCH_FAILED) {
+            free(sup->chroots[i]);
+            sup->chroots[i--] = sup->chroots[--sup->chroot_count];
+        }
+    }
+
+    int added = 0, changed = 0, unchanged = 0, removed = 0;
+    for (int i = 0; i < sup->slot_count; i++) {
+        project_slot_t *slot = sup->slots[i];
+        const project_t *running = slot->pending_project ? slot->pending_project : slot->worker.project;
+        int kept = 0;
+        for (project_t *prj = cfg.projects; prj && running && !slot->removed; prj = prj->next) {
+            if (strcmp(prj->name, running->name) == 0) kept = 1;
+        }
+        if (kept || slot->removed) continue;
+        removed++;
+        slot->removed = 1;
+        free_project(slot->pending_project);
+        slot->pending_project = NULL;
+        if (slot->active) {
+            formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, running->name, NULL, "Project %s removed from the configuration: cancelling its running cycle.", running->name);
+            project_worker_request_stop(&slot->worker);
+        } else {
+            release_slot(sup, slot);
+            i--;
+        }
+    }
+    project_t *prj = cfg.projects;
+    while (prj) {
+        project_t *next = prj->next;
+        prj->next = NULL;
+        project_slot_t *slot = find_slot(sup, prj->name);
+        const project_t *current = slot ? (slot->pending_project ? slot->pending_project : slot->worker.project) : NULL;
+        if (current && project_config_equal(current, prj)) {
+            unchanged++;
+            free_project(prj);
+        } else if (slot) {
+            changed++;
+            free_project(slot->pending_project);
+            slot->pending_project = prj;
+            formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Configuration of project %s changed%s.", prj->name, slot->active ? "; it is applied when the running cycle ends" : "");
+            apply_pending_config(sup, slot);
+        } else if ((slot = add_slot(sup, prj)) != NULL) {
+            added++;
+            formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, prj->name, NULL, "Project %s added to the configuration.", prj->name);
+            apply_pending_config(sup, slot);
+        } else {
+            formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, prj->name, NULL, "Unable to allocate the state of the new project %s.", prj->name);
+            free_project(prj);
+        }
+        prj = next;
+    }
+    update_served_projects(sup);
+    formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Configuration reloaded: %d projects added, %d changed, %d removed, %d unchanged; %d chroots bootstrapping.", added, changed, removed, unchanged, sup->bootstrapping);
+}
+
+// Arms the rotation timer on the next local midnight (as the former "0 0 * * *" crontab entry)
+static void arm_rotation_timer(supervisor_t *sup) {
+    time_t now = time(NULL);
+    struct tm next;
+    localtime_r(&now, &next);
+    next.tm_mday++;
+    next.tm_hour = next.tm_min = next.tm_sec = 0;
+    next.tm_isdst = -1;
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = mktime(&next);
+    timerfd_settime(sup->rotation_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void *rotation_thread(void *arg) {
+    supervisor_t *sup = (supervisor_t *)arg;
+    for (int i = 0; i < sup->rotation_job_count && !sup->rotation_cancel; i++) {
+        rotation_job_t *job = &sup->rotation_jobs[i];
+        FILE *log_fp = fopen(job->log_file, "a");
+        formatted_log(log_fp ? log_fp : sup->log_fp, "INFO", __FILE__, __LINE__, job->project, NULL, "Starting the binaries rotation of project %s.", job->project);
+        rotation_rotate(job->target_dir, &job->limits, log_fp ? log_fp : sup->log_fp, job->project);
+        if (log_fp) fclose(log_fp);
+    }
+
+    pthread_mutex_lock(&sup->done_lock);
+    sup->rotation_finished = 1;
+    pthread_mutex_unlock(&sup->done_lock);
+    uint64_t one = 1;
+    ssize_t written = write(sup->cycle_done_fd, &one, sizeof(one));
+    (void)written;
+    return NULL;
+}
+
+// Rotates the target dirs of all the projects (or of the named one) in the background; returns the number of projects, -1 on errors
+static int start_rotation(supervisor_t *sup, const char *name) {
+    if (sup->rotating || sup->stopping) return -1;
+    rotation_job_t *jobs = calloc(sup->slot_count ? sup->slot_count : 1, sizeof(rotation_job_t));
+    if (!jobs) return -1;
+    int count = 0;
+    for (int i = 0; i < sup->slot_count; i++) {
+        const project_t *prj = sup->slots[i]->worker.project;
+        if (!prj || sup->slots[i]->removed || (name && strcmp(prj->name, name) != 0)) continue;
+        rotation_job_t *job = &jobs[count++];
+        snprintf(job->project, sizeof(job->project), "%s", prj->name);
+        snprintf(job->target_dir, sizeof(job->target_dir), "%s", prj->target_dir);
+        snprintf(job->log_file, sizeof(job->log_file), "%s", prj->rotation_log_file);
+        job->limits = *prj->binaries_limits;
+    }
+    free(sup->rotation_jobs);
+    sup->rotation_jobs = jobs;
+    sup->rotation_job_count = count;
+    sup->rotation_cancel = 0;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, rotation_thread, sup);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, name, NULL, "Unable to start the binaries rotation: %s", strerror(err));
+        return -1;
+    }
+    sup->rotating = 1;
+    formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, name, NULL, "Binaries rotation of %d projects started.", count);
+    return count;
+}
+
+static void handle_rotation_timer(supervisor_t *sup) {
+    uint64_t expirations;
+    if (read(sup->rotation_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to read the rotation timerfd: %s", strerror(errno));
+    }
+    if (sup->rotating) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "The previous binaries rotation is still running; skipping this one.");
+    } else if (!sup->stopping) {
+        start_rotation(sup, NULL);
+    }
+    arm_rotation_timer(sup);
+}
+
+static void handle_signal(supervisor_t *sup) {
+    struct signalfd_siginfo info;
+    while (read(sup->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGTERM) {
+            if (sup->stopping) {
+                formatted_log(sup->log_fp, "INTERRUPT", __FILE__, __LINE__, NULL, NULL, "Termination signal received again; still waiting for %d running cycles.", sup->active);
+                continue;
+            }
+            formatted_log(sup->log_fp, "INTERRUPT", __FILE__, __LINE__, NULL, NULL, "Termination signal received (from PID %u): cancelling %d running cycles, %d projects idle.", info.ssi_pid, sup->active, sup->heap_size);
+            for (int i = 0; i < sup->slot_count; i++) {
+                project_worker_request_stop(&sup->slots[i]->worker);
+            }
+            sup->stopping = 1;
+            sup->rotation_cancel = 1;
+            // The idle and queued projects are done right away
+            while (sup->heap_size > 0) heap_pop(sup);
+            for (project_slot_t *slot = sup->ready_head; slot; slot = slot->next_ready) slot->queued = 0;
+            sup->ready_head = sup->ready_tail = NULL;
+        } else if (info.ssi_signo == SIGHUP && !sup->stopping) {
+            formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "SIGHUP received: reloading the configuration.");
+            reload_config(sup);
+        }
+    }
+}
+
+static const char *build_state_name(int state) {
+    switch (state) {
+        case BUILD_STATE_WAITING: return "waiting";
+        case BUILD_STATE_RUNNING: return "running";
+        default: return "idle";
+    }
+}
+
+static const char *thread_status_name(int status) {
+    switch (status) {
+        case THREAD_STATUS_SUCCESS: return "success";
+        case THREAD_STATUS_TIMEOUT: return "timeout";
+        case THREAD_STATUS_OOM: return "oom";
+        case THREAD_STATUS_CANCELLED: return "cancelled";
+        case THREAD_STATUS_SESSION_LOST: return "session_lost";
+        default: return "failed";
+    }
+}
+
+static const char *cycle_step_name(int step) {
+    switch (step) {
+        case WORKER_STEP_HEALTH_CHECK: return "health_check";
+        case WORKER_STEP_UPDATE_CHECK: return "update_check";
+        case WORKER_STEP_BUILDS: return "builds";
+        case WORKER_STEP_RECOVERY: return "recovery";
+        default: return "starting";
+    }
+}
+
+static int arch_index(const project_t *prj, const char *arch) {
+    for (int k = 0; k < prj->arch_count; k++) {
+        if (strcmp(prj->architectures[k], arch) == 0) return k;
+    }
+    return -1;
+}
+
+// Appends the live state of the build of architecture k of a project, and the outcome of its latest build from the state journal
+static void status_build_json(supervisor_t *sup, project_slot_t *slot, int k, time_t now, json_buf_t *out) {
+    const project_t *prj = slot->worker.project;
+    build_status_t status;
+    pthread_mutex_lock(&slot->worker.builds[k].lock);
+    status.state = slot->worker.builds[k].state;
+    snprintf(status.phase, sizeof(status.phase), "%s", slot->worker.builds[k].phase);
+    status.started_at = slot->worker.builds[k].started_at;
+    status.phase_started_at = slot->worker.builds[k].phase_started_at;
+    pthread_mutex_unlock(&slot->worker.builds[k].lock);
+
+    // During the build the script reports its own phase (configure, build, publish) in its phase file, rewritten at every change
+    if (status.state == BUILD_STATE_RUNNING && strcmp(status.phase, "build") == 0) {
+        char phase_file[MIN_CONFIG_ATTR_LEN * 3];
+        snprintf(phase_file, sizeof(phase_file), "%s/%s-chroot/home/%s/logs/phase", sup->build_dir, prj->architectures[k], prj->name);
+        struct stat st;
+        FILE *fp = fopen(phase_file, "r");
+        if (fp) {
+            char line[sizeof(status.phase)];
+            if (fstat(fileno(fp), &st) == 0 && st.st_mtime >= status.phase_started_at && fgets(line, sizeof(line), fp) && line[0] != '\n') {
+                line[strcspn(line, "\n")] = '\0';
+                snprintf(status.phase, sizeof(status.phase), "%s", line);
+                status.phase_started_at = st.st_mtime;
+            }
+            fclose(fp);
+        }
+    }
+
+    json_printf(out, "{\"arch\":");
+    json_string(out, prj->architectures[k]);
+    json_printf(out, ",\"state\":\"%s\"", build_state_name(status.state));
+    if (status.state != BUILD_STATE_IDLE) {
+        json_printf(out, ",\"phase\":");
+        json_string(out, status.phase);
+        json_printf(out, ",\"elapsed_s\":%lld,\"phase_elapsed_s\":%lld", (long long)(now - status.started_at), (long long)(now - status.phase_started_at));
+    }
+    journal_entry_t entry;
+    if (state_journal_lookup(prj->name, prj->architectures[k], &entry) == 0) {
+        json_printf(out, ",\"last\":{\"status\":\"%s\",\"attempts\":%d,\"built_at\":%lld,\"artifact\":", thread_status_name(entry.status), entry.attempts, entry.built_at);
+        json_string(out, entry.artifact[0] ? entry.artifact : NULL);
+        json_printf(out, "}");
+    } else {
+        json_printf(out, ",\"last\":null");
+    }
+    json_printf(out, "}");
+}
+
+static void handle_status(supervisor_t *sup, json_buf_t *out) {
+    time_t now = time(NULL);
+    struct timespec mono_now;
+    clock_gettime(CLOCK_MONOTONIC, &mono_now);
+    json_printf(out, "{\"ok\":true,\"pid\":%d,\"uptime_s\":%lld,\"stopping\":%s,\"draining\":%s,\"rotating\":%s,\"active\":%d,\"max_active\":%d,\"queue\":[",
+        (int)getpid(), (long long)(now - sup->started_at), sup->stopping ? "true" : "false", sup->draining ? "true" : "false", sup->rotating ? "true" : "false", sup->active, sup->max_active);
+    for (project_slot_t *slot = sup->ready_head; slot; slot = slot->next_ready) {
+        json_string(out, slot->worker.project->name);
+        if (slot->next_ready) json_printf(out, ",");
+    }
+    json_printf(out, "],\"chroots\":[");
+    for (int i = 0; i < sup->chroot_count; i++) {
+        const chroot_state_t *chroot = sup->chroots[i];
+        json_printf(out, "%s{\"arch\":", i > 0 ? "," : "");
+        json_string(out, chroot->arch);
+        json_printf(out, ",\"state\":\"%s\"}", chroot->state == ARCH_READY ? "ready" : chroot->state == ARCH_FAILED ? "failed" : "bootstrapping");
+    }
+    json_printf(out, "],\"projects\":[");
+    int listed = 0;
+    for (int i = 0; i < sup->slot_count; i++) {
+        project_slot_t *slot = sup->slots[i];
+        const project_t *prj = slot->worker.project ? slot->worker.project : slot->pending_project;
+        if (!prj) continue;
+        const char *state = slot->removed ? "removed" : slot->active ? "running" : slot->queued ? "queued" : slot->heap_index >= 0 ? "scheduled" :
+            slot->paused ? "paused" : slot->worker.project ? "idle" : "waiting_chroot";
+        json_printf(out, "%s{\"name\":", listed++ > 0 ? "," : "");
+        json_string(out, prj->name);
+        json_printf(out, ",\"state\":\"%s\",\"paused\":%s,\"pending_config\":%s", state, slot->paused ? "true" : "false", slot->pending_project && slot->worker.project ? "true" : "false");
+        if (slot->active) {
+            json_printf(out, ",\"step\":\"%s\",\"cycle_elapsed_s\":%lld", cycle_step_name(slot->worker.cycle_step), (long long)(now - slot->cycle_started_at));
+        }
+        if (slot->heap_index >= 0) {
+            long long next_s = slot->deadline.tv_sec - mono_now.tv_sec;
+            json_printf(out, ",\"next_cycle_in_s\":%lld", next_s > 0 ? next_s : 0);
+        }
+        json_printf(out, ",\"builds\":[");
+        for (int k = 0; slot->worker.project && k < slot->worker.project->arch_count; k++) {
+            if (k > 0) json_printf(out, ",");
+            status_build_json(sup, slot, k, now, out);
+        }
+        json_printf(out, "]}");
+    }
+    json_printf(out, "]}");
+}
+
+static void control_error(json_buf_t *out, const char *format, const char *argument) {
+    char message[CONTROL_REQUEST_LEN];
+    snprintf(message, sizeof(message), format, argument ? argument : "");
+    json_printf(out, "{\"ok\":false,\"error\":");
+    json_string(out, message);
+    json_printf(out, "}");
+}
+
+// Appends the rotation plan of a project, computed now and not executed (the tiers are only read)
+static void rotation_plan_json(const rotation_job_t *target, time_t now, json_buf_t *out) {
+    const binaries_limits_for_project_t *limits_of = &target->limits;
+    json_printf(out, "{\"name\":");
+    json_string(out, target->project);
+    json_printf(out, ",\"target_dir\":");
+    json_string(out, target->target_dir);
+    json_printf(out, ",\"codec\":");
+    json_string(out, limits_of->codec);
+    rotation_plan_t plan;
+    if (rotation_plan(target->target_dir, limits_of, now, &plan) != 0) {
+        json_printf(out, ",\"error\":");
+        json_string(out, strerror(errno));
+        json_printf(out, "}");
+        return;
+    }
+    const int limits[ROTATION_TIER_COUNT] = { limits_of->daily_mem_limit, limits_of->weekly_mem_limit, limits_of->monthly_mem_limit, limits_of->yearly_mem_limit };
+    json_printf(out, ",\"tiers\":[");
+    for (int t = 0; t < ROTATION_TIER_COUNT; t++) {
+        json_printf(out, "%s{\"tier\":\"%s\",\"entries\":%d,\"kb\":%lld,\"entries_after\":%d,\"kb_after\":%lld,\"limit_kb\":%d}", t > 0 ? "," : "", rotation_tier_name(t),
+            plan.entries_before[t], plan.kb_before[t], plan.entries_after[t], plan.kb_after[t], limits[t]);
+    }
+    json_printf(out, "],\"actions\":[");
+    for (int i = 0; i < plan.count; i++) {
+        const rotation_action_t *action = &plan.actions[i];
+        json_printf(out, "%s{\"action\":\"%s\",\"tier\":\"%s\",\"entry\":", i > 0 ? "," : "", rotation_action_name(action->type), rotation_tier_name(action->tier));
+        json_string(out, action->name);
+        if (action->type == ROTATION_ACTION_MOVE) json_printf(out, ",\"to\":\"%s\"", rotation_tier_name(action->to_tier));
+        json_printf(out, ",\"age_min\":%lld,\"kb\":%lld}", (long long)(now - action->mtime.tv_sec) / 60, action->kb);
+    }
+    json_printf(out, "]}");
+    rotation_plan_free(&plan);
+}
+
+static void *control_job_thread(void *arg) {
+    control_job_t *job = (control_job_t *)arg;
+    supervisor_t *sup = job->supervisor;
+    if (job->report) {
+        const project_t *projects[job->count > 0 ? job->count : 1];
+        for (int i = 0; i < job->count; i++) projects[i] = &job->projects[i];
+        phase_history_report_json(projects, job->count, job->limit, &job->out);
+    } else {
+        time_t now = time(NULL);
+        json_printf(&job->out, "{\"ok\":true,\"dry_run\":true,\"rotating\":%s,\"projects\":[", job->rotating ? "true" : "false");
+        for (int i = 0; i < job->count; i++) {
+            if (i > 0) json_printf(&job->out, ",");
+            rotation_plan_json(&job->targets[i], now, &job->out);
+        }
+        json_printf(&job->out, "]}");
+    }
+
+    pthread_mutex_lock(&sup->done_lock);
+    job->next_done = sup->control_done_list;
+    sup->control_done_list = job;
+    pthread_mutex_unlock(&sup->done_lock);
+    uint64_t one = 1;
+    ssize_t written = write(sup->cycle_done_fd, &one, sizeof(one));
+    (void)written;
+    return NULL;
+}
+
+static void free_control_job(control_job_t *job) {
+    free(job->targets);
+    free(job->projects);
+    json_free(&job->out);
+    free(job);
+}
+
+// Starts a helper thread on job; returns 0 if it runs (the connection then waits for it), 1 after writing the error to out
+static int start_control_job(supervisor_t *sup, control_job_t *job, json_buf_t *out) {
+    if (sup->stopping) {
+        free_control_job(job);
+        control_error(out, "the supervisor is stopping", NULL);
+        return 1;
+    }
+    job->supervisor = sup;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, control_job_thread, job);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        formatted_log(sup->log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to start a control helper thread: %s", strerror(err));
+        free_control_job(job);
+        control_error(out, "unable to start the request", NULL);
+        return 1;
+    }
+    sup->control_jobs++;
+    return 0;
+}
+
+// rotate [<project>] [--dry-run]: starts the rotation now, or prints its plan (computed by a helper thread); returns 0 if the response
+// comes later
+static int handle_rotate(supervisor_t *sup, int conn, const char *name, const char *arch, json_buf_t *out) {
+    int dry_run = strcmp(name, "--dry-run") == 0 || strcmp(arch, "--dry-run") == 0;
+    const char *project = name[0] && strcmp(name, "--dry-run") != 0 ? name : NULL;
+    project_slot_t *slot = project ? find_slot(sup, project) : NULL;
+    if (project && (!slot || !slot->worker.project)) {
+        control_error(out, slot ? "project '%s' is waiting for its chroots" : "unknown project '%s'", project);
+        return 1;
+    }
+    if (!dry_run) {
+        if (sup->rotating) {
+            control_error(out, "a rotation is already running", NULL);
+            return 1;
+        }
+        int count = start_rotation(sup, project);
+        if (count < 0) {
+            control_error(out, sup->stopping ? "the supervisor is stopping" : "unable to start the rotation", NULL);
+            return 1;
+        }
+        json_printf(out, "{\"ok\":true,\"rotating\":true,\"projects\":%d}", count);
+        return 1;
+    }
+    control_job_t *job = calloc(1, sizeof(control_job_t));
+    if (job) job->targets = calloc(sup->slot_count ? sup->slot_count : 1, sizeof(rotation_job_t));
+    if (!job || !job->targets) {
+        free(job);
+        control_error(out, "out of memory", NULL);
+        return 1;
+    }
+    job->conn = conn;
+    job->rotating = sup->rotating;
+    for (int i = 0; i < sup->slot_count; i++) {
+        const project_t *prj = sup->slots[i]->worker.project;
+        if (!prj || sup->slots[i]->removed || (project && strcmp(prj->name, project) != 0)) continue;
+        rotation_job_t *target = &job->targets[job->count++];
+        snprintf(target->project, sizeof(target->project), "%s", prj->name);
+        snprintf(target->target_dir, sizeof(target->target_dir), "%s", prj->target_dir);
+        target->limits = *prj->binaries_limits;
+    }
+    return start_control_job(sup, job, out);
+}
+
+// report [<count>]: the slowest phases of the builds of all the projects (see phase_history.c), read by a helper thread; returns 0 if the
+// response comes later
+static int handle_report(supervisor_t *sup, int conn, const char *count, json_buf_t *out) {
+    int limit = PHASE_REPORT_DEFAULT_LIMIT;
+    if (count[0]) {
+        char *end;
+        long value = strtol(count, &end, 10);
+        if (*end != '\0' || value < 1) {
+            control_error(out, "invalid count '%s'", count);
+            return 1;
+        }
+        limit = value > INT_MAX ? INT_MAX : (int)value;
+    }
+    control_job_t *job = calloc(1, sizeof(control_job_t));
+    if (job) job->projects = malloc((sup->slot_count ? sup->slot_count : 1) * sizeof(project_t));
+    if (!job || !job->projects) {
+        free(job);
+        control_error(out, "out of memory", NULL);
+        return 1;
+    }
+    job->conn = conn;
+    job->report = 1;
+    job->limit = limit;
+    for (int i = 0; i < sup->slot_count; i++) {
+        const project_t *prj = sup->slots[i]->worker.project;
+        if (prj && !sup->slots[i]->removed) job->projects[job->count++] = *prj;
+    }
+    return start_control_job(sup, job, out);
+}
+
+// Handles one command line of v2ci_ctl: status, build <project> [<arch>], cancel <project> [<arch>], pause <project>, resume [<project>], drain,
+// rotate [<project>] [--dry-run], report [<count>]; returns 0 if a helper thread answers later (see control_respond_later), 1 once out is
+// the response
+static int handle_control_request(supervisor_t *sup, int conn, const char *request, json_buf_t *out) {
+    char command[32] = "", name[MIN_CONFIG_ATTR_LEN] = "", arch[MIN_CONFIG_ATTR_LEN] = "";
+    if (sscanf(request, "%31s %127s %127s", command, name, arch) < 1) {
+        control_error(out, "empty request", NULL);
+        return 1;
+    }
+    if (strcmp(command, "status") == 0) {
+        handle_status(sup, out);
+        return 1;
+    }
+    if (strcmp(command, "drain") == 0) {
+        if (!sup->draining) {
+            formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Draining (control socket): no new cycle starts, %d running.", sup->active);
+        }
+        sup->draining = 1;
+        json_printf(out, "{\"ok\":true,\"draining\":true,\"active\":%d}", sup->active);
+        return 1;
+    }
+    if (strcmp(command, "resume") == 0 && !name[0]) {
+        if (sup->draining) {
+            formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Drain ended (control socket): the queued projects start again.");
+        }
+        sup->draining = 0;
+        json_printf(out, "{\"ok\":true,\"draining\":false}");
+        return 1;
+    }
+    if (strcmp(command, "rotate") == 0) {
+        return handle_rotate(sup, conn, name, arch, out);
+    }
+    if (strcmp(command, "report") == 0) {
+        return handle_report(sup, conn, name, out);
+    }
+    if (strcmp(command, "build") != 0 && strcmp(command, "cancel") != 0 && strcmp(command, "pause") != 0 && strcmp(command, "resume") != 0) {
+        control_error(out, "unknown command '%s'", command);
+        return 1;
+    }
+    if (!name[0]) {
+        control_error(out, "%s needs a project", command);
+        return 1;
+    }
+    project_slot_t *slot = find_slot(sup, name);
+    if (!slot) {
+        control_error(out, "unknown project '%s'", name);
+        return 1;
+    }
+    const project_t *prj = slot->worker.project;
+    int k = -1;
+    if (arch[0] && (!prj || (k = arch_index(prj, arch)) < 0)) {
+        control_error(out, "project has no architecture '%s'", arch);
+        return 1;
+    }
+
+    if (strcmp(command, "pause") == 0) {
+        slot->paused = 1;
+        if (!slot->active) unschedule(sup, slot);
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, name, NULL, "Project %s paused (control socket).", name);
+        json_printf(out, "{\"ok\":true,\"project\":");
+        json_string(out, name);
+        json_printf(out, ",\"paused\":true,\"running\":%s}", slot->active ? "true" : "false");
+    } else if (strcmp(command, "resume") == 0) {
+        slot->paused = 0;
+        // A resumed project is polled at once
+        if (prj && !slot->active && !slot->queued && slot->heap_index < 0 && !sup->stopping) schedule(sup, slot, 0);
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, name, NULL, "Project %s resumed (control socket).", name);
+        json_printf(out, "{\"ok\":true,\"project\":");
+        json_string(out, name);
+        json_printf(out, ",\"paused\":false}");
+    } else if (strcmp(command, "build") == 0) {
+        if (!prj) {
+            control_error(out, "project '%s' is waiting for its chroots", name);
+            return 1;
+        }
+        if (sup->stopping) {
+            control_error(out, "the supervisor is stopping", NULL);
+            return 1;
+        }
+        for (int i = 0; i < prj->arch_count; i++) {
+            if (k < 0 || i == k) slot->forced_archs |= 1u << i;
+        }
+        if (slot->active) {
+            slot->triggered = 1;
+        } else if (!slot->queued) {
+            unschedule(sup, slot);
+            schedule(sup, slot, 0);
+        }
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, name, arch[0] ? arch : NULL, "Build of project %s (%s) requested from the control socket.", name, arch[0] ? arch : "all architectures");
+        json_printf(out, "{\"ok\":true,\"project\":");
+        json_string(out, name);
+        json_printf(out, ",\"arch\":");
+        json_string(out, arch[0] ? arch : NULL);
+        json_printf(out, ",\"when\":\"%s\"}", slot->active ? "after the running cycle" : sup->draining ? "after the drain" : "now");
+    } else {
+        int cancelled = slot->active && prj ? project_worker_cancel_build(&slot->worker, arch[0] ? arch : NULL) : 0;
+        if (cancelled == 0) {
+            control_error(out, "no running build of project '%s' to cancel", name);
+            return 1;
+        }
+        formatted_log(sup->log_fp, "INFO", __FILE__, __LINE__, name, arch[0] ? arch : NULL, "Cancelling %d builds of project %s (control socket).", cancelled, name);
+        json_printf(out, "{\"ok\":true,\"project\":");
+        json_string(out, name);
+        json_printf(out, ",\"cancelled\":%d}", cancelled);
+    }
+    return 1;
+}
+
+static void close_control_conn(supervisor_t *sup, int index) {
+    control_conn_t *conn = &sup->control_conns[index];
+    epoll_ctl(sup->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    json_free(&conn->response);
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = -1;
+}
+
+static void set_control_deadline(control_conn_t *conn) {
+    clock_gettime(CLOCK_MONOTONIC, &conn->deadline);
+    conn->deadline.tv_sec += CONTROL_IO_TIMEOUT_MS / 1000;
+    conn->deadline.tv_nsec += (CONTROL_IO_TIMEOUT_MS % 1000) * 1000000L;
+    if (conn->deadline.tv_nsec >= 1000000000L) {
+        conn->deadline.tv_sec++;
+        conn->deadline.tv_nsec -= 1000000000L;
+    }
+}
+
+// Starts sending the response of a connection (watched for EPOLLOUT; added back if a helper thread had it)
+static void start_control_write(supervisor_t *sup, int index) {
+    control_conn_t *conn = &sup->control_conns[index];
+    int op = conn->state == CONTROL_CONN_WORKING ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    conn->state = CONTROL_CONN_WRITING;
+    conn->sent = 0;
+    set_control_deadline(conn);
+    struct epoll_event ev = { .events = EPOLLOUT, .data.u64 = SUPERVISOR_TAG_CONTROL_CONN + index };
+    if (epoll_ctl(sup->epoll_fd, op, conn->fd, &ev) != 0) close_control_conn(sup, index);
+}
+
+// Hands the response computed by a helper thread to its connection
+static void control_respond_later(supervisor_t *sup, control_job_t *job) {
+    sup->control_jobs--;
+    int index = job->conn;
+    sup->control_conns[index].response = job->out;
+    memset(&job->out, 0, sizeof(job->out));
+    free_control_job(job);
+    start_control_write(sup, index);
+}
+
+static void handle_control(supervisor_t *sup) {
+    int fd;
+    while ((fd = control_accept(sup->control_fd)) >= 0 || errno == EACCES || errno == EINTR || errno == ECONNABORTED) {
+        if (fd < 0) {
+            if (errno == EACCES) formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Control connection from another user refused.");
+            continue;
+        }
+        int index = -1;
+        for (int i = 0; i < SUPERVISOR_CONTROL_CONNECTIONS && index < 0; i++) {
+            if (sup->control_conns[i].state == CONTROL_CONN_FREE) index = i;
+        }
+        if (index < 0) {
+            formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Too many control connections (%d); refusing one.", SUPERVISOR_CONTROL_CONNECTIONS);
+            close(fd);
+            continue;
+        }
+        control_conn_t *conn = &sup->control_conns[index];
+        conn->fd = fd;
+        conn->state = CONTROL_CONN_READING;
+        conn->request_len = 0;
+        set_control_deadline(conn);
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = SUPERVISOR_TAG_CONTROL_CONN + index };
+        if (epoll_ctl(sup->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) close_control_conn(sup, index);
+    }
+}
+
+// Reads the request of a connection and answers it (or hands it to a helper thread), or sends what the socket takes of its response
+static void handle_control_conn(supervisor_t *sup, int index) {
+    control_conn_t *conn = &sup->control_conns[index];
+    if (conn->state == CONTROL_CONN_READING) {
+        int read_result = control_read_request(conn->fd, conn->request, sizeof(conn->request), &conn->request_len);
+        if (read_result < 0) {
+            close_control_conn(sup, index);
+        } else if (read_result > 0) {
+            if (handle_control_request(sup, index, conn->request, &conn->response) == 0) {
+                // Not watched while the helper thread works: the loop has nothing to read from it meanwhile
+                conn->state = CONTROL_CONN_WORKING;
+                epoll_ctl(sup->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+            } else {
+                start_control_write(sup, index);
+            }
+        }
+    } else if (conn->state == CONTROL_CONN_WRITING) {
+        int send_result = control_send_response(conn->fd, &conn->response, &conn->sent);
+        if (send_result < 0) {
+            formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to send the response to '%s' on the control socket: %s", conn->request, strerror(errno));
+        }
+        if (send_result != 0) close_control_conn(sup, index);
+    }
+}
+
+// Closes the connections whose peer stalled (a helper thread at work is not the peer's fault); returns the ms until the next deadline,
+// -1 if there is none
+static int expire_control_conns(supervisor_t *sup) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long next_ms = -1;
+    for (int i = 0; i < SUPERVISOR_CONTROL_CONNECTIONS; i++) {
+        control_conn_t *conn = &sup->control_conns[i];
+        if (conn->state != CONTROL_CONN_READING && conn->state != CONTROL_CONN_WRITING) continue;
+        long left_ms = (conn->deadline.tv_sec - now.tv_sec) * 1000L + (conn->deadline.tv_nsec - now.tv_nsec) / 1000000L;
+        if (left_ms <= 0) {
+            formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Control connection closed: its peer did not %s within %d ms.",
+                conn->state == CONTROL_CONN_READING ? "send a request" : "read the response", CONTROL_IO_TIMEOUT_MS);
+            close_control_conn(sup, i);
+            continue;
+        }
+        if (next_ms < 0 || left_ms < next_ms) next_ms = left_ms;
+    }
+    return (int)next_ms;
+}
+
+static int pidfd_open_compat(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void watch_session(supervisor_t *sup, int index) {
+    session_watch_t *session = &sup->sessions[index];
+    session->pidfd = -1;
+    session->pid = session_server_pid(session->chroot_dir);
+    if (session->pid <= 0) return;
+    session->started_at = time(NULL);
+    session->pidfd = pidfd_open_compat(session->pid);
+    if (session->pidfd < 0) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, session->arch, "Unable to watch the session server %d of %s: %s", session->pid, session->chroot_dir, strerror(errno));
+        return;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = SUPERVISOR_TAG_SESSION + index };
+    epoll_ctl(sup->epoll_fd, EPOLL_CTL_ADD, session->pidfd, &ev);
+}
+
+static void handle_session_exit(supervisor_t *sup, int index) {
+    session_watch_t *session = &sup->sessions[index];
+    epoll_ctl(sup->epoll_fd, EPOLL_CTL_DEL, session->pidfd, NULL);
+    close(session->pidfd);
+    session->pidfd = -1;
+    int status = 0;
+    int reaped = waitpid(session->pid, &status, WNOHANG) == session->pid;
+    if (sup->stopping) return;
+
+    long uptime_s = (long)(time(NULL) - session->started_at);
+    if (reaped) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, session->arch, "Session server %d of %s exited (%s %d) after %ld s.", session->pid, session->chroot_dir,
+            WIFSIGNALED(status) ? "signal" : "code", WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status), uptime_s);
+    } else {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, session->arch, "Session server %d of %s (started by a previous supervisor) exited after %ld s.", session->pid, session->chroot_dir, uptime_s);
+    }
+    if (uptime_s < SESSION_RESTART_MIN_UPTIME_S) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, session->arch, "Not restarting the session of %s (it died within %d s); its steps will use a fresh _enter.", session->chroot_dir, SESSION_RESTART_MIN_UPTIME_S);
+        return;
+    }
+    if (session_start(session->chroot_dir, sup->log_fp, session->arch) == 0) {
+        watch_session(sup, index);
+    }
+}
+
+static int setup_fds(supervisor_t *sup) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    // Blocked before any cycle thread exists, so that they inherit the mask and the signals only reach the signalfd
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) != 0) return 1;
+
+    sup->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    sup->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    sup->rotation_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    sup->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    sup->cycle_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sup->epoll_fd < 0 || sup->timer_fd < 0 || sup->rotation_fd < 0 || sup->signal_fd < 0 || sup->cycle_done_fd < 0) return 1;
+
+    // The daemon runs without the control socket if it cannot be created (v2ci_stop only needs the PID file)
+    sup->control_fd = control_listen(CONTROL_SOCKET_PATH);
+    if (sup->control_fd < 0) {
+        formatted_log(sup->log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to listen on the control socket %s: %s; v2ci_ctl will not work.", CONTROL_SOCKET_PATH, strerror(errno));
+    } else {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = SUPERVISOR_TAG_CONTROL };
+        epoll_ctl(sup->epoll_fd, EPOLL_CTL_ADD, sup->control_fd, &ev);
+    }
+
+    struct { int fd; uint64_t tag; } sources[] = {
+        { sup->timer_fd, SUPERVISOR_TAG_TIMER },
+        { sup->rotation_fd, SUPERVISOR_TAG_ROTATION },
+        { sup->signal_fd, SUPERVISOR_TAG_SIGNAL },
+        { sup->cycle_done_fd, SUPERVISOR_TAG_CYCLE_DONE },
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = sources[i].tag };
+        if (epoll_ctl(sup->epoll_fd, EPOLL_CTL_ADD, sources[i].fd, &ev) != 0) return 1;
+    }
+    return 0;
+}
+
+static void close_fds(supervisor_t *sup) {
+    int fds[] = { sup->epoll_fd, sup->timer_fd, sup->rotation_fd, sup->signal_fd, sup->cycle_done_fd };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+    if (sup->control_fd >= 0) {
+        close(sup->control_fd);
+        unlink(CONTROL_SOCKET_PATH);
+    }
+    for (int i = 0; i < SUPERVISOR_CONTROL_CONNECTIONS; i++) {
+        if (sup->control_conns[i].state != CONTROL_CONN_FREE) {
+            close(sup->control_conns[i].fd);
+            json_free(&sup->control_conns[i].response);
+        }
+    }
+    for (int i = 0; i < sup->session_count; i++) {
+        if (sup->sessions[i].pidfd >= 0) close(sup->sessions[i].pidfd);
+    }
+}
+
+// Drives the cycles of all the projects of cfg (those with at least one architecture) until SIGTERM; session_archs are the architectures
+// whose persistent session was started by this process. Takes ownership of the projects; returns 0 after a clean shutdown
+int supervisor_run(Config *cfg, char *session_archs[], int session_count, FILE *log_fp) {
+    supervisor_t sup;
+    memset(&sup, 0, sizeof(sup));
+    sup.epoll_fd = sup.timer_fd = sup.rotation_fd = sup.signal_fd = sup.cycle_done_fd = sup.control_fd = -1;
+    sup.started_at = time(NULL);
+    sup.log_fp = log_fp;
+    sup.max_active = cfg->max_active_projects;
+    snprintf(sup.build_dir, sizeof(sup.build_dir), "%s", cfg->build_dir);
+    snprintf(sup.main_log_file, sizeof(sup.main_log_file), "%s", cfg->main_log_file);
+    sup.persistent_sessions = strcmp(cfg->chroot_session, "persistent") == 0;
+    snprintf(sup.artifact_server_address, sizeof(sup.artifact_server_address), "%s", cfg->artifact_server);
+    pthread_mutex_init(&sup.done_lock, NULL);
+
+    if (setup_fds(&sup) != 0) {
+        formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "Unable to set up the supervisor event loop: %s", strerror(errno));
+        close_fds(&sup);
+        return 1;
+    }
+
+    // What was built before a restart (or a crash) is read back, so that it is not built again
+    if (state_journal_open(cfg->build_dir, log_fp) != 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "The state journal cannot be written; builds will not be remembered across restarts.");
+    }
+
+    // The projects start like the ones added by a reload (see apply_pending_config)
+    project_t *current = cfg->projects;
+    cfg->projects = NULL;
+    while (current) {
+        project_t *next = current->next;
+        current->next = NULL;
+        project_slot_t *slot = add_slot(&sup, current);
+        if (!slot) {
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, current->name, NULL, "Unable to allocate the state of project %s.", current->name);
+            free_project(current);
+        } else {
+            apply_pending_config(&sup, slot);
+        }
+        current = next;
+    }
+    for (int i = 0; i < session_count && i < MAX_ARCHITECTURES; i++) {
+        session_watch_t *session = &sup.sessions[sup.session_count];
+        snprintf(session->chroot_dir, sizeof(session->chroot_dir), "%s/%s-chroot", cfg->build_dir, session_archs[i]);
+        snprintf(session->arch, sizeof(session->arch), "%s", session_archs[i]);
+        watch_session(&sup, sup.session_count++);
+    }
+    arm_rotation_timer(&sup);
+    // The daemon runs without the artifact server if it cannot listen (the binaries are still in the target dirs)
+    if (artifact_server_enabled(cfg->artifact_server)) {
+        sup.artifact_server = artifact_server_start(cfg->artifact_server, log_fp);
+        update_served_projects(&sup);
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Supervisor started with %d projects (at most %d cycles at a time), %d watched sessions and %d chroots bootstrapping.", sup.slot_count, sup.max_active, sup.session_count, sup.bootstrapping);
+
+    struct epoll_event events[SUPERVISOR_MAX_EVENTS];
+    while (!sup.stopping || sup.active > 0 || sup.rotating || sup.control_jobs > 0) {
+        enqueue_due_projects(&sup);
+        start_ready_cycles(&sup);
+        arm_timer(&sup);
+        int n = epoll_wait(sup.epoll_fd, events, SUPERVISOR_MAX_EVENTS, expire_control_conns(&sup));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            formatted_log(log_fp, "ERROR", __FILE__, __LINE__, NULL, NULL, "epoll_wait failed: %s; stopping.", strerror(errno));
+            for (int i = 0; i < sup.slot_count; i++) {
+                project_worker_request_stop(&sup.slots[i]->worker);
+            }
+            sup.stopping = 1;
+            sup.rotation_cancel = 1;
+            while (sup.active > 0 || sup.rotating || sup.control_jobs > 0) {
+                struct timespec pause = { 0, 100000000L };
+                nanosleep(&pause, NULL);
+                handle_finished_cycles(&sup);
+            }
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == SUPERVISOR_TAG_TIMER) {
+                uint64_t expirations;
+                if (read(sup.timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "Unable to read the timerfd: %s", strerror(errno));
+                }
+            } else if (tag == SUPERVISOR_TAG_ROTATION) {
+                handle_rotation_timer(&sup);
+            } else if (tag == SUPERVISOR_TAG_SIGNAL) {
+                handle_signal(&sup);
+            } else if (tag == SUPERVISOR_TAG_CYCLE_DONE) {
+                handle_finished_cycles(&sup);
+            } else if (tag == SUPERVISOR_TAG_CONTROL) {
+                handle_control(&sup);
+            } else if (tag >= SUPERVISOR_TAG_CONTROL_CONN && tag < SUPERVISOR_TAG_CONTROL_CONN + SUPERVISOR_CONTROL_CONNECTIONS) {
+                handle_control_conn(&sup, (int)(tag - SUPERVISOR_TAG_CONTROL_CONN));
+            } else if (tag >= SUPERVISOR_TAG_SESSION && tag < SUPERVISOR_TAG_SESSION + (uint64_t)sup.session_count) {
+                handle_session_exit(&sup, (int)(tag - SUPERVISOR_TAG_SESSION));
+            }
+        }
+    }
+
+    artifact_server_stop(sup.artifact_server);
+    // Every cycle has ended: wait for the abandoned build threads and release the projects (the chroot bootstraps still running, which
+    // cannot be cancelled, are left to be set up again at the next start)
+    if (sup.bootstrapping > 0) {
+        formatted_log(log_fp, "WARNING", __FILE__, __LINE__, NULL, NULL, "%d chroot bootstraps still running at exit.", sup.bootstrapping);
+    }
+    int project_count = sup.slot_count;
+    for (int i = 0; i < sup.slot_count; i++) {
+        project_slot_t *slot = sup.slots[i];
+        free_project(slot->pending_project);
+        if (slot->worker.project && project_worker_shutdown(&slot->worker) > 0) continue;
+        free(slot);
+    }
+    formatted_log(log_fp, "INFO", __FILE__, __LINE__, NULL, NULL, "Supervisor stopped: all the cycles of the %d projects have ended.", project_count);
+    state_journal_close();
+    close_fds(&sup);
+    pthread_mutex_destroy(&sup.done_lock);
+    free(sup.slots);
+    free(sup.heap);
+    free(sup.rotation_jobs);
+    return 0;
+}